@@ -10,6 +10,7 @@
 #include <PubSubClient.h>
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
+#include <ConnSupervisor.h>
 
 // Define the RX and TX pins for Serial 2
 #define RXD2 16
@@ -41,8 +42,11 @@ TinyGPSPlus gps;
 HardwareSerial gpsSerial(2);
 
 // WiFi and MQTT clients
+#define TLS_HANDSHAKE_TIMEOUT 10  // Seconds, bounds the supervisor's TLS step
+#define MQTT_RESPONSE_TIMEOUT 5   // Seconds to wait for CONNACK
 WiFiClientSecure espClient;
 PubSubClient mqttClient(espClient);
+ConnSupervisor connection(espClient, mqttClient);
 
 void setup() {
   // Serial Monitor
@@ -54,27 +58,27 @@ void setup() {
   delay(1000);
   Serial.println("Serial 2 started at 9600 baud rate");
   
-  // Connect to WiFi
-  setupWiFi();
-  
   // Skip certificate verification (for testing only)
   espClient.setInsecure();
+  espClient.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT);
   
   // Set up MQTT connection
   mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setSocketTimeout(MQTT_RESPONSE_TIMEOUT);
   
   // Create the MQTT topic
   sprintf(mqtt_topic, "animals/%s/location", animal_id);
   
+  // WiFi and MQTT are brought up in the background so GPS parsing never stalls
+  connection.onConnected(onMqttConnected);
+  connection.begin(ssid, password, mqtt_server, mqtt_port, "ESP32-", mqtt_username, mqtt_password);
+  
   Serial.println("Setup complete, waiting for GPS fix...");
 }
 
 void loop() {
-  // Keep WiFi and MQTT connected
-  if (!mqttClient.connected()) {
-    reconnectMQTT();
-  }
-  mqttClient.loop();
+  // Keep WiFi and MQTT connected without blocking
+  connection.poll();
 
   // Read GPS data
   while (gpsSerial.available() > 0) {
@@ -83,7 +87,7 @@ void loop() {
   
   // Check if it's time to publish data and we have a valid GPS fix
   unsigned long currentMillis = millis();
-  if ((currentMillis - lastPublishTime >= PUBLISH_INTERVAL) && gps.location.isValid()) {
+  if ((currentMillis - lastPublishTime >= PUBLISH_INTERVAL) && gps.location.isValid() && connection.connected()) {
     publishGPSData();
     lastPublishTime = currentMillis;
   }
@@ -94,37 +98,12 @@ void loop() {
   }
 }
 
-void setupWiFi() {
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(ssid);
-  
-  WiFi.begin(ssid, password);
-  
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
-    Serial.print(".");
-  }
-  
-  Serial.println();
-  Serial.println("WiFi connected");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-}
-
-void reconnectMQTT() {
-  while (!mqttClient.connected()) {
-    Serial.print("Connecting to MQTT broker...");
-    String clientId = "ESP32-" + String(random(0xffff), HEX);
-    
-    if (mqttClient.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
-      Serial.println("connected");
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(mqttClient.state());
-      Serial.println(" retrying in 5 seconds");
-      delay(5000);
-    }
-  }
+// Log how the connection went each time the MQTT session comes up
+void onMqttConnected() {
+  char stats[200];
+  connection.statsJson(stats, sizeof(stats));
+  Serial.print("MQTT connected: ");
+  Serial.println(stats);
 }
 
 void publishGPSData() {
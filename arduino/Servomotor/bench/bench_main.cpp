@@ -0,0 +1,117 @@
+/*
+  Host benchmark for the Servomotor firmware (pio run -e native)
+
+  Runs src/main.cpp over a directory of recorded JPEG frames, first end
+  to end through setup() and loop(), then stage by stage on each frame
+  so the cost of every step can be compared between builds:
+
+    .pio/build/native/program [--link B/s] [--repeat N] FRAME_DIR
+
+  The native environment builds the sequential loop (CAPTURE_PIPELINE
+  0); the pipelined build runs the same stages from two tasks.
+*/
+
+#include <Arduino.h>
+#include <esp_camera.h>
+#include <HostHarness.h>
+
+// Firmware entry points and stages, from src/main.cpp
+void setup();
+void loop();
+bool decodeLuminance(camera_fb_t *fb);
+bool detectObstruction(bool midSweep);
+bool frameChanged();
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out);
+size_t sendImageViaMQTT(camera_fb_t *fb);
+
+#define BENCH_BASE64_BLOCK 768   // Same block size the firmware streams with
+
+static HostStage loopStages[] = {
+  {"loop", 0, 0, 0, 0},
+};
+
+enum {
+  STAGE_FB_GET,
+  STAGE_DECODE,
+  STAGE_OBSTRUCTION,
+  STAGE_SIGNATURE,
+  STAGE_BASE64,
+  STAGE_PUBLISH,
+  STAGE_COUNT
+};
+
+static HostStage frameStages[STAGE_COUNT] = {
+  {"esp_camera_fb_get", 0, 0, 0, 0},
+  {"decodeLuminance", 0, 0, 0, 0},
+  {"detectObstruction", 0, 0, 0, 0},
+  {"frameChanged", 0, 0, 0, 0},
+  {"base64 encode", 0, 0, 0, 0},
+  {"sendImageViaMQTT", 0, 0, 0, 0},
+};
+
+int main(int argc, char** argv) {
+  HostOptions options;
+  if (!hostParseArgs(argc, argv, options)) {
+    return 2;
+  }
+  size_t frames = hostLoadFrames(options.frameDir);
+  if (frames == 0) {
+    fprintf(stderr, "no .jpg frames in %s\n", options.frameDir);
+    return 1;
+  }
+  printf("Servomotor firmware, %u frames, uplink %u B/s\n", (unsigned)frames,
+         (unsigned)options.linkBytesPerSecond);
+
+  // End to end: every frame through the firmware's own loop
+  setup();
+  hostHeapResetPeak();
+  hostResetMqttStats();
+  while (!hostFramesExhausted()) {
+    HOST_STAGE(loopStages[0]);
+    loop();
+  }
+  hostPrintStages("End to end", loopStages, 1);
+  hostPrintTraffic("End to end traffic", hostFramesServed());
+
+  // Stage by stage, on the same frames
+  static char encoded[BENCH_BASE64_BLOCK / 3 * 4];
+  for (uint16_t pass = 0; pass < options.repeat; pass++) {
+    hostRewindFrames();
+    for (;;) {
+      camera_fb_t* fb;
+      {
+        HOST_STAGE(frameStages[STAGE_FB_GET]);
+        fb = esp_camera_fb_get();
+      }
+      if (!fb) {
+        break;
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_DECODE]);
+        decodeLuminance(fb);
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_OBSTRUCTION]);
+        detectObstruction(false);
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_SIGNATURE]);
+        frameChanged();
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_BASE64]);
+        for (size_t offset = 0; offset < fb->len; offset += BENCH_BASE64_BLOCK) {
+          size_t block = fb->len - offset < BENCH_BASE64_BLOCK ? fb->len - offset : BENCH_BASE64_BLOCK;
+          base64EncodeBlock(fb->buf + offset, block, encoded);
+        }
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_PUBLISH]);
+        sendImageViaMQTT(fb);
+      }
+      esp_camera_fb_return(fb);
+    }
+  }
+  hostPrintStages("Per frame stages", frameStages, STAGE_COUNT);
+  return 0;
+}
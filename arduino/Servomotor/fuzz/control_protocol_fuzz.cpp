@@ -0,0 +1,218 @@
+/*
+  Fuzz target for parseControlCommand()
+
+  Any payload that reaches camera/control is parsed, so every byte
+  string must be rejected cleanly or give a command that holds only
+  in-range values. An accepted command is also written back out, one
+  argument per field in tag order, and must parse to the same command.
+
+  With libFuzzer:
+
+    clang++ -g -O1 -fsanitize=fuzzer,address,undefined -I../lib/ControlProtocol -I../lib/MotionPlanner \
+        control_protocol_fuzz.cpp ../lib/ControlProtocol/ControlProtocol.cpp -o control_protocol_fuzz
+    ./control_protocol_fuzz -max_len=64
+
+  Without it, -DFUZZ_STANDALONE builds a driver that runs the files given
+  on the command line, or else mutations of a few valid commands:
+
+    g++ -g -O1 -fsanitize=address,undefined -DFUZZ_STANDALONE -I../lib/ControlProtocol -I../lib/MotionPlanner \
+        control_protocol_fuzz.cpp ../lib/ControlProtocol/ControlProtocol.cpp -o control_protocol_fuzz
+    ./control_protocol_fuzz [FILE...]
+*/
+
+#include <ControlProtocol.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define FUZZ_CHECK(condition)                                                        \
+  do {                                                                               \
+    if (!(condition)) {                                                              \
+      fprintf(stderr, "%s:%d: %s does not hold\n", __FILE__, __LINE__, #condition);  \
+      abort();                                                                       \
+    }                                                                                \
+  } while (0)
+
+static const uint32_t knownFields = CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE) | CONTROL_FIELD(CONTROL_TAG_QUALITY) |
+                                    CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL) |
+                                    CONTROL_FIELD(CONTROL_TAG_OBSTRUCTION_THRESHOLD) |
+                                    CONTROL_FIELD(CONTROL_TAG_SWEEP) | CONTROL_FIELD(CONTROL_TAG_IR);
+
+static void put16(std::vector<uint8_t>& out, uint16_t value) {
+  out.push_back((uint8_t)value);
+  out.push_back((uint8_t)(value >> 8));
+}
+
+static std::vector<uint8_t> encode(const ControlCommand& command) {
+  std::vector<uint8_t> out = {CONTROL_MAGIC, command.opcode};
+  put16(out, command.sequence);
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE)) {
+    out.insert(out.end(), {CONTROL_TAG_FRAME_SIZE, 1, command.frameSize});
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_QUALITY)) {
+    out.insert(out.end(), {CONTROL_TAG_QUALITY, 1, command.quality});
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL)) {
+    out.insert(out.end(), {CONTROL_TAG_FRAME_INTERVAL, 2});
+    put16(out, command.frameInterval);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_OBSTRUCTION_THRESHOLD)) {
+    out.insert(out.end(), {CONTROL_TAG_OBSTRUCTION_THRESHOLD, 1, command.obstructionThreshold});
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_SWEEP)) {
+    out.insert(out.end(), {CONTROL_TAG_SWEEP, (uint8_t)(command.sweepCount * CONTROL_SWEEP_STEP_SIZE)});
+    for (uint8_t i = 0; i < command.sweepCount; i++) {
+      out.push_back((uint8_t)command.sweep[i].angle);
+      put16(out, command.sweep[i].speed);
+      put16(out, command.sweep[i].dwellMs);
+    }
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_IR)) {
+    out.insert(out.end(), {CONTROL_TAG_IR, 1, (uint8_t)command.irOn});
+  }
+  return out;
+}
+
+static void checkAccepted(const ControlCommand& command, size_t length) {
+  FUZZ_CHECK(command.opcode == CONTROL_OP_PING || command.opcode == CONTROL_OP_WIPE ||
+             command.opcode == CONTROL_OP_SET);
+  FUZZ_CHECK((command.fields & ~knownFields) == 0);
+  if (command.opcode != CONTROL_OP_SET) {
+    FUZZ_CHECK(command.fields == 0);
+    FUZZ_CHECK(length == CONTROL_HEADER_SIZE);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE)) {
+    FUZZ_CHECK(command.frameSize <= 31);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_QUALITY)) {
+    FUZZ_CHECK(command.quality <= 63);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL)) {
+    FUZZ_CHECK(command.frameInterval >= 10);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_OBSTRUCTION_THRESHOLD)) {
+    FUZZ_CHECK(command.obstructionThreshold > 0);
+  }
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_SWEEP)) {
+    FUZZ_CHECK(command.sweepCount >= 1 && command.sweepCount <= CONTROL_MAX_SWEEP_STEPS);
+    for (uint8_t i = 0; i < command.sweepCount; i++) {
+      FUZZ_CHECK(command.sweep[i].angle >= 0 && command.sweep[i].angle <= 180);
+    }
+  } else {
+    FUZZ_CHECK(command.sweepCount == 0);
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  ControlCommand command;
+  ControlResult result = parseControlCommand(data, size, command);
+  FUZZ_CHECK(strcmp(controlResultName(result), "unknown") != 0);
+  FUZZ_CHECK(result != CONTROL_REJECTED);  // Left to the device
+  if (size < CONTROL_HEADER_SIZE || data[0] != CONTROL_MAGIC) {
+    FUZZ_CHECK(result == CONTROL_TRUNCATED || result == CONTROL_BAD_MAGIC);
+    FUZZ_CHECK(command.sequence == 0);
+    return 0;
+  }
+  // The header is always read back for the ack
+  FUZZ_CHECK(command.opcode == data[1]);
+  FUZZ_CHECK(command.sequence == (uint16_t)(data[2] | data[3] << 8));
+  if (result != CONTROL_OK) {
+    return 0;
+  }
+  checkAccepted(command, size);
+
+  std::vector<uint8_t> encoded = encode(command);
+  ControlCommand again;
+  FUZZ_CHECK(parseControlCommand(encoded.data(), encoded.size(), again) == CONTROL_OK);
+  FUZZ_CHECK(memcmp(&again, &command, sizeof(command)) == 0);
+  return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+#define FUZZ_MUTATIONS 2000000
+#define FUZZ_MAX_LENGTH 64
+
+static const std::vector<uint8_t> seeds[] = {
+  {CONTROL_MAGIC, CONTROL_OP_PING, 1, 0},
+  {CONTROL_MAGIC, CONTROL_OP_WIPE, 2, 0},
+  {CONTROL_MAGIC, CONTROL_OP_SET, 3, 0, CONTROL_TAG_FRAME_SIZE, 1, 8, CONTROL_TAG_QUALITY, 1, 12,
+   CONTROL_TAG_FRAME_INTERVAL, 2, 0xF4, 0x01, CONTROL_TAG_OBSTRUCTION_THRESHOLD, 1, 40, CONTROL_TAG_IR, 1, 1},
+  {CONTROL_MAGIC, CONTROL_OP_SET, 4, 0, CONTROL_TAG_SWEEP, 15, 0, 100, 0, 200, 0, 180, 100, 0, 200, 0,
+   90, 100, 0, 0, 0},
+};
+
+// Boundaries of the tags' ranges and lengths
+static const uint8_t interesting[] = {0, 1, 2, 5, 9, 10, 31, 32, 63, 64, 180, 181, 0x7F, 0x80, 0xFF};
+
+static uint32_t randomState = 1;
+
+static uint32_t nextRandom() {
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+static void runInput(const std::vector<uint8_t>& input) {
+  // Exactly sized, so a read past the payload is caught
+  uint8_t* exact = (uint8_t*)malloc(input.size() ? input.size() : 1);
+  if (!input.empty()) {
+    memcpy(exact, input.data(), input.size());
+  }
+  LLVMFuzzerTestOneInput(exact, input.size());
+  free(exact);
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      FILE* f = fopen(argv[i], "rb");
+      if (!f) {
+        fprintf(stderr, "Cannot open %s\n", argv[i]);
+        return 1;
+      }
+      std::vector<uint8_t> input;
+      int c;
+      while ((c = fgetc(f)) != EOF) {
+        input.push_back((uint8_t)c);
+      }
+      fclose(f);
+      runInput(input);
+    }
+    printf("%d inputs passed\n", argc - 1);
+    return 0;
+  }
+
+  size_t seedCount = sizeof(seeds) / sizeof(seeds[0]);
+  for (uint32_t i = 0; i < FUZZ_MUTATIONS; i++) {
+    std::vector<uint8_t> input = seeds[i % seedCount];
+    uint32_t edits = 1 + nextRandom() % 4;
+    for (uint32_t e = 0; e < edits; e++) {
+      uint32_t r = nextRandom();
+      size_t at = input.empty() ? 0 : r % input.size();
+      switch ((r >> 16) % 5) {
+        case 0:
+          if (!input.empty()) input[at] = (uint8_t)(r >> 8);
+          break;
+        case 1:
+          if (!input.empty()) input[at] = interesting[(r >> 8) % sizeof(interesting)];
+          break;
+        case 2:
+          if (!input.empty()) input[at] ^= (uint8_t)(1 << ((r >> 8) % 8));
+          break;
+        case 3:
+          input.resize(at);
+          break;
+        default:
+          if (input.size() < FUZZ_MAX_LENGTH) input.insert(input.begin() + at, (uint8_t)(r >> 8));
+          break;
+      }
+    }
+    runInput(input);
+  }
+  printf("%d mutated inputs passed\n", FUZZ_MUTATIONS);
+  return 0;
+}
+#endif
@@ -0,0 +1,145 @@
+#include "ControlProtocol.h"
+
+#include <string.h>
+
+// Limits that hold for any camera; device specific checks (which frame
+// sizes fit the buffers, the slowest interval) are up to the caller
+#define CONTROL_MAX_QUALITY 63
+#define CONTROL_MAX_FRAME_SIZE 31
+#define CONTROL_MAX_ANGLE 180
+#define CONTROL_MIN_FRAME_INTERVAL 10   // ms, no camera module captures faster
+
+static uint16_t readU16(const uint8_t* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Check and store a single argument
+static ControlResult parseArgument(uint8_t tag, const uint8_t* value, uint8_t length, ControlCommand& command) {
+  switch (tag) {
+    case CONTROL_TAG_FRAME_SIZE:
+      if (length != 1) return CONTROL_BAD_LENGTH;
+      if (value[0] > CONTROL_MAX_FRAME_SIZE) return CONTROL_OUT_OF_RANGE;
+      command.frameSize = value[0];
+      return CONTROL_OK;
+
+    case CONTROL_TAG_QUALITY:
+      if (length != 1) return CONTROL_BAD_LENGTH;
+      if (value[0] > CONTROL_MAX_QUALITY) return CONTROL_OUT_OF_RANGE;
+      command.quality = value[0];
+      return CONTROL_OK;
+
+    case CONTROL_TAG_FRAME_INTERVAL:
+      if (length != 2) return CONTROL_BAD_LENGTH;
+      command.frameInterval = readU16(value);
+      if (command.frameInterval < CONTROL_MIN_FRAME_INTERVAL) return CONTROL_OUT_OF_RANGE;
+      return CONTROL_OK;
+
+    case CONTROL_TAG_OBSTRUCTION_THRESHOLD:
+      if (length != 1) return CONTROL_BAD_LENGTH;
+      if (value[0] == 0) return CONTROL_OUT_OF_RANGE;
+      command.obstructionThreshold = value[0];
+      return CONTROL_OK;
+
+    case CONTROL_TAG_SWEEP:
+      if (length == 0 || length % CONTROL_SWEEP_STEP_SIZE != 0 ||
+          length / CONTROL_SWEEP_STEP_SIZE > CONTROL_MAX_SWEEP_STEPS) {
+        return CONTROL_BAD_LENGTH;
+      }
+      command.sweepCount = length / CONTROL_SWEEP_STEP_SIZE;
+      for (uint8_t i = 0; i < command.sweepCount; i++) {
+        const uint8_t* step = value + i * CONTROL_SWEEP_STEP_SIZE;
+        if (step[0] > CONTROL_MAX_ANGLE) return CONTROL_OUT_OF_RANGE;
+        command.sweep[i].angle = step[0];
+        command.sweep[i].speed = readU16(step + 1);
+        command.sweep[i].dwellMs = readU16(step + 3);
+      }
+      return CONTROL_OK;
+
+    case CONTROL_TAG_IR:
+      if (length != 1) return CONTROL_BAD_LENGTH;
+      if (value[0] > 1) return CONTROL_OUT_OF_RANGE;
+      command.irOn = value[0] == 1;
+      return CONTROL_OK;
+
+    default:
+      return CONTROL_UNKNOWN_TAG;
+  }
+}
+
+ControlResult parseControlCommand(const uint8_t* data, size_t length, ControlCommand& command) {
+  memset(&command, 0, sizeof(command));
+  if (length < 1) {
+    return CONTROL_TRUNCATED;
+  }
+  if (data[0] != CONTROL_MAGIC) {
+    return CONTROL_BAD_MAGIC;
+  }
+  if (length < CONTROL_HEADER_SIZE) {
+    return CONTROL_TRUNCATED;
+  }
+  command.opcode = data[1];
+  command.sequence = readU16(data + 2);
+
+  if (command.opcode != CONTROL_OP_PING && command.opcode != CONTROL_OP_WIPE &&
+      command.opcode != CONTROL_OP_SET) {
+    return CONTROL_UNKNOWN_OPCODE;
+  }
+
+  const uint8_t* pos = data + CONTROL_HEADER_SIZE;
+  const uint8_t* end = data + length;
+  if (command.opcode != CONTROL_OP_SET) {
+    return pos == end ? CONTROL_OK : CONTROL_UNEXPECTED_ARGUMENT;
+  }
+
+  while (pos < end) {
+    if (end - pos < 2) {
+      return CONTROL_TRUNCATED;
+    }
+    uint8_t tag = pos[0];
+    uint8_t valueLength = pos[1];
+    pos += 2;
+    if ((size_t)(end - pos) < valueLength) {
+      return CONTROL_TRUNCATED;
+    }
+    // Unknown tags are rejected before their bit is tested so the shift
+    // below stays in range
+    if (tag < CONTROL_TAG_FRAME_SIZE || tag > CONTROL_TAG_IR) {
+      return CONTROL_UNKNOWN_TAG;
+    }
+    if (command.fields & CONTROL_FIELD(tag)) {
+      return CONTROL_DUPLICATE_TAG;
+    }
+    ControlResult result = parseArgument(tag, pos, valueLength, command);
+    if (result != CONTROL_OK) {
+      return result;
+    }
+    command.fields |= CONTROL_FIELD(tag);
+    pos += valueLength;
+  }
+  return CONTROL_OK;
+}
+
+const char* controlResultName(ControlResult result) {
+  switch (result) {
+    case CONTROL_OK: return "ok";
+    case CONTROL_TRUNCATED: return "truncated";
+    case CONTROL_BAD_MAGIC: return "bad_magic";
+    case CONTROL_UNKNOWN_OPCODE: return "unknown_opcode";
+    case CONTROL_UNKNOWN_TAG: return "unknown_tag";
+    case CONTROL_BAD_LENGTH: return "bad_length";
+    case CONTROL_OUT_OF_RANGE: return "out_of_range";
+    case CONTROL_DUPLICATE_TAG: return "duplicate_tag";
+    case CONTROL_UNEXPECTED_ARGUMENT: return "unexpected_argument";
+    case CONTROL_REJECTED: return "rejected";
+    default: return "unknown";
+  }
+}
+
+const char* controlOpcodeName(uint8_t opcode) {
+  switch (opcode) {
+    case CONTROL_OP_PING: return "ping";
+    case CONTROL_OP_WIPE: return "wipe";
+    case CONTROL_OP_SET: return "set";
+    default: return "unknown";
+  }
+}
@@ -0,0 +1,82 @@
+/*
+  ControlProtocol - binary command format for camera/control
+
+  Every command is a 4-byte header followed by TLV arguments:
+
+    byte 0     CONTROL_MAGIC (never a printable character, so text
+               commands can share the topic)
+    byte 1     opcode
+    byte 2-3   sequence number, little-endian, echoed in the ack
+    byte 4..   arguments: tag (1 byte), length (1 byte), value
+
+  Multi-byte values are little-endian. The payload is parsed in place
+  into a fixed-size ControlCommand without allocating, and every length
+  is checked against the buffer, so any byte string is safe to feed in.
+  Has no Arduino dependencies.
+*/
+
+#ifndef CONTROL_PROTOCOL_H
+#define CONTROL_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <MotionPlanner.h>
+
+#define CONTROL_MAGIC 0xC5
+#define CONTROL_HEADER_SIZE 4
+#define CONTROL_MAX_SWEEP_STEPS 8
+#define CONTROL_SWEEP_STEP_SIZE 5   // angle (1), speed (2), dwell (2)
+
+enum ControlOpcode {
+  CONTROL_OP_PING = 0x01,           // No arguments, only acked
+  CONTROL_OP_WIPE = 0x02,           // Run the wiper sweep now
+  CONTROL_OP_SET = 0x03             // Change the settings given as arguments
+};
+
+enum ControlTag {
+  CONTROL_TAG_FRAME_SIZE = 0x01,    // u8, esp32-camera framesize_t
+  CONTROL_TAG_QUALITY = 0x02,       // u8, JPEG quality, lower is better
+  CONTROL_TAG_FRAME_INTERVAL = 0x03,// u16, fastest capture interval (ms)
+  CONTROL_TAG_OBSTRUCTION_THRESHOLD = 0x04, // u8, brightness drop
+  CONTROL_TAG_SWEEP = 0x05,         // 1-8 steps: angle u8, speed u16, dwell u16
+  CONTROL_TAG_IR = 0x06             // u8, 0 = off, 1 = on
+};
+
+// Bits of ControlCommand::fields, one per tag that was present
+#define CONTROL_FIELD(tag) (1u << (tag))
+
+enum ControlResult {
+  CONTROL_OK = 0,
+  CONTROL_TRUNCATED,                // Header or an argument runs past the payload
+  CONTROL_BAD_MAGIC,
+  CONTROL_UNKNOWN_OPCODE,
+  CONTROL_UNKNOWN_TAG,
+  CONTROL_BAD_LENGTH,               // Argument length does not fit its tag
+  CONTROL_OUT_OF_RANGE,
+  CONTROL_DUPLICATE_TAG,
+  CONTROL_UNEXPECTED_ARGUMENT,      // Arguments given to an opcode that takes none
+  CONTROL_REJECTED                  // Well formed, but the device cannot apply it
+};
+
+struct ControlCommand {
+  uint8_t opcode;
+  uint16_t sequence;                // 0 if the header was incomplete
+  uint32_t fields;                  // CONTROL_FIELD() bits of the arguments present
+  uint8_t frameSize;
+  uint8_t quality;
+  uint16_t frameInterval;
+  uint8_t obstructionThreshold;
+  bool irOn;
+  uint8_t sweepCount;
+  SweepStep sweep[CONTROL_MAX_SWEEP_STEPS];
+};
+
+// Parse length bytes of data into command. On failure the sequence and
+// opcode are still filled in when the header was readable, so the
+// command can be acked.
+ControlResult parseControlCommand(const uint8_t* data, size_t length, ControlCommand& command);
+
+const char* controlResultName(ControlResult result);
+const char* controlOpcodeName(uint8_t opcode);
+
+#endif
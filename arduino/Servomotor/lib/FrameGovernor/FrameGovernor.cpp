@@ -0,0 +1,150 @@
+#include "FrameGovernor.h"
+
+// Updates to wait after a quality or frame size change so the frame size
+// average can settle before the next decision
+#define GOVERNOR_HOLD_UPDATES 3
+
+FrameGovernor::FrameGovernor(const GovernorConfig& cfg)
+  : config(cfg), lastReason(GOVERNOR_STEADY), frameBytesAvg(0), throughputAvg(0),
+    thermalFloor(cfg.minFrameInterval), temperature(0), temperatureFresh(false), holdUpdates(0) {
+  point.frameInterval = cfg.minFrameInterval;
+  point.quality = cfg.bestQuality;
+  point.frameSize = cfg.largestFrameSize;
+}
+
+void FrameGovernor::recordFrame(uint32_t bytes) {
+  frameBytesAvg = frameBytesAvg ? (frameBytesAvg * 7 + bytes) / 8 : bytes;
+}
+
+void FrameGovernor::recordPublish(uint32_t bytes, uint32_t elapsedMs) {
+  if (bytes == 0) {
+    return;
+  }
+  if (elapsedMs == 0) {
+    elapsedMs = 1;
+  }
+  uint32_t rate = (uint32_t)((uint64_t)bytes * 1000 / elapsedMs);
+  throughputAvg = throughputAvg ? (throughputAvg * 3 + rate) / 4 : rate;
+}
+
+void FrameGovernor::recordTemperature(float celsius) {
+  temperature = celsius;
+  temperatureFresh = true;
+}
+
+void FrameGovernor::reconfigure(const GovernorConfig& cfg) {
+  config = cfg;
+  if (point.frameInterval < config.minFrameInterval) {
+    point.frameInterval = config.minFrameInterval;
+  }
+  if (point.frameInterval > config.maxFrameInterval) {
+    point.frameInterval = config.maxFrameInterval;
+  }
+  if (thermalFloor < config.minFrameInterval) {
+    thermalFloor = config.minFrameInterval;
+  }
+  if (point.quality < config.bestQuality) {
+    point.quality = config.bestQuality;
+  }
+  if (point.quality > config.worstQuality) {
+    point.quality = config.worstQuality;
+  }
+  if (point.frameSize < config.largestFrameSize) {
+    point.frameSize = config.largestFrameSize;
+  }
+  if (point.frameSize >= config.frameSizeCount) {
+    point.frameSize = config.frameSizeCount - 1;
+  }
+  holdUpdates = 0;
+}
+
+bool FrameGovernor::update() {
+  OperatingPoint previous = point;
+  bool hot = temperature > config.tempCeiling;
+  bool warm = temperature > config.tempCeiling - config.tempHysteresis;
+
+  // Back off multiplicatively on each hot reading, recover gradually once
+  // the temperature is clearly below the ceiling
+  if (temperatureFresh) {
+    temperatureFresh = false;
+    if (hot) {
+      uint32_t base = thermalFloor > point.frameInterval ? thermalFloor : point.frameInterval;
+      thermalFloor = base * 2;
+      if (thermalFloor > config.maxFrameInterval) {
+        thermalFloor = config.maxFrameInterval;
+      }
+    } else if (!warm) {
+      thermalFloor = thermalFloor * 3 / 4;
+      if (thermalFloor < config.minFrameInterval) {
+        thermalFloor = config.minFrameInterval;
+      }
+    }
+  }
+
+  // Interval the uplink can sustain at the current frame size, with 10% margin
+  uint32_t rate = config.bandwidthBudget;
+  if (throughputAvg && throughputAvg * 9 / 10 < rate) {
+    rate = throughputAvg * 9 / 10;
+  }
+  if (rate == 0) {
+    rate = 1;
+  }
+  uint32_t linkInterval = (uint32_t)((uint64_t)frameBytesAvg * 1000 / rate);
+
+  uint32_t target = config.minFrameInterval;
+  lastReason = GOVERNOR_STEADY;
+  if (linkInterval > target) {
+    target = linkInterval;
+    lastReason = GOVERNOR_BANDWIDTH;
+  }
+  if (thermalFloor > target) {
+    target = thermalFloor;
+    lastReason = GOVERNOR_THERMAL;
+  }
+
+  if (holdUpdates) {
+    holdUpdates--;
+  } else if (target > config.maxFrameInterval || (hot && thermalFloor >= config.maxFrameInterval)) {
+    // Even the slowest interval is not enough: make frames smaller
+    if (point.quality + config.qualityStep <= config.worstQuality) {
+      point.quality += config.qualityStep;
+    } else if (point.frameSize + 1 < config.frameSizeCount) {
+      point.frameSize++;
+    }
+    if (point.quality != previous.quality || point.frameSize != previous.frameSize) {
+      lastReason = GOVERNOR_DEGRADE;
+      holdUpdates = GOVERNOR_HOLD_UPDATES;
+    }
+  } else if (!warm && frameBytesAvg && thermalFloor * 2 <= config.maxFrameInterval &&
+             linkInterval * 2 <= config.maxFrameInterval) {
+    // Frames twice the size would still fit the slowest interval: restore
+    // detail, frame size first since it matters most for what the camera can see
+    if (point.frameSize > config.largestFrameSize) {
+      point.frameSize--;
+    } else if (point.quality >= config.bestQuality + config.qualityStep) {
+      point.quality -= config.qualityStep;
+    }
+    if (point.quality != previous.quality || point.frameSize != previous.frameSize) {
+      lastReason = GOVERNOR_UPGRADE;
+      holdUpdates = GOVERNOR_HOLD_UPDATES;
+    }
+  }
+
+  if (target > config.maxFrameInterval) {
+    target = config.maxFrameInterval;
+  }
+  point.frameInterval = target;
+
+  return point.frameInterval != previous.frameInterval || point.quality != previous.quality ||
+         point.frameSize != previous.frameSize;
+}
+
+const char* governorReasonName(GovernorReason reason) {
+  switch (reason) {
+    case GOVERNOR_THERMAL: return "thermal";
+    case GOVERNOR_BANDWIDTH: return "bandwidth";
+    case GOVERNOR_DEGRADE: return "degrade";
+    case GOVERNOR_UPGRADE: return "upgrade";
+    default: return "steady";
+  }
+}
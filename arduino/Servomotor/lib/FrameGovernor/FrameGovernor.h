@@ -0,0 +1,82 @@
+/*
+  FrameGovernor - closed-loop frame rate / JPEG quality / resolution control
+
+  Picks the fastest frame interval that keeps the camera under a thermal
+  ceiling and within what the uplink actually accepts. When even the
+  slowest allowed interval cannot keep up, JPEG quality and then frame
+  size are stepped down; with enough headroom they are stepped back up.
+
+  Inputs are fed in as they are measured (frame size, bytes accepted per
+  publish, die temperature) and update() is called periodically to
+  re-evaluate. Frame and publish sizes must be in the same unit, the
+  payload as sent, or the link interval is off by the encoding overhead.
+  Has no Arduino dependencies.
+*/
+
+#ifndef FRAME_GOVERNOR_H
+#define FRAME_GOVERNOR_H
+
+#include <stdint.h>
+
+struct GovernorConfig {
+  uint16_t minFrameInterval;   // Fastest allowed capture interval (ms)
+  uint16_t maxFrameInterval;   // Slowest interval before quality/size are reduced (ms)
+  uint8_t bestQuality;         // esp32-camera jpeg_quality, lower is better
+  uint8_t worstQuality;
+  uint8_t qualityStep;
+  uint8_t frameSizeCount;      // Length of the caller's frame size ladder, index 0 is largest
+  uint8_t largestFrameSize;    // Smallest ladder index the governor may pick
+  uint32_t bandwidthBudget;    // Upper limit on uplink use (bytes/s)
+  int16_t tempCeiling;         // Thermal ceiling (deg C)
+  int16_t tempHysteresis;      // Must drop this far below the ceiling before speeding up again
+};
+
+struct OperatingPoint {
+  uint16_t frameInterval;      // ms between captures
+  uint8_t quality;
+  uint8_t frameSize;           // Index into the frame size ladder
+};
+
+enum GovernorReason {
+  GOVERNOR_STEADY,             // Running at the minimum interval
+  GOVERNOR_THERMAL,            // Interval held back by temperature
+  GOVERNOR_BANDWIDTH,          // Interval held back by uplink throughput
+  GOVERNOR_DEGRADE,            // Quality or frame size reduced
+  GOVERNOR_UPGRADE             // Quality or frame size increased
+};
+
+class FrameGovernor {
+public:
+  explicit FrameGovernor(const GovernorConfig& config);
+
+  void recordFrame(uint32_t bytes);
+  void recordPublish(uint32_t bytes, uint32_t elapsedMs);
+  void recordTemperature(float celsius);
+
+  // Re-evaluate the operating point, returns true if it changed
+  bool update();
+
+  // Change the limits at runtime, keeping the measurements so far. The
+  // operating point is pulled inside the new limits straight away.
+  void reconfigure(const GovernorConfig& config);
+
+  const OperatingPoint& operatingPoint() const { return point; }
+  GovernorReason reason() const { return lastReason; }
+  uint32_t throughput() const { return throughputAvg; }
+  uint32_t frameBytes() const { return frameBytesAvg; }
+
+private:
+  GovernorConfig config;
+  OperatingPoint point;
+  GovernorReason lastReason;
+  uint32_t frameBytesAvg;      // Moving averages, 0 until the first sample
+  uint32_t throughputAvg;
+  uint32_t thermalFloor;       // Lower bound on the interval imposed by temperature
+  float temperature;
+  bool temperatureFresh;
+  uint8_t holdUpdates;         // Updates to wait after a quality/size change
+};
+
+const char* governorReasonName(GovernorReason reason);
+
+#endif
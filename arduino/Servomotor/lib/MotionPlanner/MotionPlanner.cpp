@@ -0,0 +1,61 @@
+#include "MotionPlanner.h"
+
+MotionPlanner::MotionPlanner(int16_t startAngle)
+  : steps(0), count(0), index(0), running(false), angle(startAngle),
+    fromAngle(startAngle), stepStart(0), moveDuration(0), finishTime(0) {
+}
+
+void MotionPlanner::start(const SweepStep* profile, uint8_t stepCount, unsigned long now) {
+  if (stepCount == 0) {
+    return;
+  }
+  steps = profile;
+  count = stepCount;
+  index = 0;
+  running = true;
+  beginStep(now);
+}
+
+void MotionPlanner::stop(unsigned long now) {
+  if (running) {
+    running = false;
+    finishTime = now;
+  }
+}
+
+void MotionPlanner::beginStep(unsigned long now) {
+  const SweepStep& step = steps[index];
+  int32_t distance = step.angle - angle;
+  if (distance < 0) {
+    distance = -distance;
+  }
+  fromAngle = angle;
+  stepStart = now;
+  moveDuration = step.speed ? (unsigned long)distance * 1000UL / step.speed : 0;
+}
+
+int16_t MotionPlanner::update(unsigned long now) {
+  // Steps are chained on their scheduled end times, so a late tick
+  // catches up on the trajectory instead of stretching it
+  while (running) {
+    const SweepStep& step = steps[index];
+    unsigned long elapsed = now - stepStart;
+    if (elapsed < moveDuration) {
+      angle = fromAngle + (int32_t)(step.angle - fromAngle) * (int32_t)elapsed / (int32_t)moveDuration;
+      return angle;
+    }
+    angle = step.angle;
+    if (elapsed < moveDuration + step.dwellMs) {
+      return angle;
+    }
+
+    unsigned long stepEnd = stepStart + moveDuration + step.dwellMs;
+    if (++index >= count) {
+      running = false;
+      finishTime = stepEnd;
+      break;
+    }
+    beginStep(stepEnd);
+  }
+  return angle;
+}
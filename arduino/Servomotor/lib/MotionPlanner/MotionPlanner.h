@@ -0,0 +1,57 @@
+/*
+  MotionPlanner - time-driven servo sweep planner
+
+  Replaces blocking step/delay loops with a profile that is advanced from
+  the main loop. Each call to update() returns the angle the servo should
+  be commanded to at that moment, so the caller stays free to capture
+  frames and service MQTT while the servo moves.
+
+  Has no Arduino dependencies; time is passed in by the caller.
+*/
+
+#ifndef MOTION_PLANNER_H
+#define MOTION_PLANNER_H
+
+#include <stdint.h>
+
+// One leg of a sweep profile
+struct SweepStep {
+  int16_t angle;      // Target angle in degrees
+  uint16_t speed;     // Degrees per second, 0 jumps straight to the target
+  uint16_t dwellMs;   // Time to hold the target before the next step
+};
+
+class MotionPlanner {
+public:
+  explicit MotionPlanner(int16_t startAngle = 90);
+
+  // Start running count steps from the current position. The steps array
+  // must stay valid until the profile finishes.
+  void start(const SweepStep* steps, uint8_t count, unsigned long now);
+
+  // Hold the current position and drop the rest of the profile
+  void stop(unsigned long now);
+
+  // Advance the profile to time now and return the commanded angle
+  int16_t update(unsigned long now);
+
+  bool isRunning() const { return running; }
+  int16_t position() const { return angle; }
+  // Time the last profile finished (its final dwell included)
+  unsigned long finishedAt() const { return finishTime; }
+
+private:
+  void beginStep(unsigned long now);
+
+  const SweepStep* steps;
+  uint8_t count;
+  uint8_t index;
+  bool running;
+  int16_t angle;
+  int16_t fromAngle;          // Angle at the start of the current step
+  unsigned long stepStart;
+  unsigned long moveDuration; // Travel time of the current step in ms
+  unsigned long finishTime;
+};
+
+#endif
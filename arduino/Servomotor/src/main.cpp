@@ -4,16 +4,24 @@
 #include <ESP32Servo.h>
 #include "esp_camera.h"
 #include "Arduino.h"
+#include <JpegDc.h>
+#include <MotionPlanner.h>
+#include <FrameGovernor.h>
+#include <FrameSignature.h>
+#include <ConnSupervisor.h>
+#include <ControlProtocol.h>
+#include <StageStats.h>
 
 // WiFi and MQTT configurations
 const char* ssid = "Mi 11X";
 const char* password = "Laptop99@!";
-const char* mqtt_server = "mqtt://c997ac04f7364048929feac82a351c39.s1.eu.hivemq.cloud";
+const char* mqtt_server = "c997ac04f7364048929feac82a351c39.s1.eu.hivemq.cloud";
 const int mqtt_port = 8883;
 const char* mqtt_username = "Camera-module";
 const char* mqtt_password = "Kaushikyadalaisagaydumbass53";
 const char* mqtt_topic_image = "camera/images";
 const char* mqtt_topic_status = "camera/status";
+const char* mqtt_topic_control = "camera/control";
 
 // Camera configurations
 #define CAMERA_MODEL_AI_THINKER
@@ -21,31 +29,175 @@ const char* mqtt_topic_status = "camera/status";
 
 // Servo configurations
 #define SERVO_PIN 14  // GPIO14 for servo control
+#define SERVO_TICK_MS 20         // Motion planner update period (one servo PWM frame)
+#define SERVO_SETTLE_MS 300      // Frames this soon after a sweep are still treated as mid-sweep
 Servo myservo;
+MotionPlanner wiper(90);
+int servoAngle = 90;
+volatile bool wipeRequested = false;
+bool awaitingClearCheck = false;
+
+// Wiper sweep used to clear the lens: angle, speed (deg/s), dwell (ms)
+const SweepStep WIPE_SWEEP[] = {
+  {0, 100, 200},     // First, move slowly to one side
+  {180, 100, 200},   // Then move to the other side
+  {90, 100, 0}       // Return to center position
+};
+
+// Sweep in use, replaced over camera/control. A new sweep is staged and
+// only swapped in while the wiper is idle.
+SweepStep wipeSweep[CONTROL_MAX_SWEEP_STEPS];
+uint8_t wipeSweepCount = 0;
+SweepStep pendingSweep[CONTROL_MAX_SWEEP_STEPS];
+uint8_t pendingSweepCount = 0;
+volatile bool sweepPending = false;
 
 // IR bulb configuration
 #define IR_BULB_PIN 4  // GPIO4 for IR LED control
 
 // Variables for obstruction detection
-#define FRAME_BRIGHTNESS_SAMPLES 100  // Number of pixels to sample for brightness
-#define OBSTRUCTION_THRESHOLD 30      // Brightness threshold for obstruction detection
-#define BRIGHTNESS_HISTORY_SIZE 10    // Number of frames to keep in history
-int brightnessHistory[BRIGHTNESS_HISTORY_SIZE] = {0};
+#define LUMA_MAP_MAX_BLOCKS (80 * 60)    // One value per 8x8 block, sized for VGA
+#define OBSTRUCTION_REGIONS_X 4          // Frame is split into a grid of regions
+#define OBSTRUCTION_REGIONS_Y 3
+#define OBSTRUCTION_REGIONS (OBSTRUCTION_REGIONS_X * OBSTRUCTION_REGIONS_Y)
+#define OBSTRUCTION_THRESHOLD 30         // Default brightness drop that marks a region as darkened
+#define OBSTRUCTION_FLAT_VARIANCE 40     // Block variance below which a region has lost its detail
+#define OBSTRUCTION_MIN_REGIONS 6        // Covered regions needed to report an obstruction
+#define BRIGHTNESS_HISTORY_SIZE 10       // Number of frames to keep in history
+uint8_t obstructionThreshold = OBSTRUCTION_THRESHOLD;
+JpegDcDecoder jpegDecoder;
+uint8_t lumaMap[LUMA_MAP_MAX_BLOCKS];
+int regionHistory[BRIGHTNESS_HISTORY_SIZE][OBSTRUCTION_REGIONS];
 int historyIndex = 0;
+int historyCount = 0;
+unsigned long lastLumaDecodeMicros = 0;
+bool lumaValid = false;            // lumaMap holds the current frame
 bool obstructionCleared = false;
 
+// Change detection: frames that barely differ from the last uploaded one
+// are not sent, apart from a periodic keyframe
+#define CHANGE_GATE 1
+#define CHANGE_CELL_THRESHOLD 12     // Brightness change for a signature cell to count as changed
+#define CHANGE_MIN_CELLS 3           // Changed cells (of 192) needed to upload a frame
+#define KEYFRAME_INTERVAL 300000     // Upload a frame at least this often (ms)
+ChangeGate changeGate(CHANGE_CELL_THRESHOLD, CHANGE_MIN_CELLS, KEYFRAME_INTERVAL);
+uint32_t framesSuppressed = 0;
+
 // Temperature monitoring
 #define TEMP_THRESHOLD 75  // Temperature threshold in Celsius
+#define TEMP_HYSTERESIS 5  // Degrees below the threshold before frame rate is raised again
 unsigned long lastTempCheck = 0;
+float lastTemperature = 0;
 #define TEMP_CHECK_INTERVAL 10000  // Check temperature every 10 seconds
 
 // Frame rate control
 #define MIN_FRAME_INTERVAL 200     // Minimum time between frames (ms)
+#define MAX_FRAME_INTERVAL 2000    // Slowest frame rate before quality and resolution are reduced (ms)
+#define FASTEST_FRAME_INTERVAL 100 // Fastest accepted over camera/control, capture and upload cannot keep up beyond it (ms)
 unsigned long lastFrameTime = 0;
+unsigned long frameInterval = MIN_FRAME_INTERVAL;
+
+// Governor adjusting frame interval, JPEG quality and frame size to stay
+// under the thermal ceiling and the uplink budget
+#define GOVERNOR_INTERVAL 2000     // How often the operating point is re-evaluated (ms)
+#define UPLINK_BUDGET 60000        // Uplink bytes per second the camera may use
+#define JPEG_QUALITY_BEST 12
+#define JPEG_QUALITY_WORST 30
+#define JPEG_QUALITY_STEP 4
+#define JPEG_QUALITY_FINEST 8      // Best quality accepted over camera/control, finer frames overflow the buffers
+const framesize_t FRAME_SIZE_LADDER[] = {FRAMESIZE_VGA, FRAMESIZE_CIF, FRAMESIZE_QVGA, FRAMESIZE_QQVGA};
+#define FRAME_SIZE_COUNT (sizeof(FRAME_SIZE_LADDER) / sizeof(FRAME_SIZE_LADDER[0]))
+uint8_t frameSizeLimit = 0;        // Largest ladder step the frame buffers can hold
+GovernorConfig governorConfig = {
+  MIN_FRAME_INTERVAL, MAX_FRAME_INTERVAL,
+  JPEG_QUALITY_BEST, JPEG_QUALITY_WORST, JPEG_QUALITY_STEP,
+  FRAME_SIZE_COUNT, 0,
+  UPLINK_BUDGET, TEMP_THRESHOLD, TEMP_HYSTERESIS
+};
+FrameGovernor governor(governorConfig);
+OperatingPoint appliedPoint = {MIN_FRAME_INTERVAL, JPEG_QUALITY_BEST, 0};
+GovernorReason lastGovernorReason = GOVERNOR_STEADY;
+unsigned long lastGovernorUpdate = 0;
+volatile bool governorReconfigured = false;  // Limits changed over camera/control
+
+// Capture/uplink pipeline: capture and analysis run on one core while the
+// previous frames are published from the other
+#ifndef CAPTURE_PIPELINE
+#define CAPTURE_PIPELINE 1             // 0 = capture, analyse and publish in turn from loop()
+#endif
+#define FRAME_QUEUE_DEPTH 2            // Frames waiting for upload
+#define FRAME_QUEUE_DROP_OLDEST 1      // 1 = drop the oldest queued frame when full, 0 = block capture
+#define STATUS_QUEUE_DEPTH 8
+#define CAPTURE_TASK_CORE 1
+#define UPLINK_TASK_CORE 0             // Same core as the WiFi stack
+#if CAPTURE_PIPELINE
+struct StatusMessage {
+  char text[384];                      // Fits the stage summary
+};
+QueueHandle_t frameQueue;
+QueueHandle_t statusQueue;
+volatile uint32_t framesCaptured = 0;
+volatile uint32_t framesSent = 0;
+volatile uint32_t framesDropped = 0;
+uint32_t lastStatusFramesSent = 0;
+// The governor is fed from both tasks
+portMUX_TYPE governorMux = portMUX_INITIALIZER_UNLOCKED;
+#define GOVERNOR_LOCK() portENTER_CRITICAL(&governorMux)
+#define GOVERNOR_UNLOCK() portEXIT_CRITICAL(&governorMux)
+// Control commands arrive on the uplink task, the wiper runs from loop()
+portMUX_TYPE sweepMux = portMUX_INITIALIZER_UNLOCKED;
+#define SWEEP_LOCK() portENTER_CRITICAL(&sweepMux)
+#define SWEEP_UNLOCK() portEXIT_CRITICAL(&sweepMux)
+#else
+#define GOVERNOR_LOCK()
+#define GOVERNOR_UNLOCK()
+#define SWEEP_LOCK()
+#define SWEEP_UNLOCK()
+#endif
+
+// Image upload configuration
+#define IMAGE_CHUNK_SIZE 10000     // Payload bytes per MQTT message
+#define BASE64_BLOCK_INPUT 768     // Frame bytes encoded per write in base64 mode (multiple of 3)
+enum ImageEncoding {
+  IMAGE_ENCODING_RAW,              // JPEG bytes as-is, smallest on the wire
+  IMAGE_ENCODING_BASE64            // Text-safe payload for existing subscribers
+};
+ImageEncoding imageEncoding = IMAGE_ENCODING_BASE64;
+
+// Stage instrumentation: latency histograms (us) per stage, summarised
+// on camera/status to show which stage limits the frame rate
+#define STATS_INTERVAL 60000       // How often the stage summary is published (ms)
+enum Stage {
+  STAGE_FB_GET,                    // esp_camera_fb_get()
+  STAGE_DECODE,                    // Luminance map decode
+  STAGE_OBSTRUCTION,               // detectObstruction()
+  STAGE_BASE64,                    // Base64 encoding, per frame
+  STAGE_CHUNK,                     // Publishing one image chunk
+  STAGE_UPLOAD,                    // Whole frame upload, metadata included
+  STAGE_RECONNECT,                 // First connection attempt to MQTT session up
+  STAGE_COUNT
+};
+const char* const STAGE_NAMES[STAGE_COUNT] = {
+  "fb_get", "decode", "obstruction", "base64", "chunk", "upload", "reconnect"
+};
+StageHistogram stageStats[STAGE_COUNT];
+StageReport stageReports[STAGE_COUNT];
+unsigned long frameBase64Micros = 0;
+unsigned long lastStatsPublish = 0;
+// Monotonic counters, never reset so the receiving side can take deltas
+uint32_t captureFailures = 0;
+uint32_t decodeFailures = 0;
+uint32_t chunksPublished = 0;
+uint32_t chunkFailures = 0;
+uint32_t bytesPublished = 0;
 
 // Variables for MQTT
+#define TLS_HANDSHAKE_TIMEOUT 10   // Seconds, bounds the supervisor's TLS step
+#define MQTT_RESPONSE_TIMEOUT 5    // Seconds to wait for CONNACK
+#define MQTT_BUFFER_SIZE 512       // Status messages exceed the 256-byte default
 WiFiClientSecure espClient;
 PubSubClient client(espClient);
+ConnSupervisor connection(espClient, client);
 
 // Root CA certificate for HiveMQ Cloud (from search results)
 static const char* root_ca PROGMEM = R"EOF(
@@ -62,6 +214,37 @@ A5/TR5d8mUgjU+g4rk8Kb4Mu0UlXjIB0ttov0DiNeNxGnTu3m8mfYXZg7w/
 -----END CERTIFICATE-----
 )EOF";
 
+// Function prototypes, a .cpp file does not get them generated like a sketch
+void onMqttConnected();
+void publishStatus(const char* message);
+void checkTemperature();
+void publishStageStats();
+void updateGovernor();
+void publishFrame(camera_fb_t *fb);
+camera_fb_t* captureFrame();
+bool frameChanged();
+#if CAPTURE_PIPELINE
+void enqueueFrame(camera_fb_t* fb);
+void captureTask(void* parameter);
+void uplinkTask(void* parameter);
+#endif
+bool decodeLuminance(camera_fb_t *fb);
+bool detectObstruction(bool midSweep);
+void clearObstruction();
+void tickWiper();
+float readTemperature();
+void mqttCallback(char* topic, byte* payload, unsigned int length);
+ControlResult validateControlCommand(const ControlCommand& command, uint8_t& frameSizeIndex);
+void handleControlCommand(const uint8_t* payload, unsigned int length);
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out);
+size_t encodedImageSize(size_t length);
+bool publishImageSlice(const char* topic, const uint8_t* data, size_t length);
+size_t sendImageViaMQTT(camera_fb_t *fb);
+
+#ifdef CONFIG_IDF_TARGET_ESP32
+extern "C" uint8_t temprature_sens_read();  // Internal sensor, exported by the ESP32 ROM
+#endif
+
 void setup() {
   Serial.begin(115200);
   Serial.println("Starting ESP32-CAM with obstruction detection...");
@@ -74,6 +257,8 @@ void setup() {
   myservo.setPeriodHertz(50);  // Standard 50hz servo
   myservo.attach(SERVO_PIN, 500, 2400);  // Attaches the servo on pin 14
   myservo.write(90);  // Set servo to middle position
+  wipeSweepCount = sizeof(WIPE_SWEEP) / sizeof(WIPE_SWEEP[0]);
+  memcpy(wipeSweep, WIPE_SWEEP, sizeof(WIPE_SWEEP));
   
   // Initialize IR bulb pin
   pinMode(IR_BULB_PIN, OUTPUT);
@@ -104,15 +289,27 @@ void setup() {
   config.pixel_format = PIXFORMAT_JPEG;
   
   // Configure camera settings to reduce overheating
+  // The governor only steps down from the initial frame size, so the
+  // frame buffers allocated here always fit
   if(psramFound()) {
     config.frame_size = FRAMESIZE_VGA;  // 640x480, reduced from higher res
-    config.jpeg_quality = 12;           // Balance between quality and size
+    config.jpeg_quality = JPEG_QUALITY_BEST;  // Balance between quality and size
     config.fb_count = 1;                // Reduced to save memory
   } else {
     config.frame_size = FRAMESIZE_QVGA; // 320x240 for devices without PSRAM
-    config.jpeg_quality = 12;
+    config.jpeg_quality = JPEG_QUALITY_BEST;
     config.fb_count = 1;
+    frameSizeLimit = 2;
+    governorConfig.largestFrameSize = frameSizeLimit;
+    governor = FrameGovernor(governorConfig);
+    appliedPoint = governor.operatingPoint();
   }
+#if CAPTURE_PIPELINE
+  // One buffer being filled, one being published and every queued frame.
+  // Without PSRAM only two fit, so capture waits on the uplink instead.
+  config.fb_count = psramFound() ? FRAME_QUEUE_DEPTH + 2 : 2;
+  config.grab_mode = CAMERA_GRAB_LATEST;
+#endif
   
   // Initialize the camera
   esp_err_t err = esp_camera_init(&config);
@@ -135,192 +332,491 @@ void setup() {
   s->set_gain_ctrl(s, 1);       // Enable gain control
   s->set_agc_gain(s, 0);        // Set gain to 0
   
-  // Initialize WiFi
-  Serial.println("Connecting to WiFi...");
-  WiFi.begin(ssid, password);
-  int wifiAttempts = 0;
-  while (WiFi.status() != WL_CONNECTED && wifiAttempts < 20) {
-    delay(500);
-    Serial.print(".");
-    wifiAttempts++;
-  }
-  
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("\nFailed to connect to WiFi. Restarting...");
-    ESP.restart();
-  }
-  
-  Serial.println("\nWiFi connected");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  
   // Set up MQTT with secure connection
   espClient.setCACert(root_ca);
+  espClient.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT);
   client.setServer(mqtt_server, mqtt_port);
   client.setCallback(mqttCallback);
+  client.setSocketTimeout(MQTT_RESPONSE_TIMEOUT);
+  client.setBufferSize(MQTT_BUFFER_SIZE);
   
-  // Try to connect to MQTT broker
-  reconnectMQTT();
+  // WiFi and MQTT are brought up in the background by the connection
+  // supervisor, capture starts without waiting for them
+  connection.onConnected(onMqttConnected);
+  connection.begin(ssid, password, mqtt_server, mqtt_port, "ESP32CAM-", mqtt_username, mqtt_password);
   
-  // Send initial status message
-  client.publish(mqtt_topic_status, "{\"status\":\"online\",\"temperature\":0}");
+#if CAPTURE_PIPELINE
+  frameQueue = xQueueCreate(FRAME_QUEUE_DEPTH, sizeof(camera_fb_t*));
+  statusQueue = xQueueCreate(STATUS_QUEUE_DEPTH, sizeof(StatusMessage));
+  xTaskCreatePinnedToCore(captureTask, "capture", 8192, NULL, 2, NULL, CAPTURE_TASK_CORE);
+  xTaskCreatePinnedToCore(uplinkTask, "uplink", 8192, NULL, 1, NULL, UPLINK_TASK_CORE);
+#endif
   
   Serial.println("Setup complete!");
 }
 
 void loop() {
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
-    Serial.println("WiFi connection lost. Reconnecting...");
-    WiFi.begin(ssid, password);
-    delay(5000);  // Wait a bit before continuing
+  tickWiper();
+  
+#if CAPTURE_PIPELINE
+  // Capture and uplink run in their own tasks, loop() only drives the servo
+  delay(SERVO_TICK_MS);
+#else
+  // Keep the link up in the background, sensing continues while it is down
+  connection.poll();
+  
+  // Check temperature periodically and let the governor pick the frame rate
+  checkTemperature();
+  publishStageStats();
+  updateGovernor();
+  
+  // Control frame rate to prevent overheating
+  unsigned long currentTime = millis();
+  if (currentTime - lastFrameTime < frameInterval) {
+    delay(10);  // Short delay to yield processor time
     return;
   }
+  lastFrameTime = currentTime;
   
-  // Check MQTT connection
-  if (!client.connected()) {
-    reconnectMQTT();
+  camera_fb_t * fb = captureFrame();
+  if (!fb) {
+    return;
   }
-  client.loop();
   
-  // Check temperature periodically to prevent overheating
+  // Skip frames where nothing has changed, or that cannot be sent
+  if (!connection.connected() || !frameChanged()) {
+    esp_camera_fb_return(fb);
+    return;
+  }
+  
+  // Stream the image to the broker in chunks
+  publishFrame(fb);
+  
+  // Return the frame buffer back to the camera
+  esp_camera_fb_return(fb);
+#endif
+}
+
+// Runs each time the supervisor brings the MQTT session up
+void onMqttConnected() {
+  // Time from the first attempt to subscribed, capped to fit in microseconds
+  uint32_t connectMs = connection.stats().lastConnectMs;
+  stageStats[STAGE_RECONNECT].record(min(connectMs, (uint32_t)(UINT32_MAX / 1000)) * 1000);
+  
+  // Subscribe to control topics
+  client.subscribe(mqtt_topic_control);
+  
+  // Announce the device along with how the connection went
+  char msg[MQTT_BUFFER_SIZE - 64];
+  int length = snprintf(msg, sizeof(msg), "{\"status\":\"online\",\"temperature\":%.1f,\"conn\":", lastTemperature);
+  length += connection.statsJson(msg + length, sizeof(msg) - length - 1);
+  snprintf(msg + length, sizeof(msg) - length, "}");
+  client.publish(mqtt_topic_status, msg);
+}
+
+// Send a status message on camera/status. In pipelined mode only the
+// uplink task touches the MQTT client, so messages are queued for it.
+void publishStatus(const char* message) {
+#if CAPTURE_PIPELINE
+  StatusMessage status;
+  strncpy(status.text, message, sizeof(status.text) - 1);
+  status.text[sizeof(status.text) - 1] = '\0';
+  xQueueSend(statusQueue, &status, 0);  // Drop rather than stall capture
+#else
+  client.publish(mqtt_topic_status, message);
+#endif
+}
+
+// Read and publish the temperature periodically, together with the
+// current operating point
+void checkTemperature() {
   unsigned long currentTime = millis();
-  if (currentTime - lastTempCheck > TEMP_CHECK_INTERVAL) {
-    lastTempCheck = currentTime;
-    float temperature = readTemperature();
-    
-    // Send temperature to MQTT broker
-    char tempMsg[50];
-    sprintf(tempMsg, "{\"status\":\"online\",\"temperature\":%.1f}", temperature);
-    client.publish(mqtt_topic_status, tempMsg);
-    
-    // If temperature is too high, enter cooling mode
-    if (temperature > TEMP_THRESHOLD) {
-      Serial.println("WARNING: ESP32 is overheating! Entering cooling mode...");
-      delay(5000);  // Extended delay to allow cooling
-      return;
-    }
+  if (currentTime - lastTempCheck <= TEMP_CHECK_INTERVAL) {
+    return;
   }
+  lastTempCheck = currentTime;
+  float temperature = readTemperature();
+  lastTemperature = temperature;
   
-  // Control frame rate to prevent overheating
-  if (currentTime - lastFrameTime < MIN_FRAME_INTERVAL) {
-    delay(10);  // Short delay to yield processor time
+  GOVERNOR_LOCK();
+  governor.recordTemperature(temperature);
+  uint32_t throughput = governor.throughput();
+  GOVERNOR_UNLOCK();
+  
+  // Send temperature to MQTT broker
+  char tempMsg[256];
+  int length = snprintf(tempMsg, sizeof(tempMsg),
+                        "{\"status\":\"online\",\"temperature\":%.1f,\"interval\":%u,\"quality\":%u,\"framesize\":%u,\"throughput\":%u,\"suppressed\":%u",
+                        temperature, (unsigned)appliedPoint.frameInterval, appliedPoint.quality,
+                        (unsigned)FRAME_SIZE_LADDER[appliedPoint.frameSize], (unsigned)throughput,
+                        (unsigned)framesSuppressed);
+#if CAPTURE_PIPELINE
+  uint32_t sent = framesSent;
+  float fps = (sent - lastStatusFramesSent) * 1000.0 / TEMP_CHECK_INTERVAL;
+  lastStatusFramesSent = sent;
+  length += snprintf(tempMsg + length, sizeof(tempMsg) - length,
+                     ",\"queue_depth\":%u,\"captured\":%u,\"sent\":%u,\"dropped\":%u,\"fps\":%.1f",
+                     (unsigned)uxQueueMessagesWaiting(frameQueue), (unsigned)framesCaptured,
+                     (unsigned)sent, (unsigned)framesDropped, fps);
+#endif
+  snprintf(tempMsg + length, sizeof(tempMsg) - length, "}");
+  publishStatus(tempMsg);
+  
+  if (temperature > TEMP_THRESHOLD) {
+    Serial.println("WARNING: ESP32 is overheating! Governor is lowering the frame rate...");
+  }
+}
+
+// Publish the latency percentiles of each stage over the last interval,
+// then the running counters
+void publishStageStats() {
+  unsigned long currentTime = millis();
+  if (currentTime - lastStatsPublish < STATS_INTERVAL) {
     return;
   }
-  lastFrameTime = currentTime;
+  lastStatsPublish = currentTime;
+  
+  // {"status":"stages","name":[count,p50,p90,p99],...}
+  char msg[384];
+  int length = snprintf(msg, sizeof(msg), "{\"status\":\"stages\"");
+  for (int i = 0; i < STAGE_COUNT && length < (int)sizeof(msg) - 1; i++) {
+    msg[length++] = ',';
+    length += stageReports[i].appendJson(msg + length, sizeof(msg) - length, STAGE_NAMES[i], stageStats[i]);
+  }
+  if (length < (int)sizeof(msg) - 1) {
+    snprintf(msg + length, sizeof(msg) - length, "}");
+    publishStatus(msg);
+  }
+  
+  const ConnStats& conn = connection.stats();
+  snprintf(msg, sizeof(msg),
+           "{\"status\":\"counters\",\"uptime\":%lu,\"frames\":%u,\"capture_failures\":%u,\"decode_failures\":%u,\"suppressed\":%u,\"uploads\":%u,\"chunks\":%u,\"chunk_failures\":%u,\"bytes\":%u,\"sessions\":%u,\"drops\":%u}",
+           currentTime / 1000, (unsigned)stageStats[STAGE_FB_GET].count(), (unsigned)captureFailures,
+           (unsigned)decodeFailures, (unsigned)framesSuppressed, (unsigned)stageStats[STAGE_UPLOAD].count(),
+           (unsigned)chunksPublished, (unsigned)chunkFailures, (unsigned)bytesPublished,
+           (unsigned)conn.sessions, (unsigned)conn.drops);
+  publishStatus(msg);
+}
+
+// Re-evaluate the operating point and apply any change to the sensor
+void updateGovernor() {
+  unsigned long currentTime = millis();
+  if (!governorReconfigured && currentTime - lastGovernorUpdate < GOVERNOR_INTERVAL) {
+    return;
+  }
+  governorReconfigured = false;
+  lastGovernorUpdate = currentTime;
+  
+  GOVERNOR_LOCK();
+  governor.update();
+  OperatingPoint point = governor.operatingPoint();
+  GovernorReason reason = governor.reason();
+  uint32_t throughput = governor.throughput();
+  uint32_t frameBytes = governor.frameBytes();
+  GOVERNOR_UNLOCK();
+  // Compared against what the sensor runs at, since a reconfiguration
+  // moves the point outside of update()
+  if (point.frameInterval == appliedPoint.frameInterval && point.quality == appliedPoint.quality &&
+      point.frameSize == appliedPoint.frameSize) {
+    return;
+  }
+  
+  sensor_t * s = esp_camera_sensor_get();
+  bool imageChanged = false;
+  if (point.quality != appliedPoint.quality) {
+    s->set_quality(s, point.quality);
+    imageChanged = true;
+  }
+  if (point.frameSize != appliedPoint.frameSize) {
+    s->set_framesize(s, FRAME_SIZE_LADDER[point.frameSize]);
+    imageChanged = true;
+  }
+  frameInterval = point.frameInterval;
+  appliedPoint = point;
+  
+  // Interval tweaks are frequent and show up in the periodic status;
+  // report image changes and changes in what limits the frame rate
+  if (imageChanged || reason != lastGovernorReason) {
+    lastGovernorReason = reason;
+    char msg[200];
+    snprintf(msg, sizeof(msg),
+             "{\"status\":\"governor\",\"reason\":\"%s\",\"interval\":%u,\"quality\":%u,\"framesize\":%u,\"throughput\":%u,\"frame_bytes\":%u,\"temperature\":%.1f}",
+             governorReasonName(reason), (unsigned)point.frameInterval, point.quality,
+             (unsigned)FRAME_SIZE_LADDER[point.frameSize], (unsigned)throughput, (unsigned)frameBytes, lastTemperature);
+    publishStatus(msg);
+  }
+}
+
+// Upload a frame and feed the measured throughput to the governor
+void publishFrame(camera_fb_t *fb) {
+  unsigned long publishStart = micros();
+  size_t published = sendImageViaMQTT(fb);
+  unsigned long elapsedMicros = micros() - publishStart;
+  unsigned long elapsed = elapsedMicros / 1000;
+  stageStats[STAGE_UPLOAD].record(elapsedMicros);
+  bytesPublished += published;
   
+  GOVERNOR_LOCK();
+  governor.recordPublish(published, elapsed);
+  GOVERNOR_UNLOCK();
+}
+
+// Capture a frame and run obstruction handling on it. Returns the frame
+// to upload (caller returns it to the driver) or NULL if capture failed.
+camera_fb_t* captureFrame() {
   // Capture an image
+  unsigned long captureStart = micros();
   camera_fb_t * fb = esp_camera_fb_get();
+  stageStats[STAGE_FB_GET].record(micros() - captureStart);
   if (!fb) {
+    captureFailures++;
     Serial.println("Camera capture failed");
     delay(1000);
-    return;
+    return NULL;
   }
   
+  // In the same unit as recordPublish(): bytes on the wire, so a base64
+  // frame counts a third bigger than the JPEG
+  GOVERNOR_LOCK();
+  governor.recordFrame(encodedImageSize(fb->len));
+  GOVERNOR_UNLOCK();
+  
+  lumaValid = decodeLuminance(fb);
+  
+  // Frames taken while the wiper is in view are tagged so they do not
+  // count as obstructed or feed the brightness history
+  bool midSweep = wipeRequested || wiper.isRunning() ||
+                  (millis() - wiper.finishedAt() < SERVO_SETTLE_MS);
+  
   // Check for obstruction
-  bool isObstructed = detectObstruction(fb);
+  unsigned long detectStart = micros();
+  bool isObstructed = detectObstruction(midSweep);
+  stageStats[STAGE_OBSTRUCTION].record(micros() - detectStart);
+  if (midSweep) {
+    return fb;
+  }
   
-  // If obstruction is detected and hasn't been cleared yet, activate servo
-  if (isObstructed && !obstructionCleared) {
+  if (awaitingClearCheck) {
+    // First clean frame after a sweep: check if clearing worked
+    awaitingClearCheck = false;
+    if (!isObstructed) {
+      Serial.println("Obstruction cleared successfully!");
+      publishStatus("{\"status\":\"cleared\"}");
+    } else {
+      Serial.println("Failed to clear obstruction.");
+      publishStatus("{\"status\":\"failed_to_clear\"}");
+    }
+  } else if (isObstructed && !obstructionCleared) {
+    // If obstruction is detected and hasn't been cleared yet, activate servo
     Serial.println("Obstruction detected! Clearing...");
     
     // Publish obstruction status
-    client.publish(mqtt_topic_status, "{\"status\":\"obstructed\"}");
+    publishStatus("{\"status\":\"obstructed\"}");
     
-    // Attempt to clear obstruction
+    // Attempt to clear obstruction, the result is checked once the sweep is done
     clearObstruction();
+    awaitingClearCheck = true;
     
     // Set flag to avoid continuous clearing attempts
     obstructionCleared = true;
+  } else if (!isObstructed) {
+    // Reset obstruction cleared flag if no obstruction is detected
+    obstructionCleared = false;
+  }
+  
+  return fb;
+}
+
+// Decide whether the frame just captured differs enough from the last
+// uploaded one to be worth sending
+bool frameChanged() {
+#if CHANGE_GATE
+  if (!lumaValid) {
+    return true;  // Cannot tell, send it
+  }
+  
+  FrameSignature signature;
+  computeSignature(lumaMap, jpegDecoder.blocksWide(), jpegDecoder.blocksHigh(), signature);
+  if (!changeGate.pass(signature, millis())) {
+    framesSuppressed++;
+    return false;
+  }
+#endif
+  return true;
+}
+
+#if CAPTURE_PIPELINE
+// Hand a captured frame to the uplink task, applying the backpressure policy
+void enqueueFrame(camera_fb_t* fb) {
+#if FRAME_QUEUE_DROP_OLDEST
+  while (xQueueSend(frameQueue, &fb, 0) != pdTRUE) {
+    // Queue is full: give the oldest frame back to the driver to make room
+    camera_fb_t* oldest;
+    if (xQueueReceive(frameQueue, &oldest, 0) == pdTRUE) {
+      esp_camera_fb_return(oldest);
+      framesDropped++;
+    }
+  }
+#else
+  xQueueSend(frameQueue, &fb, portMAX_DELAY);
+#endif
+}
+
+// Core 1: capture, obstruction detection and servo control
+void captureTask(void* parameter) {
+  for (;;) {
+    checkTemperature();
+    publishStageStats();
+    updateGovernor();
     
-    // Release the current frame
-    esp_camera_fb_return(fb);
+    // Control frame rate to prevent overheating
+    unsigned long elapsed = millis() - lastFrameTime;
+    if (elapsed < frameInterval) {
+      vTaskDelay(pdMS_TO_TICKS(frameInterval - elapsed));
+    }
+    lastFrameTime = millis();
     
-    // Capture a new frame after clearing
-    delay(1000);
-    fb = esp_camera_fb_get();
+    camera_fb_t* fb = captureFrame();
     if (!fb) {
-      Serial.println("Camera capture failed after clearing obstruction");
-      delay(1000);
-      return;
+      continue;
     }
+    framesCaptured++;
     
-    // Check if clearing worked
-    if (!detectObstruction(fb)) {
-      Serial.println("Obstruction cleared successfully!");
-      client.publish(mqtt_topic_status, "{\"status\":\"cleared\"}");
+    // Skip frames where nothing has changed
+    if (frameChanged()) {
+      enqueueFrame(fb);
     } else {
-      Serial.println("Failed to clear obstruction.");
-      client.publish(mqtt_topic_status, "{\"status\":\"failed_to_clear\"}");
+      esp_camera_fb_return(fb);
+    }
+  }
+}
+
+// Core 0: owns the MQTT client, publishes queued status messages and frames
+void uplinkTask(void* parameter) {
+  for (;;) {
+    if (!connection.poll()) {
+      vTaskDelay(pdMS_TO_TICKS(50));  // Frames keep queueing, the oldest are dropped
+      continue;
+    }
+    
+    StatusMessage status;
+    while (xQueueReceive(statusQueue, &status, 0) == pdTRUE) {
+      client.publish(mqtt_topic_status, status.text);
+    }
+    
+    camera_fb_t* fb;
+    if (xQueueReceive(frameQueue, &fb, pdMS_TO_TICKS(50)) == pdTRUE) {
+      publishFrame(fb);
+      esp_camera_fb_return(fb);
+      framesSent++;
     }
-  } else if (!isObstructed) {
-    // Reset obstruction cleared flag if no obstruction is detected
-    obstructionCleared = false;
   }
-  
-  // Convert the image to base64 and send via MQTT
-  sendImageViaMQTT(fb);
-  
-  // Return the frame buffer back to the camera
-  esp_camera_fb_return(fb);
 }
+#endif
 
-bool detectObstruction(camera_fb_t *fb) {
-  // Sample pixels from the JPEG to estimate overall brightness
-  int totalBrightness = 0;
-  int samplesCount = 0;
+// Build a 1/64-scale luminance map from the DC coefficients of the JPEG
+bool decodeLuminance(camera_fb_t *fb) {
+  unsigned long decodeStart = micros();
+  JpegDcResult result = jpegDecoder.decode(fb->buf, fb->len, lumaMap, sizeof(lumaMap));
+  lastLumaDecodeMicros = micros() - decodeStart;
+  stageStats[STAGE_DECODE].record(lastLumaDecodeMicros);
+  if (result != JPEG_DC_OK) {
+    decodeFailures++;
+    Serial.printf("Luminance decode failed (%d)\n", result);
+    return false;
+  }
+  if (lastLumaDecodeMicros > MIN_FRAME_INTERVAL * 1000UL) {
+    Serial.printf("WARNING: luminance decode took %lu us, over the frame interval\n", lastLumaDecodeMicros);
+  }
+  return true;
+}
+
+// Check the luminance map of the current frame for a covered lens
+bool detectObstruction(bool midSweep) {
+  // The wiper itself darkens the frame, so ignore frames taken during a sweep
+  if (midSweep || !lumaValid) {
+    return false;
+  }
   
-  // Sample every Nth byte to estimate brightness
-  for (size_t i = 0; i < fb->len; i += fb->len / FRAME_BRIGHTNESS_SAMPLES) {
-    totalBrightness += fb->buf[i];
-    samplesCount++;
+  // Per-region brightness and variance of the block values
+  int blocksWide = jpegDecoder.blocksWide();
+  int blocksHigh = jpegDecoder.blocksHigh();
+  int regionMean[OBSTRUCTION_REGIONS];
+  int regionVariance[OBSTRUCTION_REGIONS];
+  for (int ry = 0; ry < OBSTRUCTION_REGIONS_Y; ry++) {
+    for (int rx = 0; rx < OBSTRUCTION_REGIONS_X; rx++) {
+      int x0 = rx * blocksWide / OBSTRUCTION_REGIONS_X;
+      int x1 = (rx + 1) * blocksWide / OBSTRUCTION_REGIONS_X;
+      int y0 = ry * blocksHigh / OBSTRUCTION_REGIONS_Y;
+      int y1 = (ry + 1) * blocksHigh / OBSTRUCTION_REGIONS_Y;
+      uint32_t sum = 0;
+      uint32_t sumSquares = 0;
+      for (int y = y0; y < y1; y++) {
+        const uint8_t* row = lumaMap + y * blocksWide;
+        for (int x = x0; x < x1; x++) {
+          sum += row[x];
+          sumSquares += row[x] * row[x];
+        }
+      }
+      int count = max(1, (x1 - x0) * (y1 - y0));
+      int r = ry * OBSTRUCTION_REGIONS_X + rx;
+      regionMean[r] = sum / count;
+      regionVariance[r] = sumSquares / count - regionMean[r] * regionMean[r];
+    }
   }
   
-  int currentBrightness = totalBrightness / samplesCount;
+  // A region counts as covered when it is both flat and clearly darker
+  // than its own recent history
+  int coveredRegions = 0;
+  if (historyCount > 0) {
+    for (int r = 0; r < OBSTRUCTION_REGIONS; r++) {
+      int sumBrightness = 0;
+      for (int i = 0; i < historyCount; i++) {
+        sumBrightness += regionHistory[i][r];
+      }
+      int avgBrightness = sumBrightness / historyCount;
+      if (regionVariance[r] < OBSTRUCTION_FLAT_VARIANCE &&
+          regionMean[r] < avgBrightness - obstructionThreshold) {
+        coveredRegions++;
+      }
+    }
+  }
   
   // Add to brightness history
-  brightnessHistory[historyIndex] = currentBrightness;
+  memcpy(regionHistory[historyIndex], regionMean, sizeof(regionMean));
   historyIndex = (historyIndex + 1) % BRIGHTNESS_HISTORY_SIZE;
-  
-  // Calculate average brightness from history
-  int sumBrightness = 0;
-  for (int i = 0; i < BRIGHTNESS_HISTORY_SIZE; i++) {
-    sumBrightness += brightnessHistory[i];
+  if (historyCount < BRIGHTNESS_HISTORY_SIZE) {
+    historyCount++;
   }
-  int avgBrightness = sumBrightness / BRIGHTNESS_HISTORY_SIZE;
   
-  // If brightness suddenly drops significantly compared to history, 
-  // it might indicate an obstruction
-  bool obstructionDetected = false;
-  if (avgBrightness > 0 && currentBrightness < avgBrightness - OBSTRUCTION_THRESHOLD) {
-    obstructionDetected = true;
-  }
-  
-  return obstructionDetected;
+  return coveredRegions >= OBSTRUCTION_MIN_REGIONS;
 }
 
+// Request a wiper sweep. Safe to call from the MQTT callback; the sweep is
+// started and driven by tickWiper() so nothing blocks while it runs.
 void clearObstruction() {
-  // Move servo to clear obstruction
-  // The exact movement pattern will depend on your setup
-  
-  // First, move slowly to one side
-  for (int pos = 90; pos >= 0; pos -= 5) {
-    myservo.write(pos);
-    delay(50);
+  wipeRequested = true;
+}
+
+// Advance the wiper motion and update the servo when its angle changes
+void tickWiper() {
+  unsigned long now = millis();
+  if (sweepPending && !wiper.isRunning()) {
+    SWEEP_LOCK();
+    memcpy(wipeSweep, pendingSweep, pendingSweepCount * sizeof(SweepStep));
+    wipeSweepCount = pendingSweepCount;
+    sweepPending = false;
+    SWEEP_UNLOCK();
   }
-  delay(200);
-  
-  // Then move to the other side
-  for (int pos = 0; pos <= 180; pos += 5) {
-    myservo.write(pos);
-    delay(50);
+  if (wipeRequested && !wiper.isRunning()) {
+    wiper.start(wipeSweep, wipeSweepCount, now);
+    wipeRequested = false;
   }
-  delay(200);
   
-  // Return to center position
-  for (int pos = 180; pos >= 90; pos -= 5) {
-    myservo.write(pos);
-    delay(50);
+  int angle = wiper.update(now);
+  if (angle != servoAngle) {
+    myservo.write(angle);
+    servoAngle = angle;
   }
 }
 
@@ -335,134 +831,220 @@ float readTemperature() {
   #endif
 }
 
-void reconnectMQTT() {
-  // Loop until we're reconnected
-  int attempts = 0;
-  while (!client.connected() && attempts < 5) {
-    Serial.print("Attempting MQTT connection...");
-    // Create a random client ID
-    String clientId = "ESP32CAM-";
-    clientId += String(random(0xffff), HEX);
-    // Attempt to connect
-    if (client.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
-      Serial.println("connected");
-      
-      // Subscribe to control topics
-      client.subscribe("camera/control");
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(client.state());
-      Serial.println(" try again in 5 seconds");
-      delay(5000);
-      attempts++;
-    }
-  }
-}
-
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  // Handle incoming MQTT messages
-  String message;
-  for (int i = 0; i < length; i++) {
-    message += (char)payload[i];
+  if (strcmp(topic, mqtt_topic_control) != 0) {
+    return;
+  }
+  
+  // Binary commands start with a byte that is never printable
+  if (length > 0 && payload[0] == CONTROL_MAGIC) {
+    handleControlCommand(payload, length);
+    return;
   }
   
   Serial.print("Message arrived [");
   Serial.print(topic);
   Serial.print("] ");
-  Serial.println(message);
-  
-  // Example: Control servo movement remotely
-  if (String(topic) == "camera/control") {
-    if (message == "clear") {
-      clearObstruction();
-    } else if (message == "ir_on") {
-      digitalWrite(IR_BULB_PIN, HIGH);
-    } else if (message == "ir_off") {
-      digitalWrite(IR_BULB_PIN, LOW);
+  Serial.write(payload, length);
+  Serial.println();
+  
+  // Plain text commands, kept for existing senders
+  if (length == 5 && memcmp(payload, "clear", 5) == 0) {
+    clearObstruction();
+  } else if (length == 5 && memcmp(payload, "ir_on", 5) == 0) {
+    digitalWrite(IR_BULB_PIN, HIGH);
+  } else if (length == 6 && memcmp(payload, "ir_off", 6) == 0) {
+    digitalWrite(IR_BULB_PIN, LOW);
+  }
+}
+
+// Check the settings in a parsed command against what this camera can do
+ControlResult validateControlCommand(const ControlCommand& command, uint8_t& frameSizeIndex) {
+  if (command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE)) {
+    // Only sizes on the ladder that fit the allocated frame buffers
+    frameSizeIndex = FRAME_SIZE_COUNT;
+    for (uint8_t i = frameSizeLimit; i < FRAME_SIZE_COUNT; i++) {
+      if (FRAME_SIZE_LADDER[i] == command.frameSize) {
+        frameSizeIndex = i;
+      }
+    }
+    if (frameSizeIndex == FRAME_SIZE_COUNT) {
+      return CONTROL_REJECTED;
     }
   }
+  if ((command.fields & CONTROL_FIELD(CONTROL_TAG_QUALITY)) &&
+      (command.quality < JPEG_QUALITY_FINEST || command.quality > JPEG_QUALITY_WORST)) {
+    return CONTROL_REJECTED;
+  }
+  if ((command.fields & CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL)) &&
+      (command.frameInterval < FASTEST_FRAME_INTERVAL || command.frameInterval > MAX_FRAME_INTERVAL)) {
+    return CONTROL_REJECTED;
+  }
+  return CONTROL_OK;
 }
 
-void sendImageViaMQTT(camera_fb_t *fb) {
-  // Convert image to base64
-  String base64Image = base64Encode(fb->buf, fb->len);
+// Parse and apply a binary control command, then ack it on camera/status.
+// Settings are only applied once every argument has been checked.
+void handleControlCommand(const uint8_t* payload, unsigned int length) {
+  ControlCommand command;
+  ControlResult result = parseControlCommand(payload, length, command);
+  uint8_t frameSizeIndex = 0;
+  if (result == CONTROL_OK) {
+    result = validateControlCommand(command, frameSizeIndex);
+  }
   
-  // Check if conversion was successful
-  if (base64Image.length() > 0) {
-    // Split the image into chunks if it's too large for MQTT
-    int chunkSize = 10000; // Adjust based on MQTT broker's message size limit
-    int numChunks = (base64Image.length() + chunkSize - 1) / chunkSize;
-    
-    // Send a start message with metadata
-    String metadata = "{\"type\":\"image\",\"chunks\":" + String(numChunks) + ",\"size\":" + String(base64Image.length()) + "}";
-    client.publish(mqtt_topic_status, metadata.c_str());
-    
-    // Send each chunk
-    for (int i = 0; i < numChunks; i++) {
-      int startIndex = i * chunkSize;
-      int endIndex = min((i + 1) * chunkSize, (int)base64Image.length());
-      String chunk = base64Image.substring(startIndex, endIndex);
-      
-      String chunkTopic = String(mqtt_topic_image) + "/chunk/" + String(i);
-      boolean success = client.publish(chunkTopic.c_str(), chunk.c_str());
-      
-      if (!success) {
-        Serial.println("Failed to publish chunk " + String(i));
+  if (result == CONTROL_OK && command.opcode == CONTROL_OP_WIPE) {
+    clearObstruction();
+  } else if (result == CONTROL_OK && command.opcode == CONTROL_OP_SET) {
+    uint32_t fields = command.fields;
+    if (fields & (CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE) | CONTROL_FIELD(CONTROL_TAG_QUALITY) |
+                  CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL))) {
+      // These set the limits the governor works within, it still backs
+      // off from them for temperature and bandwidth
+      GOVERNOR_LOCK();
+      if (fields & CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE)) {
+        governorConfig.largestFrameSize = frameSizeIndex;
+      }
+      if (fields & CONTROL_FIELD(CONTROL_TAG_QUALITY)) {
+        governorConfig.bestQuality = command.quality;
       }
-      
-      // Small delay between chunks to avoid overwhelming the broker
-      delay(50);
+      if (fields & CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL)) {
+        governorConfig.minFrameInterval = command.frameInterval;
+      }
+      governor.reconfigure(governorConfig);
+      GOVERNOR_UNLOCK();
+      governorReconfigured = true;
+    }
+    if (fields & CONTROL_FIELD(CONTROL_TAG_OBSTRUCTION_THRESHOLD)) {
+      obstructionThreshold = command.obstructionThreshold;
+    }
+    if (fields & CONTROL_FIELD(CONTROL_TAG_SWEEP)) {
+      SWEEP_LOCK();
+      memcpy(pendingSweep, command.sweep, command.sweepCount * sizeof(SweepStep));
+      pendingSweepCount = command.sweepCount;
+      sweepPending = true;
+      SWEEP_UNLOCK();
+    }
+    if (fields & CONTROL_FIELD(CONTROL_TAG_IR)) {
+      digitalWrite(IR_BULB_PIN, command.irOn ? HIGH : LOW);
     }
-    
-    Serial.println("Image sent successfully in " + String(numChunks) + " chunks");
-  } else {
-    Serial.println("Failed to encode image to base64");
+  }
+  
+  char ack[128];
+  snprintf(ack, sizeof(ack), "{\"status\":\"ack\",\"seq\":%u,\"op\":\"%s\",\"result\":\"%s\"}",
+           (unsigned)command.sequence, controlOpcodeName(command.opcode), controlResultName(result));
+  publishStatus(ack);
+  if (result != CONTROL_OK) {
+    Serial.printf("Control command %u rejected: %s\n", (unsigned)command.sequence, controlResultName(result));
   }
 }
 
-String base64Encode(uint8_t* data, size_t length) {
-  // Standard Base64 encoding implementation
-  const char* base64_chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  String result;
-  result.reserve(4 * ((length + 2) / 3)); // Reserve approximate space
-  
-  int i = 0;
-  unsigned char char_array_3[3];
-  unsigned char char_array_4[4];
-  
-  while (length--) {
-    char_array_3[i++] = *(data++);
-    if (i == 3) {
-      char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-      char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-      char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-      char_array_4[3] = char_array_3[2] & 0x3f;
-      
-      for(i = 0; i < 4; i++) {
-        result += base64_chars[char_array_4[i]];
-      }
-      i = 0;
+// Encode length bytes from data as base64 into out (4 chars per 3 bytes, '=' padded).
+// out must hold 4 * ((length + 2) / 3) characters. Returns the number written.
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out) {
+  static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t o = 0;
+  size_t i = 0;
+  
+  for (; i + 2 < length; i += 3) {
+    uint32_t triple = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+    out[o++] = base64_chars[(triple >> 18) & 0x3F];
+    out[o++] = base64_chars[(triple >> 12) & 0x3F];
+    out[o++] = base64_chars[(triple >> 6) & 0x3F];
+    out[o++] = base64_chars[triple & 0x3F];
+  }
+  
+  // Pad the trailing 1 or 2 bytes
+  if (i < length) {
+    uint32_t triple = (uint32_t)data[i] << 16;
+    if (i + 1 < length) {
+      triple |= (uint32_t)data[i + 1] << 8;
     }
+    out[o++] = base64_chars[(triple >> 18) & 0x3F];
+    out[o++] = base64_chars[(triple >> 12) & 0x3F];
+    out[o++] = (i + 1 < length) ? base64_chars[(triple >> 6) & 0x3F] : '=';
+    out[o++] = '=';
   }
   
-  if (i) {
-    for(int j = i; j < 3; j++) {
-      char_array_3[j] = '\0';
+  return o;
+}
+
+// Publish one slice of the frame as a single MQTT message, streaming it
+// straight from the frame buffer instead of building a String first
+bool publishImageSlice(const char* topic, const uint8_t* data, size_t length) {
+  if (imageEncoding == IMAGE_ENCODING_RAW) {
+    if (!client.beginPublish(topic, length, false)) {
+      return false;
     }
-    
-    char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-    char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-    char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-    char_array_4[3] = char_array_3[2] & 0x3f;
-    
-    for (int j = 0; j < i + 1; j++) {
-      result += base64_chars[char_array_4[j]];
+    size_t written = client.write(data, length);
+    return client.endPublish() && written == length;
+  }
+  
+  // Base64 is encoded block by block into one small reusable buffer
+  static char encodeBuffer[4 * (BASE64_BLOCK_INPUT / 3)];
+  size_t encodedLength = 4 * ((length + 2) / 3);
+  if (!client.beginPublish(topic, encodedLength, false)) {
+    return false;
+  }
+  
+  size_t written = 0;
+  for (size_t offset = 0; offset < length; offset += BASE64_BLOCK_INPUT) {
+    size_t blockLength = min((size_t)BASE64_BLOCK_INPUT, length - offset);
+    unsigned long encodeStart = micros();
+    size_t blockEncoded = base64EncodeBlock(data + offset, blockLength, encodeBuffer);
+    frameBase64Micros += micros() - encodeStart;
+    size_t blockWritten = client.write((const uint8_t*)encodeBuffer, blockEncoded);
+    written += blockWritten;
+    if (blockWritten != blockEncoded) {
+      break;  // Connection dropped mid-message
     }
+  }
+  
+  return client.endPublish() && written == encodedLength;
+}
+
+// Payload bytes a frame of length bytes takes in the current encoding
+size_t encodedImageSize(size_t length) {
+  return imageEncoding == IMAGE_ENCODING_BASE64 ? 4 * ((length + 2) / 3) : length;
+}
+
+// Returns the number of payload bytes the broker connection accepted
+size_t sendImageViaMQTT(camera_fb_t *fb) {
+  // In base64 mode every slice covers whole 3-byte groups, so the chunks
+  // concatenate into one valid base64 string on the receiving side
+  bool base64 = (imageEncoding == IMAGE_ENCODING_BASE64);
+  size_t sliceSize = base64 ? (IMAGE_CHUNK_SIZE / 4) * 3 : IMAGE_CHUNK_SIZE;
+  size_t numChunks = (fb->len + sliceSize - 1) / sliceSize;
+  size_t encodedSize = encodedImageSize(fb->len);
+  
+  // Send a start message with metadata
+  char metadata[128];
+  snprintf(metadata, sizeof(metadata), "{\"type\":\"image\",\"encoding\":\"%s\",\"chunks\":%u,\"size\":%u}",
+           base64 ? "base64" : "raw", (unsigned)numChunks, (unsigned)encodedSize);
+  client.publish(mqtt_topic_status, metadata);
+  
+  // Send each chunk directly from the frame buffer
+  frameBase64Micros = 0;
+  char chunkTopic[48];
+  for (size_t i = 0; i < numChunks; i++) {
+    size_t offset = i * sliceSize;
+    size_t sliceLength = min(sliceSize, fb->len - offset);
+    snprintf(chunkTopic, sizeof(chunkTopic), "%s/chunk/%u", mqtt_topic_image, (unsigned)i);
     
-    while((i++ < 3)) {
-      result += '=';
+    unsigned long chunkStart = micros();
+    bool sent = publishImageSlice(chunkTopic, fb->buf + offset, sliceLength);
+    stageStats[STAGE_CHUNK].record(micros() - chunkStart);
+    if (!sent) {
+      chunkFailures++;
+      Serial.printf("Failed to publish chunk %u\n", (unsigned)i);
+      return base64 ? offset / 3 * 4 : offset;
     }
+    chunksPublished++;
   }
   
-  return result;
+  if (base64) {
+    stageStats[STAGE_BASE64].record(frameBase64Micros);
+  }
+  Serial.printf("Image sent successfully in %u chunks\n", (unsigned)numChunks);
+  return encodedSize;
 }
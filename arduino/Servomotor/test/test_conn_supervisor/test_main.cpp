@@ -0,0 +1,237 @@
+/*
+  ConnSupervisor through WiFi and broker outages
+
+  Polls the supervisor every 10 ms of the harness's virtual clock over
+  the ArduinoHost WiFi, client and PubSubClient stand-ins, and records
+  each state it passes through. A broker outage stops the broker, keeps
+  it down for five minutes, then restarts it answering CONNECT with
+  "server unavailable" for a few seconds before it accepts clients.
+  Every backoff is checked against the jittered exponential schedule,
+  and the time to reconnect after the restart is reported.
+
+    pio test -e native -f test_conn_supervisor
+*/
+
+#include <ConnSupervisor.h>
+#include <HostHarness.h>
+#include <WiFiClientSecure.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define POLL_PERIOD_MS 10
+#define OUTAGE_MS 300000
+#define RESTART_REFUSING_MS 3000
+
+struct Transition {
+  unsigned long at;
+  ConnState to;
+};
+
+static std::vector<Transition> transitions;
+static ConnState lastState;
+static int connectedCalls;
+
+static void countConnected() {
+  connectedCalls++;
+}
+
+static void pollFor(ConnSupervisor& supervisor, unsigned long ms) {
+  unsigned long end = millis() + ms;
+  while ((long)(millis() - end) < 0) {
+    supervisor.poll();
+    if (supervisor.currentState() != lastState) {
+      lastState = supervisor.currentState();
+      transitions.push_back({millis(), lastState});
+    }
+    hostAdvanceMicros(POLL_PERIOD_MS * 1000);
+  }
+}
+
+// Poll until the session is up, returning the time it took
+static unsigned long pollUntilReady(ConnSupervisor& supervisor, unsigned long limitMs) {
+  unsigned long start = millis();
+  while (!supervisor.connected() && millis() - start < limitMs) {
+    pollFor(supervisor, POLL_PERIOD_MS);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(supervisor.connected(), connStateName(supervisor.currentState()));
+  return millis() - start;
+}
+
+static uint32_t backoffBase(int failure) {
+  uint32_t backoff = CONN_BACKOFF_MIN_MS;
+  for (int i = 1; i < failure && backoff < CONN_BACKOFF_MAX_MS; i++) {
+    backoff *= 2;
+  }
+  return backoff < CONN_BACKOFF_MAX_MS ? backoff : CONN_BACKOFF_MAX_MS;
+}
+
+// Check each backoff recorded from transition first on against the
+// schedule, counting failures from 1. Returns the number checked.
+static int checkBackoffs(size_t first, ConnState retryState) {
+  int failure = 0;
+  for (size_t i = first; i + 1 < transitions.size(); i++) {
+    if (transitions[i].to != CONN_BACKOFF) {
+      continue;
+    }
+    failure++;
+    unsigned long waited = transitions[i + 1].at - transitions[i].at;
+    uint32_t base = backoffBase(failure);
+    char message[96];
+    snprintf(message, sizeof(message), "failure %d waited %lu ms, schedule %u ms", failure, waited, (unsigned)base);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(retryState, transitions[i + 1].to, message);
+    TEST_ASSERT_TRUE_MESSAGE(waited >= base / 2, message);
+    TEST_ASSERT_TRUE_MESSAGE(waited <= base + POLL_PERIOD_MS, message);
+  }
+  return failure;
+}
+
+void setUp() {
+  hostSetWifiUp(true);
+  hostSetBrokerUp(true);
+  hostSetBrokerRefusal(0);
+  hostAdvanceMicros(3600000000ull);
+  transitions.clear();
+  lastState = CONN_WIFI_DOWN;
+  connectedCalls = 0;
+  randomSeed(millis());
+}
+
+void tearDown() {}
+
+static void test_connects_step_by_step() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  ConnSupervisor supervisor(net, mqtt);
+  supervisor.begin("ssid", "pass", "broker", 8883, "test-", "user", "pass");
+  supervisor.onConnected(countConnected);
+
+  static const ConnState expected[] = {CONN_WIFI_JOINING, CONN_TLS, CONN_MQTT, CONN_SUBSCRIBE, CONN_READY};
+  for (ConnState state : expected) {
+    TEST_ASSERT_EQUAL_INT(state == CONN_READY, supervisor.poll());
+    TEST_ASSERT_EQUAL_STRING(connStateName(state), connStateName(supervisor.currentState()));
+  }
+  TEST_ASSERT_EQUAL_INT(1, connectedCalls);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.stats().sessions);
+  TEST_ASSERT_EQUAL_UINT32(0, supervisor.stats().drops);
+}
+
+static void test_broker_outage_and_restart() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  ConnSupervisor supervisor(net, mqtt);
+  supervisor.begin("ssid", "pass", "broker", 8883, "test-", "user", "pass");
+  supervisor.onConnected(countConnected);
+  pollUntilReady(supervisor, 1000);
+  pollFor(supervisor, 5000);
+
+  // Broker stopped: every retry fails at the socket, WiFi is left alone
+  hostSetBrokerUp(false);
+  size_t outageStart = transitions.size();
+  pollFor(supervisor, OUTAGE_MS);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.stats().drops);
+  TEST_ASSERT_EQUAL_INT(CONN_TLS, transitions[outageStart].to);
+  for (size_t i = outageStart; i < transitions.size(); i++) {
+    TEST_ASSERT_TRUE(transitions[i].to == CONN_TLS || transitions[i].to == CONN_BACKOFF);
+  }
+  int failures = checkBackoffs(outageStart, CONN_TLS);
+  TEST_ASSERT_UINT32_WITHIN(1, failures, supervisor.stats().tlsFailures);
+  // 1, 2, 4, 8, 16 and 32 s, then 60 s at a time: no more than the cap allows
+  TEST_ASSERT_GREATER_OR_EQUAL(8, failures);
+  TEST_ASSERT_LESS_OR_EQUAL(6 + (OUTAGE_MS - 31500) / (CONN_BACKOFF_MAX_MS / 2) + 1, failures);
+
+  // Restarted, and still refusing clients while it comes up
+  hostSetBrokerUp(true);
+  hostSetBrokerRefusal(MQTT_CONNECT_UNAVAILABLE);
+  pollFor(supervisor, RESTART_REFUSING_MS);
+  hostSetBrokerRefusal(0);
+  unsigned long reconnect = RESTART_REFUSING_MS + pollUntilReady(supervisor, CONN_BACKOFF_MAX_MS + 1000);
+  checkBackoffs(outageStart, CONN_TLS);
+
+  char message[128];
+  snprintf(message, sizeof(message), "Reconnected %lu ms after the broker restarted, %lu ms after the drop, %u retries",
+           reconnect, (unsigned long)supervisor.stats().lastConnectMs,
+           (unsigned)(supervisor.stats().tlsFailures + supervisor.stats().mqttFailures[MQTT_CONNECT_UNAVAILABLE + 4]));
+  TEST_MESSAGE(message);
+  // At worst a full backoff, then the TLS, MQTT and subscribe steps
+  TEST_ASSERT_LESS_OR_EQUAL(CONN_BACKOFF_MAX_MS + RESTART_REFUSING_MS + 4 * POLL_PERIOD_MS, reconnect);
+  TEST_ASSERT_EQUAL_UINT32(2, supervisor.stats().sessions);
+  TEST_ASSERT_EQUAL_INT(2, connectedCalls);
+  TEST_ASSERT_UINT32_WITHIN(2 * POLL_PERIOD_MS, OUTAGE_MS + reconnect, supervisor.stats().lastConnectMs);
+  TEST_ASSERT_EQUAL_UINT32(supervisor.stats().lastConnectMs, supervisor.stats().longestConnectMs);
+
+  char json[256];
+  supervisor.statsJson(json, sizeof(json));
+  TEST_ASSERT_NOT_NULL(strstr(json, "\"state\":\"ready\",\"sessions\":2,\"drops\":1"));
+
+  // A success resets the schedule: the next outage starts again at 1 s
+  hostSetBrokerUp(false);
+  size_t secondOutage = transitions.size();
+  pollFor(supervisor, 10000);
+  TEST_ASSERT_GREATER_OR_EQUAL(3, checkBackoffs(secondOutage, CONN_TLS));
+}
+
+static void test_refusals_counted_by_code() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  ConnSupervisor supervisor(net, mqtt);
+  supervisor.begin("ssid", "pass", "broker", 8883, "test-", "user", "pass");
+  hostSetBrokerRefusal(MQTT_CONNECT_BAD_CREDENTIALS);
+  pollFor(supervisor, 20000);
+  const ConnStats& stats = supervisor.stats();
+  TEST_ASSERT_GREATER_OR_EQUAL(4, stats.mqttFailures[MQTT_CONNECT_BAD_CREDENTIALS + 4]);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.tlsFailures);
+  if (supervisor.currentState() == CONN_BACKOFF) {
+    TEST_ASSERT_FALSE(net.connected());  // The socket is closed after each refusal
+  }
+  checkBackoffs(0, CONN_TLS);
+
+  char json[256];
+  supervisor.statsJson(json, sizeof(json));
+  char expected[32];
+  snprintf(expected, sizeof(expected), "\"mqtt_fail\":{\"4\":%u}}",
+           (unsigned)stats.mqttFailures[MQTT_CONNECT_BAD_CREDENTIALS + 4]);
+  TEST_ASSERT_NOT_NULL(strstr(json, expected));
+}
+
+static void test_wifi_outage() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  ConnSupervisor supervisor(net, mqtt);
+  supervisor.begin("ssid", "pass", "broker", 8883, "test-", "user", "pass");
+  pollUntilReady(supervisor, 1000);
+
+  hostSetWifiUp(false);
+  size_t outageStart = transitions.size();
+  pollFor(supervisor, 120000);
+  // Dropped to CONN_WIFI_DOWN and started a join in the same poll
+  TEST_ASSERT_EQUAL_INT(CONN_WIFI_JOINING, transitions[outageStart].to);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.stats().drops);
+  // Each join gets its full timeout before the backoff
+  for (size_t i = outageStart; i + 1 < transitions.size(); i++) {
+    if (transitions[i].to == CONN_WIFI_JOINING) {
+      TEST_ASSERT_EQUAL_INT(CONN_BACKOFF, transitions[i + 1].to);
+      TEST_ASSERT_UINT32_WITHIN(POLL_PERIOD_MS, CONN_WIFI_JOIN_TIMEOUT_MS + POLL_PERIOD_MS,
+                                transitions[i + 1].at - transitions[i].at);
+    }
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(4, supervisor.stats().wifiFailures);
+
+  hostSetWifiUp(true);
+  pollUntilReady(supervisor, CONN_BACKOFF_MAX_MS + CONN_WIFI_JOIN_TIMEOUT_MS);
+  TEST_ASSERT_EQUAL_UINT32(2, supervisor.stats().sessions);
+  TEST_ASSERT_EQUAL_UINT32(0, supervisor.stats().tlsFailures);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_connects_step_by_step);
+  RUN_TEST(test_broker_outage_and_restart);
+  RUN_TEST(test_refusals_counted_by_code);
+  RUN_TEST(test_wifi_outage);
+  return UNITY_END();
+}
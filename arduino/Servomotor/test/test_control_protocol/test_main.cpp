@@ -0,0 +1,200 @@
+/*
+  parseControlCommand() on well formed, truncated and out of range input
+
+  Byte-level cases for each opcode and tag. Random input is left to the
+  fuzz target in ../../fuzz/.
+
+    pio test -e native -f test_control_protocol
+*/
+
+#include <ControlProtocol.h>
+#include <unity.h>
+
+#include <string.h>
+#include <initializer_list>
+#include <vector>
+
+static ControlCommand command;
+
+// Parse from a buffer of exactly the payload's size, so the address
+// sanitizer catches a read past it
+static ControlResult parse(const std::vector<uint8_t>& data) {
+  uint8_t* exact = new uint8_t[data.size() ? data.size() : 1];
+  if (!data.empty()) {
+    memcpy(exact, data.data(), data.size());
+  }
+  ControlResult result = parseControlCommand(exact, data.size(), command);
+  delete[] exact;
+  return result;
+}
+
+static ControlResult parse(std::initializer_list<uint8_t> bytes) {
+  return parse(std::vector<uint8_t>(bytes));
+}
+
+// A SET command with one argument
+static ControlResult parseSet(uint8_t tag, std::initializer_list<uint8_t> value) {
+  std::vector<uint8_t> data = {CONTROL_MAGIC, CONTROL_OP_SET, 0x34, 0x12, tag, (uint8_t)value.size()};
+  data.insert(data.end(), value.begin(), value.end());
+  return parse(data);
+}
+
+void setUp() {
+  memset(&command, 0xAA, sizeof(command));
+}
+
+void tearDown() {}
+
+static void test_ping_and_wipe() {
+  TEST_ASSERT_EQUAL(CONTROL_OK, parse({CONTROL_MAGIC, CONTROL_OP_PING, 0x01, 0x02}));
+  TEST_ASSERT_EQUAL(CONTROL_OP_PING, command.opcode);
+  TEST_ASSERT_EQUAL_UINT16(0x0201, command.sequence);
+  TEST_ASSERT_EQUAL_UINT32(0, command.fields);
+
+  TEST_ASSERT_EQUAL(CONTROL_OK, parse({CONTROL_MAGIC, CONTROL_OP_WIPE, 0xFF, 0xFF}));
+  TEST_ASSERT_EQUAL(CONTROL_OP_WIPE, command.opcode);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, command.sequence);
+
+  TEST_ASSERT_EQUAL(CONTROL_UNEXPECTED_ARGUMENT, parse({CONTROL_MAGIC, CONTROL_OP_PING, 7, 0, 0x02, 1, 10}));
+  TEST_ASSERT_EQUAL_UINT16(7, command.sequence);
+  TEST_ASSERT_EQUAL(CONTROL_UNEXPECTED_ARGUMENT, parse({CONTROL_MAGIC, CONTROL_OP_WIPE, 7, 0, 0}));
+}
+
+static void test_set_every_field() {
+  TEST_ASSERT_EQUAL(CONTROL_OK, parse({CONTROL_MAGIC, CONTROL_OP_SET, 0x10, 0x00,
+                                       CONTROL_TAG_FRAME_SIZE, 1, 8,
+                                       CONTROL_TAG_QUALITY, 1, 12,
+                                       CONTROL_TAG_FRAME_INTERVAL, 2, 0xF4, 0x01,
+                                       CONTROL_TAG_OBSTRUCTION_THRESHOLD, 1, 40,
+                                       CONTROL_TAG_SWEEP, 10, 0, 100, 0, 200, 0, 180, 0x2C, 0x01, 0, 0,
+                                       CONTROL_TAG_IR, 1, 1}));
+  TEST_ASSERT_EQUAL(CONTROL_OP_SET, command.opcode);
+  TEST_ASSERT_EQUAL_UINT16(16, command.sequence);
+  TEST_ASSERT_EQUAL_UINT32(CONTROL_FIELD(CONTROL_TAG_FRAME_SIZE) | CONTROL_FIELD(CONTROL_TAG_QUALITY) |
+                           CONTROL_FIELD(CONTROL_TAG_FRAME_INTERVAL) |
+                           CONTROL_FIELD(CONTROL_TAG_OBSTRUCTION_THRESHOLD) | CONTROL_FIELD(CONTROL_TAG_SWEEP) |
+                           CONTROL_FIELD(CONTROL_TAG_IR), command.fields);
+  TEST_ASSERT_EQUAL_UINT8(8, command.frameSize);
+  TEST_ASSERT_EQUAL_UINT8(12, command.quality);
+  TEST_ASSERT_EQUAL_UINT16(500, command.frameInterval);
+  TEST_ASSERT_EQUAL_UINT8(40, command.obstructionThreshold);
+  TEST_ASSERT_TRUE(command.irOn);
+  TEST_ASSERT_EQUAL_UINT8(2, command.sweepCount);
+  TEST_ASSERT_EQUAL_INT(0, command.sweep[0].angle);
+  TEST_ASSERT_EQUAL_UINT16(100, command.sweep[0].speed);
+  TEST_ASSERT_EQUAL_UINT16(200, command.sweep[0].dwellMs);
+  TEST_ASSERT_EQUAL_INT(180, command.sweep[1].angle);
+  TEST_ASSERT_EQUAL_UINT16(300, command.sweep[1].speed);
+  TEST_ASSERT_EQUAL_UINT16(0, command.sweep[1].dwellMs);
+
+  // A SET without arguments changes nothing and is still acked
+  TEST_ASSERT_EQUAL(CONTROL_OK, parse({CONTROL_MAGIC, CONTROL_OP_SET, 1, 0}));
+  TEST_ASSERT_EQUAL_UINT32(0, command.fields);
+}
+
+static void test_header_errors() {
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({}));
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({CONTROL_MAGIC}));
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({CONTROL_MAGIC, CONTROL_OP_PING, 5}));
+  TEST_ASSERT_EQUAL_UINT16(0, command.sequence);
+  TEST_ASSERT_EQUAL(CONTROL_BAD_MAGIC, parse({'c', 'l', 'e', 'a', 'r'}));
+
+  // The sequence is read even when the opcode is not known, for the ack
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_OPCODE, parse({CONTROL_MAGIC, 0x00, 9, 0}));
+  TEST_ASSERT_EQUAL_UINT16(9, command.sequence);
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_OPCODE, parse({CONTROL_MAGIC, 0x04, 9, 0}));
+  TEST_ASSERT_EQUAL_UINT8(0x04, command.opcode);
+}
+
+static void test_argument_framing() {
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_QUALITY}));
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_QUALITY, 1}));
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED,
+                    parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_FRAME_INTERVAL, 2, 0xF4}));
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED, parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_IR, 255, 1}));
+  // The second argument is cut off after a good first one
+  TEST_ASSERT_EQUAL(CONTROL_TRUNCATED,
+                    parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_IR, 1, 1, CONTROL_TAG_QUALITY}));
+
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_TAG, parseSet(0x00, {1}));
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_TAG, parseSet(0x07, {1}));
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_TAG, parseSet(0x20, {1}));
+  TEST_ASSERT_EQUAL(CONTROL_UNKNOWN_TAG, parseSet(0xFF, {1}));
+
+  TEST_ASSERT_EQUAL(CONTROL_DUPLICATE_TAG,
+                    parse({CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_IR, 1, 1, CONTROL_TAG_IR, 1, 0}));
+}
+
+static void test_argument_lengths() {
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_FRAME_SIZE, {}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_QUALITY, {12, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_FRAME_INTERVAL, {200}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_FRAME_INTERVAL, {200, 0, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_OBSTRUCTION_THRESHOLD, {}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_IR, {1, 1}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_SWEEP, {}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_SWEEP, {90, 100, 0, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_BAD_LENGTH, parseSet(CONTROL_TAG_SWEEP, {90, 100, 0, 0, 0, 90}));
+
+  // Eight steps fit the command, nine do not
+  std::vector<uint8_t> data = {CONTROL_MAGIC, CONTROL_OP_SET, 0, 0, CONTROL_TAG_SWEEP, 0};
+  for (int i = 0; i < CONTROL_MAX_SWEEP_STEPS + 1; i++) {
+    static const uint8_t step[CONTROL_SWEEP_STEP_SIZE] = {45, 90, 0, 50, 0};
+    data.insert(data.end(), step, step + CONTROL_SWEEP_STEP_SIZE);
+    data[5] = (uint8_t)(data.size() - 6);
+    ControlResult expected = i < CONTROL_MAX_SWEEP_STEPS ? CONTROL_OK : CONTROL_BAD_LENGTH;
+    TEST_ASSERT_EQUAL(expected, parse(data));
+    if (expected == CONTROL_OK) {
+      TEST_ASSERT_EQUAL_UINT8(i + 1, command.sweepCount);
+      TEST_ASSERT_EQUAL_INT(45, command.sweep[i].angle);
+    }
+  }
+}
+
+static void test_argument_ranges() {
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_FRAME_SIZE, {31}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_FRAME_SIZE, {32}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_QUALITY, {0}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_QUALITY, {63}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_QUALITY, {64}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_OBSTRUCTION_THRESHOLD, {0}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_OBSTRUCTION_THRESHOLD, {255}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_IR, {0}));
+  TEST_ASSERT_FALSE(command.irOn);
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_IR, {2}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_SWEEP, {180, 0, 0, 0xFF, 0xFF}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_SWEEP, {90, 100, 0, 0, 0, 181, 100, 0, 0, 0}));
+}
+
+static void test_frame_interval_floor() {
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_FRAME_INTERVAL, {0, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_FRAME_INTERVAL, {1, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_OUT_OF_RANGE, parseSet(CONTROL_TAG_FRAME_INTERVAL, {9, 0}));
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_FRAME_INTERVAL, {10, 0}));
+  TEST_ASSERT_EQUAL_UINT16(10, command.frameInterval);
+  TEST_ASSERT_EQUAL(CONTROL_OK, parseSet(CONTROL_TAG_FRAME_INTERVAL, {0xFF, 0xFF}));
+  TEST_ASSERT_EQUAL_UINT16(65535, command.frameInterval);
+}
+
+static void test_names() {
+  for (int result = CONTROL_OK; result <= CONTROL_REJECTED; result++) {
+    TEST_ASSERT_TRUE(strcmp(controlResultName((ControlResult)result), "unknown") != 0);
+  }
+  TEST_ASSERT_EQUAL_STRING("set", controlOpcodeName(CONTROL_OP_SET));
+  TEST_ASSERT_EQUAL_STRING("unknown", controlOpcodeName(0x7F));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_ping_and_wipe);
+  RUN_TEST(test_set_every_field);
+  RUN_TEST(test_header_errors);
+  RUN_TEST(test_argument_framing);
+  RUN_TEST(test_argument_lengths);
+  RUN_TEST(test_argument_ranges);
+  RUN_TEST(test_frame_interval_floor);
+  RUN_TEST(test_names);
+  return UNITY_END();
+}
@@ -0,0 +1,173 @@
+/*
+  ChangeGate on sequences of JPEG frames, as frameChanged() runs it
+
+  Each fixture directory holds 20 QQVGA frames, 00.jpg to 19.jpg, saved
+  at quality 50 with 4:2:0 chroma. All have sensor noise of about 3
+  levels on a fixed scene:
+
+    static    Auto-exposure drifting by up to 4%, nothing moves
+    lights    The whole scene 25 levels brighter from frame 10
+    intruder  A dark figure walks in from the left edge at frame 8
+
+  The frames go through JpegDc, computeSignature() and a ChangeGate set
+  up as in src/main.cpp, 200 ms apart. Reports the share of frames
+  suppressed and how many frames after the figure came in one passed.
+
+    pio test -e native -f test_frame_change
+*/
+
+#include <FrameSignature.h>
+#include <JpegDc.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// As in src/main.cpp
+#define CHANGE_CELL_THRESHOLD 12
+#define CHANGE_MIN_CELLS 3
+#define KEYFRAME_INTERVAL 300000
+
+#define FRAME_PERIOD_MS 200
+#define MAX_LATENCY_FRAMES 1
+
+struct Sequence {
+  const char* name;
+  int eventFrame;               // First frame that should pass after the first, -1 for none
+};
+
+static const Sequence sequences[] = {
+  {"static", -1},
+  {"lights", -1},
+  {"intruder", 8},
+};
+
+static JpegDcDecoder decoder;
+static uint8_t map[1024];
+
+static std::string fixturePath(const char* sequence, int frame) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  char name[16];
+  snprintf(name, sizeof(name), "/%02d.jpg", frame);
+  return path + "fixtures/" + sequence + name;
+}
+
+// Signatures of the frames of a sequence, in order
+static std::vector<FrameSignature> loadSignatures(const char* sequence) {
+  std::vector<FrameSignature> signatures;
+  for (int frame = 0;; frame++) {
+    FILE* f = fopen(fixturePath(sequence, frame).c_str(), "rb");
+    if (!f) {
+      break;
+    }
+    std::vector<uint8_t> data;
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+    TEST_ASSERT_EQUAL(JPEG_DC_OK, decoder.decode(data.data(), data.size(), map, sizeof(map)));
+    FrameSignature signature;
+    computeSignature(map, decoder.blocksWide(), decoder.blocksHigh(), signature);
+    signatures.push_back(signature);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(signatures.size() >= 2, sequence);
+  return signatures;
+}
+
+// Run the frames through a fresh gate, returning which passed
+static std::vector<bool> runGate(const std::vector<FrameSignature>& signatures, unsigned long periodMs) {
+  ChangeGate gate(CHANGE_CELL_THRESHOLD, CHANGE_MIN_CELLS, KEYFRAME_INTERVAL);
+  std::vector<bool> passed;
+  unsigned long now = 1000;
+  for (const FrameSignature& signature : signatures) {
+    passed.push_back(gate.pass(signature, now));
+    now += periodMs;
+  }
+  return passed;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_sequences() {
+  for (const Sequence& sequence : sequences) {
+    std::vector<bool> passed = runGate(loadSignatures(sequence.name), FRAME_PERIOD_MS);
+    int frames = (int)passed.size();
+    TEST_ASSERT_TRUE_MESSAGE(passed[0], "The first frame always passes");
+
+    int quietFrames = sequence.eventFrame < 0 ? frames : sequence.eventFrame;
+    int suppressed = 0;
+    for (int i = 1; i < quietFrames; i++) {
+      suppressed += !passed[i];
+    }
+    char message[128];
+    snprintf(message, sizeof(message), "%s: %d of %d frames without a change suppressed (%.0f%%)", sequence.name,
+             suppressed, quietFrames - 1, 100.0 * suppressed / (quietFrames - 1));
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(quietFrames - 1, suppressed, message);
+
+    if (sequence.eventFrame >= 0) {
+      int detected = -1;
+      int uploaded = 0;
+      for (int i = sequence.eventFrame; i < frames; i++) {
+        if (passed[i]) {
+          uploaded++;
+          if (detected < 0) {
+            detected = i;
+          }
+        }
+      }
+      snprintf(message, sizeof(message), "%s: first passed %d frames (%d ms) after the change, %d of %d frames since",
+               sequence.name, detected - sequence.eventFrame, (detected - sequence.eventFrame) * FRAME_PERIOD_MS,
+               uploaded, frames - sequence.eventFrame);
+      TEST_MESSAGE(message);
+      TEST_ASSERT_TRUE_MESSAGE(detected >= 0, message);
+      TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_LATENCY_FRAMES, detected - sequence.eventFrame, message);
+    }
+  }
+}
+
+static void test_keyframes() {
+  // One frame every 100 s: a keyframe passes every third
+  std::vector<bool> passed = runGate(loadSignatures("static"), KEYFRAME_INTERVAL / 3);
+  for (size_t i = 0; i < passed.size(); i++) {
+    TEST_ASSERT_EQUAL_INT_MESSAGE(i % 3 == 0, passed[i], fixturePath("static", (int)i).c_str());
+  }
+}
+
+static void test_reset_passes_next_frame() {
+  std::vector<FrameSignature> signatures = loadSignatures("static");
+  ChangeGate gate(CHANGE_CELL_THRESHOLD, CHANGE_MIN_CELLS, KEYFRAME_INTERVAL);
+  TEST_ASSERT_TRUE(gate.pass(signatures[0], 0));
+  TEST_ASSERT_FALSE(gate.pass(signatures[1], 200));
+  gate.reset();
+  TEST_ASSERT_TRUE(gate.pass(signatures[2], 400));
+  TEST_ASSERT_FALSE(gate.pass(signatures[3], 600));
+}
+
+static void test_exposure_shift_is_removed() {
+  std::vector<FrameSignature> signatures = loadSignatures("lights");
+  TEST_ASSERT_LESS_OR_EQUAL(CHANGE_MIN_CELLS - 1, signatureDifference(signatures[9], signatures[10], CHANGE_CELL_THRESHOLD));
+  // Without removing the shift every cell would count
+  FrameSignature shifted = signatures[9];
+  for (int i = 0; i < SIGNATURE_CELLS; i++) {
+    shifted.cells[i] = shifted.cells[i] + 25 > 255 ? 255 : shifted.cells[i] + 25;
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(CHANGE_MIN_CELLS - 1, signatureDifference(signatures[9], shifted, CHANGE_CELL_THRESHOLD));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_sequences);
+  RUN_TEST(test_keyframes);
+  RUN_TEST(test_reset_passes_next_frame);
+  RUN_TEST(test_exposure_shift_is_removed);
+  return UNITY_END();
+}
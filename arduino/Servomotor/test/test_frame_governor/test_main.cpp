@@ -0,0 +1,143 @@
+/*
+  FrameGovernor against a link of fixed capacity
+
+  Frames are captured at the governor's interval and published over a
+  link that carries a fixed number of payload bytes a second, fed back the way
+  src/main.cpp does: recordFrame() with the size of the payload the
+  frame will be sent as and recordPublish() with the bytes accepted and
+  the time they took. Once settled, the payload per second at the chosen
+  interval must fit the link, in base64 mode (the default) as in raw.
+
+    pio test -e native -f test_frame_governor
+*/
+
+#include <FrameGovernor.h>
+#include <unity.h>
+
+#include <stdio.h>
+
+// As in src/main.cpp
+#define MIN_FRAME_INTERVAL 200
+#define MAX_FRAME_INTERVAL 2000
+#define GOVERNOR_INTERVAL 2000
+#define UPLINK_BUDGET 60000
+#define JPEG_QUALITY_BEST 12
+#define JPEG_QUALITY_WORST 30
+#define JPEG_QUALITY_STEP 4
+#define FRAME_SIZE_COUNT 4
+#define TEMP_THRESHOLD 75
+#define TEMP_HYSTERESIS 5
+
+#define SETTLE_MS 120000
+#define MEASURE_MS 60000
+
+static const GovernorConfig config = {
+  MIN_FRAME_INTERVAL, MAX_FRAME_INTERVAL,
+  JPEG_QUALITY_BEST, JPEG_QUALITY_WORST, JPEG_QUALITY_STEP,
+  FRAME_SIZE_COUNT, 0,
+  UPLINK_BUDGET, TEMP_THRESHOLD, TEMP_HYSTERESIS
+};
+
+struct LinkRun {
+  uint32_t payloadBytes;       // Per frame at the settled operating point
+  uint32_t payloadRate;        // Bytes/s sent while measuring
+  OperatingPoint point;
+  GovernorReason reason;
+};
+
+// JPEG size shrinking with quality and with each step down the ladder
+static uint32_t jpegBytes(const OperatingPoint& point, uint32_t largest) {
+  return largest * JPEG_QUALITY_BEST / point.quality >> point.frameSize;
+}
+
+static uint32_t payloadBytes(uint32_t jpeg, bool base64) {
+  return base64 ? 4 * ((jpeg + 2) / 3) : jpeg;
+}
+
+static LinkRun runLink(uint32_t largestJpeg, uint32_t linkRate, bool base64) {
+  FrameGovernor governor(config);
+  governor.recordTemperature(50);
+  unsigned long now = 0;
+  unsigned long lastUpdate = 0;
+  unsigned long sent = 0;
+  while (now < SETTLE_MS + MEASURE_MS) {
+    const OperatingPoint& point = governor.operatingPoint();
+    uint32_t payload = payloadBytes(jpegBytes(point, largestJpeg), base64);
+    governor.recordFrame(payload);
+    uint32_t elapsed = (uint32_t)((uint64_t)payload * 1000 / linkRate);
+    governor.recordPublish(payload, elapsed);
+    if (now >= SETTLE_MS) {
+      sent += payload;
+    }
+    // Captures wait for the interval, or for the upload when it is slower
+    now += elapsed > point.frameInterval ? elapsed : point.frameInterval;
+    if (now - lastUpdate >= GOVERNOR_INTERVAL) {
+      lastUpdate = now;
+      governor.update();
+    }
+  }
+  LinkRun run;
+  run.point = governor.operatingPoint();
+  run.reason = governor.reason();
+  run.payloadBytes = payloadBytes(jpegBytes(run.point, largestJpeg), base64);
+  run.payloadRate = (uint32_t)((uint64_t)sent * 1000 / (now - SETTLE_MS));
+  return run;
+}
+
+static void checkFitsLink(const LinkRun& run, uint32_t linkRate, const char* mode) {
+  uint32_t offered = (uint32_t)((uint64_t)run.payloadBytes * 1000 / run.point.frameInterval);
+  char message[160];
+  snprintf(message, sizeof(message), "%s: %u byte payloads every %u ms (quality %u, frame size %u), %u bytes/s offered, link %u",
+           mode, (unsigned)run.payloadBytes, (unsigned)run.point.frameInterval, run.point.quality, run.point.frameSize,
+           (unsigned)offered, (unsigned)linkRate);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(linkRate, offered, message);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(linkRate, run.payloadRate, message);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(MAX_FRAME_INTERVAL, run.point.frameInterval, message);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_base64_frames_fit_the_link() {
+  // 9 kB JPEGs are 12 kB of base64: 400 ms apart at the least, not 300
+  LinkRun run = runLink(9000, 30000, true);
+  checkFitsLink(run, 30000, "base64");
+  TEST_ASSERT_EQUAL_UINT8(JPEG_QUALITY_BEST, run.point.quality);
+  TEST_ASSERT_GREATER_OR_EQUAL(400, run.point.frameInterval);
+  TEST_ASSERT_EQUAL_STRING("bandwidth", governorReasonName(run.reason));
+}
+
+static void test_raw_frames_fit_the_link() {
+  LinkRun run = runLink(9000, 30000, false);
+  checkFitsLink(run, 30000, "raw");
+  TEST_ASSERT_GREATER_OR_EQUAL(300, run.point.frameInterval);
+  // Raw frames need a quarter less time on the link than base64 ones
+  TEST_ASSERT_LESS_THAN(runLink(9000, 30000, true).point.frameInterval, run.point.frameInterval);
+}
+
+static void test_fast_link_held_to_budget() {
+  LinkRun run = runLink(15000, 200000, true);
+  checkFitsLink(run, 200000, "fast link");
+  // Limited by the budget rather than the link: 20 kB of base64 at 60 kB/s
+  TEST_ASSERT_EQUAL_UINT16(20000 * 1000 / UPLINK_BUDGET, run.point.frameInterval);
+}
+
+static void test_slow_link_reduces_quality_then_size() {
+  LinkRun run = runLink(20000, 5000, true);
+  checkFitsLink(run, 5000, "slow link");
+  TEST_ASSERT_EQUAL_UINT8(JPEG_QUALITY_BEST + 4 * JPEG_QUALITY_STEP, run.point.quality);
+  TEST_ASSERT_GREATER_THAN(0, run.point.frameSize);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_base64_frames_fit_the_link);
+  RUN_TEST(test_raw_frames_fit_the_link);
+  RUN_TEST(test_fast_link_held_to_budget);
+  RUN_TEST(test_slow_link_reduces_quality_then_size);
+  return UNITY_END();
+}
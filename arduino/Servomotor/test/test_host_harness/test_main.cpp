@@ -0,0 +1,193 @@
+/*
+  ArduinoHost stand-ins the benches rely on
+
+  The benches read their results off the harness, so the stand-ins have
+  to behave like the device where it matters: the clock only moves on
+  delay() and on bytes sent over the simulated uplink, PubSubClient
+  rejects a publish() that does not fit its buffer as the real client
+  does, esp_camera_fb_get() serves the recorded frames in name order
+  until they run out, and the heap peak is counted from its last reset.
+  The frames are written to /tmp by the test, each a JPEG header with
+  only its size in it.
+
+    pio test -e native -f test_host_harness
+*/
+
+#include <HostHarness.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <esp_camera.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+
+#define FRAME_DIR "/tmp/servomotor-test-frames"
+#define TOPIC "cameras/test"
+
+// Start of image and a baseline SOF0 marker with the frame's size, as
+// the stand-in reads it, then end of image
+static void writeFrame(const char* name, uint16_t width, uint16_t height) {
+  const uint8_t jpeg[] = {
+    0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08,
+    (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8), (uint8_t)width,
+    0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xD9,
+  };
+  std::string path = std::string(FRAME_DIR "/") + name;
+  FILE* f = fopen(path.c_str(), "wb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, path.c_str());
+  fwrite(jpeg, 1, sizeof(jpeg), f);
+  fclose(f);
+}
+
+// Largest payload a publish() to TOPIC fits in the client's buffer
+static unsigned int largestPayload(PubSubClient& mqtt) {
+  return mqtt.getBufferSize() - MQTT_MAX_HEADER_SIZE - 2 - strlen(TOPIC);
+}
+
+void setUp() {
+  WiFi.begin("ssid", "pass");
+  hostSetWifiUp(true);
+  hostSetBrokerUp(true);
+  hostSetBrokerRefusal(0);
+  hostSetLinkRate(0);
+  hostResetMqttStats();
+}
+
+void tearDown() {}
+
+static void test_clock_moves_only_when_told() {
+  unsigned long start = millis();
+  volatile uint32_t sink = 0;
+  for (uint32_t i = 0; i < 10000000; i++) {
+    sink = sink + i;
+  }
+  TEST_ASSERT_EQUAL_UINT32(start, millis());
+  delay(250);
+  TEST_ASSERT_EQUAL_UINT32(start + 250, millis());
+  delayMicroseconds(1500);
+  hostAdvanceMicros(500);
+  TEST_ASSERT_EQUAL_UINT32(start + 252, millis());
+  TEST_ASSERT_EQUAL_UINT32((start + 252) * 1000, micros());
+}
+
+static void test_publish_must_fit_the_buffer() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  mqtt.setServer("broker", 8883);
+  static uint8_t payload[2048];
+  memset(payload, 'x', sizeof(payload));
+
+  // Nothing is counted before the client is connected
+  TEST_ASSERT_FALSE(mqtt.publish(TOPIC, payload, 10));
+  TEST_ASSERT_TRUE(mqtt.connect("test"));
+
+  unsigned int fits = largestPayload(mqtt);
+  TEST_ASSERT_TRUE(mqtt.publish(TOPIC, payload, fits));
+  TEST_ASSERT_FALSE(mqtt.publish(TOPIC, payload, fits + 1));
+  TEST_ASSERT_EQUAL_UINT32(1, hostMqttStats().messages);
+  TEST_ASSERT_EQUAL_UINT32(1, hostMqttStats().rejected);
+  TEST_ASSERT_EQUAL_UINT64(fits, hostMqttStats().bytes);
+
+  // A larger buffer takes it, the streaming path never needed one
+  TEST_ASSERT_TRUE(mqtt.setBufferSize(1024));
+  TEST_ASSERT_TRUE(mqtt.publish(TOPIC, payload, fits + 1));
+  TEST_ASSERT_TRUE(mqtt.beginPublish(TOPIC, sizeof(payload), false));
+  TEST_ASSERT_EQUAL_UINT32(sizeof(payload), mqtt.write(payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL_INT(1, mqtt.endPublish());
+  TEST_ASSERT_EQUAL_UINT32(3, hostMqttStats().messages);
+  TEST_ASSERT_EQUAL_UINT32(1, hostMqttStats().rejected);
+  TEST_ASSERT_EQUAL_UINT64(2 * fits + 1 + sizeof(payload), hostMqttStats().bytes);
+
+  // A stopped broker drops the session
+  hostSetBrokerUp(false);
+  TEST_ASSERT_FALSE(mqtt.publish(TOPIC, payload, 10));
+  TEST_ASSERT_EQUAL_INT(MQTT_CONNECTION_LOST, mqtt.state());
+  TEST_ASSERT_EQUAL_UINT32(3, hostMqttStats().messages);
+}
+
+static void test_uplink_charges_the_clock() {
+  WiFiClientSecure net;
+  PubSubClient mqtt(net);
+  mqtt.setServer("broker", 8883);
+  TEST_ASSERT_TRUE(mqtt.connect("test"));
+  static uint8_t payload[300];
+  memset(payload, 'x', sizeof(payload));
+
+  unsigned long start = millis();
+  TEST_ASSERT_TRUE(mqtt.publish(TOPIC, payload, 100));
+  TEST_ASSERT_EQUAL_UINT32(start, millis());
+
+  // 100 B/s: 100 bytes take a second, a rejected publish takes nothing
+  hostSetLinkRate(100);
+  TEST_ASSERT_TRUE(mqtt.publish(TOPIC, payload, 100));
+  TEST_ASSERT_EQUAL_UINT32(start + 1000, millis());
+  TEST_ASSERT_FALSE(mqtt.publish(TOPIC, payload, largestPayload(mqtt) + 1));
+  TEST_ASSERT_EQUAL_UINT32(start + 1000, millis());
+  TEST_ASSERT_TRUE(mqtt.beginPublish(TOPIC, 50, false));
+  mqtt.write(payload, 50);
+  mqtt.endPublish();
+  TEST_ASSERT_EQUAL_UINT32(start + 1500, millis());
+}
+
+static void test_frames_served_in_name_order() {
+  mkdir(FRAME_DIR, 0755);
+  writeFrame("b.jpg", 320, 240);
+  writeFrame("a.jpg", 160, 120);
+  writeFrame("c.JPEG", 640, 480);
+  FILE* notes = fopen(FRAME_DIR "/notes.txt", "w");
+  TEST_ASSERT_NOT_NULL(notes);
+  fputs("not a frame\n", notes);
+  fclose(notes);
+
+  TEST_ASSERT_EQUAL_UINT32(3, hostLoadFrames(FRAME_DIR));
+  TEST_ASSERT_EQUAL_STRING("a.jpg", hostFrameName(0));
+  TEST_ASSERT_EQUAL_STRING("c.JPEG", hostFrameName(2));
+  TEST_ASSERT_NULL(hostFrameName(3));
+
+  const uint16_t widths[] = {160, 320, 640};
+  for (int pass = 0; pass < 2; pass++) {
+    hostRewindFrames();
+    for (uint16_t width : widths) {
+      camera_fb_t* fb = esp_camera_fb_get();
+      TEST_ASSERT_NOT_NULL(fb);
+      TEST_ASSERT_EQUAL_UINT32(width, fb->width);
+      TEST_ASSERT_EQUAL_UINT32(width * 3 / 4, fb->height);
+      TEST_ASSERT_EQUAL_UINT32(23, fb->len);
+      TEST_ASSERT_FALSE(hostFramesExhausted());
+      esp_camera_fb_return(fb);
+    }
+    TEST_ASSERT_NULL(esp_camera_fb_get());
+    TEST_ASSERT_TRUE(hostFramesExhausted());
+    TEST_ASSERT_EQUAL_UINT32(3, hostFramesServed());
+    TEST_ASSERT_EQUAL_UINT32(0, hostFramesOutstanding());
+  }
+}
+
+static void test_heap_peak_counts_from_reset() {
+  char* before = new char[4096];
+  hostHeapResetPeak();
+  TEST_ASSERT_EQUAL_UINT32(0, hostHeapPeak());
+  char* block = new char[1000];
+  size_t peak = hostHeapPeak();
+  TEST_ASSERT_GREATER_OR_EQUAL(1000, peak);
+  delete[] block;
+  delete[] before;
+  // Freeing what was there at the reset does not lower the peak
+  TEST_ASSERT_EQUAL_UINT32(peak, hostHeapPeak());
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_clock_moves_only_when_told);
+  RUN_TEST(test_publish_must_fit_the_buffer);
+  RUN_TEST(test_uplink_charges_the_clock);
+  RUN_TEST(test_frames_served_in_name_order);
+  RUN_TEST(test_heap_peak_counts_from_reset);
+  return UNITY_END();
+}
@@ -0,0 +1,253 @@
+/*
+  JpegDc against reference block means, corrupt input and timing
+
+  The fixtures are 72x40 frames saved by PIL at quality 75 as 4:2:0,
+  4:2:2 and 4:4:4 YCbCr and as grayscale. Each .txt next to a .jpg holds
+  the blocks wide and high, then the mean of each 8x8 block of the luma
+  plane libjpeg decodes from it, rounded. The DC map may differ from the
+  mean by the DC quantization step over 16 and by rounding.
+
+    pio test -e native -f test_jpeg_dc
+*/
+
+#include <JpegDc.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#define MEAN_TOLERANCE 2           // Brightness levels
+#define TIMING_DECODES 2000
+
+static const char* fixtureNames[] = {"yuv420", "yuv422", "yuv444", "gray"};
+
+static JpegDcDecoder decoder;
+static uint8_t map[256];
+
+static std::string fixturePath(const char* name, const char* extension) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  return path + "fixtures/" + name + extension;
+}
+
+static std::vector<uint8_t> loadJpeg(const char* name) {
+  std::vector<uint8_t> data;
+  FILE* f = fopen(fixturePath(name, ".jpg").c_str(), "rb");
+  if (f) {
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(!data.empty(), name);
+  return data;
+}
+
+// Offset of the first segment with marker, at its length field
+static size_t findSegment(const std::vector<uint8_t>& data, uint8_t marker) {
+  size_t p = 2;
+  while (p + 4 <= data.size() && data[p] == 0xFF) {
+    if (data[p + 1] == marker) {
+      return p + 2;
+    }
+    p += 2 + (data[p + 2] << 8 | data[p + 3]);
+  }
+  TEST_FAIL_MESSAGE("Marker not found");
+  return 0;
+}
+
+static void setLength(std::vector<uint8_t>& data, size_t segment, int length) {
+  data[segment] = (uint8_t)(length >> 8);
+  data[segment + 1] = (uint8_t)length;
+}
+
+static JpegDcResult decode(const std::vector<uint8_t>& data) {
+  return decoder.decode(data.data(), data.size(), map, sizeof(map));
+}
+
+void setUp() {
+  memset(map, 0, sizeof(map));
+  decoder.setMeasureAc(false);
+}
+
+void tearDown() {}
+
+static void test_matches_block_means() {
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(JPEG_DC_OK, decode(data), name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(72, decoder.imageWidth(), name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(40, decoder.imageHeight(), name);
+
+    FILE* f = fopen(fixturePath(name, ".txt").c_str(), "r");
+    TEST_ASSERT_NOT_NULL(f);
+    int wide = 0, high = 0;
+    TEST_ASSERT_EQUAL(2, fscanf(f, "%d %d", &wide, &high));
+    TEST_ASSERT_EQUAL_INT_MESSAGE(wide, decoder.blocksWide(), name);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(high, decoder.blocksHigh(), name);
+    for (int i = 0; i < wide * high; i++) {
+      int mean = 0;
+      TEST_ASSERT_EQUAL(1, fscanf(f, "%d", &mean));
+      char message[64];
+      snprintf(message, sizeof(message), "%s block %d,%d", name, i % wide, i / wide);
+      TEST_ASSERT_INT_WITHIN_MESSAGE(MEAN_TOLERANCE, mean, map[i], message);
+    }
+    fclose(f);
+  }
+}
+
+static void test_rejects_small_map() {
+  std::vector<uint8_t> data = loadJpeg("yuv420");
+  TEST_ASSERT_EQUAL(JPEG_DC_MAP_TOO_SMALL, decoder.decode(data.data(), data.size(), map, 9 * 5 - 1));
+}
+
+static void test_rejects_truncated_data() {
+  std::vector<uint8_t> data = loadJpeg("yuv420");
+  for (size_t length : {(size_t)0, (size_t)1, (size_t)20, data.size() / 2, data.size() - 40}) {
+    JpegDcResult result = decoder.decode(data.data(), length, map, sizeof(map));
+    TEST_ASSERT_TRUE(result == JPEG_DC_TRUNCATED || result == JPEG_DC_BAD_MARKER);
+  }
+}
+
+// Every DC symbol of every DC table decodes to a size of 255
+static void test_rejects_dc_size_over_16() {
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    size_t p = 2;
+    while (p + 4 <= data.size() && data[p] == 0xFF && data[p + 1] != 0xDA) {
+      size_t end = p + 2 + (data[p + 2] << 8 | data[p + 3]);
+      if (data[p + 1] == 0xC4) {
+        for (size_t table = p + 4; table < end;) {
+          int total = 0;
+          for (int i = 1; i <= 16; i++) {
+            total += data[table + i];
+          }
+          if ((data[table] >> 4) == 0) {
+            memset(&data[table + 17], 0xFF, total);
+          }
+          table += 17 + total;
+        }
+      }
+      p = end;
+    }
+    TEST_ASSERT_EQUAL_INT_MESSAGE(JPEG_DC_BAD_HUFFMAN, decode(data), name);
+  }
+}
+
+static void test_rejects_scan_table_ids_over_3() {
+  static const uint8_t tables[] = {0x50, 0xA0, 0xC0, 0xF0, 0x04, 0x0F};
+  for (uint8_t ids : tables) {
+    std::vector<uint8_t> data = loadJpeg("yuv420");
+    data[findSegment(data, 0xDA) + 4] = ids;
+    TEST_ASSERT_EQUAL(JPEG_DC_BAD_HUFFMAN, decode(data));
+  }
+}
+
+static void test_rejects_table_definition_ids_over_3() {
+  std::vector<uint8_t> data = loadJpeg("gray");
+  data[findSegment(data, 0xC4) + 2] = 0x05;
+  TEST_ASSERT_EQUAL(JPEG_DC_BAD_HUFFMAN, decode(data));
+
+  data = loadJpeg("gray");
+  data[findSegment(data, 0xDB) + 2] = 0x0C;
+  TEST_ASSERT_EQUAL(JPEG_DC_BAD_MARKER, decode(data));
+
+  data = loadJpeg("gray");
+  data[findSegment(data, 0xC0) + 10] = 0x0A;  // Quantization table of the component
+  TEST_ASSERT_EQUAL(JPEG_DC_BAD_MARKER, decode(data));
+}
+
+static void test_rejects_short_frame_header() {
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    size_t sof = findSegment(data, 0xC0);
+    int components = data[sof + 7];
+    for (int length = 2; length < 8 + components * 3; length++) {
+      std::vector<uint8_t> cut = data;
+      setLength(cut, sof, length);
+      TEST_ASSERT_EQUAL_INT_MESSAGE(JPEG_DC_TRUNCATED, decode(cut), name);
+    }
+  }
+}
+
+static void test_rejects_short_scan_header() {
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    size_t sos = findSegment(data, 0xDA);
+    int components = data[sos + 2];
+    for (int length = 2; length < 6 + components * 2; length++) {
+      std::vector<uint8_t> cut = data;
+      setLength(cut, sos, length);
+      TEST_ASSERT_EQUAL_INT_MESSAGE(JPEG_DC_TRUNCATED, decode(cut), name);
+    }
+  }
+}
+
+static void test_rejects_short_restart_interval() {
+  std::vector<uint8_t> data = loadJpeg("yuv420");
+  static const uint8_t dri[] = {0xFF, 0xDD, 0x00, 0x02};
+  size_t sos = findSegment(data, 0xDA) - 2;
+  data.insert(data.begin() + sos, dri, dri + sizeof(dri));
+  TEST_ASSERT_EQUAL(JPEG_DC_TRUNCATED, decode(data));
+}
+
+// Any single corrupt header byte must fail cleanly or decode within the map
+static void test_survives_corrupt_headers() {
+  static const uint8_t values[] = {0x00, 0x01, 0x11, 0x7F, 0xFF};
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    size_t sos = findSegment(data, 0xDA);
+    size_t header = sos + (data[sos] << 8 | data[sos + 1]);
+    for (size_t i = 2; i < header; i++) {
+      for (uint8_t value : values) {
+        std::vector<uint8_t> corrupt = data;
+        corrupt[i] = value;
+        if (decode(corrupt) == JPEG_DC_OK) {
+          TEST_ASSERT_LESS_OR_EQUAL(sizeof(map), (size_t)decoder.blocksWide() * decoder.blocksHigh());
+        }
+      }
+    }
+  }
+}
+
+static void test_timing() {
+  for (const char* name : fixtureNames) {
+    std::vector<uint8_t> data = loadJpeg(name);
+    for (int measure = 0; measure < 2; measure++) {
+      decoder.setMeasureAc(measure);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < TIMING_DECODES; i++) {
+        TEST_ASSERT_EQUAL(JPEG_DC_OK, decode(data));
+      }
+      double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+      char message[96];
+      snprintf(message, sizeof(message), "%s%s: %.2f us per frame, %.1f ns per luma block", name,
+               measure ? " with AC" : "", micros / TIMING_DECODES,
+               micros * 1000 / TIMING_DECODES / (decoder.blocksWide() * decoder.blocksHigh()));
+      TEST_MESSAGE(message);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_matches_block_means);
+  RUN_TEST(test_rejects_small_map);
+  RUN_TEST(test_rejects_truncated_data);
+  RUN_TEST(test_rejects_dc_size_over_16);
+  RUN_TEST(test_rejects_scan_table_ids_over_3);
+  RUN_TEST(test_rejects_table_definition_ids_over_3);
+  RUN_TEST(test_rejects_short_frame_header);
+  RUN_TEST(test_rejects_short_scan_header);
+  RUN_TEST(test_rejects_short_restart_interval);
+  RUN_TEST(test_survives_corrupt_headers);
+  RUN_TEST(test_timing);
+  return UNITY_END();
+}
@@ -0,0 +1,196 @@
+/*
+  MotionPlanner against the trajectory its profile describes
+
+  A fake millisecond clock drives update(). Every angle it returns is
+  compared with the straight-line position the profile gives for that
+  time, worked out here in floating point from the steps alone: at most
+  a degree behind while moving, exact at the targets and while dwelling.
+
+    pio test -e native -f test_motion_planner
+*/
+
+#include <MotionPlanner.h>
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ANGLE_TOLERANCE 1          // Degrees, from integer interpolation
+
+// The wiper sweep of src/main.cpp: angle, speed (deg/s), dwell (ms)
+static const SweepStep WIPE_SWEEP[] = {
+  {0, 100, 200},
+  {180, 100, 200},
+  {90, 100, 0}
+};
+static const uint8_t WIPE_STEPS = sizeof(WIPE_SWEEP) / sizeof(WIPE_SWEEP[0]);
+
+static unsigned long clockMs;
+
+// Position the profile gives elapsed ms after it starts from startAngle,
+// and whether it has finished by then
+static double expectedAngle(const SweepStep* steps, uint8_t count, int16_t startAngle, double elapsed,
+                            bool& finished) {
+  double angle = startAngle;
+  for (uint8_t i = 0; i < count; i++) {
+    double distance = fabs(steps[i].angle - angle);
+    double travel = steps[i].speed ? floor(distance * 1000 / steps[i].speed) : 0;
+    if (elapsed < travel) {
+      finished = false;
+      return angle + (steps[i].angle - angle) * elapsed / travel;
+    }
+    elapsed -= travel;
+    angle = steps[i].angle;
+    if (elapsed < steps[i].dwellMs) {
+      finished = false;
+      return angle;
+    }
+    elapsed -= steps[i].dwellMs;
+  }
+  finished = true;
+  return angle;
+}
+
+static unsigned long profileDuration(const SweepStep* steps, uint8_t count, int16_t startAngle) {
+  unsigned long total = 0;
+  int16_t angle = startAngle;
+  for (uint8_t i = 0; i < count; i++) {
+    if (steps[i].speed) {
+      total += (unsigned long)abs(steps[i].angle - angle) * 1000UL / steps[i].speed;
+    }
+    total += steps[i].dwellMs;
+    angle = steps[i].angle;
+  }
+  return total;
+}
+
+// Tick the planner every tickMs (plus up to jitterMs) from startMs until
+// it finishes, checking each angle against the profile
+static void followProfile(const SweepStep* steps, uint8_t count, int16_t startAngle, unsigned long startMs,
+                          unsigned long tickMs, unsigned long jitterMs) {
+  MotionPlanner planner(startAngle);
+  clockMs = startMs;
+  planner.start(steps, count, clockMs);
+  TEST_ASSERT_TRUE(planner.isRunning());
+
+  unsigned long duration = profileDuration(steps, count, startAngle);
+  srand(1);
+  while (planner.isRunning()) {
+    clockMs += tickMs + (jitterMs ? (unsigned long)rand() % (jitterMs + 1) : 0);
+    int16_t angle = planner.update(clockMs);
+    unsigned long elapsed = clockMs - startMs;
+    bool finished = false;
+    double expected = expectedAngle(steps, count, startAngle, (double)elapsed, finished);
+    char message[64];
+    snprintf(message, sizeof(message), "at %lu ms", elapsed);
+    TEST_ASSERT_INT_WITHIN_MESSAGE(ANGLE_TOLERANCE, (int)lround(expected), angle, message);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(angle, planner.position(), message);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(!finished, planner.isRunning(), message);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(duration + tickMs + jitterMs, elapsed, message);
+  }
+  TEST_ASSERT_EQUAL_INT(steps[count - 1].angle, planner.position());
+  // Finishes on schedule however late the tick that noticed it
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)duration, (uint32_t)(planner.finishedAt() - startMs));
+}
+
+void setUp() {
+  clockMs = 0;
+}
+
+void tearDown() {}
+
+static void test_wipe_sweep_at_loop_rate() {
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, 1000, 1, 0);
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, 1000, 20, 0);
+}
+
+static void test_wipe_sweep_with_late_ticks() {
+  // A loop held up by a frame upload ticks late and unevenly
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, 1000, 5, 300);
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, 1000, 700, 0);
+}
+
+static void test_wipe_sweep_key_points() {
+  MotionPlanner planner(90);
+  planner.start(WIPE_SWEEP, WIPE_STEPS, 0);
+  TEST_ASSERT_EQUAL_INT(90, planner.update(0));
+  TEST_ASSERT_EQUAL_INT(45, planner.update(450));   // Halfway to 0 at 100 deg/s
+  TEST_ASSERT_EQUAL_INT(0, planner.update(900));
+  TEST_ASSERT_EQUAL_INT(0, planner.update(1099));   // Dwelling
+  TEST_ASSERT_EQUAL_INT(0, planner.update(1100));   // Starts towards 180
+  TEST_ASSERT_EQUAL_INT(90, planner.update(2000));
+  TEST_ASSERT_EQUAL_INT(180, planner.update(2900));
+  TEST_ASSERT_EQUAL_INT(135, planner.update(3550));
+  TEST_ASSERT_TRUE(planner.isRunning());
+  TEST_ASSERT_EQUAL_INT(90, planner.update(4000));
+  TEST_ASSERT_FALSE(planner.isRunning());
+  TEST_ASSERT_EQUAL_UINT32(4000, planner.finishedAt());
+}
+
+static void test_whole_profile_in_one_late_tick() {
+  MotionPlanner planner(90);
+  planner.start(WIPE_SWEEP, WIPE_STEPS, 0);
+  TEST_ASSERT_EQUAL_INT(90, planner.update(60000));
+  TEST_ASSERT_FALSE(planner.isRunning());
+  TEST_ASSERT_EQUAL_UINT32(4000, planner.finishedAt());
+}
+
+static void test_zero_speed_jumps() {
+  static const SweepStep jumps[] = {{10, 0, 50}, {170, 0, 50}, {170, 30, 0}};
+  MotionPlanner planner(90);
+  planner.start(jumps, 3, 0);
+  TEST_ASSERT_EQUAL_INT(10, planner.update(0));
+  TEST_ASSERT_EQUAL_INT(10, planner.update(49));
+  TEST_ASSERT_EQUAL_INT(170, planner.update(50));
+  // Already at the target: no travel, no dwell
+  TEST_ASSERT_EQUAL_INT(170, planner.update(100));
+  TEST_ASSERT_FALSE(planner.isRunning());
+  TEST_ASSERT_EQUAL_UINT32(100, planner.finishedAt());
+}
+
+static void test_stop_holds_position() {
+  MotionPlanner planner(90);
+  planner.start(WIPE_SWEEP, WIPE_STEPS, 0);
+  TEST_ASSERT_EQUAL_INT(63, planner.update(270));
+  planner.stop(300);
+  TEST_ASSERT_FALSE(planner.isRunning());
+  TEST_ASSERT_EQUAL_UINT32(300, planner.finishedAt());
+  TEST_ASSERT_EQUAL_INT(63, planner.update(5000));
+
+  // A new profile starts from where the last one stopped
+  static const SweepStep back[] = {{90, 90, 0}};
+  planner.start(back, 1, 6000);
+  TEST_ASSERT_EQUAL_INT(63, planner.update(6000));
+  TEST_ASSERT_EQUAL_INT(76, planner.update(6150));
+  TEST_ASSERT_EQUAL_INT(90, planner.update(6300));
+  TEST_ASSERT_FALSE(planner.isRunning());
+}
+
+static void test_empty_profile_is_ignored() {
+  MotionPlanner planner(45);
+  planner.start(WIPE_SWEEP, 0, 0);
+  TEST_ASSERT_FALSE(planner.isRunning());
+  TEST_ASSERT_EQUAL_INT(45, planner.update(1000));
+}
+
+static void test_millis_rollover() {
+  // millis() is 32 bits on the ESP32 and wraps after 49.7 days
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, (unsigned long)-2500, 20, 0);
+  followProfile(WIPE_SWEEP, WIPE_STEPS, 90, (unsigned long)-2500, 5, 300);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_wipe_sweep_at_loop_rate);
+  RUN_TEST(test_wipe_sweep_with_late_ticks);
+  RUN_TEST(test_wipe_sweep_key_points);
+  RUN_TEST(test_whole_profile_in_one_late_tick);
+  RUN_TEST(test_zero_speed_jumps);
+  RUN_TEST(test_stop_holds_position);
+  RUN_TEST(test_empty_profile_is_ignored);
+  RUN_TEST(test_millis_rollover);
+  return UNITY_END();
+}
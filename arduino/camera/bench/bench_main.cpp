@@ -0,0 +1,495 @@
+/*
+  Host benchmark for the motion camera firmware (pio run -e native)
+
+  Runs src/main.cpp over a directory of recorded JPEG frames, first end
+  to end from a PIR wake with the PIR held high so the firmware keeps
+  capturing bursts, then asks for the last event's frames as the server
+  does with two-tier publishing, then through an uplink outage that it
+  rides out on the flash image log, then stage by stage on each frame.
+  Thumbnails are taken at QVGA, so they come from FRAME_DIR/qvga when
+  it holds frames; otherwise they are as large as the recorded frames
+  and may not fit their slots, which the bench points out. The host has
+  one core, so it runs the sequential burst (BURST_PIPELINE=0); the
+  event latencies it prints are the baseline for the figures the
+  pipelined build publishes on cameras/<id>/status.
+
+    .pio/build/native/program [--link B/s] [--repeat N] [--bursts DIR] FRAME_DIR
+
+  With --bursts it also scores bursts where a person labeled the best
+  frames, and prints for each number of frames kept how often a labeled
+  best frame was among them against the bytes left unsent; see
+  benchBursts() for the layout.
+
+  The image log's flash is kept in /tmp/camera-imagelog.bin, the frame
+  store's in /tmp/camera-framestore.bin.
+*/
+
+// The Unity suites link src/ with their own main() and leave this out
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+#include <esp_camera.h>
+#include <HostHarness.h>
+#include <FramePool.h>
+#include <MjpegStreamer.h>
+#include <FlashLog.h>
+#include <BurstScore.h>
+#include <algorithm>
+#include <dirent.h>
+#include <string>
+#include <vector>
+
+// Firmware entry points and stages, from src/main.cpp
+void setup();
+void loop();
+void captureMultiplePhotos();
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out);
+void releaseImages();
+extern FramePool framePool;
+extern FlashLog imageLog;
+extern FlashLog frameStore;
+
+// Mirrors src/main.cpp
+struct UploadItem {
+  PooledFrame* frame;
+  uint32_t eventId;
+  unsigned long triggerTime;
+  uint8_t imageNumber;
+  uint8_t eventFrames;
+};
+struct EventTiming {
+  uint32_t eventId;
+  unsigned long firstImageMs;
+  unsigned long lastImageMs;
+  uint8_t images;
+};
+bool sendImageViaMQTT(const UploadItem& item);
+extern EventTiming eventTiming;
+extern unsigned long wakeToCapture;
+extern unsigned long wakeToPublish;
+extern BurstScorer burstScorer;
+extern BurstScoreWeights scoreWeights;
+extern uint8_t bestFrameCount;
+extern uint32_t eventId;
+
+#ifndef TWO_TIER
+#define TWO_TIER 1                // Mirrors src/main.cpp
+#endif
+#define BENCH_THUMBNAIL_NUMBER 255  // THUMBNAIL_IMAGE_NUMBER
+
+#define BENCH_STREAM_POLLS 4      // streamer.poll() calls per published frame
+
+// A simulated stream viewer whose socket takes a fixed number of bytes
+// per poll
+struct BenchViewer {
+  const char* name;
+  size_t bytesPerPoll;
+  size_t room;
+  uint64_t bytes;
+};
+
+static BenchViewer benchViewers[] = {
+  {"LAN viewer", 64 * 1024, 0, 0},
+  {"LAN viewer", 64 * 1024, 0, 0},
+  {"slow viewer", 2 * 1024, 0, 0},
+};
+
+static int benchStreamWrite(void* connection, const uint8_t* data, size_t length) {
+  (void)data;
+  BenchViewer* viewer = (BenchViewer*)connection;
+  size_t taken = std::min(length, viewer->room);
+  viewer->room -= taken;
+  viewer->bytes += taken;
+  return (int)taken;
+}
+
+static void benchStreamClose(void* connection) {
+  (void)connection;
+}
+
+// Thumbnails published, from their metadata messages
+static uint32_t thumbnailsSent = 0;
+
+static void benchRecordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  char field[24];
+  snprintf(field, sizeof(field), "\"image_number\":%u,", (unsigned)BENCH_THUMBNAIL_NUMBER);
+  const char* leaf = strrchr(topic, '/');
+  if (leaf && strcmp(leaf, "/metadata") == 0 &&
+      std::string((const char*)payload, length).find(field) != std::string::npos) {
+    thumbnailsSent++;
+  }
+}
+
+#define BENCH_FLASH_FILE "/tmp/camera-imagelog.bin"
+#define BENCH_FLASH_SIZE 0x60000           // The imagelog partition in partitions.csv
+#define BENCH_FRAME_STORE_FILE "/tmp/camera-framestore.bin"
+#define BENCH_FRAME_STORE_SIZE 0x110000    // The framestore partition
+#define BENCH_REQUEST_TIMEOUT 30000        // Longest virtual wait for requested frames (ms)
+#define BENCH_DRAIN_TIMEOUT 120000         // Longest virtual wait for the log to drain (ms)
+
+#define BENCH_PIR_PIN 13
+#define BENCH_LOOP_TICK_US 1000  // Virtual time charged per loop(), which polls without delaying
+
+#define BENCH_BURST_MAX 16        // Frames scored per labeled burst
+#define BENCH_BURST_REFERENCE "reference.jpg"
+#define BENCH_BURST_LABELS "best"
+
+// Labeled bursts: one subdirectory per burst holding its frames, a file
+// "best" naming the frames a person would keep, and optionally the scene
+// before the burst as reference.jpg. Each burst is scored as the
+// firmware scores its own, and for each number of frames kept the run
+// counts the bursts whose kept frames include a labeled best one.
+struct BenchBurstResult {
+  uint32_t bursts;
+  uint8_t longest;
+  uint32_t bestKept[BENCH_BURST_MAX + 1];
+  uint64_t bytesKept[BENCH_BURST_MAX + 1];
+  uint64_t bytesAll;
+};
+
+static std::vector<std::string> benchBurstLabels(const std::string& directory) {
+  std::vector<std::string> labels;
+  FILE* file = fopen((directory + "/" BENCH_BURST_LABELS).c_str(), "r");
+  if (!file) {
+    return labels;
+  }
+  char name[256];
+  while (fscanf(file, "%255s", name) == 1) {
+    labels.push_back(name);
+  }
+  fclose(file);
+  return labels;
+}
+
+static void benchScoreBurst(const std::string& directory, BenchBurstResult& result) {
+  std::vector<std::string> labels = benchBurstLabels(directory);
+  size_t frames = hostLoadFrames(directory.c_str());
+  if (labels.empty() || frames == 0) {
+    return;
+  }
+  burstScorer.reset();
+  for (size_t i = 0; i < frames; i++) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (strcmp(hostFrameName(i), BENCH_BURST_REFERENCE) == 0) {
+      burstScorer.setReference(fb->buf, fb->len);
+    }
+    esp_camera_fb_return(fb);
+  }
+
+  FrameMeasure measures[BENCH_BURST_MAX];
+  uint32_t lengths[BENCH_BURST_MAX];
+  bool best[BENCH_BURST_MAX];
+  uint8_t count = 0;
+  hostRewindFrames();
+  for (size_t i = 0; i < frames && count < BENCH_BURST_MAX; i++) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    const char* name = hostFrameName(i);
+    if (strcmp(name, BENCH_BURST_REFERENCE) != 0) {
+      burstScorer.measure(fb->buf, fb->len, measures[count]);
+      lengths[count] = fb->len;
+      best[count] = false;
+      for (size_t j = 0; j < labels.size(); j++) {
+        best[count] = best[count] || labels[j] == name;
+      }
+      result.bytesAll += fb->len;
+      count++;
+    }
+    esp_camera_fb_return(fb);
+  }
+
+  uint16_t scores[BENCH_BURST_MAX];
+  bool kept[BENCH_BURST_MAX];
+  BurstScorer::rank(measures, count, scoreWeights, scores);
+  for (uint8_t keep = 1; keep <= BENCH_BURST_MAX; keep++) {
+    BurstScorer::selectBest(scores, count, keep, kept);
+    bool hit = false;
+    for (uint8_t i = 0; i < count; i++) {
+      if (kept[i]) {
+        result.bytesKept[keep] += lengths[i];
+        hit = hit || best[i];
+      }
+    }
+    result.bestKept[keep] += hit;
+  }
+  result.bursts++;
+  result.longest = count > result.longest ? count : result.longest;
+}
+
+static void benchBursts(const char* directory, BenchBurstResult& result) {
+  memset(&result, 0, sizeof(result));
+  DIR* dir = opendir(directory);
+  if (!dir) {
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for (size_t i = 0; i < names.size(); i++) {
+    benchScoreBurst(std::string(directory) + "/" + names[i], result);
+  }
+}
+
+static HostStage burstStages[] = {
+  {"loop", 0, 0, 0, 0},
+  {"captureMultiplePhotos", 0, 0, 0, 0},
+};
+
+enum {
+  STAGE_FB_GET,
+  STAGE_BASE64,
+  STAGE_PUBLISH,
+  STAGE_COUNT
+};
+
+static HostStage frameStages[STAGE_COUNT] = {
+  {"esp_camera_fb_get", 0, 0, 0, 0},
+  {"base64EncodeBlock", 0, 0, 0, 0},
+  {"sendImageViaMQTT", 0, 0, 0, 0},
+};
+
+static HostStage streamStages[] = {
+  {"MjpegStreamer::poll", 0, 0, 0, 0},
+};
+
+// Virtual time from the PIR trigger until an image is on the broker
+static HostStage eventLatency[] = {
+  {"first image", 0, 0, 0, 0},
+  {"last image", 0, 0, 0, 0},
+};
+
+// Virtual time from boot on the PIR wake. WiFi joins at once on the host,
+// so these show where capture sits in setup(), not the radio's timing.
+static HostStage wakeLatency[] = {
+  {"first capture", 0, 0, 0, 0},
+  {"first image", 0, 0, 0, 0},
+};
+
+// Record the latency of the event timed so far once another has taken
+// its place, or the run is over, so every image it sent is counted
+static void noteEventTiming(EventTiming& timed, bool last = false) {
+  if ((last || eventTiming.eventId != timed.eventId) && timed.images) {
+    hostStageRecord(eventLatency[0], timed.firstImageMs * 1000000ULL);
+    hostStageRecord(eventLatency[1], timed.lastImageMs * 1000000ULL);
+  }
+  timed = eventTiming;
+}
+
+int main(int argc, char** argv) {
+  HostOptions options;
+  if (!hostParseArgs(argc, argv, options)) {
+    return 2;
+  }
+  size_t frames = hostLoadFrames(options.frameDir);
+  if (frames == 0) {
+    fprintf(stderr, "no .jpg frames in %s\n", options.frameDir);
+    return 1;
+  }
+  printf("Motion camera firmware, %u frames, uplink %u B/s\n", (unsigned)frames,
+         (unsigned)options.linkBytesPerSecond);
+
+  hostFlashAttach("imagelog", BENCH_FLASH_FILE, BENCH_FLASH_SIZE, true);
+  hostFlashAttach("framestore", BENCH_FRAME_STORE_FILE, BENCH_FRAME_STORE_SIZE, true);
+
+  // End to end: woken by the PIR, motion keeps being reported until the
+  // frames run out. The wake event is sent from setup(), its traffic and
+  // latency count with the rest.
+  hostSetMqttRecorder(benchRecordMessage);
+  hostResetMqttStats();
+  EventTiming timed = {0, 0, 0, 0};
+  try {
+    hostSetWakeupCause(ESP_SLEEP_WAKEUP_EXT0);
+    setup();
+    hostHeapResetPeak();
+    noteEventTiming(timed);
+    hostSetPin(BENCH_PIR_PIN, HIGH);
+    while (!hostFramesExhausted()) {
+      {
+        HOST_STAGE(burstStages[0]);
+        loop();
+      }
+      hostAdvanceMicros(BENCH_LOOP_TICK_US);
+      noteEventTiming(timed);
+    }
+  } catch (const HostDeepSleep&) {
+    printf("Firmware went to deep sleep\n");
+  }
+  noteEventTiming(timed);
+  noteEventTiming(timed, true);
+  hostPrintStages("End to end", burstStages, 1);
+  hostPrintTraffic("End to end traffic", hostFramesServed());
+  uint32_t events = eventId;
+  uint32_t thumbnails = thumbnailsSent;
+  uint64_t eventBytes = events ? hostMqttStats().bytes / events : 0;
+  hostSetMqttRecorder(NULL);
+  printf("  %-22s %12u\n", "events", (unsigned)events);
+  printf("  %-22s %12u\n", "thumbnails sent", (unsigned)thumbnails);
+  printf("  %-22s %12llu\n", "published bytes/event", (unsigned long long)eventBytes);
+  hostPrintStages("Event latency, virtual time", eventLatency, 2);
+  hostStageRecord(wakeLatency[0], wakeToCapture * 1000000ULL);
+  hostStageRecord(wakeLatency[1], wakeToPublish * 1000000ULL);
+  hostPrintStages("Wake latency, virtual time", wakeLatency, 2);
+
+  // Two-tier: the server asks for every frame of the last event, then
+  // for one of them again
+  uint32_t kept = frameStore.pendingCount();
+  uint32_t requestedSent = 0;
+  unsigned long requestMs = 0;
+  try {
+    hostResetMqttStats();
+    hostSetPin(BENCH_PIR_PIN, LOW);
+    char request[64];
+    int length = snprintf(request, sizeof(request), "{\"event_id\":%u}", (unsigned)eventTiming.eventId);
+    hostDeliver("cameras/CAM001/request", (const uint8_t*)request, length);
+    length = snprintf(request, sizeof(request), "{\"event_id\":%u,\"frame\":0}", (unsigned)eventTiming.eventId);
+    hostDeliver("cameras/CAM001/request", (const uint8_t*)request, length);
+    unsigned long requestStart = millis();
+    while (hostMqttStats().messages == 0 && millis() - requestStart < BENCH_REQUEST_TIMEOUT) {
+      loop();
+      hostAdvanceMicros(BENCH_LOOP_TICK_US);
+    }
+    // One request is served per loop()
+    loop();
+    requestMs = millis() - requestStart;
+    requestedSent = kept - frameStore.pendingCount();
+  } catch (const HostDeepSleep&) {
+    printf("Firmware went to deep sleep during the frame requests\n");
+  }
+  printf("\nFrame requests\n");
+  printf("  %-22s %12llu\n", "mqtt payload bytes", (unsigned long long)hostMqttStats().bytes);
+  printf("  %-22s %12u\n", "frames kept", (unsigned)kept);
+  printf("  %-22s %12u\n", "frames evicted", (unsigned)frameStore.evictedCount());
+  printf("  %-22s %12u\n", "event frames sent", (unsigned)requestedSent);
+  printf("  %-22s %12lu\n", "request to sent ms", requestMs);
+
+  // Uplink outage: the events go to flash, then drain once it is back
+  uint32_t stored = 0;
+  uint32_t remaining = 0;
+  unsigned long drainMs = 0;
+  try {
+    hostRewindFrames();
+    hostResetMqttStats();
+    hostSetWifiUp(false);
+    hostSetPin(BENCH_PIR_PIN, HIGH);
+    while (!hostFramesExhausted()) {
+      loop();
+      hostAdvanceMicros(BENCH_LOOP_TICK_US);
+    }
+    stored = imageLog.pendingCount();
+    hostSetWifiUp(true);
+    hostSetPin(BENCH_PIR_PIN, LOW);
+    unsigned long drainStart = millis();
+    while (imageLog.pendingCount() > 0 && millis() - drainStart < BENCH_DRAIN_TIMEOUT) {
+      loop();
+      hostAdvanceMicros(BENCH_LOOP_TICK_US);
+    }
+    drainMs = millis() - drainStart;
+    remaining = imageLog.pendingCount();
+  } catch (const HostDeepSleep&) {
+    printf("Firmware went to deep sleep during the outage\n");
+  }
+  hostPrintTraffic("Uplink outage traffic", hostFramesServed());
+  printf("  %-22s %12u\n", "images stored", (unsigned)stored);
+  printf("  %-22s %12u\n", "images evicted", (unsigned)imageLog.evictedCount());
+  printf("  %-22s %12u\n", "left after drain", (unsigned)remaining);
+  printf("  %-22s %12.1f\n", "drain seconds", drainMs / 1000.0);
+
+  // A burst on its own, without the uploads
+  for (uint16_t pass = 0; pass < options.repeat; pass++) {
+    hostRewindFrames();
+    HOST_STAGE(burstStages[1]);
+    captureMultiplePhotos();
+  }
+  releaseImages();
+
+  // Stage by stage on every frame
+  for (uint16_t pass = 0; pass < options.repeat; pass++) {
+    hostRewindFrames();
+    for (int imageNumber = 0;; imageNumber++) {
+      camera_fb_t* fb;
+      {
+        HOST_STAGE(frameStages[STAGE_FB_GET]);
+        fb = esp_camera_fb_get();
+      }
+      if (!fb) {
+        break;
+      }
+      {
+        HOST_STAGE(frameStages[STAGE_BASE64]);
+        static char encoded[4 * ((1600 * 1200 / 5 + 2) / 3)];
+        base64EncodeBlock(fb->buf, fb->len, encoded);
+      }
+      PooledFrame* frame = framePool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+      esp_camera_fb_return(fb);
+      {
+        HOST_STAGE(frameStages[STAGE_PUBLISH]);
+        UploadItem item = {frame, 0, millis(), (uint8_t)(imageNumber % 5), 5};
+        sendImageViaMQTT(item);
+      }
+      FramePool::release(frame);
+    }
+  }
+  hostPrintStages("Per frame stages", frameStages, STAGE_COUNT);
+  hostPrintStages("Burst", burstStages + 1, 1);
+
+  // Live view: every frame is published once and shared by all viewers
+  MjpegStreamer streamer(benchStreamWrite, benchStreamClose);
+  int viewerCount = sizeof(benchViewers) / sizeof(benchViewers[0]);
+  for (int i = 0; i < viewerCount; i++) {
+    streamer.addViewer(&benchViewers[i]);
+  }
+  hostRewindFrames();
+  size_t published = 0;
+  while (camera_fb_t* fb = esp_camera_fb_get()) {
+    PooledFrame* frame = framePool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+    esp_camera_fb_return(fb);
+    streamer.publish(frame);
+    FramePool::release(frame);
+    published++;
+    for (int poll = 0; poll < BENCH_STREAM_POLLS; poll++) {
+      for (int i = 0; i < viewerCount; i++) {
+        benchViewers[i].room = benchViewers[i].bytesPerPoll;
+      }
+      HOST_STAGE(streamStages[0]);
+      streamer.poll();
+    }
+  }
+  hostPrintStages("Stream", streamStages, 1);
+  printf("  %-22s %12u\n", "frames published", (unsigned)published);
+  printf("  %-22s %12u\n", "frames sent", (unsigned)streamer.framesSent());
+  printf("  %-22s %12u\n", "frames skipped", (unsigned)streamer.framesSkipped());
+  for (int i = 0; i < viewerCount; i++) {
+    printf("  %-22s %12llu bytes at %u B/poll\n", benchViewers[i].name,
+           (unsigned long long)benchViewers[i].bytes, (unsigned)benchViewers[i].bytesPerPoll);
+  }
+  streamer.closeAll();
+  printf("  %-22s %12u\n", "pool slots free after", (unsigned)framePool.freeSlots());
+
+  // Frame selection against bursts where a person picked the best frames
+  if (options.burstDir) {
+    BenchBurstResult selection;
+    benchBursts(options.burstDir, selection);
+    printf("\nBest frame selection, %u labeled bursts, weights %u/%u/%u\n", (unsigned)selection.bursts,
+           (unsigned)scoreWeights.sharpness, (unsigned)scoreWeights.exposure, (unsigned)scoreWeights.change);
+    printf("  %-6s %14s %14s\n", "kept", "best kept %", "bytes saved %");
+    for (uint8_t keep = 1; keep <= selection.longest; keep++) {
+      printf("  %-6u %14.1f %14.1f%s\n", (unsigned)keep,
+             selection.bursts ? 100.0 * selection.bestKept[keep] / selection.bursts : 0.0,
+             selection.bytesAll ? 100.0 - 100.0 * selection.bytesKept[keep] / selection.bytesAll : 0.0,
+             keep == bestFrameCount ? "   (BEST_FRAMES)" : "");
+    }
+  }
+
+  // Without thumbnails the frame requests above did not go the two-tier
+  // path; test/test_event_upload checks it on fixtures that fit
+  if (TWO_TIER && thumbnails < events) {
+    printf("\n%u of %u events sent no thumbnail, put QVGA frames that fit the thumbnail slots in FRAME_DIR/qvga\n",
+           (unsigned)(events - thumbnails), (unsigned)events);
+  }
+  return 0;
+}
+#endif
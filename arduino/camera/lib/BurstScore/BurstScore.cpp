@@ -0,0 +1,137 @@
+#include "BurstScore.h"
+
+BurstScorer::BurstScorer() : map(NULL), mapCapacity(0), haveReference(false), pinned(false) {}
+
+void BurstScorer::begin(uint8_t* lumaMap, size_t capacity) {
+  map = lumaMap;
+  mapCapacity = capacity;
+  reset();
+}
+
+void BurstScorer::reset() {
+  haveReference = false;
+  pinned = false;
+}
+
+bool BurstScorer::decode(const uint8_t* jpeg, size_t length, bool measureAc) {
+  if (!map) {
+    return false;
+  }
+  decoder.setMeasureAc(measureAc);
+  return decoder.decode(jpeg, length, map, mapCapacity) == JPEG_DC_OK;
+}
+
+bool BurstScorer::setReference(const uint8_t* jpeg, size_t length) {
+  if (!decode(jpeg, length, false)) {
+    return false;
+  }
+  computeSignature(map, decoder.blocksWide(), decoder.blocksHigh(), reference);
+  haveReference = true;
+  pinned = true;
+  return true;
+}
+
+bool BurstScorer::measure(const uint8_t* jpeg, size_t length, FrameMeasure& frame) {
+  frame.decoded = false;
+  frame.sharpness = 0;
+  frame.exposure = 0;
+  frame.change = 0;
+  if (!decode(jpeg, length, true)) {
+    return false;
+  }
+  frame.decoded = true;
+
+  // Exposure: how far the mean sits from mid-grey, scaled down by the
+  // share of blocks that are crushed or blown out
+  uint32_t blocks = (uint32_t)decoder.blocksWide() * decoder.blocksHigh();
+  uint32_t sum = 0;
+  uint32_t clipped = 0;
+  for (uint32_t i = 0; i < blocks; i++) {
+    sum += map[i];
+    if (map[i] <= BURST_SCORE_CLIP_LOW || map[i] >= BURST_SCORE_CLIP_HIGH) {
+      clipped++;
+    }
+  }
+  uint8_t mean = sum / blocks;
+  int32_t offset = (int32_t)mean - 128;
+  uint32_t centred = BURST_SCORE_MAX - (uint32_t)(offset < 0 ? -offset : offset) * BURST_SCORE_MAX / 128;
+  frame.exposure = (uint16_t)(centred * (blocks - clipped) / blocks);
+
+  // Sharpness: AC energy grows with contrast as much as with focus, so
+  // it is divided by the spread of block brightness, which blur and
+  // motion hardly change at 8x8
+  uint32_t spread = 0;
+  for (uint32_t i = 0; i < blocks; i++) {
+    spread += map[i] > mean ? map[i] - mean : mean - map[i];
+  }
+  spread = spread / blocks + 1;
+  frame.sharpness = decoder.acEnergy() * BURST_SCORE_SHARPNESS_SCALE / spread;
+
+  FrameSignature signature;
+  computeSignature(map, decoder.blocksWide(), decoder.blocksHigh(), signature);
+  if (haveReference) {
+    frame.change = signatureDifference(reference, signature, BURST_SCORE_CELL_THRESHOLD);
+  }
+  if (!pinned) {
+    reference = signature;
+    haveReference = true;
+  }
+  return true;
+}
+
+void BurstScorer::rank(const FrameMeasure* frames, uint8_t count, const BurstScoreWeights& weights, uint16_t* scores) {
+  uint32_t sharpest = 0;
+  uint8_t decoded = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (frames[i].decoded) {
+      sharpest = frames[i].sharpness > sharpest ? frames[i].sharpness : sharpest;
+      decoded++;
+    }
+  }
+  // Change is scored against the burst's median, not its most: a flash
+  // or a dark frame moves every cell, and would otherwise push the frames
+  // that show the subject down to nothing. Frames at or above the median
+  // score full, frames still showing the empty scene score low.
+  uint16_t typicalChange = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t below = 0;
+    for (uint8_t j = 0; j < count; j++) {
+      below += frames[j].decoded && frames[j].change < frames[i].change;
+    }
+    if (frames[i].decoded && below <= decoded / 2 && frames[i].change > typicalChange) {
+      typicalChange = frames[i].change;
+    }
+  }
+  uint32_t totalWeight = (uint32_t)weights.sharpness + weights.exposure + weights.change;
+  for (uint8_t i = 0; i < count; i++) {
+    if (!frames[i].decoded || totalWeight == 0) {
+      scores[i] = 0;
+      continue;
+    }
+    uint32_t sharpness = sharpest ? (uint64_t)frames[i].sharpness * BURST_SCORE_MAX / sharpest : 0;
+    uint32_t change = BURST_SCORE_MAX;
+    if (frames[i].change < typicalChange) {
+      change = (uint32_t)frames[i].change * BURST_SCORE_MAX / typicalChange;
+    }
+    scores[i] = (uint16_t)((sharpness * weights.sharpness + (uint32_t)frames[i].exposure * weights.exposure +
+                            change * weights.change) / totalWeight);
+  }
+}
+
+uint8_t BurstScorer::selectBest(const uint16_t* scores, uint8_t count, uint8_t keep, bool* kept) {
+  for (uint8_t i = 0; i < count; i++) {
+    kept[i] = false;
+  }
+  uint8_t chosen = 0;
+  while (chosen < keep && chosen < count) {
+    int best = -1;
+    for (uint8_t i = 0; i < count; i++) {
+      if (!kept[i] && (best < 0 || scores[i] > scores[best])) {
+        best = i;
+      }
+    }
+    kept[best] = true;
+    chosen++;
+  }
+  return chosen;
+}
@@ -0,0 +1,83 @@
+/*
+  BurstScore - pick the best frames of a burst from their JPEG streams
+
+  Each frame is measured from what JpegDc gets out of its entropy-coded
+  data, without an IDCT: AC energy over the frame's contrast as a
+  sharpness proxy, so a flash-lit frame does not read sharper,
+  exposure from the DC luminance map (a flash-washed or black frame
+  scores low), and how many FrameSignature cells moved from a reference
+  frame, so a frame that still shows the empty scene scores low. The
+  reference is the frame measured before, unless one is pinned with
+  setReference().
+
+  Sharpness and change only mean something next to the other frames of
+  the same burst, so rank() scales sharpness against the burst's
+  sharpest frame and change against its median before weighting.
+  Scores rank the frames of one burst, they do not compare across
+  bursts. Has no Arduino dependencies.
+*/
+
+#ifndef BURST_SCORE_H
+#define BURST_SCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <JpegDc.h>
+#include <FrameSignature.h>
+
+#define BURST_SCORE_MAX 1000
+#define BURST_SCORE_CELL_THRESHOLD 12    // Brightness step for a signature cell to count as changed
+#define BURST_SCORE_CLIP_LOW 16          // Blocks at or past these are crushed or blown out
+#define BURST_SCORE_CLIP_HIGH 240
+#define BURST_SCORE_SHARPNESS_SCALE 64   // Fixed point of FrameMeasure::sharpness
+
+// Relative weight of each signal in a frame's score, any scale
+struct BurstScoreWeights {
+  uint8_t sharpness;
+  uint8_t exposure;
+  uint8_t change;
+};
+
+struct FrameMeasure {
+  bool decoded;                // False if the JPEG could not be read, it then scores 0
+  uint32_t sharpness;          // Mean AC magnitude per luma block over the block brightness spread
+  uint16_t exposure;           // 0-1000, 1000 for a mid-grey mean with nothing clipped
+  uint16_t change;             // Signature cells moved from the reference
+};
+
+class BurstScorer {
+public:
+  BurstScorer();
+
+  // map holds the luminance map of the largest frame, one byte per 8x8
+  // block, and must outlive the scorer
+  void begin(uint8_t* map, size_t mapCapacity);
+
+  // Forget the reference, at the start of a burst
+  void reset();
+
+  // Measure a frame against the scene before the burst instead of
+  // against the frame before it
+  bool setReference(const uint8_t* jpeg, size_t length);
+
+  bool measure(const uint8_t* jpeg, size_t length, FrameMeasure& frame);
+
+  // Score count measured frames 0-1000
+  static void rank(const FrameMeasure* frames, uint8_t count, const BurstScoreWeights& weights, uint16_t* scores);
+
+  // Flag the best keep frames, earlier frames winning ties. Returns how
+  // many were flagged.
+  static uint8_t selectBest(const uint16_t* scores, uint8_t count, uint8_t keep, bool* kept);
+
+private:
+  bool decode(const uint8_t* jpeg, size_t length, bool measureAc);
+
+  JpegDcDecoder decoder;
+  uint8_t* map;
+  size_t mapCapacity;
+  FrameSignature reference;
+  bool haveReference;
+  bool pinned;
+};
+
+#endif
@@ -0,0 +1,429 @@
+#include "FlashLog.h"
+
+#include <string.h>
+
+#define FLASH_LOG_MAGIC 0x474F4C46u        // "FLOG"
+#define FLASH_LOG_RECORD_MAGIC 0x4352u     // "RC"
+#define FLASH_LOG_NONE 0xFFFFFFFFu         // No record starts in the sector
+#define FLASH_LOG_ERASED 0xFFFFFFFFu
+
+// CRC-32 (IEEE, as zlib), a nibble at a time to keep the table small.
+// Pass the previous result to continue over several buffers.
+static uint32_t crc32(uint32_t crc, const void* data, size_t length) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+  };
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc = table[(crc ^ bytes[i]) & 0x0F] ^ (crc >> 4);
+    crc = table[(crc ^ (bytes[i] >> 4)) & 0x0F] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+FlashLog::FlashLog()
+    : device(NULL), sectorSize(0), sectorCount(0), opened(false), openSequence(0), oldestSequence(0),
+      head(0), tail(0), cursor(0), pending(0), evicted(0), corrupt(0), erases(0) {}
+
+bool FlashLog::begin(FlashDevice* flash) {
+  device = flash;
+  sectorSize = device->sectorSize();
+  sectorCount = device->sectorCount();
+  opened = false;
+  pending = 0;
+  evicted = 0;
+  corrupt = 0;
+  erases = 0;
+  if (sectorCount < 3 || sectorSize < 2 * (sizeof(SectorHeader) + sizeof(RecordHeader))) {
+    device = NULL;
+    return false;
+  }
+
+  // The newest sector has the highest sequence number
+  SectorHeader sector;
+  for (uint32_t i = 0; i < sectorCount; i++) {
+    if (!device->read(i * sectorSize, &sector, sizeof(sector))) {
+      device = NULL;
+      return false;
+    }
+    if (sector.magic == FLASH_LOG_MAGIC && sector.sequence % sectorCount == i &&
+        sector.check == crc32(0, &sector, offsetof(SectorHeader, check))) {
+      if (!opened || sector.sequence > openSequence) {
+        openSequence = sector.sequence;
+        opened = true;
+      }
+    }
+  }
+  if (!opened) {
+    // Blank or foreign flash, start an empty log
+    head = tail = cursor = sectorStart(0) + sizeof(SectorHeader);
+    oldestSequence = 0;
+    return true;
+  }
+
+  // The log is the unbroken run of sectors leading up to it
+  oldestSequence = openSequence;
+  while (oldestSequence > 0 && openSequence - (oldestSequence - 1) < sectorCount &&
+         readSectorHeader(oldestSequence - 1, sector)) {
+    oldestSequence--;
+  }
+
+  // Follow the records to find the head, counting those still to send.
+  // Erased space can only be at the head, anywhere else it is a sector
+  // whose erase was cut short.
+  uint64_t end = sectorStart(openSequence + 1);
+  tail = firstRecordFrom(oldestSequence);
+  uint64_t position = tail;
+  bool cursorFound = false;
+  head = end + sizeof(SectorHeader);
+  while (position < end) {
+    RecordHeader record;
+    if (!readRecordHeader(position, record)) {
+      device = NULL;
+      return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)&record;
+    bool erased = true;
+    for (size_t i = 0; i < offsetof(RecordHeader, committed); i++) {
+      erased = erased && bytes[i] == 0xFF;
+    }
+    if (erased && sequenceOf(position) == openSequence) {
+      head = position;
+      break;
+    }
+    if (validRecord(record) && record.committed != FLASH_LOG_ERASED && record.sent == FLASH_LOG_ERASED) {
+      pending++;
+      if (!cursorFound) {
+        cursor = position;
+        cursorFound = true;
+      }
+    }
+    position = skipRecord(position, record);
+  }
+  // A record running past the newest sector was cut off, the next one
+  // starts in a fresh sector
+  if (tail > head) {
+    tail = head;
+  }
+  if (!cursorFound) {
+    cursor = head;
+  }
+  return true;
+}
+
+bool FlashLog::append(const void* meta, uint16_t metaLength, const void* data, uint32_t length) {
+  if (!device || length > maxRecordLength() || metaLength + length > maxRecordLength()) {
+    return false;
+  }
+  RecordHeader header;
+  header.length = metaLength + length;
+  header.metaLength = metaLength;
+  header.magic = FLASH_LOG_RECORD_MAGIC;
+  header.crc = crc32(crc32(0, meta, metaLength), data, length);
+  header.check = crc32(0, &header, offsetof(RecordHeader, check));
+  header.committed = FLASH_LOG_ERASED;
+  header.sent = FLASH_LOG_ERASED;
+
+  // Headers never straddle a sector, so the flag words can be cleared
+  // in place later
+  uint64_t start = head;
+  uint64_t position = start;
+  uint32_t remaining = sizeof(header) + header.length;
+  bool written = true;
+  if (!opened || sequenceOf(start) > openSequence) {
+    written = openSector(sequenceOf(start), 0);
+  }
+  written = written && appendBytes(position, &header, sizeof(header), remaining) &&
+            appendBytes(position, meta, metaLength, remaining) &&
+            appendBytes(position, data, length, remaining);
+  if (written) {
+    uint32_t cleared = 0;
+    written = device->write(address(start + offsetof(RecordHeader, committed)), &cleared, sizeof(cleared));
+  }
+  if (!written) {
+    // Whatever made it to flash stays uncommitted, carry on in a fresh sector
+    head = sectorStart(openSequence + 1) + sizeof(SectorHeader);
+    return false;
+  }
+  head = alignRecord(position);
+  pending++;
+  return true;
+}
+
+bool FlashLog::peek(FlashLogRecord& record) {
+  if (!device) {
+    return false;
+  }
+  while (pending > 0 && cursor < head) {
+    RecordHeader header;
+    if (!readRecordHeader(cursor, header)) {
+      return false;
+    }
+    if (validRecord(header) && header.committed != FLASH_LOG_ERASED && header.sent == FLASH_LOG_ERASED) {
+      record.position = cursor;
+      record.length = header.length - header.metaLength;
+      record.metaLength = header.metaLength;
+      return true;
+    }
+    cursor = skipRecord(cursor, header);
+  }
+  pending = 0;
+  return false;
+}
+
+bool FlashLog::read(const FlashLogRecord& record, void* meta, void* data) {
+  RecordHeader header;
+  if (!device || record.position < tail || !readRecordHeader(record.position, header)) {
+    return false;
+  }
+  uint64_t position = advance(record.position, sizeof(header));
+  if (!readBytes(position, meta, record.metaLength)) {
+    return false;
+  }
+  position = advance(position, record.metaLength);
+  if (!readBytes(position, data, record.length)) {
+    return false;
+  }
+  if (crc32(crc32(0, meta, record.metaLength), data, record.length) != header.crc) {
+    corrupt++;
+    markSent(record);
+    return false;
+  }
+  return true;
+}
+
+bool FlashLog::markSent(const FlashLogRecord& record) {
+  // An evicted record's space may already hold a newer one
+  RecordHeader header;
+  if (!device || record.position < tail || !readRecordHeader(record.position, header)) {
+    return false;
+  }
+  if (header.sent != FLASH_LOG_ERASED) {
+    return true;  // Found again by a walk
+  }
+  uint32_t cleared = 0;
+  if (!device->write(address(record.position + offsetof(RecordHeader, sent)), &cleared, sizeof(cleared))) {
+    return false;
+  }
+  if (pending > 0) {
+    pending--;
+  }
+  return true;
+}
+
+bool FlashLog::first(FlashLogRecord& record) {
+  return device && recordFrom(tail, record);
+}
+
+bool FlashLog::next(FlashLogRecord& record) {
+  RecordHeader header;
+  if (!device || record.position < tail || !readRecordHeader(record.position, header)) {
+    return false;
+  }
+  return recordFrom(skipRecord(record.position, header), record);
+}
+
+bool FlashLog::readMeta(const FlashLogRecord& record, void* meta) {
+  if (!device || record.position < tail) {
+    return false;
+  }
+  return readBytes(advance(record.position, sizeof(RecordHeader)), meta, record.metaLength);
+}
+
+uint32_t FlashLog::maxRecordLength() const {
+  // Opening a sector erases the one a lap behind it, which must never be
+  // where the record being written started
+  return (sectorCount - 2) * (sectorSize - sizeof(SectorHeader)) - sizeof(RecordHeader);
+}
+
+// True if the physical sector for sequence holds that sequence number
+bool FlashLog::readSectorHeader(uint32_t sequence, SectorHeader& header) {
+  uint32_t sector = sequence % sectorCount;
+  if (!device->read(sector * sectorSize, &header, sizeof(header))) {
+    return false;
+  }
+  return header.magic == FLASH_LOG_MAGIC && header.sequence == sequence &&
+         header.check == crc32(0, &header, offsetof(SectorHeader, check));
+}
+
+// Erase the sector a lap ahead of the newest and start it. continuing is
+// how many bytes of the record being written still belong before the
+// first record that can start in it.
+bool FlashLog::openSector(uint32_t sequence, uint32_t continuing) {
+  if (opened && sequence >= sectorCount && sequence - sectorCount >= oldestSequence) {
+    evictSector(sequence - sectorCount);
+  }
+  if (!device->erase(sequence % sectorCount)) {
+    return false;
+  }
+  erases++;
+
+  SectorHeader header;
+  header.magic = FLASH_LOG_MAGIC;
+  header.sequence = sequence;
+  uint32_t first = sizeof(SectorHeader) + continuing;
+  header.firstRecord = first < sectorSize ? first : FLASH_LOG_NONE;
+  header.check = crc32(0, &header, offsetof(SectorHeader, check));
+  if (!device->write((sequence % sectorCount) * sectorSize, &header, sizeof(header))) {
+    return false;
+  }
+  if (!opened) {
+    oldestSequence = sequence;
+  }
+  opened = true;
+  openSequence = sequence;
+  return true;
+}
+
+// Drop the oldest sector, counting the unsent records that start in it
+void FlashLog::evictSector(uint32_t sequence) {
+  uint64_t limit = sectorStart(sequence + 1);
+  uint64_t position = cursor > tail ? cursor : tail;
+  while (position < limit && position < head) {
+    RecordHeader record;
+    if (!readRecordHeader(position, record)) {
+      break;
+    }
+    if (validRecord(record) && record.committed != FLASH_LOG_ERASED && record.sent == FLASH_LOG_ERASED) {
+      evicted++;
+      if (pending > 0) {
+        pending--;
+      }
+    }
+    position = skipRecord(position, record);
+  }
+  oldestSequence = sequence + 1;
+  tail = firstRecordFrom(oldestSequence);
+  if (tail > head) {
+    tail = head;
+  }
+  if (cursor < tail) {
+    cursor = tail;
+  }
+}
+
+// Write at position, opening sectors as the record crosses into them.
+// remaining counts the bytes of the record still to be written.
+bool FlashLog::appendBytes(uint64_t& position, const void* data, uint32_t length, uint32_t& remaining) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  while (length > 0) {
+    if (sequenceOf(position) > openSequence && !openSector(sequenceOf(position), remaining)) {
+      return false;
+    }
+    uint32_t room = sectorSize - (uint32_t)(position % sectorSize);
+    uint32_t step = length < room ? length : room;
+    if (!device->write(address(position), bytes, step)) {
+      return false;
+    }
+    bytes += step;
+    length -= step;
+    remaining -= step;
+    position = advance(position, step);
+  }
+  return true;
+}
+
+// Read across sector headers
+bool FlashLog::readBytes(uint64_t position, void* data, uint32_t length) {
+  uint8_t* bytes = (uint8_t*)data;
+  while (length > 0) {
+    uint32_t room = sectorSize - (uint32_t)(position % sectorSize);
+    uint32_t step = length < room ? length : room;
+    if (!device->read(address(position), bytes, step)) {
+      return false;
+    }
+    bytes += step;
+    length -= step;
+    position = advance(position, step);
+  }
+  return true;
+}
+
+bool FlashLog::readRecordHeader(uint64_t position, RecordHeader& header) {
+  return device->read(address(position), &header, sizeof(header));
+}
+
+bool FlashLog::validRecord(const RecordHeader& header) const {
+  return header.magic == FLASH_LOG_RECORD_MAGIC && header.metaLength <= header.length &&
+         header.length <= maxRecordLength() && header.check == crc32(0, &header, offsetof(RecordHeader, check));
+}
+
+// Step from the record at position to the next one. The sectors a record
+// runs into must say it continues there; if one does not, the record was
+// cut short by a power loss and the log carries on at that sector's first
+// record. A damaged header cannot be followed at all, so the rest of its
+// sector is given up.
+uint64_t FlashLog::skipRecord(uint64_t position, const RecordHeader& header) {
+  if (!validRecord(header)) {
+    return firstRecordFrom(sequenceOf(position) + 1);
+  }
+  uint64_t end = advance(position, sizeof(header) + header.length);
+  uint32_t last = sequenceOf(end);
+  for (uint32_t sequence = sequenceOf(position) + 1; sequence <= last && sequence <= openSequence; sequence++) {
+    SectorHeader sector;
+    uint32_t expected = sequence == last ? (uint32_t)(end % sectorSize) : FLASH_LOG_NONE;
+    if (!readSectorHeader(sequence, sector) || sector.firstRecord != expected) {
+      return firstRecordFrom(sequence);
+    }
+  }
+  return alignRecord(end);
+}
+
+// The first committed record at or after position
+bool FlashLog::recordFrom(uint64_t position, FlashLogRecord& record) {
+  while (position < head) {
+    RecordHeader header;
+    if (!readRecordHeader(position, header)) {
+      return false;
+    }
+    if (validRecord(header) && header.committed != FLASH_LOG_ERASED) {
+      record.position = position;
+      record.length = header.length - header.metaLength;
+      record.metaLength = header.metaLength;
+      return true;
+    }
+    position = skipRecord(position, header);
+  }
+  return false;
+}
+
+// Where the first record starts in the sectors from sequence on, or just
+// past the newest sector if none does
+uint64_t FlashLog::firstRecordFrom(uint32_t sequence) {
+  for (; opened && sequence <= openSequence; sequence++) {
+    SectorHeader sector;
+    if (readSectorHeader(sequence, sector) && sector.firstRecord != FLASH_LOG_NONE) {
+      return alignRecord(sectorStart(sequence) + sector.firstRecord);
+    }
+  }
+  return sectorStart(sequence) + sizeof(SectorHeader);
+}
+
+// Move position on by length bytes of records, skipping sector headers
+uint64_t FlashLog::advance(uint64_t position, uint32_t length) const {
+  while (length > 0) {
+    uint32_t room = sectorSize - (uint32_t)(position % sectorSize);
+    uint32_t step = length < room ? length : room;
+    position += step;
+    length -= step;
+    if (position % sectorSize == 0) {
+      position += sizeof(SectorHeader);
+    }
+  }
+  return position;
+}
+
+// A record header that would not fit before the end of the sector goes
+// to the start of the next one
+uint64_t FlashLog::alignRecord(uint64_t position) const {
+  if (sectorSize - position % sectorSize < sizeof(RecordHeader)) {
+    return sectorStart(sequenceOf(position) + 1) + sizeof(SectorHeader);
+  }
+  return position;
+}
+
+uint32_t FlashLog::address(uint64_t position) const {
+  return (sequenceOf(position) % sectorCount) * sectorSize + (uint32_t)(position % sectorSize);
+}
@@ -0,0 +1,130 @@
+/*
+  FlashLog - crash-safe ring log of records on raw NOR flash
+
+  Records (a small caller-defined metadata block followed by a payload)
+  are appended one after another through a region of equally sized
+  sectors and wrap around at its end, so every sector is erased once per
+  lap and wear is spread evenly over the whole region. When the head
+  needs a sector that still holds unsent records, the oldest sector is
+  erased and its records are dropped. The footprint is the region handed
+  in, nothing more.
+
+  Between erases the log only ever clears bits. A record is written,
+  then committed by clearing a flag word, and marked sent by clearing
+  another. Each sector starts with a header carrying its sequence number
+  and where its first record begins, so begin() rebuilds the head and
+  tail from the flash alone and power may be cut at any point: a record
+  without its commit flag is skipped, never returned. Payloads carry a
+  CRC-32 that read() checks.
+
+  Not thread safe, one task owns the log. Has no Arduino dependencies.
+*/
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Raw access to the flash region holding the log. Addresses are
+// relative to its start.
+class FlashDevice {
+public:
+  virtual ~FlashDevice() {}
+  virtual bool read(uint32_t address, void* data, size_t length) = 0;
+  virtual bool write(uint32_t address, const void* data, size_t length) = 0;  // Clears bits only
+  virtual bool erase(uint32_t sector) = 0;                                      // Sets every bit
+  virtual uint32_t sectorSize() const = 0;
+  virtual uint32_t sectorCount() const = 0;
+};
+
+struct FlashLogRecord {
+  uint64_t position;           // Where the record starts, only meaningful to the log
+  uint32_t length;             // Payload bytes
+  uint16_t metaLength;
+};
+
+class FlashLog {
+public:
+  FlashLog();
+
+  // Recover the log from what is on the device, starting an empty one on
+  // a blank or foreign region. Needs at least 3 sectors.
+  bool begin(FlashDevice* device);
+
+  // Append a record. Returns once it is committed, false if the device
+  // failed or the record can never fit (see maxRecordLength()).
+  bool append(const void* meta, uint16_t metaLength, const void* data, uint32_t length);
+
+  // The oldest committed record not yet marked sent
+  bool peek(FlashLogRecord& record);
+
+  // Read a record found by peek() or a walk into buffers of its lengths.
+  // A record that fails its CRC is marked sent and counted as corrupt.
+  bool read(const FlashLogRecord& record, void* meta, void* data);
+
+  bool markSent(const FlashLogRecord& record);
+
+  // Walk every committed record still on flash, sent or not, oldest
+  // first: first(), then next() with the record it last returned
+  bool first(FlashLogRecord& record);
+  bool next(FlashLogRecord& record);
+  // Read only a record's metadata, the CRC is not checked
+  bool readMeta(const FlashLogRecord& record, void* meta);
+
+  uint32_t pendingCount() const { return pending; }
+  uint32_t evictedCount() const { return evicted; }     // Unsent records dropped for space
+  uint32_t corruptCount() const { return corrupt; }
+  uint32_t erasesCount() const { return erases; }       // Since begin()
+  uint32_t maxRecordLength() const;                      // Metadata and payload together
+
+private:
+  struct SectorHeader {
+    uint32_t magic;
+    uint32_t sequence;         // Increases by one per sector opened, never reused
+    uint32_t firstRecord;      // Offset of the first record starting here, all ones if none
+    uint32_t check;            // CRC-32 of the fields above
+  };
+
+  struct RecordHeader {
+    uint32_t length;           // Metadata and payload bytes after the header
+    uint16_t metaLength;
+    uint16_t magic;
+    uint32_t crc;              // CRC-32 of metadata and payload
+    uint32_t check;            // CRC-32 of the fields above, catches a torn header
+    uint32_t committed;        // Cleared once the whole record is on flash
+    uint32_t sent;             // Cleared once the record has been forwarded
+  };
+
+  bool readSectorHeader(uint32_t sequence, SectorHeader& header);
+  bool openSector(uint32_t sequence, uint32_t continuing);
+  void evictSector(uint32_t sequence);
+  bool appendBytes(uint64_t& position, const void* data, uint32_t length, uint32_t& remaining);
+  bool readBytes(uint64_t position, void* data, uint32_t length);
+  bool readRecordHeader(uint64_t position, RecordHeader& header);
+  bool validRecord(const RecordHeader& header) const;
+  uint64_t skipRecord(uint64_t position, const RecordHeader& header);
+  bool recordFrom(uint64_t position, FlashLogRecord& record);
+  uint64_t firstRecordFrom(uint32_t sequence);
+  uint64_t advance(uint64_t position, uint32_t length) const;
+  uint64_t alignRecord(uint64_t position) const;
+  uint64_t sectorStart(uint32_t sequence) const { return (uint64_t)sequence * sectorSize; }
+  uint32_t sequenceOf(uint64_t position) const { return (uint32_t)(position / sectorSize); }
+  uint32_t address(uint64_t position) const;
+
+  FlashDevice* device;
+  uint32_t sectorSize;
+  uint32_t sectorCount;
+  bool opened;                 // A sector has been opened, openSequence is valid
+  uint32_t openSequence;       // Newest sector in use
+  uint32_t oldestSequence;     // Oldest sector still holding part of the log
+  uint64_t head;               // Where the next record goes
+  uint64_t tail;               // Oldest record still on flash
+  uint64_t cursor;             // No record before it is waiting to be sent
+  uint32_t pending;
+  uint32_t evicted;
+  uint32_t corrupt;
+  uint32_t erases;
+};
+
+#endif
@@ -0,0 +1,48 @@
+/*
+  PartitionFlash - FlashLog device on an ESP32 flash partition
+
+  Addresses are relative to the partition, which is erased in the SPI
+  flash's 4 KB sectors. FlashLog clears bits in words it has already
+  written, which the flash allows unless flash encryption is on, so an
+  encrypted partition is refused.
+*/
+
+#ifndef PARTITION_FLASH_H
+#define PARTITION_FLASH_H
+
+#include "FlashLog.h"
+#include "esp_partition.h"
+
+#define PARTITION_FLASH_SECTOR_SIZE 4096
+
+class PartitionFlash : public FlashDevice {
+public:
+  PartitionFlash() : partition(NULL) {}
+
+  // Find the data partition with this label
+  bool begin(const char* label) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    return partition != NULL && !partition->encrypted;
+  }
+
+  bool read(uint32_t address, void* data, size_t length) override {
+    return esp_partition_read(partition, address, data, length) == ESP_OK;
+  }
+
+  bool write(uint32_t address, const void* data, size_t length) override {
+    return esp_partition_write(partition, address, data, length) == ESP_OK;
+  }
+
+  bool erase(uint32_t sector) override {
+    return esp_partition_erase_range(partition, sector * PARTITION_FLASH_SECTOR_SIZE,
+                                     PARTITION_FLASH_SECTOR_SIZE) == ESP_OK;
+  }
+
+  uint32_t sectorSize() const override { return PARTITION_FLASH_SECTOR_SIZE; }
+  uint32_t sectorCount() const override { return partition->size / PARTITION_FLASH_SECTOR_SIZE; }
+
+private:
+  const esp_partition_t* partition;
+};
+
+#endif
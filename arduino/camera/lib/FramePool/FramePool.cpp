@@ -0,0 +1,80 @@
+#include "FramePool.h"
+
+#include <string.h>
+
+FramePool::FramePool() : size(0), count(0), peak(0) {
+  memset(frames, 0, sizeof(frames));
+}
+
+bool FramePool::begin(uint8_t* arena, size_t slotSize, uint8_t slotCount) {
+  if (!arena || slotSize == 0 || slotCount == 0 || slotCount > FRAME_POOL_MAX_SLOTS) {
+    return false;
+  }
+  for (uint8_t i = 0; i < slotCount; i++) {
+    frames[i].buf = arena + i * slotSize;
+    frames[i].len = 0;
+    frames[i].refs = 0;
+  }
+  size = slotSize;
+  count = slotCount;
+  peak = 0;
+  return true;
+}
+
+PooledFrame* FramePool::store(const uint8_t* data, size_t length, uint16_t width, uint16_t height,
+                              uint32_t capturedAt) {
+  if (length > size) {
+    return NULL;
+  }
+  PooledFrame* frame = claim();
+  if (!frame) {
+    return NULL;
+  }
+  memcpy(frame->buf, data, length);
+  frame->len = length;
+  frame->width = width;
+  frame->height = height;
+  frame->capturedAt = capturedAt;
+  return frame;
+}
+
+PooledFrame* FramePool::claim() {
+  for (uint8_t i = 0; i < count; i++) {
+    // Claim the slot by moving its count from 0 to 1, so two callers can
+    // never fill the same one
+    uint32_t expected = 0;
+    if (!__atomic_compare_exchange_n(&frames[i].refs, &expected, 1, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      continue;
+    }
+    // Both cores claim slots, so the peak is raised atomically too
+    uint8_t inUse = count - freeSlots();
+    uint8_t seen = __atomic_load_n(&peak, __ATOMIC_RELAXED);
+    while (inUse > seen &&
+           !__atomic_compare_exchange_n(&peak, &seen, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return &frames[i];
+  }
+  return NULL;
+}
+
+void FramePool::retain(PooledFrame* frame) {
+  __atomic_fetch_add(&frame->refs, 1, __ATOMIC_RELAXED);
+}
+
+void FramePool::release(PooledFrame* frame) {
+  if (frame) {
+    // Release ordering so the next owner of the slot sees every read done
+    __atomic_fetch_sub(&frame->refs, 1, __ATOMIC_RELEASE);
+  }
+}
+
+uint8_t FramePool::freeSlots() const {
+  uint8_t free = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (__atomic_load_n(&frames[i].refs, __ATOMIC_RELAXED) == 0) {
+      free++;
+    }
+  }
+  return free;
+}
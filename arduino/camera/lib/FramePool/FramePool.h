@@ -0,0 +1,67 @@
+/*
+  FramePool - fixed arena of reference-counted frame slots
+
+  Frames are copied out of the camera driver into equally sized slots as
+  soon as they are captured, so the driver gets its buffers straight back
+  and a burst is no longer limited by fb_count. The arena is handed in
+  once at startup (PSRAM on the camera) and never freed, so memory use
+  is fixed and bursts cannot fragment the heap.
+
+  store() returns a frame holding one reference. Everyone else that
+  needs the same frame (the web page, the MQTT uploader) retains it
+  instead of copying, and the slot is reused once the last holder
+  releases it. Reference counts are atomic, so holders may run on
+  different cores. Has no Arduino dependencies.
+*/
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_POOL_MAX_SLOTS 16
+
+struct PooledFrame {
+  uint8_t* buf;
+  size_t len;
+  uint16_t width;
+  uint16_t height;
+  uint32_t capturedAt;         // Caller's timestamp, millis() on the camera
+  uint32_t refs;               // Owned by the pool, use retain()/release()
+};
+
+class FramePool {
+public:
+  FramePool();
+
+  // Split arena into slotCount slots of slotSize bytes each. The arena
+  // must hold slotCount * slotSize bytes and outlive the pool.
+  bool begin(uint8_t* arena, size_t slotSize, uint8_t slotCount);
+
+  // Copy a frame into a free slot. Returns NULL if every slot is held or
+  // the frame is larger than a slot.
+  PooledFrame* store(const uint8_t* data, size_t length, uint16_t width, uint16_t height,
+                     uint32_t capturedAt);
+
+  // Take a free slot to fill in place, such as straight from flash. The
+  // caller sets len and the other fields before sharing the frame.
+  PooledFrame* claim();
+
+  // Work on frames from any pool
+  static void retain(PooledFrame* frame);
+  static void release(PooledFrame* frame);   // NULL is ignored
+
+  size_t slotSize() const { return size; }
+  uint8_t slotCount() const { return count; }
+  uint8_t freeSlots() const;
+  uint8_t peakInUse() const { return __atomic_load_n(&peak, __ATOMIC_RELAXED); }
+
+private:
+  PooledFrame frames[FRAME_POOL_MAX_SLOTS];
+  size_t size;
+  uint8_t count;
+  uint8_t peak;
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "MjpegStreamer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const char RESPONSE_HEADER[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=" MJPEG_BOUNDARY "\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char PART_END[] = "\r\n";
+
+MjpegStreamer::MjpegStreamer(MjpegWriteFn write, MjpegCloseFn close)
+    : writeFn(write), closeFn(close), latest(NULL), latestSequence(0), viewers(0), sent(0), skipped(0) {
+  memset(slots, 0, sizeof(slots));
+}
+
+bool MjpegStreamer::addViewer(void* connection) {
+  for (int i = 0; i < MJPEG_MAX_VIEWERS; i++) {
+    Viewer& viewer = slots[i];
+    if (viewer.connection) {
+      continue;
+    }
+    viewer.connection = connection;
+    viewer.frame = NULL;
+    viewer.sequence = latest ? latestSequence - 1 : latestSequence;  // Current frame goes first
+    viewer.stage = STAGE_RESPONSE;
+    viewer.offset = 0;
+    viewers++;
+    return true;
+  }
+  return false;
+}
+
+void MjpegStreamer::publish(PooledFrame* frame) {
+  if (!frame) {
+    return;
+  }
+  FramePool::retain(frame);
+  FramePool::release(latest);
+  latest = frame;
+  latestSequence++;
+}
+
+void MjpegStreamer::poll() {
+  for (int i = 0; i < MJPEG_MAX_VIEWERS; i++) {
+    if (slots[i].connection && !pump(slots[i])) {
+      close(slots[i]);
+    }
+  }
+}
+
+void MjpegStreamer::closeAll() {
+  for (int i = 0; i < MJPEG_MAX_VIEWERS; i++) {
+    if (slots[i].connection) {
+      close(slots[i]);
+    }
+  }
+  FramePool::release(latest);
+  latest = NULL;
+}
+
+// Pick up the newest frame, counting the ones this viewer never got
+void MjpegStreamer::startFrame(Viewer& viewer) {
+  if (viewer.frame) {
+    skipped += latestSequence - viewer.sequence - 1;
+  }
+  FramePool::release(viewer.frame);
+  FramePool::retain(latest);
+  viewer.frame = latest;
+  viewer.sequence = latestSequence;
+  viewer.partHeaderLength = snprintf(viewer.partHeader, sizeof(viewer.partHeader),
+                                     "--" MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+                                     (unsigned)latest->len);
+  viewer.stage = STAGE_PART_HEADER;
+  viewer.offset = 0;
+}
+
+// Send as much as the connection takes. Returns false once it is closed.
+bool MjpegStreamer::pump(Viewer& viewer) {
+  for (;;) {
+    const uint8_t* data;
+    size_t length;
+    switch (viewer.stage) {
+      case STAGE_RESPONSE:
+        data = (const uint8_t*)RESPONSE_HEADER;
+        length = sizeof(RESPONSE_HEADER) - 1;
+        break;
+      case STAGE_PART_HEADER:
+        data = (const uint8_t*)viewer.partHeader;
+        length = viewer.partHeaderLength;
+        break;
+      case STAGE_BODY:
+        data = viewer.frame->buf;
+        length = viewer.frame->len;
+        break;
+      case STAGE_PART_END:
+        data = (const uint8_t*)PART_END;
+        length = sizeof(PART_END) - 1;
+        break;
+      default:
+        if (!latest || viewer.sequence == latestSequence) {
+          return true;
+        }
+        startFrame(viewer);
+        continue;
+    }
+
+    int written = writeFn(viewer.connection, data + viewer.offset, length - viewer.offset);
+    if (written < 0) {
+      return false;
+    }
+    viewer.offset += written;
+    if (viewer.offset < length) {
+      return true;  // Socket buffer full, resume on the next poll
+    }
+    viewer.offset = 0;
+    if (viewer.stage == STAGE_PART_END) {
+      sent++;
+    }
+    viewer.stage = (viewer.stage == STAGE_RESPONSE || viewer.stage == STAGE_PART_END) ? STAGE_IDLE
+                                                                                      : viewer.stage + 1;
+  }
+}
+
+void MjpegStreamer::close(Viewer& viewer) {
+  FramePool::release(viewer.frame);
+  closeFn(viewer.connection);
+  viewer.connection = NULL;
+  viewer.frame = NULL;
+  viewers--;
+}
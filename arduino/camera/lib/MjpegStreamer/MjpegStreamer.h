@@ -0,0 +1,85 @@
+/*
+  MjpegStreamer - one shared frame streamed to several MJPEG viewers
+
+  Each viewer is sent a multipart/x-mixed-replace response made of the
+  latest published frame. Frames are never copied or re-captured per
+  viewer: a viewer holds a FramePool reference to the frame it is in
+  the middle of sending, and when it finishes it moves on to whatever is
+  newest, so a slow viewer skips frames rather than holding back the
+  others.
+
+  Nothing blocks. The connection is written through a callback that
+  returns how many bytes the socket took right now (0 if its buffer is
+  full, negative once it is closed), and poll() resumes each viewer
+  where it left off. Has no Arduino dependencies.
+*/
+
+#ifndef MJPEG_STREAMER_H
+#define MJPEG_STREAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <FramePool.h>
+
+#define MJPEG_MAX_VIEWERS 4
+#define MJPEG_BOUNDARY "frame"
+
+// Bytes accepted, 0 when the write would block, negative when closed
+typedef int (*MjpegWriteFn)(void* connection, const uint8_t* data, size_t length);
+typedef void (*MjpegCloseFn)(void* connection);
+
+class MjpegStreamer {
+public:
+  MjpegStreamer(MjpegWriteFn write, MjpegCloseFn close);
+
+  // Start streaming to a connection whose request has been read.
+  // Returns false when every viewer slot is taken.
+  bool addViewer(void* connection);
+
+  // Make frame the one viewers send next. The streamer keeps its own
+  // reference until a newer frame replaces it.
+  void publish(PooledFrame* frame);
+
+  // Write what each viewer's connection will take right now
+  void poll();
+
+  void closeAll();
+
+  uint8_t viewerCount() const { return viewers; }
+  uint32_t framesSent() const { return sent; }
+  uint32_t framesSkipped() const { return skipped; }
+
+private:
+  enum Stage {
+    STAGE_RESPONSE,                // HTTP response header, once per viewer
+    STAGE_PART_HEADER,             // Boundary and part headers
+    STAGE_BODY,                    // The JPEG itself
+    STAGE_PART_END,
+    STAGE_IDLE                     // Waiting for a newer frame
+  };
+
+  struct Viewer {
+    void* connection;              // NULL when the slot is free
+    PooledFrame* frame;            // Frame being sent, holds a reference
+    uint32_t sequence;             // Publish sequence number of that frame
+    uint8_t stage;
+    size_t offset;                 // Bytes of the current stage already sent
+    char partHeader[80];
+    uint8_t partHeaderLength;
+  };
+
+  bool pump(Viewer& viewer);
+  void startFrame(Viewer& viewer);
+  void close(Viewer& viewer);
+
+  MjpegWriteFn writeFn;
+  MjpegCloseFn closeFn;
+  Viewer slots[MJPEG_MAX_VIEWERS];
+  PooledFrame* latest;
+  uint32_t latestSequence;
+  uint8_t viewers;
+  uint32_t sent;
+  uint32_t skipped;
+};
+
+#endif
@@ -18,6 +18,12 @@
 #include <WiFiClientSecure.h>  // For secure MQTT connection
 #include <PubSubClient.h>      // MQTT client
 #include <ArduinoJson.h>       // For JSON formatting
+#include <FramePool.h>
+#include <MjpegStreamer.h>
+#include <FlashLog.h>
+#include <PartitionFlash.h>
+#include <BurstScore.h>
+#include "lwip/sockets.h"      // Non-blocking writes for the stream
 
 // WiFi credentials - replace with your network credentials
 const char* ssid = "Mi 11X";
@@ -32,24 +38,242 @@ const char* mqtt_password = "Laptop99@!"; // ESP32-specific password
 
 // MQTT topics
 char mqtt_topic_image[50]; // For image data
+char mqtt_topic_status[50]; // For event summaries
+char mqtt_topic_request[50]; // Frames the server asks for
 
 // Web server will run on port 80
 WebServer server(80);
 
+// Page served as-is from flash; motion status comes from /status
+static const char INDEX_HTML[] PROGMEM = R"rawliteral(<!DOCTYPE html><html><head>
+<meta name='viewport' content='width=device-width, initial-scale=1.0'>
+<title>ESP32-CAM Motion Detection</title>
+<style>
+body { font-family: Arial, sans-serif; text-align: center; margin: 20px; }
+img { max-width: 100%; height: auto; border: 2px solid #444; }
+button { background-color: #0275d8; color: white; padding: 10px 20px; border: none; border-radius: 4px; margin: 10px; cursor: pointer; }
+</style></head><body>
+<h1>ESP32-CAM Motion Detection</h1>
+<p id='status'>No motion detected yet.</p>
+<img src='/stream' alt='Live view'>
+<p><button onclick="location.href='/capture'">Capture New Image</button></p>
+<script>
+function update() {
+  fetch('/status').then(r => r.json()).then(s => {
+    document.getElementById('status').textContent = s.motion ?
+      'Motion detected ' + s.since + ' seconds ago.' : 'No motion detected yet.';
+  });
+}
+update();
+setInterval(update, 5000);
+</script>
+</body></html>)rawliteral";
+
 // Flag to indicate if motion was detected
 bool motionDetected = false;
-// Variable to store the latest camera image
-camera_fb_t * fb = NULL;
-// Array to store multiple camera images
-camera_fb_t* images[5] = {NULL, NULL, NULL, NULL, NULL};
+// Frames are copied out of the driver into a fixed pool as soon as they
+// are captured; the burst, the web page and the uploader share the copies
+#define BURST_LENGTH 5                          // Photos taken per motion event
+#define FRAME_SLOT_SIZE (1600 * 1200 / 5)       // Driver's JPEG buffer size at UXGA, any frame fits
+#define FRAME_POOL_SLOTS (BURST_LENGTH + 2)     // A burst, the frame still on the web page and a stored image being sent
+#define FRAME_SLOT_SIZE_DRAM (800 * 600 / 5)    // Without PSRAM the sensor runs at SVGA
+#define FRAME_POOL_SLOTS_DRAM 1
+FramePool framePool;
+// Latest image for the web page
+PooledFrame* latestFrame = NULL;
+
+// Pre-trigger ring: while awake, low resolution frames are kept so an
+// event also shows the moments before the PIR fired
+#ifndef PRE_TRIGGER
+#define PRE_TRIGGER 1                            // 0 = events start at the trigger
+#endif
+#define PRE_TRIGGER_DEPTH 8                      // Frames kept from before the trigger
+#define PRE_TRIGGER_INTERVAL 250                 // ms between ring frames, 2 s of history at depth 8
+#define PRE_TRIGGER_FRAME_SIZE FRAMESIZE_QVGA
+#define PRE_TRIGGER_SLOT_SIZE (320 * 240 / 5)    // Driver's JPEG buffer size at QVGA
+FramePool preTriggerPool;          // Extra slots for frames viewers are still being sent
+PooledFrame* preTriggerRing[PRE_TRIGGER_DEPTH];
+int ringIndex = 0;                 // Next slot to write, the oldest frame once full
+int ringCount = 0;
+bool preTriggerEnabled = false;    // Needs PSRAM
+unsigned long lastRingCapture = 0;
+
+// Live view: /stream sends every viewer the same frames as MJPEG. With
+// the ring running it streams the ring's frames, otherwise frames are
+// captured for it at the ring's size only while someone is watching.
+// Those go to a pool of their own: viewers hold the frames they are
+// sending, which in the frame pool would leave a burst without slots.
+#define STREAM_INTERVAL 250                      // ms between stream frames without the ring
+#define STREAM_FRAME_SIZE PRE_TRIGGER_FRAME_SIZE
+#define STREAM_SLOT_SIZE PRE_TRIGGER_SLOT_SIZE
+#define STREAM_POOL_SLOTS (2 + MJPEG_MAX_VIEWERS) // The frame viewers are sent next, its replacement and one per viewer still sending an older one
+#define STREAM_POOL_SLOTS_DRAM 2                 // Slow viewers skip more frames
+FramePool streamPool;
+WiFiClient streamClients[MJPEG_MAX_VIEWERS];
+unsigned long lastStreamCapture = 0;
+
+// Sensor state, bursts switch to full size and back
+framesize_t burstFrameSize = FRAMESIZE_UXGA;
+framesize_t currentFrameSize = FRAMESIZE_UXGA;
+int cameraFbCount = 2;
+
+// Frames of the last event in capture order: the pre-trigger frames
+// followed by the burst
+#define EVENT_MAX_FRAMES (PRE_TRIGGER_DEPTH + BURST_LENGTH)
+PooledFrame* images[EVENT_MAX_FRAMES];
+int imageCount = 0;
+RTC_DATA_ATTR uint32_t eventId = 0;   // Kept across deep sleep so IDs do not repeat
+unsigned long triggerTime = 0;
+uint8_t eventFrames = 0;           // Frames planned for the event, a failed capture leaves a gap
+
+// Burst pipeline: loop() captures on core 1 and hands each frame to an
+// upload task on core 0, so the first image is on its way while the
+// rest of the burst is still being taken
+#ifndef BURST_PIPELINE
+#define BURST_PIPELINE 1                         // 0 = capture the whole event, then upload it in turn
+#endif
+#define UPLOAD_QUEUE_DEPTH (EVENT_MAX_FRAMES + 2)  // An event's frames, its thumbnail and its end marker
+#define UPLOAD_TASK_CORE 0                       // Same core as the WiFi stack, loop() runs on core 1
+#define UPLOAD_DRAIN_TIMEOUT 30000               // Longest wait for queued uploads before sleeping (ms)
+struct UploadItem {
+  PooledFrame* frame;              // Holds its own reference, NULL marks the end of the event
+  uint32_t eventId;
+  unsigned long triggerTime;
+  uint8_t imageNumber;             // Frames in the event for the end marker
+  uint8_t eventFrames;
+};
+#if BURST_PIPELINE
+QueueHandle_t uploadQueue;
+volatile uint32_t uploadsPending = 0;  // Queued or being sent
+volatile bool networkStarted = false;  // connectToWiFi() has returned, uploads no longer wait for it
+#endif
+
+// When the images of an event reached the broker, relative to the trigger
+struct EventTiming {
+  uint32_t eventId;
+  unsigned long firstImageMs;
+  unsigned long lastImageMs;
+  uint8_t images;
+};
+EventTiming eventTiming = {0, 0, 0, 0};
 // Time when motion was detected
 unsigned long lastMotionTime = 0;
 // How long to keep the server running after motion (in milliseconds)
 const unsigned long KEEP_AWAKE_DURATION = 60000; // 1 minute
 // Add this constant at the top with other constants
 const unsigned long MOTION_RESET_TIME = 5000; // 5 seconds before allowing new motion detection
-// Delay between consecutive photos (milliseconds)
-const unsigned long PHOTO_DELAY = 500; 
+// Delay between consecutive photos (milliseconds), 0 takes them at the
+// sensor's frame rate
+const unsigned long PHOTO_DELAY = 0;
+
+// Image upload configuration
+#define IMAGE_CHUNK_SIZE 10000     // Base64 characters per MQTT message
+#define BASE64_BLOCK_INPUT 768     // Frame bytes encoded per write (multiple of 3)
+#define MQTT_RETRY_INTERVAL 5000   // ms between broker connection attempts
+unsigned long lastMqttAttempt = 0;
+bool mqttAttempted = false;
+
+// Store and forward: images that cannot be sent are appended to a ring
+// log on the "imagelog" flash partition (partitions.csv) and sent oldest
+// first once the broker is back. A full log drops its oldest images.
+// Event summaries wait in the same log, as records without metadata.
+// Flash writes pause both cores briefly, so only the uploader writes it.
+#define IMAGE_LOG_PARTITION "imagelog"
+#define STORED_DRAIN_INTERVAL 1000       // ms between stored images sent, live events go first
+#define EVENT_SUMMARY_SIZE 384           // Longest event summary, with its burst scores
+struct StoredImage {                     // Kept ahead of each JPEG in the log
+  uint32_t eventId;
+  int32_t triggerOffset;                 // ms from the trigger to the capture
+  uint16_t width;
+  uint16_t height;
+  uint8_t imageNumber;
+  uint8_t eventFrames;
+};
+PartitionFlash imageFlash;
+FlashLog imageLog;
+bool imageLogReady = false;
+unsigned long lastStoredDrain = 0;
+
+// Two-tier publishing: an event goes out as one QVGA thumbnail, taken
+// after the burst while the flash is still lit. Its frames are kept on
+// the "framestore" partition and published only when the server asks on
+// cameras/<id>/request with {"event_id":N,"frame":I}, leaving out
+// "frame" for all of them. The store wraps, dropping its oldest frames.
+#ifndef TWO_TIER
+#define TWO_TIER 1                               // 0 = every frame of an event is published
+#endif
+#define THUMBNAIL_FRAME_SIZE FRAMESIZE_QVGA
+#define THUMBNAIL_SLOT_SIZE (320 * 240 / 5)      // Driver's JPEG buffer size at QVGA
+#define THUMBNAIL_SLOTS 2                        // The last event's and one still being sent
+#define THUMBNAIL_SLOTS_DRAM 1
+#define THUMBNAIL_IMAGE_NUMBER 255               // An event's frames are numbered from 0
+#define FRAME_STORE_PARTITION "framestore"
+#define FRAME_REQUEST_QUEUE 8                    // Requests waiting to be served
+#define FRAME_REQUEST_DOC_SIZE 128               // {"event_id":N,"frame":I} with room for a few more members
+struct FrameRequest {
+  uint32_t eventId;
+  int16_t imageNumber;                   // -1 for every frame of the event
+};
+FramePool thumbnailPool;
+PooledFrame* thumbnail = NULL;     // The last event's, NULL if it could not be taken
+PartitionFlash frameFlash;
+FlashLog frameStore;
+bool frameStoreReady = false;
+FrameRequest frameRequests[FRAME_REQUEST_QUEUE];
+uint8_t frameRequestCount = 0;
+
+// Best-frame selection: the uploader scores each burst frame from its
+// JPEG stream (sharpness, exposure and change from the oldest
+// pre-trigger frame, see BurstScore) and holds the burst until its end.
+// Only the best BEST_FRAMES are then uploaded, or kept for requests with
+// two-tier publishing, and the event summary carries every burst
+// frame's score. Pre-trigger frames and the thumbnail are not scored.
+#define BEST_FRAMES 2                            // BURST_LENGTH uploads the whole burst
+#define SCORE_WEIGHT_SHARPNESS 5
+#define SCORE_WEIGHT_EXPOSURE 3
+#define SCORE_WEIGHT_CHANGE 2
+#define SCORE_MAP_BLOCKS (200 * 150)             // One value per 8x8 luma block at UXGA
+#define SCORE_MAP_BLOCKS_DRAM (100 * 75)         // At SVGA
+struct BurstResult {                             // The last burst's scores, for its event summary
+  uint32_t eventId;
+  uint8_t count;
+  uint8_t imageNumbers[BURST_LENGTH];
+  uint16_t scores[BURST_LENGTH];
+  bool kept[BURST_LENGTH];
+};
+BurstScorer burstScorer;
+BurstScoreWeights scoreWeights = {SCORE_WEIGHT_SHARPNESS, SCORE_WEIGHT_EXPOSURE, SCORE_WEIGHT_CHANGE};
+uint8_t bestFrameCount = BEST_FRAMES;
+UploadItem heldBurst[BURST_LENGTH];    // Burst frames waiting for the end of their burst
+FrameMeasure heldMeasures[BURST_LENGTH];
+uint8_t heldCount = 0;
+uint32_t scoredEventId = 0;
+BurstResult burstResult = {0, 0, {0}, {0}, {false}};
+
+// Fast wake: a PIR wake takes its burst before the radio is started, and
+// rejoins with the AP and lease of the last full join so it skips the
+// scan and DHCP
+#define WIFI_FAST_JOIN_TIMEOUT 3000      // Wait for a cached rejoin before scanning (ms)
+#define WIFI_JOIN_TIMEOUT 20000          // Full scan and DHCP (ms)
+#define NETWORK_CACHE_REUSES 20          // Cached rejoins before the lease is renewed with DHCP
+#define WAKE_SETTLE_TIME 200             // Sensor exposure settling after init before the wake burst (ms)
+struct NetworkCache {
+  bool valid;
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint16_t reuses;
+};
+RTC_DATA_ATTR NetworkCache networkCache = {false, {0}, 0, 0, 0, 0, 0, 0};
+bool motionWake = false;
+// ms since boot, 0 until they happen. The boot loader's time before
+// millis() starts is not included.
+unsigned long wakeToCapture = 0;
+unsigned long wakeToPublish = 0;
+uint32_t wakeEventId = 0;          // The event taken on wake, 0 on other boots
 
 // WiFi and MQTT clients
 WiFiClientSecure espClient;
@@ -75,6 +299,54 @@ PubSubClient mqttClient(espClient);
 #define LED_PIN           4
 #define PIR_PIN           13
 
+// Function prototypes, a .cpp file does not get them generated like a sketch
+void initCamera();
+void initFramePool();
+void initImageLog();
+void setFrameSize(framesize_t size);
+bool connectToWiFi();
+bool waitForWiFi(unsigned long timeout);
+PooledFrame* capturePhoto();
+void captureRingFrame();
+void captureStreamFrame();
+void captureMultiplePhotos();
+void captureThumbnail();
+void addEventFrame(PooledFrame* frame);
+void sendEvent();
+void releaseImages();
+#if BURST_PIPELINE
+void queueUpload(const UploadItem& item, bool ahead = false);
+void uploadTask(void* parameter);
+#endif
+void uploadEventFrame(const UploadItem& item);
+void deliverEventFrame(const UploadItem& item);
+void holdBurstFrame(const UploadItem& item);
+void releaseBurst(uint32_t eventId);
+void publishEventTiming(const UploadItem& end);
+bool publishStatus(const char* msg);
+void storeStatus(const char* msg);
+bool appendImage(FlashLog& log, const UploadItem& item);
+void storeImage(const UploadItem& item);
+void keepFrame(const UploadItem& item);
+void drainStoredImage();
+void mqttCallback(char* topic, byte* payload, unsigned int length);
+void serveFrameRequest();
+void setupWebServer();
+void handleRoot();
+void handleStatus();
+void handleCapture();
+void handleImage();
+void handleStream();
+int streamWrite(void* connection, const uint8_t* data, size_t length);
+void streamClose(void* connection);
+void handleNotFound();
+bool reconnectMQTT();
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out);
+bool sendImageViaMQTT(const UploadItem& item);
+
+// Declared after the prototypes it is built from
+MjpegStreamer streamer(streamWrite, streamClose);
+
 void setup() {
   WRITE_PERI_REG(RTC_CNTL_BROWN_OUT_REG, 0); // Disable brownout detector
   Serial.begin(115200);
@@ -84,12 +356,14 @@ void setup() {
   esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
   if(wakeup_reason == ESP_SLEEP_WAKEUP_EXT0) {
     Serial.println("Wakeup caused by external signal using RTC_IO (PIR)");
+    motionWake = true;
     motionDetected = true;
     lastMotionTime = millis();
   }
   
   // Initialize camera
   initCamera();
+  initFramePool();
   
   // Setup LED
   pinMode(LED_PIN, OUTPUT);
@@ -98,41 +372,81 @@ void setup() {
   // Setup PIR sensor pin
   pinMode(PIR_PIN, INPUT);
   
-  // Connect to WiFi
-  connectToWiFi();
-  
   // Skip certificate verification (for testing only)
   espClient.setInsecure();
   
   // Set up MQTT connection
   mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setCallback(mqttCallback);
   
   // Create the MQTT topic
   sprintf(mqtt_topic_image, "cameras/%s/image", device_id);
+  sprintf(mqtt_topic_status, "cameras/%s/status", device_id);
+  sprintf(mqtt_topic_request, "cameras/%s/request", device_id);
   
-  // Start web server
-  setupWebServer();
+#if BURST_PIPELINE
+  // The upload task owns the MQTT client from here on, it waits for WiFi
+  uploadQueue = xQueueCreate(UPLOAD_QUEUE_DEPTH, sizeof(UploadItem));
+  xTaskCreatePinnedToCore(uploadTask, "upload", 8192, NULL, 1, NULL, UPLOAD_TASK_CORE);
+#endif
   
-  if (motionDetected) {
-    // Take pictures when motion is detected
+  if (motionWake) {
+    // Take the pictures before the radio is up, they are held in the
+    // frame pool until the network is. The sensor streams from init, so
+    // its auto exposure only needs a moment.
+    delay(WAKE_SETTLE_TIME);
     captureMultiplePhotos();
+    wakeEventId = eventId;
+  }
+  
+  // Images left from an earlier outage go out after the new ones
+  initImageLog();
+  
+  // Connect to WiFi
+  connectToWiFi();
+#if BURST_PIPELINE
+  networkStarted = true;
+#endif
+  
+  if (motionWake) {
     // Send them via MQTT
-    for (int i = 0; i < 5; i++) {
-      if (images[i] != NULL) {
-        sendImageViaMQTT(images[i], i);
-      }
+    sendEvent();
+  } else {
+    // Nobody is waiting on a motion wake, it sleeps again without serving pages
+    setupWebServer();
+    if (preTriggerEnabled) {
+      setFrameSize(PRE_TRIGGER_FRAME_SIZE);
     }
   }
 }
 
 void loop() {
   server.handleClient();
+  streamer.poll();
   
-  // Keep MQTT connection alive
-  if (!mqttClient.connected()) {
-    reconnectMQTT();
+#if !BURST_PIPELINE
+  // Keep MQTT connection alive and catch up on stored images, with the
+  // pipeline the upload task does
+  if (reconnectMQTT()) {
+    mqttClient.loop();
+    serveFrameRequest();
+    drainStoredImage();
+  }
+#endif
+  
+#if PRE_TRIGGER
+  // Keep the ring filling so the next event has its history
+  if (preTriggerEnabled && millis() - lastRingCapture >= PRE_TRIGGER_INTERVAL) {
+    lastRingCapture = millis();
+    captureRingFrame();
+  }
+#endif
+  
+  // Without the ring, capture for the live view only while it is watched
+  if (!preTriggerEnabled && streamer.viewerCount() > 0 && millis() - lastStreamCapture >= STREAM_INTERVAL) {
+    lastStreamCapture = millis();
+    captureStreamFrame();
   }
-  mqttClient.loop();
   
   // Reset motion detection flag after a short period to allow new detections
   if (motionDetected && (millis() - lastMotionTime > MOTION_RESET_TIME)) {
@@ -149,30 +463,31 @@ void loop() {
     captureMultiplePhotos();
     
     // Send photos via MQTT
-    for (int i = 0; i < 5; i++) {
-      if (images[i] != NULL) {
-        sendImageViaMQTT(images[i], i);
-      }
-    }
+    sendEvent();
   }
   
   // Check if we should go to sleep
   if (motionDetected && (millis() - lastMotionTime > KEEP_AWAKE_DURATION)) {
     Serial.println("Going to sleep now");
     
-    // Clean up image buffers
-    for (int i = 0; i < 5; i++) {
-      if (images[i] != NULL) {
-        esp_camera_fb_return(images[i]);
-        images[i] = NULL;
-      }
+#if BURST_PIPELINE
+    // Let the upload task finish the last event
+    unsigned long drainStart = millis();
+    while (uploadsPending > 0 && millis() - drainStart < UPLOAD_DRAIN_TIMEOUT) {
+      delay(10);
     }
+#endif
     
-    if (fb) {
-      esp_camera_fb_return(fb);
-      fb = NULL;
+    // Clean up image buffers
+    releaseImages();
+    FramePool::release(latestFrame);
+    latestFrame = NULL;
+    for (int i = 0; i < ringCount; i++) {
+      FramePool::release(preTriggerRing[(ringIndex - ringCount + i + PRE_TRIGGER_DEPTH) % PRE_TRIGGER_DEPTH]);
     }
+    ringCount = 0;
     
+    streamer.closeAll();
     server.close();
     WiFi.disconnect(true);
     
@@ -223,6 +538,9 @@ void initCamera() {
     config.jpeg_quality = 12;
     config.fb_count = 1;
   }
+  burstFrameSize = config.frame_size;
+  currentFrameSize = config.frame_size;
+  cameraFbCount = config.fb_count;
  
   // Init Camera
   esp_err_t err = esp_camera_init(&config);
@@ -233,83 +551,710 @@ void initCamera() {
   Serial.println("Camera initialized successfully");
 }
 
-void connectToWiFi() {
-  WiFi.begin(ssid, password);
+// Allocate the frame pool once, it is never freed
+void initFramePool() {
+  size_t slotSize = FRAME_SLOT_SIZE;
+  uint8_t slotCount = FRAME_POOL_SLOTS;
+  uint8_t* arena = NULL;
+  if (psramFound()) {
+    arena = (uint8_t*)ps_malloc(slotSize * slotCount);
+  } else {
+    slotSize = FRAME_SLOT_SIZE_DRAM;
+    slotCount = FRAME_POOL_SLOTS_DRAM;
+    arena = (uint8_t*)malloc(slotSize * slotCount);
+  }
+  if (!framePool.begin(arena, slotSize, slotCount)) {
+    Serial.println("Frame pool allocation failed");
+    return;
+  }
+  Serial.printf("Frame pool: %u slots of %u bytes\n", (unsigned)slotCount, (unsigned)slotSize);
+  
+#if PRE_TRIGGER
+  // The ring only fits in PSRAM. A ring frame is released before the
+  // next one is stored, so one slot per ring entry is enough.
+  if (psramFound()) {
+    uint8_t slots = PRE_TRIGGER_DEPTH + MJPEG_MAX_VIEWERS;
+    uint8_t* ringArena = (uint8_t*)ps_malloc(PRE_TRIGGER_SLOT_SIZE * slots);
+    preTriggerEnabled = preTriggerPool.begin(ringArena, PRE_TRIGGER_SLOT_SIZE, slots);
+  }
+  // The sensor stays at full size for now, setup() or the first burst
+  // switches it to the ring's size
+  if (!preTriggerEnabled) {
+    Serial.println("Pre-trigger ring disabled, no PSRAM for it");
+  }
+#endif
+  
+  // Without the ring live view needs slots of its own, small enough for
+  // internal RAM
+  if (!preTriggerEnabled) {
+    uint8_t streamSlots = psramFound() ? STREAM_POOL_SLOTS : STREAM_POOL_SLOTS_DRAM;
+    uint8_t* streamArena = (uint8_t*)(psramFound() ? ps_malloc(STREAM_SLOT_SIZE * streamSlots)
+                                                   : malloc(STREAM_SLOT_SIZE * streamSlots));
+    if (!streamPool.begin(streamArena, STREAM_SLOT_SIZE, streamSlots)) {
+      Serial.println("Stream pool allocation failed, no live view");
+    }
+  }
+  
+#if TWO_TIER
+  // Thumbnails are small enough for internal RAM without PSRAM
+  uint8_t thumbnailSlots = psramFound() ? THUMBNAIL_SLOTS : THUMBNAIL_SLOTS_DRAM;
+  uint8_t* thumbnailArena = (uint8_t*)(psramFound() ? ps_malloc(THUMBNAIL_SLOT_SIZE * thumbnailSlots)
+                                                    : malloc(THUMBNAIL_SLOT_SIZE * thumbnailSlots));
+  if (!thumbnailPool.begin(thumbnailArena, THUMBNAIL_SLOT_SIZE, thumbnailSlots)) {
+    Serial.println("Thumbnail pool allocation failed, events are only kept");
+  }
+#endif
+  
+  // Without it every frame scores 0 and the first ones are kept
+  size_t mapBlocks = psramFound() ? SCORE_MAP_BLOCKS : SCORE_MAP_BLOCKS_DRAM;
+  uint8_t* scoreMap = (uint8_t*)(psramFound() ? ps_malloc(mapBlocks) : malloc(mapBlocks));
+  if (!scoreMap) {
+    Serial.println("Score map allocation failed, bursts are not scored");
+  }
+  burstScorer.begin(scoreMap, scoreMap ? mapBlocks : 0);
+}
+
+// Mount the store-and-forward log and the frame store, recovering
+// whatever an earlier boot left in them
+void initImageLog() {
+#if TWO_TIER
+  frameStoreReady = frameFlash.begin(FRAME_STORE_PARTITION) && frameStore.begin(&frameFlash);
+  if (frameStoreReady) {
+    Serial.printf("Frame store: %u KB, %u frames never asked for\n",
+                  (unsigned)(frameFlash.sectorCount() * frameFlash.sectorSize() / 1024),
+                  (unsigned)frameStore.pendingCount());
+  } else {
+    Serial.println("No " FRAME_STORE_PARTITION " partition, only thumbnails are published");
+  }
+#endif
+  
+  if (!imageFlash.begin(IMAGE_LOG_PARTITION)) {
+    Serial.println("No " IMAGE_LOG_PARTITION " partition, images are dropped while the broker is unreachable");
+    return;
+  }
+  imageLogReady = imageLog.begin(&imageFlash);
+  if (imageLogReady) {
+    Serial.printf("Image log: %u KB, %u images waiting\n",
+                  (unsigned)(imageFlash.sectorCount() * imageFlash.sectorSize() / 1024),
+                  (unsigned)imageLog.pendingCount());
+  } else {
+    Serial.println("Image log could not be mounted");
+  }
+}
+
+// Change the sensor's frame size. Frames already waiting in the driver's
+// buffers were taken at the old size, so they are thrown away.
+void setFrameSize(framesize_t size) {
+  if (size == currentFrameSize) {
+    return;
+  }
+  sensor_t* s = esp_camera_sensor_get();
+  s->set_framesize(s, size);
+  currentFrameSize = size;
+  for (int i = 0; i < cameraFbCount; i++) {
+    esp_camera_fb_return(esp_camera_fb_get());
+  }
+}
+
+// Join the network, first with the AP and lease cached from the last
+// full join. Returns false if neither way joins in time, WiFi keeps
+// trying in the background.
+bool connectToWiFi() {
+  unsigned long start = millis();
+  WiFi.mode(WIFI_STA);
   
+  if (networkCache.valid && networkCache.reuses < NETWORK_CACHE_REUSES) {
+    WiFi.config(IPAddress(networkCache.ip), IPAddress(networkCache.gateway), IPAddress(networkCache.subnet),
+                IPAddress(networkCache.dns));
+    WiFi.begin(ssid, password, networkCache.channel, networkCache.bssid);
+    Serial.print("Rejoining cached AP");
+    if (waitForWiFi(WIFI_FAST_JOIN_TIMEOUT)) {
+      networkCache.reuses++;
+      Serial.printf("Rejoined in %lu ms. IP Address: ", millis() - start);
+      Serial.println(WiFi.localIP());
+      return true;
+    }
+    // The AP moved or the lease is gone, scan and ask DHCP again
+    WiFi.disconnect();
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  }
+  networkCache.valid = false;
+  
+  WiFi.begin(ssid, password);
   Serial.print("Connecting to WiFi");
+  if (!waitForWiFi(WIFI_JOIN_TIMEOUT)) {
+    Serial.println("WiFi connection timed out");
+    return false;
+  }
+  
+  // Remember the AP and lease for the next wake
+  const uint8_t* bssid = WiFi.BSSID();
+  if (bssid) {
+    memcpy(networkCache.bssid, bssid, sizeof(networkCache.bssid));
+    networkCache.channel = WiFi.channel();
+    networkCache.ip = WiFi.localIP();
+    networkCache.gateway = WiFi.gatewayIP();
+    networkCache.subnet = WiFi.subnetMask();
+    networkCache.dns = WiFi.dnsIP();
+    networkCache.reuses = 0;
+    networkCache.valid = true;
+  }
+  
+  Serial.printf("Connected in %lu ms. IP Address: ", millis() - start);
+  Serial.println(WiFi.localIP());
+  return true;
+}
+
+// Wait up to timeout ms for the station to join
+bool waitForWiFi(unsigned long timeout) {
+  unsigned long start = millis();
   while (WiFi.status() != WL_CONNECTED) {
-    delay(500);
+    if (millis() - start >= timeout) {
+      Serial.println();
+      return false;
+    }
+    delay(100);
     Serial.print(".");
   }
   Serial.println();
-  
-  Serial.print("Connected to WiFi. IP Address: ");
-  Serial.println(WiFi.localIP());
+  return true;
 }
 
-// Capture a single photo
-camera_fb_t* capturePhoto() {
-  // Turn on flash if needed
-  digitalWrite(LED_PIN, HIGH);
-  delay(100);
-  
-  // Capture a new image
-  camera_fb_t* new_fb = esp_camera_fb_get();
-  if(!new_fb) {
+// Capture a single photo into the frame pool. The driver buffer is
+// returned straight away; the caller owns one reference to the copy.
+PooledFrame* capturePhoto() {
+  camera_fb_t* fb = esp_camera_fb_get();
+  if(!fb) {
     Serial.println("Camera capture failed");
     return NULL;
   }
   
-  Serial.printf("Image captured! Size: %zu bytes\n", new_fb->len);
-  
-  // Turn off flash
-  digitalWrite(LED_PIN, LOW);
-  
-  return new_fb;
+  PooledFrame* frame = framePool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+  if (!frame) {
+    Serial.printf("No frame slot for %zu byte image (%u of %u free)\n", fb->len,
+                  (unsigned)framePool.freeSlots(), (unsigned)framePool.slotCount());
+  } else {
+    Serial.printf("Image captured! Size: %zu bytes\n", fb->len);
+    if (motionWake && wakeToCapture == 0) {
+      wakeToCapture = millis();
+    }
+  }
+  esp_camera_fb_return(fb);
+  return frame;
 }
 
-// Capture multiple photos in sequence
+// Add a low resolution frame to the pre-trigger ring, dropping the oldest
+void captureRingFrame() {
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (!fb) {
+    return;
+  }
+  if (ringCount == PRE_TRIGGER_DEPTH) {
+    FramePool::release(preTriggerRing[ringIndex]);
+    ringCount--;
+  }
+  PooledFrame* frame = preTriggerPool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+  esp_camera_fb_return(fb);
+  if (frame) {
+    preTriggerRing[ringIndex] = frame;
+    ringIndex = (ringIndex + 1) % PRE_TRIGGER_DEPTH;
+    ringCount++;
+    streamer.publish(frame);
+  }
+}
+
+// Capture a live view frame into the stream pool, switching the sensor
+// to the stream's size. Skipped while viewers hold every slot.
+void captureStreamFrame() {
+  setFrameSize(STREAM_FRAME_SIZE);
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (!fb) {
+    return;
+  }
+  PooledFrame* frame = streamPool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+  esp_camera_fb_return(fb);
+  streamer.publish(frame);
+  FramePool::release(frame);
+}
+
+// Capture multiple photos in sequence. The event starts with the
+// pre-trigger frames, oldest first, followed by the burst.
 void captureMultiplePhotos() {
   Serial.println("Capturing multiple photos...");
   
-  // Free any previous images
-  for (int i = 0; i < 5; i++) {
-    if (images[i] != NULL) {
-      esp_camera_fb_return(images[i]);
-      images[i] = NULL;
-    }
+  // Free any previous images, the web page keeps its own reference
+  releaseImages();
+  eventId++;
+  triggerTime = millis();
+  eventFrames = ringCount + BURST_LENGTH;
+  
+  // Hand the ring over to the event, it starts refilling after the burst
+  for (int i = 0; i < ringCount; i++) {
+    addEventFrame(preTriggerRing[(ringIndex - ringCount + i + PRE_TRIGGER_DEPTH) % PRE_TRIGGER_DEPTH]);
   }
+  ringCount = 0;
   
-  // Capture 5 photos with short delays between them
-  for (int i = 0; i < 5; i++) {
-    images[i] = capturePhoto();
-    if (images[i] == NULL) {
+  // Flash stays on for the whole burst, it warms up while the sensor
+  // switches to full size
+  digitalWrite(LED_PIN, HIGH);
+  setFrameSize(burstFrameSize);
+  delay(100);
+  
+  int burstStart = imageCount;
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    PooledFrame* frame = capturePhoto();
+    if (frame == NULL) {
       Serial.println("Failed to capture image " + String(i));
+    } else {
+      addEventFrame(frame);
+    }
+    if (PHOTO_DELAY > 0) {
+      delay(PHOTO_DELAY);
     }
-    delay(PHOTO_DELAY);
   }
   
-  // Update the main fb pointer to the latest image for web display
-  if (fb) {
-    esp_camera_fb_return(fb);
+#if TWO_TIER
+  // Still lit, the sensor's exposure is already set for it
+  setFrameSize(THUMBNAIL_FRAME_SIZE);
+  captureThumbnail();
+#endif
+  
+  digitalWrite(LED_PIN, LOW);
+  setFrameSize(preTriggerEnabled ? PRE_TRIGGER_FRAME_SIZE : burstFrameSize);
+  
+  // Show the latest image on the web page, sharing the burst's copy
+  if (imageCount > burstStart) {
+    FramePool::release(latestFrame);
+    latestFrame = images[imageCount - 1];
+    FramePool::retain(latestFrame);
+  }
+  
+  Serial.println("Multiple photo capture complete");
+}
+
+// Take the event's thumbnail at the sensor's current size. With the
+// pipeline it goes to the upload task ahead of the event's frames still
+// queued.
+void captureThumbnail() {
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (!fb) {
+    Serial.println("Thumbnail capture failed");
+    return;
+  }
+  thumbnail = thumbnailPool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+  if (!thumbnail) {
+    Serial.printf("No slot for %zu byte thumbnail\n", fb->len);
+  }
+  esp_camera_fb_return(fb);
+#if BURST_PIPELINE
+  if (thumbnail) {
+    FramePool::retain(thumbnail);
+    UploadItem item = {thumbnail, eventId, triggerTime, THUMBNAIL_IMAGE_NUMBER, eventFrames};
+    queueUpload(item, true);
+  }
+#endif
+}
+
+// Add a frame to the current event. With the pipeline it goes to the
+// upload task straight away, which takes its own reference.
+void addEventFrame(PooledFrame* frame) {
+#if BURST_PIPELINE
+  FramePool::retain(frame);
+  UploadItem item = {frame, eventId, triggerTime, (uint8_t)imageCount, eventFrames};
+  queueUpload(item);
+#endif
+  images[imageCount++] = frame;
+}
+
+// Finish the last event: upload its frames in capture order, or with the
+// pipeline mark its end for the upload task, then give them back
+void sendEvent() {
+#if BURST_PIPELINE
+  UploadItem end = {NULL, eventId, triggerTime, (uint8_t)imageCount, eventFrames};
+  queueUpload(end);
+#else
+  if (thumbnail) {
+    UploadItem item = {thumbnail, eventId, triggerTime, THUMBNAIL_IMAGE_NUMBER, eventFrames};
+    uploadEventFrame(item);
+  }
+  for (int i = 0; i < imageCount; i++) {
+    UploadItem item = {images[i], eventId, triggerTime, (uint8_t)i, eventFrames};
+    uploadEventFrame(item);
+  }
+  UploadItem end = {NULL, eventId, triggerTime, (uint8_t)imageCount, eventFrames};
+  uploadEventFrame(end);
+#endif
+  releaseImages();
+}
+
+// Give the last event's frames back to their pools
+void releaseImages() {
+  for (int i = 0; i < imageCount; i++) {
+    FramePool::release(images[i]);
+    images[i] = NULL;
+  }
+  imageCount = 0;
+  FramePool::release(thumbnail);
+  thumbnail = NULL;
+}
+
+#if BURST_PIPELINE
+// Hand an item to the upload task without ever blocking capture, ahead
+// of the frames of its own event if asked. Never ahead of an earlier
+// event's: its end marker has to come first, or the upload task would
+// take it for lost and release that burst before all of it arrived.
+void queueUpload(const UploadItem& item, bool ahead) {
+  __atomic_fetch_add(&uploadsPending, 1, __ATOMIC_RELAXED);
+  if (ahead) {
+    UploadItem next;
+    ahead = xQueuePeek(uploadQueue, &next, 0) != pdTRUE || next.eventId == item.eventId;
+  }
+  BaseType_t queued = ahead ? xQueueSendToFront(uploadQueue, &item, 0) : xQueueSend(uploadQueue, &item, 0);
+  if (queued != pdTRUE) {
+    // Only when an earlier event is still being sent
+    Serial.printf("Upload queue full, image %u of event %u dropped\n", (unsigned)item.imageNumber,
+                  (unsigned)item.eventId);
+    FramePool::release(item.frame);
+    __atomic_fetch_sub(&uploadsPending, 1, __ATOMIC_RELAXED);
   }
+}
+
+// Core 0: owns the MQTT client, the image log and the frame store, keeps
+// the client connected, uploads queued frames (storing them while the
+// broker is unreachable) and when there is nothing newer serves frame
+// requests, then sends stored images. A request waits for the queue so
+// the frames it asks for are on flash by then.
+void uploadTask(void* parameter) {
+  for (;;) {
+    // A motion wake queues its frames before the network is up
+    if (!networkStarted) {
+      vTaskDelay(pdMS_TO_TICKS(50));
+      continue;
+    }
+    bool online = reconnectMQTT();
+    if (online) {
+      mqttClient.loop();
+    }
+    
+    UploadItem item;
+    if (xQueueReceive(uploadQueue, &item, pdMS_TO_TICKS(50)) == pdTRUE) {
+      uploadEventFrame(item);
+      FramePool::release(item.frame);
+      __atomic_fetch_sub(&uploadsPending, 1, __ATOMIC_RELEASE);
+    } else if (online) {
+      serveFrameRequest();
+      drainStoredImage();
+    }
+  }
+}
+#endif
+
+// Take one frame of an event. Burst frames are scored and held until
+// the end marker, which releases the best of them and publishes the
+// event's timing. The oldest pre-trigger frame is what the burst is
+// compared with.
+void uploadEventFrame(const UploadItem& item) {
+  if (item.eventId != scoredEventId) {
+    releaseBurst(scoredEventId);  // Only if the end marker was lost
+    burstScorer.reset();
+    scoredEventId = item.eventId;
+  }
+  if (!item.frame) {
+    releaseBurst(item.eventId);
+    publishEventTiming(item);
+    return;
+  }
+  if (item.imageNumber != THUMBNAIL_IMAGE_NUMBER && item.imageNumber + BURST_LENGTH >= item.eventFrames) {
+    holdBurstFrame(item);
+    return;
+  }
+  if (item.imageNumber == 0) {
+    burstScorer.setReference(item.frame->buf, item.frame->len);
+  }
+  deliverEventFrame(item);
+}
+
+// Upload a frame and note when it reached the broker
+void deliverEventFrame(const UploadItem& item) {
+#if TWO_TIER
+  // Only the thumbnail goes out now, the frames wait to be asked for
+  if (item.imageNumber != THUMBNAIL_IMAGE_NUMBER) {
+    keepFrame(item);
+    return;
+  }
+#endif
   
-  // Copy the last image to fb for web display
-  if (images[4] != NULL) {
-    fb = esp_camera_fb_get();
-    if (fb) {
-      memcpy(fb->buf, images[4]->buf, images[4]->len);
-      fb->len = images[4]->len;
+  bool sent = sendImageViaMQTT(item);
+  if (!sent && !mqttClient.connected()) {
+    storeImage(item);
+    return;
+  }
+  if (sent && item.eventId == wakeEventId && wakeToPublish == 0) {
+    wakeToPublish = millis();
+  }
+  unsigned long sinceTrigger = millis() - item.triggerTime;
+  if (eventTiming.eventId != item.eventId) {
+    eventTiming.eventId = item.eventId;
+    eventTiming.firstImageMs = sinceTrigger;
+    eventTiming.images = 0;
+  }
+  eventTiming.lastImageMs = sinceTrigger;
+  eventTiming.images++;
+}
+
+// Score a burst frame and hold on to it until the burst is complete
+void holdBurstFrame(const UploadItem& item) {
+  if (heldCount == BURST_LENGTH) {
+    deliverEventFrame(item);  // Never with a well formed event
+    return;
+  }
+  FramePool::retain(item.frame);
+  burstScorer.measure(item.frame->buf, item.frame->len, heldMeasures[heldCount]);
+  heldBurst[heldCount++] = item;
+}
+
+// Rank the held burst, deliver its best frames in capture order and give
+// the rest back, noting every score for the event summary
+void releaseBurst(uint32_t eventId) {
+  burstResult.eventId = eventId;
+  burstResult.count = heldCount;
+  if (heldCount == 0) {
+    return;
+  }
+  BurstScorer::rank(heldMeasures, heldCount, scoreWeights, burstResult.scores);
+  BurstScorer::selectBest(burstResult.scores, heldCount, bestFrameCount, burstResult.kept);
+  for (uint8_t i = 0; i < heldCount; i++) {
+    burstResult.imageNumbers[i] = heldBurst[i].imageNumber;
+    if (burstResult.kept[i]) {
+      deliverEventFrame(heldBurst[i]);
+    }
+    FramePool::release(heldBurst[i].frame);
+  }
+  heldCount = 0;
+}
+
+// Report trigger to first and last image on the broker, to compare the
+// pipelined and sequential uploads. The event taken on a motion wake also
+// reports boot to its first capture and first image on the broker. Like
+// an image, the summary is stored while the broker is unreachable.
+void publishEventTiming(const UploadItem& end) {
+  if (eventTiming.eventId != end.eventId) {
+    eventTiming = {end.eventId, 0, 0, 0};  // Nothing was sent
+  }
+  char msg[EVENT_SUMMARY_SIZE];
+  int length = snprintf(msg, sizeof(msg),
+           "{\"device_id\":\"%s\",\"type\":\"event\",\"event_id\":%u,\"frames\":%u,\"sent\":%u,\"first_image_ms\":%lu,\"last_image_ms\":%lu,\"pipeline\":%d,\"two_tier\":%d",
+           device_id, (unsigned)end.eventId, (unsigned)end.imageNumber, (unsigned)eventTiming.images,
+           eventTiming.firstImageMs, eventTiming.lastImageMs, BURST_PIPELINE, TWO_TIER);
+  if (end.eventId == wakeEventId) {
+    length += snprintf(msg + length, sizeof(msg) - length, ",\"wake_capture_ms\":%lu,\"wake_publish_ms\":%lu",
+                       wakeToCapture, wakeToPublish);
+  }
+  if (burstResult.eventId == end.eventId && burstResult.count > 0) {
+    // Burst frames by image number with their scores, and those kept
+    const char* lists[] = {",\"burst\":[", "],\"scores\":[", "],\"best\":["};
+    for (int list = 0; list < 3; list++) {
+      length += snprintf(msg + length, sizeof(msg) - length, "%s", lists[list]);
+      const char* separator = "";
+      for (uint8_t i = 0; i < burstResult.count; i++) {
+        if (list == 2 && !burstResult.kept[i]) {
+          continue;
+        }
+        unsigned value = list == 1 ? burstResult.scores[i] : burstResult.imageNumbers[i];
+        length += snprintf(msg + length, sizeof(msg) - length, "%s%u", separator, value);
+        separator = ",";
+      }
     }
+    length += snprintf(msg + length, sizeof(msg) - length, "]");
+  }
+  snprintf(msg + length, sizeof(msg) - length, "}");
+  Serial.println(msg);
+  if (!reconnectMQTT() || !publishStatus(msg)) {
+    storeStatus(msg);
+  }
+}
+
+// Publish a status message as a stream, so that a summary with its burst
+// scores does not have to fit the client's buffer. Returns true if it was
+// written to the broker.
+bool publishStatus(const char* msg) {
+  size_t length = strlen(msg);
+  return mqttClient.beginPublish(mqtt_topic_status, length, false) &&
+         mqttClient.write((const uint8_t*)msg, length) == length && mqttClient.endPublish();
+}
+
+// Keep an event summary that could not be published, to go out with the
+// stored images
+void storeStatus(const char* msg) {
+  if (!imageLogReady || !imageLog.append(NULL, 0, msg, strlen(msg))) {
+    Serial.println("Event summary dropped, no flash to store it in");
+    return;
+  }
+  Serial.printf("Event summary stored, %u waiting\n", (unsigned)imageLog.pendingCount());
+}
+
+// Append a frame to the image log or the frame store, with what is
+// needed to publish it later
+bool appendImage(FlashLog& log, const UploadItem& item) {
+  const PooledFrame* frame = item.frame;
+  StoredImage stored = {item.eventId, (int32_t)(frame->capturedAt - item.triggerTime), frame->width,
+                        frame->height, item.imageNumber, item.eventFrames};
+  return log.append(&stored, sizeof(stored), frame->buf, frame->len);
+}
+
+// Keep an image that could not be sent, to go out once the broker is back
+void storeImage(const UploadItem& item) {
+  if (!imageLogReady) {
+    Serial.println("Image dropped, no flash to store it in");
+    return;
   }
+  uint32_t evicted = imageLog.evictedCount();
+  if (!appendImage(imageLog, item)) {
+    Serial.println("Storing image failed");
+    return;
+  }
+  Serial.printf("Image %u of event %u stored, %u waiting\n", (unsigned)item.imageNumber,
+                (unsigned)item.eventId, (unsigned)imageLog.pendingCount());
+  if (imageLog.evictedCount() != evicted) {
+    Serial.printf("Image log full, %u oldest images dropped\n", (unsigned)(imageLog.evictedCount() - evicted));
+  }
+}
+
+// Keep a frame of an event on flash until the server asks for it
+void keepFrame(const UploadItem& item) {
+  if (!frameStoreReady) {
+    Serial.printf("Frame %u of event %u dropped, no flash to keep it in\n", (unsigned)item.imageNumber,
+                  (unsigned)item.eventId);
+    return;
+  }
+  if (!appendImage(frameStore, item)) {
+    Serial.println("Keeping frame failed");
+  }
+}
+
+// Send the oldest stored image or event summary, at most one per
+// STORED_DRAIN_INTERVAL so live events keep most of the uplink. An image
+// is read straight into a free frame slot and only marked sent once it
+// is on the broker.
+void drainStoredImage() {
+  if (!imageLogReady || imageLog.pendingCount() == 0 || millis() - lastStoredDrain < STORED_DRAIN_INTERVAL) {
+    return;
+  }
+  lastStoredDrain = millis();
+  FlashLogRecord record;
+  if (!imageLog.peek(record)) {
+    return;
+  }
+  if (record.metaLength == 0) {
+    char msg[EVENT_SUMMARY_SIZE];
+    if (record.length >= sizeof(msg)) {
+      imageLog.markSent(record);
+    } else if (imageLog.read(record, NULL, msg)) {
+      msg[record.length] = '\0';
+      if (publishStatus(msg) || mqttClient.connected()) {
+        imageLog.markSent(record);
+      }
+    }
+    return;
+  }
+  StoredImage stored;
+  if (record.metaLength != sizeof(stored) || record.length > framePool.slotSize()) {
+    // From a build with another layout or larger frames, it can never be sent
+    imageLog.markSent(record);
+    return;
+  }
+  PooledFrame* frame = framePool.claim();
+  if (!frame) {
+    return;  // Every slot is busy, try again next time
+  }
+  // A record that fails its CRC is dropped by the log
+  if (imageLog.read(record, &stored, frame->buf)) {
+    unsigned long now = millis();
+    frame->len = record.length;
+    frame->width = stored.width;
+    frame->height = stored.height;
+    frame->capturedAt = now + stored.triggerOffset;
+    UploadItem item = {frame, stored.eventId, now, stored.imageNumber, stored.eventFrames};
+    // Also give up on an image the broker refused while connected
+    if (sendImageViaMQTT(item) || mqttClient.connected()) {
+      imageLog.markSent(record);
+    }
+  }
+  FramePool::release(frame);
+}
+
+// Frame requests from the server, queued for serveFrameRequest(). The
+// client calls this from loop() on whichever task owns it.
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  if (strcmp(topic, mqtt_topic_request) != 0) {
+    return;
+  }
+  StaticJsonDocument<FRAME_REQUEST_DOC_SIZE> request;
+  DeserializationError error = deserializeJson(request, (const byte*)payload, length);
+  JsonVariantConst eventId = request["event_id"];
+  JsonVariantConst frame = request["frame"];
+  if (error || !eventId.is<uint32_t>() || eventId.as<uint32_t>() == 0 ||
+      (!frame.isNull() && (!frame.is<int>() || frame.as<int>() < 0 || frame.as<int>() >= EVENT_MAX_FRAMES))) {
+    Serial.printf("Bad frame request: %.*s\n", (int)length, (const char*)payload);
+    return;
+  }
+  if (frameRequestCount == FRAME_REQUEST_QUEUE) {
+    Serial.println("Frame request queue full, request dropped");
+    return;
+  }
+  frameRequests[frameRequestCount++] = {eventId.as<uint32_t>(), (int16_t)(frame.isNull() ? -1 : frame.as<int>())};
+}
+
+// Publish the frames the oldest request asks for, read from the frame
+// store one at a time into a free frame slot. They are marked sent but
+// stay on flash, so a frame can be asked for again until the store wraps.
+void serveFrameRequest() {
+  if (frameRequestCount == 0) {
+    return;
+  }
+  PooledFrame* frame = framePool.claim();
+  if (!frame) {
+    return;  // Every slot is busy, try again next time
+  }
+  FrameRequest request = frameRequests[0];
+  frameRequestCount--;
+  memmove(frameRequests, frameRequests + 1, frameRequestCount * sizeof(FrameRequest));
   
-  Serial.println("Multiple photo capture complete");
+  unsigned sent = 0;
+  FlashLogRecord record;
+  for (bool found = frameStoreReady && frameStore.first(record); found; found = frameStore.next(record)) {
+    StoredImage stored;
+    if (record.metaLength != sizeof(stored) || record.length > framePool.slotSize() ||
+        !frameStore.readMeta(record, &stored) || stored.eventId != request.eventId ||
+        (request.imageNumber >= 0 && stored.imageNumber != request.imageNumber)) {
+      continue;
+    }
+    // A record that fails its CRC is dropped by the store
+    if (!frameStore.read(record, &stored, frame->buf)) {
+      continue;
+    }
+    unsigned long now = millis();
+    frame->len = record.length;
+    frame->width = stored.width;
+    frame->height = stored.height;
+    frame->capturedAt = now + stored.triggerOffset;
+    UploadItem item = {frame, stored.eventId, now, stored.imageNumber, stored.eventFrames};
+    if (!sendImageViaMQTT(item)) {
+      break;  // The server asks again once it notices
+    }
+    frameStore.markSent(record);
+    sent++;
+  }
+  FramePool::release(frame);
+  Serial.printf("Frame request for event %u: %u frames sent\n", (unsigned)request.eventId, sent);
 }
 
 void setupWebServer() {
   server.on("/", handleRoot);
+  server.on("/status", handleStatus);
   server.on("/capture", handleCapture);
   server.on("/image", handleImage);
+  server.on("/stream", handleStream);
   server.onNotFound(handleNotFound);
   
   server.begin();
@@ -317,30 +1262,15 @@ void setupWebServer() {
 }
 
 void handleRoot() {
-  String html = "<!DOCTYPE html><html><head>";
-  html += "<meta name='viewport' content='width=device-width, initial-scale=1.0'>";
-  html += "<title>ESP32-CAM Motion Detection</title>";
-  html += "<style>";
-  html += "body { font-family: Arial, sans-serif; text-align: center; margin: 20px; }";
-  html += "img { max-width: 100%; height: auto; border: 2px solid #444; }";
-  html += "button { background-color: #0275d8; color: white; padding: 10px 20px; ";
-  html += "border: none; border-radius: 4px; margin: 10px; cursor: pointer; }";
-  html += "</style></head><body>";
-  html += "<h1>ESP32-CAM Motion Detection</h1>";
-  
-  if (motionDetected) {
-    html += "<p>Motion detected! Image captured.</p>";
-    html += "<img src='/image' alt='Captured Image'>";
-    html += "<p>Last motion detected: " + String((millis() - lastMotionTime) / 1000) + " seconds ago</p>";
-  } else {
-    html += "<p>No motion detected yet.</p>";
-  }
-  
-  html += "<button onclick=\"location.href='/capture'\">Capture New Image</button>";
-  html += "<script>setTimeout(function(){ location.reload(); }, 10000);</script>"; // Auto refresh every 10 seconds
-  html += "</body></html>";
-  
-  server.send(200, "text/html", html);
+  server.send_P(200, "text/html", INDEX_HTML);
+}
+
+void handleStatus() {
+  char json[96];
+  snprintf(json, sizeof(json), "{\"motion\":%s,\"since\":%lu,\"viewers\":%u,\"stored\":%u}",
+           motionDetected ? "true" : "false", (millis() - lastMotionTime) / 1000,
+           (unsigned)streamer.viewerCount(), (unsigned)imageLog.pendingCount());
+  server.send(200, "application/json", json);
 }
 
 void handleCapture() {
@@ -349,138 +1279,199 @@ void handleCapture() {
   lastMotionTime = millis();
   
   // Send photos via MQTT
-  for (int i = 0; i < 5; i++) {
-    if (images[i] != NULL) {
-      sendImageViaMQTT(images[i], i);
-    }
-  }
+  sendEvent();
   
   server.sendHeader("Location", "/");
   server.send(303);
 }
 
 void handleImage() {
-  if (!fb) {
+  if (!latestFrame) {
     // If no image is available, try to capture one
-    fb = capturePhoto();
+    digitalWrite(LED_PIN, HIGH);
+    delay(100);
+    latestFrame = capturePhoto();
+    digitalWrite(LED_PIN, LOW);
   }
   
-  if (!fb) {
+  if (!latestFrame) {
     server.send(404, "text/plain", "No image available");
     return;
   }
   
-  server.setContentLength(fb->len);
+  // Hold the frame while it is sent, a new burst may replace it meanwhile
+  PooledFrame* frame = latestFrame;
+  FramePool::retain(frame);
+  server.setContentLength(frame->len);
   server.send(200, "image/jpeg", "");
   
   // Send the image data
   WiFiClient client = server.client();
-  client.write(fb->buf, fb->len);
+  client.write(frame->buf, frame->len);
+  FramePool::release(frame);
+}
+
+// Hand the connection over to the streamer, which keeps its own copy of
+// the client and answers from loop() from then on
+void handleStream() {
+  for (int i = 0; i < MJPEG_MAX_VIEWERS; i++) {
+    if (streamClients[i].connected()) {
+      continue;
+    }
+    streamClients[i] = server.client();
+    streamClients[i].setNoDelay(true);
+    if (streamer.addViewer(&streamClients[i])) {
+      return;
+    }
+    streamClients[i].stop();
+    break;
+  }
+  server.send(503, "text/plain", "Too many viewers");
+}
+
+// Writes go straight to the socket so a slow viewer never blocks loop()
+int streamWrite(void* connection, const uint8_t* data, size_t length) {
+  WiFiClient* client = (WiFiClient*)connection;
+  int sent = send(client->fd(), data, length, MSG_DONTWAIT);
+  if (sent >= 0) {
+    return sent;
+  }
+  return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+}
+
+void streamClose(void* connection) {
+  ((WiFiClient*)connection)->stop();
 }
 
 void handleNotFound() {
   server.send(404, "text/plain", "Page Not Found");
 }
 
-// Function to reconnect to MQTT broker
-void reconnectMQTT() {
-  int attempts = 0;
-  while (!mqttClient.connected() && attempts < 5) {
-    Serial.print("Connecting to MQTT broker...");
-    String clientId = "ESP32CAM-";
-    clientId += String(random(0xffff), HEX);
-    
-    if (mqttClient.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
-      Serial.println("connected");
-    } else {
-      Serial.print("failed, rc=");
-      Serial.print(mqttClient.state());
-      Serial.println(" retrying in 5 seconds");
-      delay(5000);
-      attempts++;
-    }
+// Function to reconnect to MQTT broker. Makes at most one attempt per
+// MQTT_RETRY_INTERVAL without waiting, so an outage never holds up
+// capture or the upload queue. Returns true if connected.
+bool reconnectMQTT() {
+  if (mqttClient.connected()) {
+    return true;
   }
+  if (mqttAttempted && millis() - lastMqttAttempt < MQTT_RETRY_INTERVAL) {
+    return false;
+  }
+  mqttAttempted = true;
+  lastMqttAttempt = millis();
+  
+  Serial.print("Connecting to MQTT broker...");
+  String clientId = "ESP32CAM-";
+  clientId += String(random(0xffff), HEX);
+  
+  if (mqttClient.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
+    Serial.println("connected");
+#if TWO_TIER
+    mqttClient.subscribe(mqtt_topic_request);
+#endif
+    return true;
+  }
+  Serial.print("failed, rc=");
+  Serial.print(mqttClient.state());
+  Serial.println(" retrying in 5 seconds");
+  return false;
 }
 
-// Base64 encode function for image data
-String base64Encode(const uint8_t* data, size_t length) {
-  const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  String encoded;
+// Encode length bytes from data as base64 into out (4 chars per 3 bytes, '=' padded).
+// out must hold 4 * ((length + 2) / 3) characters. Returns the number written.
+size_t base64EncodeBlock(const uint8_t* data, size_t length, char* out) {
+  static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t o = 0;
+  size_t i = 0;
   
-  // Reserve memory for base64 output (4 bytes for every 3 input bytes, plus some extra)
-  encoded.reserve(((length + 2) / 3) * 4);
+  for (; i + 2 < length; i += 3) {
+    uint32_t triple = ((uint32_t)data[i] << 16) | ((uint32_t)data[i + 1] << 8) | data[i + 2];
+    out[o++] = base64_chars[(triple >> 18) & 0x3F];
+    out[o++] = base64_chars[(triple >> 12) & 0x3F];
+    out[o++] = base64_chars[(triple >> 6) & 0x3F];
+    out[o++] = base64_chars[triple & 0x3F];
+  }
   
-  for (size_t i = 0; i < length; i += 3) {
-    uint32_t octet_a = i < length ? data[i] : 0;
-    uint32_t octet_b = (i + 1) < length ? data[i + 1] : 0;
-    uint32_t octet_c = (i + 2) < length ? data[i + 2] : 0;
-    
-    uint32_t triple = (octet_a << 16) + (octet_b << 8) + octet_c;
-    
-    encoded += base64_chars[(triple >> 18) & 0x3F];
-    encoded += base64_chars[(triple >> 12) & 0x3F];
-    encoded += (i + 1 < length) ? base64_chars[(triple >> 6) & 0x3F] : '=';
-    encoded += (i + 2 < length) ? base64_chars[triple & 0x3F] : '=';
+  // Pad the trailing 1 or 2 bytes
+  if (i < length) {
+    uint32_t triple = (uint32_t)data[i] << 16;
+    if (i + 1 < length) {
+      triple |= (uint32_t)data[i + 1] << 8;
+    }
+    out[o++] = base64_chars[(triple >> 18) & 0x3F];
+    out[o++] = base64_chars[(triple >> 12) & 0x3F];
+    out[o++] = (i + 1 < length) ? base64_chars[(triple >> 6) & 0x3F] : '=';
+    out[o++] = '=';
   }
   
-  return encoded;
+  return o;
 }
 
-// Function to send image via MQTT
-void sendImageViaMQTT(camera_fb_t *fb, int imageNumber) {
+// Function to send image via MQTT. Each chunk is base64 encoded block by
+// block straight into the MQTT stream, so the image is never held encoded
+// in memory and chunks do not have to fit the client's buffer. Returns
+// true if every chunk was published.
+bool sendImageViaMQTT(const UploadItem& item) {
   if (!mqttClient.connected()) {
     reconnectMQTT();
     if (!mqttClient.connected()) {
       Serial.println("Failed to connect to MQTT broker. Not sending image.");
-      return;
+      return false;
     }
   }
   
-  if (!fb) {
+  const PooledFrame* frame = item.frame;
+  if (!frame) {
     Serial.println("Invalid image buffer");
-    return;
+    return false;
   }
   
-  // Convert image to base64
-  String base64Image = base64Encode(fb->buf, fb->len);
+  // Every chunk covers whole 3-byte groups, so the chunks concatenate
+  // into one valid base64 string on the receiving side
+  size_t sliceSize = (IMAGE_CHUNK_SIZE / 4) * 3;
+  size_t encodedSize = 4 * ((frame->len + 2) / 3);
+  int numChunks = (frame->len + sliceSize - 1) / sliceSize;
   
-  // Check if conversion was successful
-  if (base64Image.length() > 0) {
-    // Split the image into chunks if it's too large for MQTT
-    int chunkSize = 10000; // Adjust based on MQTT broker's message size limit
-    int numChunks = (base64Image.length() + chunkSize - 1) / chunkSize;
-    
-    // Send a start message with metadata
-    String metadata = "{\"device_id\":\"" + String(device_id) + 
-                     "\",\"type\":\"image\",\"image_number\":" + String(imageNumber) + 
-                     ",\"chunks\":" + String(numChunks) + 
-                     ",\"size\":" + String(base64Image.length()) + 
-                     ",\"timestamp\":" + String(millis()) + "}";
-                     
-    char metadataTopic[60];
-    sprintf(metadataTopic, "%s/metadata", mqtt_topic_image);
-    mqttClient.publish(metadataTopic, metadata.c_str());
-    Serial.println("Published image metadata");
+  // Send a start message with metadata
+  char metadata[256];
+  snprintf(metadata, sizeof(metadata),
+           "{\"device_id\":\"%s\",\"type\":\"image\",\"event_id\":%u,\"image_number\":%u,\"event_frames\":%u,\"trigger_offset\":%ld,\"width\":%u,\"height\":%u,\"chunks\":%d,\"size\":%u,\"timestamp\":%lu}",
+           device_id, (unsigned)item.eventId, (unsigned)item.imageNumber, (unsigned)item.eventFrames,
+           (long)(frame->capturedAt - item.triggerTime), (unsigned)frame->width, (unsigned)frame->height,
+           numChunks, (unsigned)encodedSize, millis());
+  
+  char metadataTopic[60];
+  sprintf(metadataTopic, "%s/metadata", mqtt_topic_image);
+  bool complete = mqttClient.publish(metadataTopic, metadata);
+  Serial.println("Published image metadata");
+  
+  // Send each chunk
+  static char encodeBuffer[4 * (BASE64_BLOCK_INPUT / 3)];
+  char chunkTopic[80];
+  for (int i = 0; i < numChunks; i++) {
+    size_t offset = i * sliceSize;
+    size_t sliceLength = min(sliceSize, frame->len - offset);
+    snprintf(chunkTopic, sizeof(chunkTopic), "%s/chunk/%u/%d", mqtt_topic_image, (unsigned)item.imageNumber, i);
     
-    // Send each chunk
-    for (int i = 0; i < numChunks; i++) {
-      int startIndex = i * chunkSize;
-      int endIndex = min((i + 1) * chunkSize, (int)base64Image.length());
-      String chunk = base64Image.substring(startIndex, endIndex);
-      
-      String chunkTopic = String(mqtt_topic_image) + "/chunk/" + String(imageNumber) + "/" + String(i);
-      boolean success = mqttClient.publish(chunkTopic.c_str(), chunk.c_str());
-      
-      if (!success) {
-        Serial.println("Failed to publish chunk " + String(i));
+    boolean success = mqttClient.beginPublish(chunkTopic, 4 * ((sliceLength + 2) / 3), false);
+    if (success) {
+      for (size_t block = 0; block < sliceLength; block += BASE64_BLOCK_INPUT) {
+        size_t blockLength = min((size_t)BASE64_BLOCK_INPUT, sliceLength - block);
+        size_t encoded = base64EncodeBlock(frame->buf + offset + block, blockLength, encodeBuffer);
+        if (mqttClient.write((const uint8_t*)encodeBuffer, encoded) != encoded) {
+          success = false;  // Connection dropped mid-message
+          break;
+        }
       }
-      
-      // Small delay between chunks to avoid overwhelming the broker
-      delay(50);
+      success = mqttClient.endPublish() && success;
     }
     
-    Serial.println("Image " + String(imageNumber) + " sent successfully in " + String(numChunks) + " chunks");
-  } else {
-    Serial.println("Failed to encode image to base64");
+    if (!success) {
+      Serial.println("Failed to publish chunk " + String(i));
+      complete = false;
+    }
   }
-}
\ No newline at end of file
+  
+  Serial.println("Image " + String(item.imageNumber) + " sent successfully in " + String(numChunks) + " chunks");
+  return complete;
+}
@@ -0,0 +1,233 @@
+/*
+  BurstScore on frames with a known best
+
+  Each signal is measured on fixtures that differ in just that one:
+  a frame blurred by a 3 pixel Gaussian must read less sharp than the
+  frame it came from and the same frame in more light about as sharp,
+  washed out or left dark it must lose on exposure, and the empty
+  scene must show no change from itself but a figure walking in must.
+  rank() and selectBest() are then checked on hand-made measures, and a
+  burst of these frames must keep the two sharp ones with the figure.
+
+  fixtures/ holds the fenced yard of test_motion_event at 320x240,
+  saved by PIL at quality 80 as 4:2:0: empty, with a figure (sharp, and
+  sharp_moved a step on), and sharp blurred, lit (x1.4 brightness),
+  washed (x2.2, the sky clipped) and dark (x0.12).
+
+    pio test -e native -f test_burst_score
+*/
+
+#include <BurstScore.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// As in src/main.cpp
+#define BEST_FRAMES 2
+#define SCORE_WEIGHT_SHARPNESS 5
+#define SCORE_WEIGHT_EXPOSURE 3
+#define SCORE_WEIGHT_CHANGE 2
+#define SCORE_WEIGHT_TOTAL (SCORE_WEIGHT_SHARPNESS + SCORE_WEIGHT_EXPOSURE + SCORE_WEIGHT_CHANGE)
+
+#define MAP_CAPACITY (320 / 8) * (240 / 8)
+#define MIN_BLUR_LOSS 2              // Sharp over blurred sharpness, at least
+#define MAX_LIGHT_GAIN_PERCENT 15    // Sharpness gained by x1.4 light, at most
+#define MIN_EXPOSURE 800             // A frame of the yard as it is lit
+#define MAX_BAD_EXPOSURE 400         // Washed out or dark
+
+static const BurstScoreWeights weights = {SCORE_WEIGHT_SHARPNESS, SCORE_WEIGHT_EXPOSURE, SCORE_WEIGHT_CHANGE};
+
+static uint8_t map[MAP_CAPACITY];
+static BurstScorer scorer;
+
+static std::string fixturePath(const char* name) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  return path + "fixtures/" + name + ".jpg";
+}
+
+static std::vector<uint8_t> loadJpeg(const char* name) {
+  std::vector<uint8_t> data;
+  FILE* f = fopen(fixturePath(name).c_str(), "rb");
+  if (f) {
+    uint8_t buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(f);
+  }
+  TEST_ASSERT_TRUE_MESSAGE(!data.empty(), name);
+  return data;
+}
+
+static FrameMeasure measure(const char* name) {
+  std::vector<uint8_t> jpeg = loadJpeg(name);
+  FrameMeasure frame;
+  TEST_ASSERT_TRUE_MESSAGE(scorer.measure(jpeg.data(), jpeg.size(), frame), name);
+  TEST_ASSERT_TRUE(frame.decoded);
+  char message[96];
+  snprintf(message, sizeof(message), "%s: sharpness %u, exposure %u, change %u", name, (unsigned)frame.sharpness,
+           (unsigned)frame.exposure, (unsigned)frame.change);
+  TEST_MESSAGE(message);
+  return frame;
+}
+
+static FrameMeasure made(uint32_t sharpness, uint16_t exposure, uint16_t change) {
+  FrameMeasure frame = {true, sharpness, exposure, change};
+  return frame;
+}
+
+void setUp() {
+  scorer.begin(map, sizeof(map));
+}
+
+void tearDown() {}
+
+static void test_unreadable_frames_score_nothing() {
+  BurstScorer idle;
+  std::vector<uint8_t> jpeg = loadJpeg("sharp");
+  FrameMeasure frame;
+  // No map to decode into yet
+  TEST_ASSERT_FALSE(idle.measure(jpeg.data(), jpeg.size(), frame));
+  TEST_ASSERT_FALSE(frame.decoded);
+
+  TEST_ASSERT_FALSE(scorer.measure(jpeg.data(), jpeg.size() / 4, frame));
+  TEST_ASSERT_FALSE(frame.decoded);
+  TEST_ASSERT_EQUAL_UINT32(0, frame.sharpness);
+  TEST_ASSERT_EQUAL_UINT16(0, frame.exposure);
+  TEST_ASSERT_EQUAL_UINT16(0, frame.change);
+  jpeg[0] = 0;
+  TEST_ASSERT_FALSE(scorer.setReference(jpeg.data(), jpeg.size()));
+}
+
+static void test_blur_lowers_sharpness() {
+  FrameMeasure sharp = measure("sharp");
+  FrameMeasure blurred = measure("blurred");
+  TEST_ASSERT_GREATER_OR_EQUAL(blurred.sharpness * MIN_BLUR_LOSS, sharp.sharpness);
+}
+
+static void test_more_light_reads_no_sharper() {
+  // A flash adds contrast, not focus: AC energy grows with it, the
+  // sharpness over the frame's contrast hardly does
+  FrameMeasure sharp = measure("sharp");
+  FrameMeasure lit = measure("lit");
+  TEST_ASSERT_UINT32_WITHIN(sharp.sharpness * MAX_LIGHT_GAIN_PERCENT / 100, sharp.sharpness, lit.sharpness);
+}
+
+static void test_washed_and_dark_lower_exposure() {
+  FrameMeasure sharp = measure("sharp");
+  FrameMeasure washed = measure("washed");
+  FrameMeasure dark = measure("dark");
+  TEST_ASSERT_GREATER_OR_EQUAL(MIN_EXPOSURE, sharp.exposure);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_BAD_EXPOSURE, washed.exposure);
+  TEST_ASSERT_LESS_OR_EQUAL(MAX_BAD_EXPOSURE, dark.exposure);
+}
+
+static void test_change_from_the_reference() {
+  std::vector<uint8_t> empty = loadJpeg("empty");
+  TEST_ASSERT_TRUE(scorer.setReference(empty.data(), empty.size()));
+  TEST_ASSERT_EQUAL_UINT16(0, measure("empty").change);
+  uint16_t figure = measure("sharp").change;
+  TEST_ASSERT_GREATER_THAN(0, figure);
+  // Pinned, so still measured against the empty scene
+  TEST_ASSERT_EQUAL_UINT16(figure, measure("sharp").change);
+
+  // Unpinned, each frame is measured against the one before
+  scorer.reset();
+  TEST_ASSERT_EQUAL_UINT16(0, measure("empty").change);
+  TEST_ASSERT_GREATER_THAN(0, measure("sharp").change);
+  TEST_ASSERT_EQUAL_UINT16(0, measure("sharp").change);
+}
+
+static void test_rank_scales_within_the_burst() {
+  FrameMeasure frames[] = {
+    made(400, 1000, 10), made(800, 1000, 10), made(800, 500, 10), made(800, 1000, 0), made(800, 1000, 40),
+  };
+  uint16_t scores[5];
+  BurstScorer::rank(frames, 5, weights, scores);
+  // The sharpest frame at or above the median change scores full
+  TEST_ASSERT_EQUAL_UINT16(BURST_SCORE_MAX, scores[1]);
+  TEST_ASSERT_EQUAL_UINT16(BURST_SCORE_MAX, scores[4]);
+  TEST_ASSERT_EQUAL_UINT16((500 * SCORE_WEIGHT_SHARPNESS + 1000 * SCORE_WEIGHT_EXPOSURE + 1000 * SCORE_WEIGHT_CHANGE) /
+                             SCORE_WEIGHT_TOTAL, scores[0]);
+  TEST_ASSERT_EQUAL_UINT16((1000 * SCORE_WEIGHT_SHARPNESS + 500 * SCORE_WEIGHT_EXPOSURE + 1000 * SCORE_WEIGHT_CHANGE) /
+                             SCORE_WEIGHT_TOTAL, scores[2]);
+  // Below the median change, the empty scene
+  TEST_ASSERT_EQUAL_UINT16((1000 * SCORE_WEIGHT_SHARPNESS + 1000 * SCORE_WEIGHT_EXPOSURE) / SCORE_WEIGHT_TOTAL, scores[3]);
+
+  // Only relative sharpness counts, and unread frames score 0
+  for (FrameMeasure& frame : frames) {
+    frame.sharpness *= 3;
+  }
+  frames[1].decoded = false;
+  uint16_t again[5];
+  BurstScorer::rank(frames, 5, weights, again);
+  TEST_ASSERT_EQUAL_UINT16(0, again[1]);
+  TEST_ASSERT_EQUAL_UINT16(scores[4], again[4]);
+  TEST_ASSERT_EQUAL_UINT16(scores[0], again[0]);
+
+  BurstScoreWeights none = {0, 0, 0};
+  BurstScorer::rank(frames, 5, none, again);
+  for (uint16_t score : again) {
+    TEST_ASSERT_EQUAL_UINT16(0, score);
+  }
+}
+
+static void test_select_best_keeps_the_highest() {
+  const uint16_t scores[] = {300, 900, 500, 900, 100};
+  bool kept[5];
+  TEST_ASSERT_EQUAL_UINT8(2, BurstScorer::selectBest(scores, 5, 2, kept));
+  const bool expected[] = {false, true, false, true, false};
+  for (int i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL_INT(expected[i], kept[i]);
+  }
+  // Ties go to the earlier frame
+  TEST_ASSERT_EQUAL_UINT8(1, BurstScorer::selectBest(scores, 5, 1, kept));
+  TEST_ASSERT_TRUE(kept[1]);
+  TEST_ASSERT_FALSE(kept[3]);
+  // Never more than the burst
+  TEST_ASSERT_EQUAL_UINT8(5, BurstScorer::selectBest(scores, 5, 9, kept));
+  TEST_ASSERT_EQUAL_UINT8(0, BurstScorer::selectBest(scores, 5, 0, kept));
+  TEST_ASSERT_FALSE(kept[1]);
+}
+
+static void test_burst_keeps_the_sharp_frames_of_the_figure() {
+  const char* burst[] = {"blurred", "sharp", "empty", "sharp_moved", "dark"};
+  const int count = sizeof(burst) / sizeof(burst[0]);
+  std::vector<uint8_t> reference = loadJpeg("empty");
+  TEST_ASSERT_TRUE(scorer.setReference(reference.data(), reference.size()));
+  FrameMeasure frames[count];
+  for (int i = 0; i < count; i++) {
+    frames[i] = measure(burst[i]);
+  }
+  uint16_t scores[count];
+  bool kept[count];
+  BurstScorer::rank(frames, count, weights, scores);
+  BurstScorer::selectBest(scores, count, BEST_FRAMES, kept);
+  for (int i = 0; i < count; i++) {
+    char message[64];
+    snprintf(message, sizeof(message), "%s: %u%s", burst[i], (unsigned)scores[i], kept[i] ? ", kept" : "");
+    TEST_MESSAGE(message);
+    bool best = strcmp(burst[i], "sharp") == 0 || strcmp(burst[i], "sharp_moved") == 0;
+    TEST_ASSERT_EQUAL_INT_MESSAGE(best, kept[i], message);
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_unreadable_frames_score_nothing);
+  RUN_TEST(test_blur_lowers_sharpness);
+  RUN_TEST(test_more_light_reads_no_sharper);
+  RUN_TEST(test_washed_and_dark_lower_exposure);
+  RUN_TEST(test_change_from_the_reference);
+  RUN_TEST(test_rank_scales_within_the_burst);
+  RUN_TEST(test_select_best_keeps_the_highest);
+  RUN_TEST(test_burst_keeps_the_sharp_frames_of_the_figure);
+  return UNITY_END();
+}
@@ -0,0 +1,249 @@
+/*
+  Event uploads of src/main.cpp on the host
+
+  The firmware boots on the ArduinoHost stand-ins and takes a few
+  motion events. Every message it publishes is recorded. Each image
+  must go out as its metadata followed by the chunks it announces, and
+  the chunks must join into one base64 string that decodes to the frame
+  the camera served. No publish may be rejected for not fitting the
+  client's buffer. With two-tier publishing every event must send its
+  QVGA thumbnail live and a summary on cameras/<id>/status, and its
+  frames once asked for.
+
+  fixtures/yard is test_motion_event's scene saved by PIL at quality 90
+  with more noise, so that a 320x240 frame takes two chunks; the
+  160x120 frames in qvga/ still fit the thumbnail slot.
+
+    pio test -e native -f test_event_upload
+*/
+
+#include <Arduino.h>
+#include <HostHarness.h>
+#include <unity.h>
+
+#include <dirent.h>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Firmware, from src/main.cpp
+void setup();
+void loop();
+extern uint32_t eventId;
+
+// As in src/main.cpp
+#define PIR_PIN 13
+#define BURST_LENGTH 5
+#define BEST_FRAMES 2
+#define PRE_TRIGGER_DEPTH 8
+#define PRE_TRIGGER_INTERVAL 250
+#define MOTION_RESET_TIME 5000
+#define THUMBNAIL_IMAGE_NUMBER 255
+#define IMAGE_CHUNK_SIZE 10000
+#define IMAGE_LOG_SIZE 0x60000           // partitions.csv
+#define FRAME_STORE_SIZE 0x110000
+
+#define LOOP_TICK_US 1000
+#define EVENT_COUNT 3
+#define THUMBNAIL_WIDTH 160
+#define IMAGE_TOPIC "cameras/CAM001/image"
+#define STATUS_TOPIC "cameras/CAM001/status"
+
+struct PublishedImage {
+  uint32_t eventId;
+  int imageNumber;
+  int chunks;
+  size_t size;
+  int width;
+  std::string data;                  // Chunks as they arrived, joined
+  int chunksSeen;
+};
+
+static std::vector<PublishedImage> images;
+static std::vector<std::string> statuses;
+static std::set<std::string> fixtureFrames;
+
+static long jsonField(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  TEST_ASSERT_TRUE_MESSAGE(at != std::string::npos, name);
+  return strtol(json.c_str() + at + key.size(), NULL, 10);
+}
+
+// Chunks belong to the image whose metadata came last
+static void recordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  std::string json((const char*)payload, length);
+  if (strcmp(topic, IMAGE_TOPIC "/metadata") == 0) {
+    images.push_back({(uint32_t)jsonField(json, "event_id"), (int)jsonField(json, "image_number"),
+                      (int)jsonField(json, "chunks"), (size_t)jsonField(json, "size"),
+                      (int)jsonField(json, "width"), std::string(), 0});
+  } else if (strncmp(topic, IMAGE_TOPIC "/chunk/", strlen(IMAGE_TOPIC "/chunk/")) == 0) {
+    TEST_ASSERT_FALSE_MESSAGE(images.empty(), topic);
+    PublishedImage& image = images.back();
+    char expected[80];
+    snprintf(expected, sizeof(expected), IMAGE_TOPIC "/chunk/%d/%d", image.imageNumber, image.chunksSeen);
+    TEST_ASSERT_EQUAL_STRING(expected, topic);
+    image.data += json;
+    image.chunksSeen++;
+  } else if (strcmp(topic, STATUS_TOPIC) == 0) {
+    statuses.push_back(json);
+  }
+}
+
+static std::string base64Decode(const std::string& text) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  uint32_t bits = 0;
+  int count = 0;
+  for (char c : text) {
+    if (c == '=') {
+      break;
+    }
+    const char* at = strchr(alphabet, c);
+    TEST_ASSERT_TRUE_MESSAGE(at && c, "not base64");
+    bits = (bits << 6) | (uint32_t)(at - alphabet);
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      out += (char)((bits >> count) & 0xFF);
+    }
+  }
+  return out;
+}
+
+static std::string fixturePath(const char* name) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  return path + "fixtures/" + name;
+}
+
+// Every frame the camera can serve, burst and ring sizes
+static void loadFixtureFrames(const std::string& directory) {
+  DIR* dir = opendir(directory.c_str());
+  TEST_ASSERT_NOT_NULL_MESSAGE(dir, directory.c_str());
+  while (dirent* entry = readdir(dir)) {
+    std::string path = directory + "/" + entry->d_name;
+    if (strstr(entry->d_name, ".jpg")) {
+      FILE* f = fopen(path.c_str(), "rb");
+      TEST_ASSERT_NOT_NULL_MESSAGE(f, path.c_str());
+      std::string data;
+      char buffer[4096];
+      size_t got;
+      while ((got = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        data.append(buffer, got);
+      }
+      fclose(f);
+      fixtureFrames.insert(data);
+    }
+  }
+  closedir(dir);
+}
+
+// Run loop() for ms of virtual time, never letting the frames run out
+static void runFor(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    if (hostFramesServed() + BURST_LENGTH + 8 >= hostFrameCount()) {
+      hostRewindFrames();
+    }
+    loop();
+    hostAdvanceMicros(LOOP_TICK_US);
+  }
+}
+
+static std::vector<const PublishedImage*> eventImages(uint32_t id) {
+  std::vector<const PublishedImage*> found;
+  for (const PublishedImage& image : images) {
+    if (image.eventId == id) {
+      found.push_back(&image);
+    }
+  }
+  return found;
+}
+
+// The chunks announced, in order, joining into one of the frames served
+static void checkImage(const PublishedImage& image) {
+  char message[64];
+  snprintf(message, sizeof(message), "event %u image %d", (unsigned)image.eventId, image.imageNumber);
+  TEST_ASSERT_EQUAL_INT_MESSAGE(image.chunks, image.chunksSeen, message);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(image.size, image.data.size(), message);
+  TEST_ASSERT_TRUE_MESSAGE(image.chunks == (int)((image.size + IMAGE_CHUNK_SIZE - 1) / IMAGE_CHUNK_SIZE), message);
+  TEST_ASSERT_TRUE_MESSAGE(fixtureFrames.count(base64Decode(image.data)) == 1, message);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_events_publish_their_thumbnail() {
+  TEST_ASSERT_GREATER_THAN(0, hostLoadFrames(fixturePath("yard").c_str()));
+  loadFixtureFrames(fixturePath("yard"));
+  loadFixtureFrames(fixturePath("yard/qvga"));
+  TEST_ASSERT_TRUE(hostFlashAttach("imagelog", "/tmp/camera-test-imagelog.bin", IMAGE_LOG_SIZE, true));
+  TEST_ASSERT_TRUE(hostFlashAttach("framestore", "/tmp/camera-test-framestore.bin", FRAME_STORE_SIZE, true));
+  hostSetMqttRecorder(recordMessage);
+  hostSetPin(PIR_PIN, LOW);
+  setup();
+  hostResetMqttStats();
+  for (int event = 0; event < EVENT_COUNT; event++) {
+    runFor(MOTION_RESET_TIME);
+    uint32_t before = eventId;
+    hostSetPin(PIR_PIN, HIGH);
+    loop();
+    hostSetPin(PIR_PIN, LOW);
+    runFor(100);
+    TEST_ASSERT_EQUAL_UINT32(before + 1, eventId);
+
+    // Only the thumbnail goes out live
+    std::vector<const PublishedImage*> sent = eventImages(eventId);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, sent.size(), "no thumbnail");
+    TEST_ASSERT_EQUAL_INT(THUMBNAIL_IMAGE_NUMBER, sent[0]->imageNumber);
+    TEST_ASSERT_EQUAL_INT(THUMBNAIL_WIDTH, sent[0]->width);
+    checkImage(*sent[0]);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, hostMqttStats().rejected);
+}
+
+static void test_status_summary_for_each_event() {
+  TEST_ASSERT_EQUAL_UINT32(EVENT_COUNT, statuses.size());
+  for (int event = 0; event < EVENT_COUNT; event++) {
+    const std::string& status = statuses[event];
+    TEST_MESSAGE(status.c_str());
+    TEST_ASSERT_EQUAL_INT(eventId - EVENT_COUNT + 1 + event, jsonField(status, "event_id"));
+    TEST_ASSERT_EQUAL_INT(PRE_TRIGGER_DEPTH + BURST_LENGTH, jsonField(status, "frames"));
+    TEST_ASSERT_EQUAL_INT(1, jsonField(status, "sent"));
+    TEST_ASSERT_EQUAL_INT(0, jsonField(status, "pipeline"));
+    TEST_ASSERT_EQUAL_INT(1, jsonField(status, "two_tier"));
+    TEST_ASSERT_LESS_OR_EQUAL(jsonField(status, "last_image_ms"), jsonField(status, "first_image_ms"));
+  }
+}
+
+static void test_requested_frames_rebuild() {
+  // Every event's frames are still in the frame store
+  for (uint32_t id = eventId - EVENT_COUNT + 1; id <= eventId; id++) {
+    size_t first = images.size();
+    char request[32];
+    int length = snprintf(request, sizeof(request), "{\"event_id\":%u}", (unsigned)id);
+    hostDeliver("cameras/CAM001/request", (const uint8_t*)request, length);
+    runFor(100);
+    TEST_ASSERT_EQUAL_UINT32(PRE_TRIGGER_DEPTH + BEST_FRAMES, images.size() - first);
+    for (size_t i = first; i < images.size(); i++) {
+      TEST_ASSERT_EQUAL_UINT32(id, images[i].eventId);
+      checkImage(images[i]);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, hostMqttStats().rejected);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_events_publish_their_thumbnail);
+  RUN_TEST(test_status_summary_for_each_event);
+  RUN_TEST(test_requested_frames_rebuild);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+/*
+  PIR wake of src/main.cpp: burst first, then the cached network
+
+  The firmware boots on the ArduinoHost stand-ins as from an EXT0 wake
+  with the AP down. It must take the burst once the sensor has settled,
+  before it tries to join, and keep the event in flash with the wake
+  times in its summary until it reaches cameras/<id>/status. The join
+  after a full one reuses the AP and lease kept in RTC memory,
+  NETWORK_CACHE_REUSES times before it renews them with DHCP, and an AP
+  that does not answer costs at most WIFI_FAST_JOIN_TIMEOUT and
+  WIFI_JOIN_TIMEOUT and drops the cache.
+
+  The frames are those of test_motion_event/fixtures/yard.
+
+    pio test -e native -f test_fast_wake
+*/
+
+#include <Arduino.h>
+#include <HostHarness.h>
+#include <WiFi.h>
+#include <unity.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+// As in src/main.cpp
+struct NetworkCache {
+  bool valid;
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint16_t reuses;
+};
+
+#define PIR_PIN 13
+#define WIFI_FAST_JOIN_TIMEOUT 3000
+#define WIFI_JOIN_TIMEOUT 20000
+#define NETWORK_CACHE_REUSES 20
+#define WAKE_SETTLE_TIME 200
+#define IMAGE_LOG_SIZE 0x60000           // partitions.csv
+#define FRAME_STORE_SIZE 0x110000
+
+#define FLASH_WARM_UP 100                // captureMultiplePhotos() lights the flash first
+#define WIFI_POLL 100                    // waitForWiFi() polls every 100 ms
+#define DRAIN_TIMEOUT 15000              // Broker retry, then stored records 1 s apart (ms)
+#define STATUS_TOPIC "cameras/CAM001/status"
+
+// Firmware, from src/main.cpp
+void setup();
+void loop();
+bool connectToWiFi();
+extern NetworkCache networkCache;
+extern unsigned long wakeToCapture;
+extern unsigned long wakeToPublish;
+extern uint32_t eventId;
+
+static std::string wakeStatus;
+
+static long jsonField(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  TEST_ASSERT_TRUE_MESSAGE(at != std::string::npos, name);
+  return strtol(json.c_str() + at + key.size(), NULL, 10);
+}
+
+static void recordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  if (strcmp(topic, STATUS_TOPIC) == 0 && wakeStatus.empty()) {
+    wakeStatus.assign((const char*)payload, length);
+  }
+}
+
+static std::string fixturePath(const char* name) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  return path + "../test_motion_event/fixtures/" + name;
+}
+
+void setUp() {
+  hostSetWifiUp(true);
+}
+
+void tearDown() {}
+
+static void test_burst_taken_before_joining() {
+  TEST_ASSERT_GREATER_THAN(0, hostLoadFrames(fixturePath("yard").c_str()));
+  TEST_ASSERT_TRUE(hostFlashAttach("imagelog", "/tmp/camera-test-imagelog.bin", IMAGE_LOG_SIZE, true));
+  TEST_ASSERT_TRUE(hostFlashAttach("framestore", "/tmp/camera-test-framestore.bin", FRAME_STORE_SIZE, true));
+  hostSetMqttRecorder(recordMessage);
+  hostSetWakeupCause(ESP_SLEEP_WAKEUP_EXT0);
+  hostSetPin(PIR_PIN, HIGH);
+
+  // With the AP gone the burst is taken all the same, once the sensor
+  // has settled and the flash is on; only then does the join give up
+  hostSetWifiUp(false);
+  unsigned long boot = millis();
+  setup();
+  TEST_ASSERT_EQUAL_UINT32(1, eventId);
+  TEST_ASSERT_EQUAL_UINT32(boot + WAKE_SETTLE_TIME + FLASH_WARM_UP, wakeToCapture);
+  TEST_ASSERT_GREATER_OR_EQUAL(wakeToCapture + WIFI_JOIN_TIMEOUT, millis());
+  TEST_ASSERT_FALSE(networkCache.valid);
+  // Nothing reached the broker
+  TEST_ASSERT_EQUAL_UINT32(0, wakeToPublish);
+  TEST_ASSERT_TRUE(wakeStatus.empty());
+}
+
+static void test_full_join_fills_the_cache() {
+  TEST_ASSERT_TRUE(connectToWiFi());
+  TEST_ASSERT_TRUE(networkCache.valid);
+  TEST_ASSERT_EQUAL_UINT16(0, networkCache.reuses);
+  TEST_ASSERT_EQUAL_INT(WiFi.channel(), networkCache.channel);
+  TEST_ASSERT_TRUE(memcmp(WiFi.BSSID(), networkCache.bssid, sizeof(networkCache.bssid)) == 0);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)WiFi.localIP(), networkCache.ip);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)WiFi.gatewayIP(), networkCache.gateway);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)WiFi.subnetMask(), networkCache.subnet);
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)WiFi.dnsIP(), networkCache.dns);
+}
+
+static void test_stored_summary_keeps_the_wake_times() {
+  // loop() sends what was stored once the broker can be reached
+  hostSetPin(PIR_PIN, LOW);
+  unsigned long start = millis();
+  while (wakeStatus.empty() && millis() - start < DRAIN_TIMEOUT) {
+    loop();
+    hostAdvanceMicros(1000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, eventId);
+  TEST_ASSERT_FALSE_MESSAGE(wakeStatus.empty(), "no event summary");
+  TEST_MESSAGE(wakeStatus.c_str());
+  TEST_ASSERT_EQUAL_INT(eventId, jsonField(wakeStatus, "event_id"));
+  TEST_ASSERT_EQUAL_INT(wakeToCapture, jsonField(wakeStatus, "wake_capture_ms"));
+  TEST_ASSERT_EQUAL_INT(0, jsonField(wakeStatus, "wake_publish_ms"));
+}
+
+static void test_cached_rejoins_renew_the_lease() {
+  for (int join = 1; join <= NETWORK_CACHE_REUSES; join++) {
+    TEST_ASSERT_TRUE(connectToWiFi());
+    TEST_ASSERT_EQUAL_UINT16(join, networkCache.reuses);
+  }
+  // Then DHCP again, and the count starts over
+  TEST_ASSERT_TRUE(connectToWiFi());
+  TEST_ASSERT_TRUE(networkCache.valid);
+  TEST_ASSERT_EQUAL_UINT16(0, networkCache.reuses);
+  TEST_ASSERT_TRUE(connectToWiFi());
+  TEST_ASSERT_EQUAL_UINT16(1, networkCache.reuses);
+}
+
+static void test_dead_ap_gives_up_in_time() {
+  hostSetWifiUp(false);
+  unsigned long start = millis();
+  TEST_ASSERT_FALSE(connectToWiFi());
+  unsigned long took = millis() - start;
+  TEST_ASSERT_GREATER_OR_EQUAL(WIFI_FAST_JOIN_TIMEOUT + WIFI_JOIN_TIMEOUT, took);
+  TEST_ASSERT_LESS_OR_EQUAL(WIFI_FAST_JOIN_TIMEOUT + WIFI_JOIN_TIMEOUT + 2 * WIFI_POLL, took);
+  TEST_ASSERT_FALSE(networkCache.valid);
+
+  // The next join scans, and caches again
+  hostSetWifiUp(true);
+  TEST_ASSERT_TRUE(connectToWiFi());
+  TEST_ASSERT_TRUE(networkCache.valid);
+  TEST_ASSERT_EQUAL_UINT16(0, networkCache.reuses);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_taken_before_joining);
+  RUN_TEST(test_full_join_fills_the_cache);
+  RUN_TEST(test_stored_summary_keeps_the_wake_times);
+  RUN_TEST(test_cached_rejoins_renew_the_lease);
+  RUN_TEST(test_dead_ap_gives_up_in_time);
+  return UNITY_END();
+}
@@ -0,0 +1,279 @@
+/*
+  FlashLog across power cuts, evictions and laps of its region
+
+  The log sits on the harness's "imagelog" partition, kept in a file. A
+  workload appends 60 records of 100 to 6100 bytes to a 16 sector log,
+  marking the oldest sent whenever more than 6 wait, so it wraps several
+  times without ever dropping an unsent record. The power is cut at each
+  of its writes and erases in turn. After every cut the log is recovered
+  as a reboot would and drained: no record acknowledged as appended may
+  be lost, none marked sent may come back, none may be corrupt, and the
+  recovered log must take a new record and return it after another
+  reboot.
+
+    pio test -e native -f test_flash_log
+*/
+
+#include <FlashLog.h>
+#include <HostHarness.h>
+#include <PartitionFlash.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_FILE "/tmp/camera-test-flashlog.bin"
+#define LOG_SECTORS 16
+#define WORKLOAD_RECORDS 60
+#define WORKLOAD_BACKLOG 6
+#define WORKLOAD_MAX_LENGTH 6100
+
+struct LogState {
+  uint32_t appended;           // Appends that returned
+  uint32_t sent;               // Records below this were marked sent and it returned
+  int64_t sending;             // Record being marked sent, -1 for none
+};
+
+static PartitionFlash flash;
+static uint8_t payload[LOG_SECTORS * PARTITION_FLASH_SECTOR_SIZE];
+static uint8_t stored[LOG_SECTORS * PARTITION_FLASH_SECTOR_SIZE];
+
+static uint32_t recordLength(uint32_t index) {
+  return 100 + (index * 2654435761u >> 16) % (WORKLOAD_MAX_LENGTH - 100);
+}
+
+static void fillRecord(uint32_t index, uint32_t length) {
+  for (uint32_t i = 0; i < length; i++) {
+    payload[i] = (uint8_t)(index * 31 + i * 7);
+  }
+}
+
+// Read a record back and check it is the one with its index
+static bool readRecord(FlashLog& log, const FlashLogRecord& record, uint32_t& index) {
+  if (record.metaLength != sizeof(index) || record.length > sizeof(stored) || !log.read(record, &index, stored)) {
+    return false;
+  }
+  fillRecord(index, record.length);
+  return memcmp(stored, payload, record.length) == 0;
+}
+
+static void blankLog(FlashLog& log) {
+  TEST_ASSERT_TRUE(hostFlashAttach("imagelog", LOG_FILE, LOG_SECTORS * PARTITION_FLASH_SECTOR_SIZE, true));
+  TEST_ASSERT_TRUE(log.begin(&flash));
+}
+
+// Runs until done or the power is cut, state follows what has returned
+static void runWorkload(FlashLog& log, LogState& state) {
+  while (state.appended < WORKLOAD_RECORDS) {
+    uint32_t index = state.appended;
+    uint32_t length = recordLength(index);
+    fillRecord(index, length);
+    if (!log.append(&index, sizeof(index), payload, length)) {
+      return;
+    }
+    state.appended++;
+    FlashLogRecord record;
+    while (log.pendingCount() > WORKLOAD_BACKLOG && log.peek(record)) {
+      uint32_t sentIndex;
+      if (!log.read(record, &sentIndex, stored)) {
+        return;
+      }
+      state.sending = sentIndex;
+      log.markSent(record);
+      state.sending = -1;
+      state.sent = sentIndex + 1;
+    }
+  }
+}
+
+void setUp() {
+  TEST_ASSERT_TRUE(hostFlashAttach("imagelog", LOG_FILE, LOG_SECTORS * PARTITION_FLASH_SECTOR_SIZE, true));
+  TEST_ASSERT_TRUE(flash.begin("imagelog"));
+}
+
+void tearDown() {
+  hostFlashCutPower(0);
+}
+
+static void test_power_cut_at_every_operation() {
+  FlashLog log;
+  LogState state = {0, 0, -1};
+  blankLog(log);
+  runWorkload(log, state);
+  TEST_ASSERT_EQUAL_UINT32(WORKLOAD_RECORDS, state.appended);
+  uint32_t operations = hostFlashOperations();
+
+  uint32_t recovered = 0;
+  for (uint32_t cut = 1; cut <= operations; cut++) {
+    blankLog(log);
+    state = {0, 0, -1};
+    hostFlashCutPower(cut);
+    try {
+      runWorkload(log, state);
+    } catch (const HostPowerLoss&) {
+    }
+    hostFlashCutPower(0);
+
+    // Drain as the firmware would after a reboot
+    char message[96];
+    FlashLog after;
+    TEST_ASSERT_TRUE(after.begin(&flash));
+    int64_t previous = -1;
+    uint32_t expected = state.sent;     // Next acknowledged record that must come back
+    FlashLogRecord record;
+    while (after.peek(record)) {
+      uint32_t index = 0;
+      snprintf(message, sizeof(message), "cut at operation %u of %u, record after %d", (unsigned)cut,
+               (unsigned)operations, (int)previous);
+      TEST_ASSERT_TRUE_MESSAGE(readRecord(after, record, index), message);
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(recordLength(index), record.length, message);
+      TEST_ASSERT_TRUE_MESSAGE((int64_t)index > previous, message);
+      // Only the record that was being marked sent may come back once sent
+      TEST_ASSERT_TRUE_MESSAGE(index >= state.sent || (int64_t)index == state.sending, message);
+      // Acknowledged records skipped over were lost, the one in flight may go either way
+      for (; expected < index && expected < state.appended; expected++) {
+        TEST_ASSERT_TRUE_MESSAGE((int64_t)expected == state.sending, message);
+      }
+      if (index >= expected) {
+        expected = index + 1;
+      }
+      previous = index;
+      recovered++;
+      TEST_ASSERT_TRUE_MESSAGE(after.markSent(record), message);
+    }
+    snprintf(message, sizeof(message), "cut at operation %u of %u, records from %u", (unsigned)cut,
+             (unsigned)operations, (unsigned)expected);
+    for (; expected < state.appended; expected++) {
+      TEST_ASSERT_TRUE_MESSAGE((int64_t)expected == state.sending, message);
+    }
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, after.corruptCount(), message);
+
+    // The recovered log must keep working across another reboot
+    uint32_t index = WORKLOAD_RECORDS;
+    fillRecord(index, 64);
+    TEST_ASSERT_TRUE_MESSAGE(after.append(&index, sizeof(index), payload, 64), message);
+    FlashLog again;
+    TEST_ASSERT_TRUE_MESSAGE(again.begin(&flash), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1, again.pendingCount(), message);
+    TEST_ASSERT_TRUE_MESSAGE(again.peek(record), message);
+    TEST_ASSERT_TRUE_MESSAGE(readRecord(again, record, index), message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(WORKLOAD_RECORDS, index, message);
+  }
+
+  char summary[96];
+  snprintf(summary, sizeof(summary), "%u cut points, %u records recovered", (unsigned)operations,
+           (unsigned)recovered);
+  TEST_MESSAGE(summary);
+}
+
+static void test_oversize_record_is_refused() {
+  FlashLog log;
+  blankLog(log);
+  uint32_t index = 1;
+  uint32_t largest = log.maxRecordLength() - sizeof(index);
+  uint32_t operations = hostFlashOperations();
+  TEST_ASSERT_FALSE(log.append(&index, sizeof(index), payload, largest + 1));
+  TEST_ASSERT_FALSE(log.append(NULL, 0, payload, log.maxRecordLength() + 1));
+  TEST_ASSERT_EQUAL_UINT32(operations, hostFlashOperations());  // Refused before touching the flash
+  TEST_ASSERT_EQUAL_UINT32(0, log.pendingCount());
+
+  // The largest record fits, and comes back whole after a reboot
+  fillRecord(index, largest);
+  TEST_ASSERT_TRUE(log.append(&index, sizeof(index), payload, largest));
+  index = 2;
+  fillRecord(index, 100);
+  TEST_ASSERT_TRUE(log.append(&index, sizeof(index), payload, 100));
+  FlashLog after;
+  TEST_ASSERT_TRUE(after.begin(&flash));
+  TEST_ASSERT_EQUAL_UINT32(2, after.pendingCount());
+  FlashLogRecord record;
+  TEST_ASSERT_TRUE(after.peek(record));
+  TEST_ASSERT_EQUAL_UINT32(largest, record.length);
+  TEST_ASSERT_TRUE(readRecord(after, record, index));
+  TEST_ASSERT_EQUAL_UINT32(1, index);
+  TEST_ASSERT_TRUE(after.markSent(record));
+  TEST_ASSERT_TRUE(after.peek(record));
+  TEST_ASSERT_TRUE(readRecord(after, record, index));
+  TEST_ASSERT_EQUAL_UINT32(2, index);
+}
+
+static void test_eviction_drops_oldest_unsent() {
+  // Nothing is marked sent: once the head laps the tail, whole sectors
+  // of the oldest records go, and every one of them is counted
+  FlashLog log;
+  blankLog(log);
+  for (uint32_t index = 0; index < WORKLOAD_RECORDS; index++) {
+    fillRecord(index, recordLength(index));
+    TEST_ASSERT_TRUE(log.append(&index, sizeof(index), payload, recordLength(index)));
+    TEST_ASSERT_EQUAL_UINT32(index + 1, log.evictedCount() + log.pendingCount());
+  }
+  uint32_t evicted = log.evictedCount();
+  TEST_ASSERT_GREATER_THAN(0, evicted);
+  TEST_ASSERT_GREATER_THAN(0, log.pendingCount());
+
+  // The survivors are the newest records, oldest first, also after a reboot
+  FlashLog after;
+  TEST_ASSERT_TRUE(after.begin(&flash));
+  TEST_ASSERT_EQUAL_UINT32(log.pendingCount(), after.pendingCount());
+  TEST_ASSERT_EQUAL_UINT32(0, after.evictedCount());
+  FlashLogRecord record;
+  uint32_t expected = evicted;
+  while (after.peek(record)) {
+    uint32_t index;
+    TEST_ASSERT_TRUE(readRecord(after, record, index));
+    TEST_ASSERT_EQUAL_UINT32(expected++, index);
+    TEST_ASSERT_TRUE(after.markSent(record));
+  }
+  TEST_ASSERT_EQUAL_UINT32(WORKLOAD_RECORDS, expected);
+  TEST_ASSERT_EQUAL_UINT32(0, after.pendingCount());
+}
+
+// Walk the log, checking the records are consecutive and end with the
+// last appended. Returns the first one's index.
+static uint32_t walkLog(FlashLog& log) {
+  FlashLogRecord record;
+  TEST_ASSERT_TRUE(log.first(record));
+  uint32_t first = 0;
+  TEST_ASSERT_TRUE(log.readMeta(record, &first));
+  uint32_t expected = first;
+  do {
+    uint32_t index;
+    TEST_ASSERT_TRUE(log.readMeta(record, &index));
+    TEST_ASSERT_EQUAL_UINT32(expected, index);
+    TEST_ASSERT_TRUE(readRecord(log, record, index));
+    expected++;
+  } while (log.next(record));
+  TEST_ASSERT_EQUAL_UINT32(WORKLOAD_RECORDS, expected);
+  return first;
+}
+
+static void test_walk_after_wrap() {
+  FlashLog log;
+  LogState state = {0, 0, -1};
+  blankLog(log);
+  runWorkload(log, state);
+  TEST_ASSERT_EQUAL_UINT32(WORKLOAD_RECORDS, state.appended);
+  TEST_ASSERT_GREATER_THAN(2 * LOG_SECTORS, log.erasesCount());  // Lapped the region more than twice
+  TEST_ASSERT_EQUAL_UINT32(0, log.evictedCount());
+
+  // Sent records stay on flash until their sector is reused
+  uint32_t first = walkLog(log);
+  TEST_ASSERT_GREATER_THAN(0, first);
+  TEST_ASSERT_LESS_OR_EQUAL(WORKLOAD_RECORDS - WORKLOAD_BACKLOG, first);
+
+  FlashLog after;
+  TEST_ASSERT_TRUE(after.begin(&flash));
+  TEST_ASSERT_EQUAL_UINT32(first, walkLog(after));
+  TEST_ASSERT_EQUAL_UINT32(WORKLOAD_BACKLOG, after.pendingCount());
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_power_cut_at_every_operation);
+  RUN_TEST(test_oversize_record_is_refused);
+  RUN_TEST(test_eviction_drops_oldest_unsent);
+  RUN_TEST(test_walk_after_wrap);
+  return UNITY_END();
+}
@@ -0,0 +1,246 @@
+/*
+  FramePool slots, reference counts and bursts past fb_count
+
+  Frames are stored, shared and released as the burst, the web page and
+  the uploader do, and each slot must be reused only once its last
+  holder lets go. A burst of BURST_LENGTH frames is then taken from the
+  ArduinoHost camera, which like the driver fails once fb_count frames
+  are held: held as driver buffers it stalls, copied into the pool it
+  does not.
+
+    pio test -e native -f test_frame_pool
+*/
+
+#include <FramePool.h>
+#include <HostHarness.h>
+#include <esp_camera.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+
+// As in src/main.cpp
+#define BURST_LENGTH 5
+#define FB_COUNT 2
+
+#define SLOT_SIZE 64
+#define SLOT_COUNT 4
+#define FRAME_DIR "/tmp/camera-test-frames"
+#define THREAD_ROUNDS 100000
+
+static uint8_t arena[SLOT_SIZE * SLOT_COUNT];
+
+static void fillFrame(uint8_t* data, size_t length, uint8_t seed) {
+  for (size_t i = 0; i < length; i++) {
+    data[i] = (uint8_t)(seed + i);
+  }
+}
+
+// JPEG header with only the frame's size in it, as the stand-in reads it
+static void writeFrame(int index) {
+  const uint8_t jpeg[] = {
+    0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0xF0, 0x01, 0x40,
+    0x03, 0x01, 0x22, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01, 0xFF, 0xD9,
+  };
+  char path[64];
+  snprintf(path, sizeof(path), FRAME_DIR "/%02d.jpg", index);
+  FILE* f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL_MESSAGE(f, path);
+  fwrite(jpeg, 1, sizeof(jpeg), f);
+  fclose(f);
+}
+
+static void initCamera() {
+  camera_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.pixel_format = PIXFORMAT_JPEG;
+  config.frame_size = FRAMESIZE_QVGA;
+  config.fb_count = FB_COUNT;
+  TEST_ASSERT_EQUAL_INT(ESP_OK, esp_camera_init(&config));
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_begin_checks_its_arena() {
+  FramePool pool;
+  TEST_ASSERT_FALSE(pool.begin(NULL, SLOT_SIZE, SLOT_COUNT));
+  TEST_ASSERT_FALSE(pool.begin(arena, 0, SLOT_COUNT));
+  TEST_ASSERT_FALSE(pool.begin(arena, SLOT_SIZE, 0));
+  TEST_ASSERT_FALSE(pool.begin(arena, 1, FRAME_POOL_MAX_SLOTS + 1));
+  TEST_ASSERT_EQUAL_UINT8(0, pool.freeSlots());
+  TEST_ASSERT_NULL(pool.claim());
+  TEST_ASSERT_TRUE(pool.begin(arena, SLOT_SIZE, SLOT_COUNT));
+  TEST_ASSERT_EQUAL_UINT32(SLOT_SIZE, pool.slotSize());
+  TEST_ASSERT_EQUAL_UINT8(SLOT_COUNT, pool.slotCount());
+  TEST_ASSERT_EQUAL_UINT8(SLOT_COUNT, pool.freeSlots());
+}
+
+static void test_store_copies_into_its_own_slot() {
+  FramePool pool;
+  TEST_ASSERT_TRUE(pool.begin(arena, SLOT_SIZE, SLOT_COUNT));
+  uint8_t data[SLOT_SIZE];
+  PooledFrame* frames[SLOT_COUNT];
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    fillFrame(data, sizeof(data), (uint8_t)(i * 50));
+    frames[i] = pool.store(data, SLOT_SIZE - i, 320, 240, 1000 + i);
+    TEST_ASSERT_NOT_NULL(frames[i]);
+    TEST_ASSERT_EQUAL_UINT32(1, frames[i]->refs);
+    TEST_ASSERT_TRUE(frames[i]->buf >= arena && frames[i]->buf + SLOT_SIZE <= arena + sizeof(arena));
+  }
+  // Slots never overlap, and each holds what was stored in it
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    fillFrame(data, sizeof(data), (uint8_t)(i * 50));
+    TEST_ASSERT_EQUAL_UINT32(SLOT_SIZE - i, frames[i]->len);
+    TEST_ASSERT_EQUAL_UINT32(1000 + i, frames[i]->capturedAt);
+    TEST_ASSERT_EQUAL_UINT16(320, frames[i]->width);
+    TEST_ASSERT_EQUAL_UINT16(240, frames[i]->height);
+    TEST_ASSERT_TRUE(memcmp(data, frames[i]->buf, frames[i]->len) == 0);
+    for (int j = 0; j < i; j++) {
+      TEST_ASSERT_TRUE(frames[i]->buf != frames[j]->buf);
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT8(0, pool.freeSlots());
+  TEST_ASSERT_EQUAL_UINT8(SLOT_COUNT, pool.peakInUse());
+}
+
+static void test_full_pool_and_oversize_frames_refused() {
+  FramePool pool;
+  TEST_ASSERT_TRUE(pool.begin(arena, SLOT_SIZE, SLOT_COUNT));
+  uint8_t data[SLOT_SIZE + 1];
+  fillFrame(data, sizeof(data), 7);
+  TEST_ASSERT_NULL(pool.store(data, SLOT_SIZE + 1, 320, 240, 0));
+  TEST_ASSERT_EQUAL_UINT8(SLOT_COUNT, pool.freeSlots());
+
+  PooledFrame* frames[SLOT_COUNT];
+  for (int i = 0; i < SLOT_COUNT; i++) {
+    frames[i] = i % 2 ? pool.claim() : pool.store(data, SLOT_SIZE, 320, 240, 0);
+    TEST_ASSERT_NOT_NULL(frames[i]);
+  }
+  TEST_ASSERT_NULL(pool.store(data, 1, 320, 240, 0));
+  TEST_ASSERT_NULL(pool.claim());
+
+  // One freed slot is one frame more
+  FramePool::release(frames[2]);
+  PooledFrame* again = pool.store(data, 1, 320, 240, 0);
+  TEST_ASSERT_TRUE(again == frames[2]);
+  TEST_ASSERT_NULL(pool.claim());
+  FramePool::release(NULL);
+}
+
+static void test_slot_reused_after_last_holder() {
+  // The burst's copy is shared by the web page and the uploader
+  FramePool pool;
+  TEST_ASSERT_TRUE(pool.begin(arena, SLOT_SIZE, 1));
+  uint8_t data[SLOT_SIZE];
+  fillFrame(data, sizeof(data), 1);
+  PooledFrame* burst = pool.store(data, SLOT_SIZE, 320, 240, 0);
+  TEST_ASSERT_NOT_NULL(burst);
+  FramePool::retain(burst);
+  FramePool::retain(burst);
+  TEST_ASSERT_EQUAL_UINT32(3, burst->refs);
+
+  FramePool::release(burst);
+  FramePool::release(burst);
+  TEST_ASSERT_NULL(pool.claim());
+  TEST_ASSERT_TRUE(memcmp(data, burst->buf, SLOT_SIZE) == 0);
+
+  FramePool::release(burst);
+  TEST_ASSERT_EQUAL_UINT8(1, pool.freeSlots());
+  fillFrame(data, sizeof(data), 99);
+  PooledFrame* next = pool.store(data, SLOT_SIZE, 320, 240, 0);
+  TEST_ASSERT_TRUE(next == burst);
+  TEST_ASSERT_EQUAL_UINT32(1, next->refs);
+  TEST_ASSERT_EQUAL_UINT8(99, next->buf[0]);
+  TEST_ASSERT_EQUAL_UINT8(1, pool.peakInUse());
+}
+
+static void test_holders_on_two_threads() {
+  // The uploader releases on core 0 while loop() stores on core 1: no
+  // slot may be handed out twice or lost
+  FramePool pool;
+  TEST_ASSERT_TRUE(pool.begin(arena, SLOT_SIZE, SLOT_COUNT));
+  uint8_t data[SLOT_SIZE];
+  fillFrame(data, sizeof(data), 3);
+  std::thread other([&pool]() {
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+      PooledFrame* frame = pool.claim();
+      if (frame) {
+        FramePool::retain(frame);
+        FramePool::release(frame);
+        FramePool::release(frame);
+      }
+    }
+  });
+  uint32_t stored = 0;
+  for (int round = 0; round < THREAD_ROUNDS; round++) {
+    PooledFrame* frame = pool.store(data, SLOT_SIZE, 320, 240, round);
+    if (frame) {
+      TEST_ASSERT_EQUAL_UINT32(round, frame->capturedAt);
+      stored++;
+      FramePool::release(frame);
+    }
+  }
+  other.join();
+  TEST_ASSERT_GREATER_THAN(0, stored);
+  TEST_ASSERT_EQUAL_UINT8(SLOT_COUNT, pool.freeSlots());
+}
+
+static void test_burst_past_fb_count() {
+  mkdir(FRAME_DIR, 0755);
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    writeFrame(i);
+  }
+  TEST_ASSERT_EQUAL_UINT32(BURST_LENGTH, hostLoadFrames(FRAME_DIR));
+  initCamera();
+
+  // Holding driver buffers, as the burst used to, stalls at fb_count
+  hostResetMqttStats();
+  camera_fb_t* held[BURST_LENGTH];
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    held[i] = esp_camera_fb_get();
+  }
+  TEST_ASSERT_EQUAL_UINT32(BURST_LENGTH - FB_COUNT, hostMqttStats().captureStalls);
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    esp_camera_fb_return(held[i]);
+  }
+
+  // Copied out and returned straight away, the whole burst is taken
+  hostRewindFrames();
+  hostResetMqttStats();
+  static uint8_t burstArena[BURST_LENGTH * 1024];
+  FramePool pool;
+  TEST_ASSERT_TRUE(pool.begin(burstArena, 1024, BURST_LENGTH));
+  PooledFrame* burst[BURST_LENGTH];
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    TEST_ASSERT_NOT_NULL(fb);
+    burst[i] = pool.store(fb->buf, fb->len, fb->width, fb->height, millis());
+    esp_camera_fb_return(fb);
+    TEST_ASSERT_NOT_NULL(burst[i]);
+    TEST_ASSERT_EQUAL_UINT16(320, burst[i]->width);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, hostMqttStats().captureStalls);
+  TEST_ASSERT_EQUAL_UINT32(0, hostFramesOutstanding());
+  for (int i = 0; i < BURST_LENGTH; i++) {
+    FramePool::release(burst[i]);
+  }
+  TEST_ASSERT_EQUAL_UINT8(BURST_LENGTH, pool.freeSlots());
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_checks_its_arena);
+  RUN_TEST(test_store_copies_into_its_own_slot);
+  RUN_TEST(test_full_pool_and_oversize_frames_refused);
+  RUN_TEST(test_slot_reused_after_last_holder);
+  RUN_TEST(test_holders_on_two_threads);
+  RUN_TEST(test_burst_past_fb_count);
+  return UNITY_END();
+}
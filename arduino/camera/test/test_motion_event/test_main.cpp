@@ -0,0 +1,207 @@
+/*
+  Motion events of src/main.cpp end to end on the host
+
+  The firmware boots on the ArduinoHost stand-ins and is kept awake
+  with the PIR low while its pre-trigger ring fills, then the PIR fires.
+  Every message it publishes is recorded, and each event's frames are
+  asked for on cameras/<id>/request as the server does with two-tier
+  publishing. An event must start with the ring's frames, oldest first,
+  PRE_TRIGGER_INTERVAL apart and taken up to the trigger, followed by
+  the burst at full size.
+
+  fixtures/yard holds 12 frames of a figure walking into a fenced yard,
+  saved by PIL at quality 50 as 4:2:0: 320x240 for the burst and, in
+  qvga/, 160x120 for the ring and the thumbnail. They are served round
+  and round. Flash goes to /tmp/camera-test-imagelog.bin and
+  /tmp/camera-test-framestore.bin.
+
+    pio test -e native -f test_motion_event
+*/
+
+#include <Arduino.h>
+#include <HostHarness.h>
+#include <esp_camera.h>
+#include <unity.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Firmware, from src/main.cpp
+void setup();
+void loop();
+extern uint32_t eventId;
+extern int ringCount;
+
+// As in src/main.cpp
+#define PIR_PIN 13
+#define BURST_LENGTH 5
+#define BEST_FRAMES 2
+#define PRE_TRIGGER_DEPTH 8
+#define PRE_TRIGGER_INTERVAL 250
+#define MOTION_RESET_TIME 5000
+#define THUMBNAIL_IMAGE_NUMBER 255
+#define IMAGE_LOG_SIZE 0x60000           // partitions.csv
+#define FRAME_STORE_SIZE 0x110000
+
+#define LOOP_TICK_US 1000
+#define BURST_WIDTH 320
+#define RING_WIDTH 160
+
+struct PublishedImage {
+  uint32_t eventId;
+  int imageNumber;
+  int eventFrames;
+  long triggerOffset;
+  int width;
+};
+
+static std::vector<PublishedImage> published;
+static unsigned long lastTrigger;
+
+static long jsonField(const std::string& json, const char* name) {
+  std::string key = std::string("\"") + name + "\":";
+  size_t at = json.find(key);
+  TEST_ASSERT_TRUE_MESSAGE(at != std::string::npos, name);
+  return strtol(json.c_str() + at + key.size(), NULL, 10);
+}
+
+static void recordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  const char* leaf = strrchr(topic, '/');
+  if (!leaf || strcmp(leaf, "/metadata") != 0) {
+    return;
+  }
+  std::string json((const char*)payload, length);
+  published.push_back({(uint32_t)jsonField(json, "event_id"), (int)jsonField(json, "image_number"),
+                       (int)jsonField(json, "event_frames"), jsonField(json, "trigger_offset"),
+                       (int)jsonField(json, "width")});
+}
+
+static std::string fixturePath(const char* name) {
+  std::string path = __FILE__;
+  path.resize(path.find_last_of('/') + 1);
+  return path + "fixtures/" + name;
+}
+
+// Run loop() for ms of virtual time, never letting the frames run out
+static void runFor(unsigned long ms) {
+  unsigned long start = millis();
+  while (millis() - start < ms) {
+    if (hostFramesServed() + BURST_LENGTH + 8 >= hostFrameCount()) {
+      hostRewindFrames();
+    }
+    loop();
+    hostAdvanceMicros(LOOP_TICK_US);
+  }
+}
+
+// PIR high for one pass of loop(), which takes and sends the event
+static uint32_t trigger() {
+  hostRewindFrames();
+  lastTrigger = millis();
+  uint32_t before = eventId;
+  hostSetPin(PIR_PIN, HIGH);
+  loop();
+  hostSetPin(PIR_PIN, LOW);
+  hostAdvanceMicros(LOOP_TICK_US);
+  TEST_ASSERT_EQUAL_UINT32(before + 1, eventId);
+  return eventId;
+}
+
+// Ask for every frame of an event and return them in the order sent
+static std::vector<PublishedImage> requestEvent(uint32_t id) {
+  published.clear();
+  char request[32];
+  int length = snprintf(request, sizeof(request), "{\"event_id\":%u}", (unsigned)id);
+  hostDeliver("cameras/CAM001/request", (const uint8_t*)request, length);
+  runFor(100);
+  std::vector<PublishedImage> frames;
+  for (const PublishedImage& image : published) {
+    if (image.eventId == id) {
+      frames.push_back(image);
+    }
+  }
+  return frames;
+}
+
+// The ring's frames first, oldest first and before the trigger at the
+// ring's interval, then the kept burst frames at full size
+static void checkEventOrder(const std::vector<PublishedImage>& frames) {
+  const int eventFrames = PRE_TRIGGER_DEPTH + BURST_LENGTH;
+  TEST_ASSERT_EQUAL_UINT32(PRE_TRIGGER_DEPTH + BEST_FRAMES, frames.size());
+  for (size_t i = 0; i < frames.size(); i++) {
+    const PublishedImage& frame = frames[i];
+    char message[96];
+    snprintf(message, sizeof(message), "frame %u: image %d at %ld ms", (unsigned)i, frame.imageNumber,
+             frame.triggerOffset);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(eventFrames, frame.eventFrames, message);
+    if (i > 0) {
+      TEST_ASSERT_TRUE_MESSAGE(frame.imageNumber > frames[i - 1].imageNumber, message);
+      TEST_ASSERT_TRUE_MESSAGE(frame.triggerOffset >= frames[i - 1].triggerOffset, message);
+    }
+    if (i < PRE_TRIGGER_DEPTH) {
+      TEST_ASSERT_EQUAL_INT_MESSAGE(i, frame.imageNumber, message);
+      TEST_ASSERT_EQUAL_INT_MESSAGE(RING_WIDTH, frame.width, message);
+      TEST_ASSERT_TRUE_MESSAGE(frame.triggerOffset <= 0, message);
+      TEST_ASSERT_TRUE_MESSAGE(frame.triggerOffset >= -PRE_TRIGGER_DEPTH * PRE_TRIGGER_INTERVAL, message);
+      if (i > 0) {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(PRE_TRIGGER_INTERVAL, frame.triggerOffset - frames[i - 1].triggerOffset,
+                                      message);
+      }
+    } else {
+      TEST_ASSERT_TRUE_MESSAGE(frame.imageNumber >= PRE_TRIGGER_DEPTH && frame.imageNumber < eventFrames,
+                               message);
+      TEST_ASSERT_EQUAL_INT_MESSAGE(BURST_WIDTH, frame.width, message);
+      TEST_ASSERT_TRUE_MESSAGE(frame.triggerOffset > frames[PRE_TRIGGER_DEPTH - 1].triggerOffset, message);
+    }
+  }
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_ring_fills_while_awake() {
+  TEST_ASSERT_GREATER_THAN(0, hostLoadFrames(fixturePath("yard").c_str()));
+  TEST_ASSERT_TRUE(hostFlashAttach("imagelog", "/tmp/camera-test-imagelog.bin", IMAGE_LOG_SIZE, true));
+  TEST_ASSERT_TRUE(hostFlashAttach("framestore", "/tmp/camera-test-framestore.bin", FRAME_STORE_SIZE, true));
+  hostSetMqttRecorder(recordMessage);
+  hostSetPin(PIR_PIN, LOW);
+  setup();
+  TEST_ASSERT_EQUAL_INT(FRAMESIZE_QVGA, hostSensorFrameSize());
+  runFor(PRE_TRIGGER_DEPTH * PRE_TRIGGER_INTERVAL / 2);
+  TEST_ASSERT_LESS_THAN(PRE_TRIGGER_DEPTH, ringCount);
+  runFor(PRE_TRIGGER_DEPTH * PRE_TRIGGER_INTERVAL);
+  TEST_ASSERT_EQUAL_INT(PRE_TRIGGER_DEPTH, ringCount);
+}
+
+static void test_event_starts_with_ring_frames() {
+  uint32_t id = trigger();
+  // Back at the ring's size and filling again from empty
+  TEST_ASSERT_EQUAL_INT(FRAMESIZE_QVGA, hostSensorFrameSize());
+  TEST_ASSERT_EQUAL_INT(0, ringCount);
+  checkEventOrder(requestEvent(id));
+}
+
+static void test_ring_refills_for_the_next_event() {
+  runFor(MOTION_RESET_TIME);
+  TEST_ASSERT_EQUAL_INT(PRE_TRIGGER_DEPTH, ringCount);
+  unsigned long previous = lastTrigger;
+  uint32_t id = trigger();
+  std::vector<PublishedImage> frames = requestEvent(id);
+  checkEventOrder(frames);
+  // Only frames taken since the last event's burst
+  TEST_ASSERT_GREATER_THAN(previous, lastTrigger + frames[0].triggerOffset);
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_ring_fills_while_awake);
+  RUN_TEST(test_event_starts_with_ring_frames);
+  RUN_TEST(test_ring_refills_for_the_next_event);
+  return UNITY_END();
+}
@@ -0,0 +1,749 @@
+/*
+  Offline evaluation of the gunshot detector on labelled WAV files
+
+  Runs every 16 kHz, 16-bit mono WAV under the given directories through
+  what the sketch runs per analysis window: RealFft on 512 samples every
+  256, ShotFeatureExtractor, and ShotModel on each candidate it closes.
+  A file under a directory named "gunshot" is a gunshot clip, any other
+  file is not. A clip counts as detected when any of its candidates
+  scores at or above the model's threshold.
+
+  Reports clip precision and recall for the model, across a sweep of
+  thresholds, and for the four hand-set rules the sketch uses by default
+  (SHOT_CLASSIFIER 0), evaluated on the same windows. Timing is per
+  analysis window on the host, in ns and, on x86, TSC cycles; the sketch
+  prints the on-device cycle count of its classifier stage.
+
+  --train fits the logistic model to the candidates of the given clips
+  (each labelled as its clip), picks the threshold with the best clip
+  F1, writes the model as text and reports on the clips it read. Train
+  and evaluate on different corpora. --synth writes a synthetic corpus
+  to DIR/train and DIR/test: shots with their echo and reverb tail, and
+  twig snaps, claps, door thuds, thunder, bird calls, voices and wind.
+  It has no recordings in it, so its numbers show the harness works, not
+  how the detector does in the field.
+
+    g++ -O2 -I../../libraries/RealFft -I../../libraries/ShotClassifier classifier_eval.cpp \
+        ../../libraries/RealFft/RealFft.cpp ../../libraries/ShotClassifier/ShotClassifier.cpp -o classifier_eval
+    ./classifier_eval --synth /tmp/shots
+    ./classifier_eval --train model.txt /tmp/shots/train
+    ./classifier_eval [--model model.txt] /tmp/shots/test
+
+  Clip recall here is not the sketch's alert rate. The sketch raises no
+  alert while the audio of the last one is still streaming, for
+  SECONDS_TO_STREAM, nor within COOLDOWN_MS of it, and it carries its
+  background level from one sound to the next. The WAV replay
+  (replay_main.cpp) runs the sketch itself over the same clips back to
+  back and prints both: the clips it flagged, which should match the
+  clips detected here, and the clips that raised an alert.
+
+  Without --model the sketch's built-in model (shot_model.h) is used.
+  Exits with 1 if no clip could be read or the model does not parse.
+*/
+
+#include <RealFft.h>
+#include <ShotClassifier.h>
+#include "../shot_model.h"
+
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+// Mirrors gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define FFT_SAMPLES 512
+#define ANALYSIS_HOP (FFT_SAMPLES / 2)
+#define SAMPLE_SCALE (1.0f / 100000.0f)
+#define FREQUENCY_LOWER_BOUND 250
+#define FREQUENCY_UPPER_BOUND 5000
+#define SPECTRAL_RATIO_THRESHOLD 0.5
+#define MIN_GUNSHOT_BAND_ENERGY 0.01
+#define AMPLITUDE_THRESHOLD 80.0
+#define HISTORY_SIZE 60
+#define TRANSIENT_THRESHOLD 4.0
+
+#define WAV_TO_I2S_SHIFT 16           // 16-bit WAV full scale to the microphone's 24-in-32-bit full scale
+#define TRAIN_ITERATIONS 4000
+#define TRAIN_RATE 0.2
+#define TRAIN_L2 0.001
+#define SYNTH_SECONDS 3
+#define SYNTH_SHOTS 150               // Gunshot clips per set
+#define SYNTH_OTHERS 300              // Other clips per set
+
+struct Clip {
+  std::string path;
+  bool gunshot;
+  bool legacyHit;
+  std::vector<std::vector<float> > candidates;
+};
+
+struct Timing {
+  uint64_t windows = 0;
+  double fftNs = 0, classifierNs = 0, legacyNs = 0;
+  uint64_t classifierCycles = 0;
+};
+
+static double nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t cycles() {
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// ---- WAV files ----
+
+static bool readWav(const char* path, std::vector<int16_t>& samples) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  uint8_t header[12];
+  bool ok = fread(header, 1, 12, f) == 12 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0;
+  bool formatOk = false;
+  while (ok) {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, 8, f) != 8) {
+      ok = false;
+      break;
+    }
+    uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (size < 16 || fread(fmt, 1, 16, f) != 16) {
+        ok = false;
+        break;
+      }
+      uint16_t format = fmt[0] | fmt[1] << 8;
+      uint16_t channels = fmt[2] | fmt[3] << 8;
+      uint32_t rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (uint32_t)fmt[7] << 24;
+      uint16_t bits = fmt[14] | fmt[15] << 8;
+      formatOk = format == 1 && channels == 1 && rate == I2S_SAMPLE_RATE && bits == 16;
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!formatOk) {
+        ok = false;
+        break;
+      }
+      samples.resize(size / 2);
+      ok = fread(samples.data(), 2, samples.size(), f) == samples.size();
+      break;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(f);
+  if (ok && !formatOk) {
+    ok = false;
+  }
+  return ok;
+}
+
+static void put16(FILE* f, uint16_t v) {
+  fputc(v & 0xFF, f);
+  fputc(v >> 8, f);
+}
+
+static void put32(FILE* f, uint32_t v) {
+  put16(f, v & 0xFFFF);
+  put16(f, v >> 16);
+}
+
+static bool writeWav(const char* path, const std::vector<int16_t>& samples) {
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  uint32_t bytes = samples.size() * 2;
+  fwrite("RIFF", 1, 4, f);
+  put32(f, 36 + bytes);
+  fwrite("WAVEfmt ", 1, 8, f);
+  put32(f, 16);
+  put16(f, 1);
+  put16(f, 1);
+  put32(f, I2S_SAMPLE_RATE);
+  put32(f, I2S_SAMPLE_RATE * 2);
+  put16(f, 2);
+  put16(f, 16);
+  fwrite("data", 1, 4, f);
+  put32(f, bytes);
+  fwrite(samples.data(), 2, samples.size(), f);
+  return fclose(f) == 0;
+}
+
+static void findWavs(const std::string& dir, std::vector<std::string>& paths) {
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  std::vector<std::string> names;
+  while (dirent* entry = readdir(d)) {
+    if (entry->d_name[0] != '.') {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (const std::string& name : names) {
+    std::string path = dir + "/" + name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      findWavs(path, paths);
+    } else if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".wav") == 0) {
+      paths.push_back(path);
+    }
+  }
+}
+
+static bool underGunshotDir(const std::string& path) {
+  size_t start = 0;
+  while (true) {
+    size_t slash = path.find('/', start);
+    if (slash == std::string::npos) {
+      return false;
+    }
+    if (path.compare(start, slash - start, "gunshot") == 0) {
+      return true;
+    }
+    start = slash + 1;
+  }
+}
+
+// ---- The sketch's four rules, for comparison ----
+
+struct LegacyDetector {
+  float history[HISTORY_SIZE];
+  int index = 0;
+
+  LegacyDetector() {
+    for (int i = 0; i < HISTORY_SIZE; i++) {
+      history[i] = -60.0;
+    }
+  }
+
+  bool window(float rms, const float* binPower) {
+    float db = 20 * log10f(rms * 22);
+    history[index] = db;
+    index = (index + 1) % HISTORY_SIZE;
+    float sum = 0;
+    int count = 0;
+    for (int i = 0; i < HISTORY_SIZE; i++) {
+      if (i != (index - 1 + HISTORY_SIZE) % HISTORY_SIZE) {
+        sum += history[i];
+        count++;
+      }
+    }
+    bool transient = db - sum / count >= TRANSIENT_THRESHOLD;
+
+    float binWidth = (float)I2S_SAMPLE_RATE / FFT_SAMPLES;
+    int lowBin = (int)(FREQUENCY_LOWER_BOUND / binWidth);
+    int highBin = (int)(FREQUENCY_UPPER_BOUND / binWidth);
+    float peak = 0;
+    int peakIndex = 0;
+    float total = 0, band = 0;
+    for (int i = 1; i <= FFT_SAMPLES / 2; i++) {
+      if (binPower[i] > peak) {
+        peak = binPower[i];
+        peakIndex = i;
+      }
+      total += binPower[i];
+      if (i >= lowBin && i <= highBin) {
+        band += binPower[i];
+      }
+    }
+    bool frequency = peakIndex >= lowBin && peakIndex <= highBin;
+    float ratio = total > 0 ? band / total : 0;
+    bool spectral = ratio > SPECTRAL_RATIO_THRESHOLD && band > MIN_GUNSHOT_BAND_ENERGY;
+    return frequency && db > AMPLITUDE_THRESHOLD && transient && spectral;
+  }
+};
+
+// ---- Running clips through the detector ----
+
+static void analyseClip(const std::vector<int16_t>& pcm, Clip& clip, Timing& timing) {
+  static RealFft fft;
+  static bool fftReady = fft.begin(FFT_SAMPLES, SAMPLE_SCALE);
+  (void)fftReady;
+  ShotFeatureExtractor extractor;
+  extractor.begin(FFT_SAMPLES / 2 + 1, (float)I2S_SAMPLE_RATE / FFT_SAMPLES, 1000.0f * ANALYSIS_HOP / I2S_SAMPLE_RATE);
+  LegacyDetector legacy;
+  std::vector<int32_t> words(pcm.size());
+  for (size_t i = 0; i < pcm.size(); i++) {
+    words[i] = (int32_t)pcm[i] * (1 << WAV_TO_I2S_SHIFT);
+  }
+  float binPower[FFT_SAMPLES / 2 + 1];
+  binPower[0] = 0;
+  clip.legacyHit = false;
+  for (size_t start = 0; start + FFT_SAMPLES <= words.size(); start += ANALYSIS_HOP) {
+    const int32_t* window = &words[start];
+    float sumSquares = 0, peak = 0;
+    for (int i = 0; i < FFT_SAMPLES; i++) {
+      float sample = (float)window[i] * SAMPLE_SCALE;
+      sumSquares += sample * sample;
+      peak = fmaxf(peak, fabsf(sample));
+    }
+    float rms = sqrtf(sumSquares / FFT_SAMPLES);
+
+    double t0 = nowNs();
+    fft.transform(window);
+    fft.powerSpectrum(1, FFT_SAMPLES / 2, binPower + 1);
+    double t1 = nowNs();
+    uint64_t c0 = cycles();
+    if (extractor.add(binPower, rms, peak)) {
+      const float* f = extractor.features();
+      clip.candidates.push_back(std::vector<float>(f, f + SHOT_FEATURE_COUNT));
+    }
+    uint64_t c1 = cycles();
+    double t2 = nowNs();
+    clip.legacyHit |= legacy.window(rms, binPower);
+    double t3 = nowNs();
+    timing.windows++;
+    timing.fftNs += t1 - t0;
+    timing.classifierNs += t2 - t1;
+    timing.legacyNs += t3 - t2;
+    timing.classifierCycles += c1 - c0;
+  }
+}
+
+static int32_t clipScore(const ShotModel& model, const Clip& clip, double& ns) {
+  int32_t best = INT32_MIN;
+  for (const std::vector<float>& candidate : clip.candidates) {
+    double t0 = nowNs();
+    int32_t score = model.score(candidate.data());
+    ns += nowNs() - t0;
+    best = score > best ? score : best;
+  }
+  return best;
+}
+
+struct Counts {
+  int tp = 0, fp = 0, fn = 0, tn = 0;
+  double precision() const { return tp + fp ? 100.0 * tp / (tp + fp) : 100.0; }
+  double recall() const { return tp + fn ? 100.0 * tp / (tp + fn) : 100.0; }
+  double f1() const {
+    double p = precision(), r = recall();
+    return p + r > 0 ? 2 * p * r / (p + r) : 0;
+  }
+  void add(bool truth, bool detected) {
+    (truth ? (detected ? tp : fn) : (detected ? fp : tn))++;
+  }
+};
+
+static Counts countAt(const std::vector<Clip>& clips, const std::vector<int32_t>& scores, int32_t threshold) {
+  Counts counts;
+  for (size_t i = 0; i < clips.size(); i++) {
+    counts.add(clips[i].gunshot, scores[i] >= threshold);
+  }
+  return counts;
+}
+
+static void printCounts(const char* name, const Counts& c) {
+  printf("  %-28s precision %6.1f%%  recall %6.1f%%  (tp %d, fp %d, fn %d)\n", name, c.precision(), c.recall(), c.tp,
+         c.fp, c.fn);
+}
+
+// ---- Training ----
+
+static bool train(const std::vector<Clip>& clips, const char* outPath) {
+  std::vector<const float*> rows;
+  std::vector<int> labels;
+  for (const Clip& clip : clips) {
+    for (const std::vector<float>& candidate : clip.candidates) {
+      rows.push_back(candidate.data());
+      labels.push_back(clip.gunshot);
+    }
+  }
+  if (rows.empty()) {
+    fprintf(stderr, "No candidates to train on\n");
+    return false;
+  }
+  double mean[SHOT_FEATURE_COUNT] = {0}, scale[SHOT_FEATURE_COUNT];
+  for (const float* row : rows) {
+    for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+      mean[j] += row[j] / rows.size();
+    }
+  }
+  for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+    double var = 0;
+    for (const float* row : rows) {
+      var += (row[j] - mean[j]) * (row[j] - mean[j]) / rows.size();
+    }
+    scale[j] = var > 1e-12 ? 1 / sqrt(var) : 0;
+  }
+
+  // Full-batch gradient descent on the logistic loss, classes weighted equally
+  int positives = 0;
+  for (int label : labels) {
+    positives += label;
+  }
+  double positiveWeight = positives ? rows.size() / (2.0 * positives) : 1;
+  double negativeWeight = positives < (int)rows.size() ? rows.size() / (2.0 * (rows.size() - positives)) : 1;
+  double w[SHOT_FEATURE_COUNT] = {0}, b = 0;
+  for (int iteration = 0; iteration < TRAIN_ITERATIONS; iteration++) {
+    double gw[SHOT_FEATURE_COUNT] = {0}, gb = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+      double z = b, x[SHOT_FEATURE_COUNT];
+      for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+        x[j] = fmax(-8.0, fmin(8.0, (rows[i][j] - mean[j]) * scale[j]));
+        z += w[j] * x[j];
+      }
+      double error = (1 / (1 + exp(-z)) - labels[i]) * (labels[i] ? positiveWeight : negativeWeight);
+      for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+        gw[j] += error * x[j];
+      }
+      gb += error;
+    }
+    for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+      w[j] -= TRAIN_RATE * (gw[j] / rows.size() + TRAIN_L2 * w[j]);
+    }
+    b -= TRAIN_RATE * gb / rows.size();
+  }
+
+  // Threshold with the best clip F1, on the quantised model
+  char text[SHOT_MODEL_MAX_TEXT];
+  size_t length = 0;
+  auto emit = [&](double threshold) {
+    length = snprintf(text, sizeof(text), "# Trained on %zu clips, %zu candidates\nthreshold %.2f\nbias %.4f\n",
+                      clips.size(), rows.size(), threshold, b);
+    for (int j = 0; j < SHOT_FEATURE_COUNT; j++) {
+      length += snprintf(text + length, sizeof(text) - length, "%s %.6g %.6g %.4f\n", shotFeatureName(j), mean[j],
+                         scale[j], w[j]);
+    }
+  };
+  emit(0);
+  ShotModel model;
+  if (!model.parse(text, length)) {
+    fprintf(stderr, "Trained model does not parse\n");
+    return false;
+  }
+  std::vector<int32_t> scores;
+  double ns = 0;
+  for (const Clip& clip : clips) {
+    scores.push_back(clipScore(model, clip, ns));
+  }
+  double bestThreshold = 0, bestF1 = -1;
+  for (double threshold = -6; threshold <= 6; threshold += 0.25) {
+    double f1 = countAt(clips, scores, (int32_t)lrint(threshold * 256)).f1();
+    if (f1 > bestF1) {
+      bestF1 = f1;
+      bestThreshold = threshold;
+    }
+  }
+  emit(bestThreshold);
+  FILE* f = fopen(outPath, "w");
+  if (!f || fwrite(text, 1, length, f) != length || fclose(f) != 0) {
+    fprintf(stderr, "Cannot write %s\n", outPath);
+    return false;
+  }
+  printf("Model written to %s\n%s\n", outPath, text);
+  return true;
+}
+
+// ---- Synthetic corpus ----
+
+struct Rng {
+  uint64_t state;
+  explicit Rng(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ull + 1) {}
+  double uniform() {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+  }
+  double range(double low, double high) { return low + (high - low) * uniform(); }
+  double gauss() { return sqrt(-2 * log(uniform() + 1e-300)) * cos(2 * M_PI * uniform()); }
+};
+
+static double dbfs(double db) { return 32767.0 * pow(10.0, db / 20); }
+
+static void addNoiseFloor(std::vector<double>& s, Rng& rng) {
+  double level = dbfs(rng.range(-58, -45)), low = 0;
+  for (double& v : s) {
+    low = 0.95 * low + 0.05 * rng.gauss();
+    v += level * (0.4 * rng.gauss() + 3 * low);
+  }
+}
+
+// Impulse decaying as noise, low-passed by a one-pole filter
+static void addDecayingNoise(std::vector<double>& s, Rng& rng, size_t at, double amplitude, double tauMs, double pole) {
+  double low = 0;
+  size_t length = (size_t)(tauMs * 8 * I2S_SAMPLE_RATE / 1000);
+  for (size_t i = 0; i < length && at + i < s.size(); i++) {
+    low = pole * low + (1 - pole) * rng.gauss();
+    s[at + i] += amplitude * low * exp(-1000.0 * i / I2S_SAMPLE_RATE / tauMs);
+  }
+}
+
+static void addNWave(std::vector<double>& s, size_t at, double amplitude, double ms) {
+  size_t length = (size_t)(ms * I2S_SAMPLE_RATE / 1000) + 2;
+  for (size_t i = 0; i < length && at + i < s.size(); i++) {
+    s[at + i] += amplitude * (1 - 2.0 * i / (length - 1));
+  }
+}
+
+static void addGunshot(std::vector<double>& s, Rng& rng, size_t at) {
+  double amplitude = dbfs(rng.range(-30, -3));
+  if (rng.uniform() < 0.5) {
+    addNWave(s, at - (size_t)(rng.range(2, 20) * 16), 0.5 * amplitude, 0.3);  // Supersonic crack
+  }
+  addNWave(s, at, amplitude, rng.range(1.0, 3.0));
+  addNWave(s, at + (size_t)(rng.range(2, 15) * 16), -rng.range(0.3, 0.6) * amplitude, rng.range(1.0, 3.0));
+  double pole = rng.range(0.2, 0.8);
+  addDecayingNoise(s, rng, at, amplitude * rng.range(0.25, 0.6), rng.range(10, 50), pole);
+}
+
+static void addTone(std::vector<double>& s, size_t at, double amplitude, double seconds, double f0, double f1,
+                    double attack, int harmonics) {
+  size_t length = (size_t)(seconds * I2S_SAMPLE_RATE);
+  double phase = 0;
+  for (size_t i = 0; i < length && at + i < s.size(); i++) {
+    double t = (double)i / length;
+    double f = f0 + (f1 - f0) * t;
+    phase += 2 * M_PI * f / I2S_SAMPLE_RATE;
+    double envelope = fmin(1.0, i / (attack * I2S_SAMPLE_RATE + 1)) * sin(M_PI * t);
+    double v = 0;
+    for (int h = 1; h <= harmonics && f * h < 3500; h++) {
+      v += sin(phase * h) / h;
+    }
+    s[at + i] += amplitude * envelope * v;
+  }
+}
+
+static const char* const otherKinds[] = {"snap", "clap", "thud", "thunder", "birds", "voice", "wind"};
+
+static void synthOther(std::vector<double>& s, Rng& rng, int kind) {
+  size_t at = (size_t)(rng.range(0.6, 2.0) * I2S_SAMPLE_RATE);
+  switch (kind) {
+    case 0:  // Twig snap: a click and a very short tail
+      addNWave(s, at, dbfs(rng.range(-45, -20)), rng.range(0.2, 0.6));
+      addDecayingNoise(s, rng, at, dbfs(rng.range(-50, -25)), rng.range(2, 6), 0.1);
+      break;
+    case 1: {  // Hand clap: a noise burst around 1-2 kHz
+      double amplitude = dbfs(rng.range(-40, -15));
+      std::vector<double> burst(s.size(), 0.0);
+      addDecayingNoise(burst, rng, at, amplitude, rng.range(4, 12), 0.3);
+      double low = 0;
+      for (size_t i = 0; i < s.size(); i++) {
+        low = 0.8 * low + 0.2 * burst[i];
+        s[i] += burst[i] - low;
+      }
+      break;
+    }
+    case 2:  // Door or log thud: low-passed with a ringing body
+      addDecayingNoise(s, rng, at, dbfs(rng.range(-35, -10)), rng.range(60, 200), 0.97);
+      addTone(s, at, dbfs(rng.range(-40, -15)), rng.range(0.1, 0.3), rng.range(60, 150), rng.range(50, 120), 0.002, 1);
+      break;
+    case 3: {  // Thunder: slow rise, long rumble
+      double amplitude = dbfs(rng.range(-30, -8)), rise = rng.range(0.15, 0.4), decay = rng.range(0.8, 1.5), low = 0;
+      for (size_t i = 0; at + i < s.size(); i++) {
+        double t = (double)i / I2S_SAMPLE_RATE;
+        low = 0.99 * low + 0.01 * rng.gauss();
+        s[at + i] += amplitude * 10 * low * (t < rise ? t / rise : exp(-(t - rise) / decay));
+      }
+      break;
+    }
+    case 4: {  // Bird calls: short frequency sweeps
+      int calls = 3 + (int)rng.range(0, 6);
+      for (int c = 0; c < calls; c++) {
+        size_t start = (size_t)(rng.range(0.2, 2.6) * I2S_SAMPLE_RATE);
+        addTone(s, start, dbfs(rng.range(-40, -15)), rng.range(0.04, 0.15), rng.range(2500, 6000),
+                rng.range(2500, 6000), 0.005, 1);
+      }
+      break;
+    }
+    case 5: {  // Voice: harmonic syllables
+      int syllables = 2 + (int)rng.range(0, 4);
+      double f0 = rng.range(100, 250), amplitude = dbfs(rng.range(-35, -10));
+      for (int i = 0; i < syllables; i++) {
+        double length = rng.range(0.15, 0.35);
+        addTone(s, at, amplitude, length, f0 * rng.range(0.9, 1.1), f0 * rng.range(0.8, 1.2), 0.03, 20);
+        at += (size_t)((length + rng.range(0.05, 0.2)) * I2S_SAMPLE_RATE);
+      }
+      break;
+    }
+    default: {  // Wind gust
+      double amplitude = dbfs(rng.range(-35, -15)), length = rng.range(0.5, 1.5), low = 0;
+      for (size_t i = 0; i < length * I2S_SAMPLE_RATE && at + i < s.size(); i++) {
+        low = 0.98 * low + 0.02 * rng.gauss();
+        s[at + i] += amplitude * 5 * low * sin(M_PI * i / (length * I2S_SAMPLE_RATE));
+      }
+      break;
+    }
+  }
+}
+
+static bool writeClip(const std::string& path, const std::vector<double>& s) {
+  std::vector<int16_t> pcm(s.size());
+  for (size_t i = 0; i < s.size(); i++) {
+    pcm[i] = (int16_t)fmax(-32768.0, fmin(32767.0, lrint(s[i])));
+  }
+  return writeWav(path.c_str(), pcm);
+}
+
+static bool synthSet(const std::string& dir, uint64_t seed) {
+  Rng rng(seed);
+  mkdir(dir.c_str(), 0755);
+  mkdir((dir + "/gunshot").c_str(), 0755);
+  mkdir((dir + "/other").c_str(), 0755);
+  char name[64];
+  for (int i = 0; i < SYNTH_SHOTS; i++) {
+    std::vector<double> s(SYNTH_SECONDS * I2S_SAMPLE_RATE, 0.0);
+    addNoiseFloor(s, rng);
+    size_t at = (size_t)(rng.range(0.8, 2.0) * I2S_SAMPLE_RATE);
+    int shots = rng.uniform() < 0.7 ? 1 : 2 + (int)rng.range(0, 2);
+    for (int shot = 0; shot < shots; shot++) {
+      addGunshot(s, rng, at);
+      at += (size_t)(rng.range(0.08, 0.4) * I2S_SAMPLE_RATE);
+    }
+    snprintf(name, sizeof(name), "/gunshot/shot_%03d.wav", i);
+    if (!writeClip(dir + name, s)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < SYNTH_OTHERS; i++) {
+    std::vector<double> s(SYNTH_SECONDS * I2S_SAMPLE_RATE, 0.0);
+    addNoiseFloor(s, rng);
+    int kind = i % (sizeof(otherKinds) / sizeof(otherKinds[0]));
+    synthOther(s, rng, kind);
+    snprintf(name, sizeof(name), "/other/%s_%03d.wav", otherKinds[kind], i);
+    if (!writeClip(dir + name, s)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* modelPath = NULL;
+  const char* trainPath = NULL;
+  const char* synthDir = NULL;
+  std::vector<std::string> dirs;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+      modelPath = argv[++i];
+    } else if (strcmp(argv[i], "--train") == 0 && i + 1 < argc) {
+      trainPath = argv[++i];
+    } else if (strcmp(argv[i], "--synth") == 0 && i + 1 < argc) {
+      synthDir = argv[++i];
+    } else {
+      dirs.push_back(argv[i]);
+    }
+  }
+
+  if (synthDir) {
+    std::string root = synthDir;
+    mkdir(synthDir, 0755);
+    if (!synthSet(root + "/train", 1) || !synthSet(root + "/test", 2)) {
+      fprintf(stderr, "Cannot write the corpus to %s\n", synthDir);
+      return 1;
+    }
+    printf("Synthetic corpus written to %s/train and %s/test, %d gunshot and %d other clips each\n", synthDir,
+           synthDir, SYNTH_SHOTS, SYNTH_OTHERS);
+    if (dirs.empty()) {
+      return 0;
+    }
+  }
+
+  std::vector<std::string> paths;
+  for (const std::string& dir : dirs) {
+    findWavs(dir, paths);
+  }
+  std::vector<Clip> clips;
+  Timing timing;
+  int skipped = 0;
+  for (const std::string& path : paths) {
+    std::vector<int16_t> pcm;
+    if (!readWav(path.c_str(), pcm)) {
+      skipped++;
+      continue;  // Not 16 kHz, 16-bit mono PCM
+    }
+    Clip clip;
+    clip.path = path;
+    clip.gunshot = underGunshotDir(path);
+    analyseClip(pcm, clip, timing);
+    clips.push_back(clip);
+  }
+  if (clips.empty()) {
+    fprintf(stderr, "usage: classifier_eval [--synth DIR] [--train OUT | --model FILE] DIR...\n"
+                    "No 16 kHz 16-bit mono WAV files found\n");
+    return 1;
+  }
+  size_t candidates = 0;
+  int gunshots = 0;
+  for (const Clip& clip : clips) {
+    candidates += clip.candidates.size();
+    gunshots += clip.gunshot;
+  }
+  printf("%zu clips (%d gunshot), %zu candidates, %d files skipped\n", clips.size(), gunshots, candidates, skipped);
+
+  if (trainPath) {
+    return train(clips, trainPath) ? 0 : 1;
+  }
+
+  ShotModel model;
+  std::string text = DEFAULT_SHOT_MODEL;
+  if (modelPath) {
+    FILE* f = fopen(modelPath, "r");
+    char buffer[SHOT_MODEL_MAX_TEXT + 1];
+    size_t length = f ? fread(buffer, 1, sizeof(buffer), f) : 0;
+    if (f) {
+      fclose(f);
+    }
+    text.assign(buffer, length);
+  }
+  if (!model.parse(text.data(), text.size())) {
+    fprintf(stderr, "Model %s does not parse\n", modelPath ? modelPath : "shot_model.h");
+    return 1;
+  }
+
+  std::vector<int32_t> scores;
+  double scoreNs = 0;
+  for (const Clip& clip : clips) {
+    scores.push_back(clipScore(model, clip, scoreNs));
+  }
+  Counts legacy;
+  for (const Clip& clip : clips) {
+    legacy.add(clip.gunshot, clip.legacyHit);
+  }
+
+  printf("\nClip detection\n");
+  char name[64];
+  snprintf(name, sizeof(name), "model, threshold %.2f", model.thresholdQ8() / 256.0);
+  printCounts(name, countAt(clips, scores, model.thresholdQ8()));
+  printCounts("four rules (before)", legacy);
+  printf("\nThreshold sweep (log-odds)\n");
+  for (int threshold = -4; threshold <= 4; threshold++) {
+    snprintf(name, sizeof(name), "%+d", threshold);
+    printCounts(name, countAt(clips, scores, threshold * 256));
+  }
+
+  printf("\nPer analysis window, host CPU\n");
+  printf("  FFT                     %8.1f ns\n", timing.fftNs / timing.windows);
+  printf("  features                %8.1f ns", timing.classifierNs / timing.windows);
+#ifdef HAVE_TSC
+  printf("  %6.0f TSC cycles", (double)timing.classifierCycles / timing.windows);
+#endif
+  printf("\n  model, per candidate    %8.1f ns\n", candidates ? scoreNs / candidates : 0.0);
+  printf("  four rules              %8.1f ns\n", timing.legacyNs / timing.windows);
+  return 0;
+}
@@ -0,0 +1,221 @@
+/*
+  Host benchmark for the gunshot audio uplink encoder (AudioCodec)
+
+  Runs test signals at the I2S word scale through the old path (every
+  second sample, mapped to 8-bit linear) and the new one (half-band
+  decimator, then IMA-ADPCM, decoded back), and compares them with the
+  exact 8 kHz signal: the in-band tones of each block sampled at 8 kHz,
+  delayed by the decimator for the new path. The decimator's 16-bit
+  output is scored on its own too, so the loss of each stage shows. The
+  tones above 4 kHz have no in-band content, so what comes out of them is
+  aliasing, in dB below the tone.
+
+  4-bit ADPCM at half the bit rate does not beat 8-bit linear on a loud
+  tone, the more so towards 4 kHz, where a sample tells little about
+  the next. It keeps its SNR as the level drops instead of losing 6 dB
+  per halving. Also reports the bits per second of each path and the
+  encode time per I2S sample; the sketch prints on-device encode
+  cycles. test/test_audio_codec checks the decimator's passband and
+  alias rejection and the ADPCM round trip.
+
+    g++ -O2 -I../../libraries/AudioCodec codec_bench.cpp ../../libraries/AudioCodec/AudioCodec.cpp -o codec_bench
+    ./codec_bench [--repeat N]
+*/
+
+#include <AudioCodec.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Mirrors gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define AUDIO_SAMPLE_RATE 8000
+#define AUDIO_INPUT_SHIFT 5
+#define ANALYSIS_HOP 256
+
+#define BENCH_SECONDS 2
+#define BENCH_INPUT (I2S_SAMPLE_RATE * BENCH_SECONDS)
+#define BENCH_OUTPUT (BENCH_INPUT / 2)
+#define BENCH_SKIP 400               // 8 kHz samples left out at the start while the filter fills
+#define BENCH_REPEAT 50
+#define BENCH_FULL_SCALE 1000000.0   // I2S words the old path mapped to its 8-bit range
+
+struct Tone {
+  double hz;
+  double amplitude;                  // Share of BENCH_FULL_SCALE
+};
+
+struct BenchSignal {
+  const char* name;
+  Tone tones[3];
+  double noise;                      // White noise outside the reference, share of full scale
+};
+
+static const BenchSignal signals[] = {
+  {"440 Hz, -6 dB", {{440, 0.5}}, 0},
+  {"1.5 kHz, -20 dB", {{1500, 0.1}}, 0},
+  {"3 kHz, -6 dB", {{3000, 0.5}}, 0},
+  {"speech band mix", {{300, 0.2}, {1100, 0.15}, {2400, 0.1}}, 0},
+  {"quiet 800 Hz, -40 dB", {{800, 0.01}}, 0},
+  {"5.1 kHz, -6 dB (alias)", {{5100, 0.5}}, 0},
+  {"6.7 kHz, -6 dB (alias)", {{6700, 0.5}}, 0},
+};
+
+static double toneValue(const BenchSignal& signal, double t, bool inBandOnly) {
+  double value = 0;
+  for (int i = 0; i < 3 && signal.tones[i].hz > 0; i++) {
+    if (!inBandOnly || signal.tones[i].hz < AUDIO_SAMPLE_RATE / 2) {
+      value += signal.tones[i].amplitude * BENCH_FULL_SCALE * sin(6.283185307179586 * signal.tones[i].hz * t);
+    }
+  }
+  return value;
+}
+
+// Old path: every second sample, mapped from +-1e6 to 0-255 as
+// map()/constrain() did, then back to the I2S word scale
+static void oldPath(const int32_t* in, double* out) {
+  for (int m = 0; m < BENCH_OUTPUT; m++) {
+    long val = in[2 * m];
+    long mapped = (val + 1000000) * 255 / 2000000;
+    mapped = mapped < 0 ? 0 : mapped > 255 ? 255 : mapped;
+    out[m] = mapped * 2000000.0 / 255 - 1000000;
+  }
+}
+
+// New path, fed by analysis hops as the sketch feeds it
+static size_t encodeAll(const int32_t* in, uint8_t* blocks) {
+  HalfBandDecimator decimator(AUDIO_INPUT_SHIFT);
+  ImaAdpcmEncoder encoder;
+  int16_t pcm[ANALYSIS_HOP / 2];
+  size_t blockCount = 0;
+  for (int start = 0; start < BENCH_INPUT; start += ANALYSIS_HOP) {
+    size_t produced = decimator.process(in + start, ANALYSIS_HOP, pcm);
+    for (size_t i = 0; i < produced; i++) {
+      if (encoder.add(pcm[i])) {
+        memcpy(blocks + blockCount++ * ADPCM_BLOCK_BYTES, encoder.block(), ADPCM_BLOCK_BYTES);
+      }
+    }
+  }
+  return blockCount;
+}
+
+// The decimator alone, at 16 bits
+static void filterPath(const int32_t* in, double* out) {
+  HalfBandDecimator decimator(AUDIO_INPUT_SHIFT);
+  int16_t pcm[ANALYSIS_HOP / 2];
+  size_t produced = 0;
+  for (int start = 0; start < BENCH_INPUT; start += ANALYSIS_HOP) {
+    size_t count = decimator.process(in + start, ANALYSIS_HOP, pcm);
+    for (size_t i = 0; i < count; i++) {
+      out[produced++] = (double)pcm[i] * (1 << AUDIO_INPUT_SHIFT);
+    }
+  }
+}
+
+static void newPath(const int32_t* in, double* out, size_t& decoded) {
+  static uint8_t blocks[BENCH_OUTPUT / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES + ADPCM_BLOCK_BYTES];
+  size_t blockCount = encodeAll(in, blocks);
+  int16_t pcm[ADPCM_BLOCK_SAMPLES];
+  decoded = 0;
+  for (size_t b = 0; b < blockCount; b++) {
+    imaAdpcmDecodeBlock(blocks + b * ADPCM_BLOCK_BYTES, pcm);
+    for (int i = 0; i < ADPCM_BLOCK_SAMPLES; i++) {
+      out[decoded++] = (double)pcm[i] * (1 << AUDIO_INPUT_SHIFT);
+    }
+  }
+}
+
+// Signal to error ratio against the reference, or the output level
+// relative to the input tone when the reference is silent
+static double compare(const double* out, const double* reference, size_t count, double inputPower) {
+  double signal = 0, error = 0;
+  for (size_t i = BENCH_SKIP; i < count; i++) {
+    signal += reference[i] * reference[i];
+    error += (out[i] - reference[i]) * (out[i] - reference[i]);
+  }
+  if (signal == 0) {
+    return error > 0 ? 10 * log10(error / (count - BENCH_SKIP) / inputPower) : -99.9;
+  }
+  return error > 0 ? 10 * log10(signal / error) : 99.9;
+}
+
+static uint64_t nowNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  unsigned repeat = BENCH_REPEAT;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--repeat N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  static int32_t input[BENCH_INPUT];
+  static double reference[BENCH_OUTPUT], delayedReference[BENCH_OUTPUT];
+  static double oldOut[BENCH_OUTPUT], filterOut[BENCH_OUTPUT], newOut[BENCH_OUTPUT];
+  printf("Uplink audio, %d s blocks at %d Hz into %d Hz\n", BENCH_SECONDS, I2S_SAMPLE_RATE, AUDIO_SAMPLE_RATE);
+  printf("  %-24s %14s %14s %14s\n", "block", "old dB", "decimator dB", "ADPCM dB");
+  int signalCount = sizeof(signals) / sizeof(signals[0]);
+  for (int s = 0; s < signalCount; s++) {
+    const BenchSignal& signal = signals[s];
+    double inputPower = 0;
+    for (int n = 0; n < BENCH_INPUT; n++) {
+      double value = toneValue(signal, (double)n / I2S_SAMPLE_RATE, false);
+      input[n] = (int32_t)lround(value);
+      inputPower += value * value / BENCH_INPUT;
+    }
+    double delay = (double)HalfBandDecimator::delay() / I2S_SAMPLE_RATE;
+    for (int m = 0; m < BENCH_OUTPUT; m++) {
+      reference[m] = toneValue(signal, (double)m / AUDIO_SAMPLE_RATE, true);
+      delayedReference[m] = toneValue(signal, (double)m / AUDIO_SAMPLE_RATE - delay, true);
+    }
+    size_t decoded;
+    oldPath(input, oldOut);
+    filterPath(input, filterOut);
+    newPath(input, newOut, decoded);
+    double oldSnr = compare(oldOut, reference, BENCH_OUTPUT, inputPower);
+    double filterSnr = compare(filterOut, delayedReference, BENCH_OUTPUT, inputPower);
+    double newSnr = compare(newOut, delayedReference, decoded, inputPower);
+    bool alias = signal.tones[0].hz >= AUDIO_SAMPLE_RATE / 2;
+    printf("  %-24s %14.1f %14.1f %14.1f%s\n", signal.name, oldSnr, filterSnr, newSnr,
+           alias ? "   (alias level)" : "");
+  }
+
+  // Rates and encode time over the speech band block
+  const BenchSignal& timed = signals[3];
+  for (int n = 0; n < BENCH_INPUT; n++) {
+    input[n] = (int32_t)lround(toneValue(timed, (double)n / I2S_SAMPLE_RATE, false));
+  }
+  static uint8_t oldBytes[BENCH_OUTPUT];
+  static uint8_t blocks[BENCH_OUTPUT / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_BYTES + ADPCM_BLOCK_BYTES];
+  volatile uint32_t sink = 0;
+  uint64_t start = nowNanos();
+  for (unsigned r = 0; r < repeat; r++) {
+    for (int i = 0; i < BENCH_INPUT; i += 2) {
+      long mapped = ((long)input[i] + 1000000) * 255 / 2000000;
+      oldBytes[i / 2] = mapped < 0 ? 0 : mapped > 255 ? 255 : mapped;
+    }
+    sink = sink + oldBytes[r % BENCH_OUTPUT];
+  }
+  uint64_t oldNanos = nowNanos() - start;
+  start = nowNanos();
+  for (unsigned r = 0; r < repeat; r++) {
+    sink = sink + encodeAll(input, blocks);
+  }
+  uint64_t newNanos = nowNanos() - start;
+  double samples = (double)repeat * BENCH_INPUT;
+  printf("\nPer I2S sample, host CPU\n");
+  printf("  %-24s %10.2f ns %10.1f kbit/s\n", "every 2nd, 8-bit", oldNanos / samples, AUDIO_SAMPLE_RATE * 8 / 1000.0);
+  printf("  %-24s %10.2f ns %10.1f kbit/s\n", "half-band + ADPCM", newNanos / samples,
+         AUDIO_SAMPLE_RATE * 8.0 * ADPCM_BLOCK_BYTES / ADPCM_BLOCK_SAMPLES / 1000.0);
+  return 0;
+}
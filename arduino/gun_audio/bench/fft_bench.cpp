@@ -0,0 +1,154 @@
+/*
+  Host benchmark for the gunshot detector's FFT (RealFft)
+
+  Times RealFft on a muzzle blast at the scale the INMP441 delivers it
+  (24-bit samples in 32-bit I2S words) against a double complex FFT the
+  way the sketch ran arduinoFFT (window worked out per call, full
+  complex transform, magnitudes), and the cascade's bandPower() gate.
+  On the host double is done in hardware, so the gap is far smaller
+  than on the ESP32, which emulates it; the sketch prints the on-device
+  cycle count of its FFT stage. Its accuracy against a double DFT is
+  checked by test/test_real_fft.
+
+    g++ -O2 -I../../libraries/RealFft fft_bench.cpp ../../libraries/RealFft/RealFft.cpp -o fft_bench
+    ./fft_bench [--repeat N]
+*/
+
+#include <RealFft.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Mirrors gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define FFT_SAMPLES 512
+#define SAMPLE_SCALE (1.0f / 100000.0f)
+#define FREQUENCY_LOWER_BOUND 250
+
+#define BENCH_REPEAT 20000
+#define CASCADE_GATE_BINS 3           // Bins the sketch's band gate sums, from 1
+#define FULL_SCALE 2147483647.0
+
+static double noise(unsigned& state) {
+  state = state * 1103515245u + 12345u;
+  return ((state >> 8) & 0xFFFF) / 32768.0 - 1.0;
+}
+
+static int32_t clampSample(double value) {
+  value = value > FULL_SCALE ? FULL_SCALE : value < -FULL_SCALE ? -FULL_SCALE : value;
+  return (int32_t)value;
+}
+
+// A muzzle blast: a near full-scale broadband onset decaying over a few
+// milliseconds into background noise
+static void impulse(int32_t* samples, unsigned seed) {
+  for (int i = 0; i < FFT_SAMPLES; i++) {
+    double envelope = i < 100 ? 0 : exp(-(i - 100) / 40.0);
+    samples[i] = clampSample(1.9e9 * envelope * noise(seed) + 1e5 * noise(seed));
+  }
+}
+
+static double hamming(int i) {
+  return 0.54 - 0.46 * cos(6.283185307179586 * i / (FFT_SAMPLES - 1));
+}
+
+// Baseline: what the sketch did with arduinoFFT<double> - window from
+// cos() per call, complex FFT of the full block, square roots
+static void doubleFft(const int32_t* samples, double* re, double* im) {
+  for (int i = 0; i < FFT_SAMPLES; i++) {
+    re[i] = samples[i] / 100000.0 * hamming(i);
+    im[i] = 0;
+  }
+  for (int i = 1, j = 0; i < FFT_SAMPLES; i++) {
+    int bit = FFT_SAMPLES >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      double t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+    }
+  }
+  for (int span = 1; span < FFT_SAMPLES; span <<= 1) {
+    double c = cos(M_PI / span), s = -sin(M_PI / span);
+    for (int start = 0; start < FFT_SAMPLES; start += 2 * span) {
+      double wr = 1, wi = 0;
+      for (int j = 0; j < span; j++) {
+        int a = start + j, b = a + span;
+        double tr = wr * re[b] - wi * im[b];
+        double ti = wr * im[b] + wi * re[b];
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+        double next = wr * c - wi * s;
+        wi = wr * s + wi * c;
+        wr = next;
+      }
+    }
+  }
+  for (int i = 0; i < FFT_SAMPLES; i++) {
+    re[i] = sqrt(re[i] * re[i] + im[i] * im[i]);
+  }
+}
+
+static uint64_t nowNanos() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  unsigned repeat = BENCH_REPEAT;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      repeat = strtoul(argv[++i], NULL, 10);
+    } else {
+      fprintf(stderr, "usage: %s [--repeat N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  RealFft fft;
+  fft.begin(FFT_SAMPLES, SAMPLE_SCALE);
+  double binWidth = (double)I2S_SAMPLE_RATE / FFT_SAMPLES;
+  int lowBin = (int)(FREQUENCY_LOWER_BOUND / binWidth);
+
+  static int32_t samples[FFT_SAMPLES];
+  static float power[FFT_SAMPLES / 2 + 1];
+  impulse(samples, 1);
+
+  static double re[FFT_SAMPLES], im[FFT_SAMPLES];
+  volatile float sinkFloat = 0;
+  volatile double sinkDouble = 0;
+  uint64_t start = nowNanos();
+  for (unsigned i = 0; i < repeat; i++) {
+    fft.transform(samples);
+    fft.powerSpectrum(1, FFT_SAMPLES / 2, power + 1);
+    sinkFloat = sinkFloat + power[lowBin];
+  }
+  uint64_t realNanos = nowNanos() - start;
+  start = nowNanos();
+  for (unsigned i = 0; i < repeat; i++) {
+    doubleFft(samples, re, im);
+    sinkDouble = sinkDouble + re[lowBin];
+  }
+  uint64_t doubleNanos = nowNanos() - start;
+  start = nowNanos();
+  for (unsigned i = 0; i < repeat; i++) {
+    float gateTotal;
+    sinkFloat = sinkFloat + fft.bandPower(samples, 1, CASCADE_GATE_BINS, gateTotal);
+  }
+  uint64_t gateNanos = nowNanos() - start;
+  printf("Per block, %u blocks, host CPU\n", repeat);
+  printf("  %-24s %10.2f us\n", "RealFft + power", realNanos / 1000.0 / repeat);
+  printf("  %-24s %10.2f us\n", "double complex FFT", doubleNanos / 1000.0 / repeat);
+  printf("  %-24s %10.1f x\n", "speedup", realNanos ? (double)doubleNanos / realNanos : 0.0);
+  printf("  %-24s %10.2f us\n", "bandPower gate", gateNanos / 1000.0 / repeat);
+  return 0;
+}
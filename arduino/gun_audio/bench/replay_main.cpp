@@ -0,0 +1,392 @@
+/*
+  WAV replay of the gun_audio firmware (pio run -e native)
+
+  Runs gun_audio.ino through setup() and loop() with i2s_read() served
+  from recordings instead of the INMP441 and the MQTT client recorded
+  instead of connected, as fast as the host can go:
+
+    .pio/build/native/program [--link B/s] [--verbose] RECORDING
+
+  RECORDING is a 16 kHz 16-bit mono WAV file, or a directory of them,
+  replayed back to back in name order as one stream. For every alert it
+  prints where in the recordings it fired, which rules agreed and the
+  classifier's score, and the audio frames uploaded for the event. Then
+  the real-time factor, the CPU time of each stage of the detector, and
+  how many windows each stage of its cascade saw and its share of the
+  detector's CPU time. In the classifier build, a table of clips: those
+  with a candidate scored at or above the threshold, as classifier_eval
+  counts them, and those that raised an alert. A file under a directory
+  named "gunshot" is a gunshot clip. Last, how many uploads finished
+  with more or less post-shot audio than SECONDS_TO_STREAM, which
+  test_audio_upload checks is none. Build with -D DETECTOR_CASCADE=0 to
+  compare the alerts and timings against the full analysis of every
+  window.
+
+  The native environment builds the sequential loop (AUDIO_PIPELINE 0),
+  so uploads hold up acquisition as they would on one core: with a slow
+  --link the DMA overflows show up as lost samples.
+*/
+
+// The Unity suites link the sketch with their own main() and leave this out
+#ifndef PIO_UNIT_TESTING
+
+#include <Arduino.h>
+#include <SampleRing.h>
+#include <ShotClassifier.h>
+#include <AudioCodec.h>
+#include <HostHarness.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Firmware entry points and detector state, from gun_audio.ino
+void setup();
+void loop();
+extern bool gun_by_frequency;
+extern bool gun_by_amplitude;
+extern bool gun_by_transient;
+extern bool gun_by_spectral;
+extern int32_t shotScore;
+extern uint32_t shotCandidates;
+extern ShotFeatureExtractor shotFeatures;
+extern ShotModel shotModel;
+extern bool isStreaming;
+extern uint32_t fftCycles;             // ESP.getCycleCount() is CPU ns on the host
+extern uint32_t classifierCycles;
+extern uint32_t encodeCycles;
+extern SampleRing audioRing;
+extern int cascadeStages;              // The spectrum stage is the last
+extern const char* cascadeNames[];
+extern uint32_t cascadeWindows[];
+extern uint64_t cascadeCycles[];
+extern uint64_t detectorCycles;
+
+#define FRAME_HEADER_BYTES 16          // Audio frame layout, see gun_audio.ino
+#define FRAME_MAGIC 0xA7
+#define FRAME_PRESHOT 0x01
+#define FRAME_LAST 0x02
+#define WINDOW_SAMPLES 512             // FFT_SAMPLES
+#define HOP_SAMPLES 256                // ANALYSIS_HOP
+#define STREAM_SECONDS 6               // SECONDS_TO_STREAM
+
+enum {
+  STAGE_LOOP,
+  STAGE_FFT,
+  STAGE_CLASSIFIER,
+  STAGE_ENCODE,
+  STAGE_FILE,
+  STAGE_COUNT
+};
+
+static HostStage stages[STAGE_COUNT] = {
+  {"loop", 0, 0, 0, 0},
+  {"fft", 0, 0, 0, 0},
+  {"classifier", 0, 0, 0, 0},
+  {"encode", 0, 0, 0, 0},
+  {"i2s_read file I/O", 0, 0, 0, 0},
+};
+
+struct Alert {
+  uint32_t eventId;
+  uint64_t sample;                     // End of the window that fired, in the stream
+  bool frequency, amplitude, transient, spectral;
+  int32_t score;
+};
+
+struct Upload {
+  uint32_t preshotFrames;
+  uint32_t postFrames;
+  uint64_t bytes;
+  uint64_t samples;                    // At the uplink rate
+  uint64_t postSamples;
+  uint32_t lastFrameSamples;           // Of the latest post-shot frame
+  uint32_t sequenceGaps;               // Frames missing between those received
+  uint32_t offsetGaps;                 // Audio missing between frames received
+  bool last;
+  uint16_t nextSequence;
+  uint32_t nextOffset;
+  uint16_t rate;
+};
+
+// Candidates the classifier scored in one recording. A recording under
+// a directory named "gunshot" is a gunshot clip, as for classifier_eval.
+struct ClipResult {
+  bool gunshot;
+  uint32_t candidates;
+  uint32_t flagged;                    // Scored at or above the threshold
+  uint32_t flaggedStreaming;           // Of those, while an alert's audio was streaming
+  uint32_t alerts;
+};
+
+static std::vector<Alert> alerts;
+static std::map<std::string, ClipResult> clips;
+static std::map<uint32_t, Upload> uploads;
+static uint32_t badMessages = 0;
+
+static uint16_t le16(const uint8_t* p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const uint8_t* p) {
+  return le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+static ClipResult& clipAt(uint64_t sample);
+
+static uint64_t streamPosition() {
+  const HostAudioStats& audio = hostAudioStats();
+  return audio.samplesRead + audio.samplesLost;
+}
+
+static void recordAlert(const uint8_t* payload, size_t length) {
+  std::string json((const char*)payload, length);
+  size_t key = json.find("\"eventId\":");
+  if (key == std::string::npos) {
+    badMessages++;
+    return;
+  }
+  Alert alert;
+  alert.eventId = strtoul(json.c_str() + key + 10, NULL, 10);
+  // The firmware publishes from inside the window, before the ring moves on
+  alert.sample = streamPosition() - audioRing.available() + WINDOW_SAMPLES;
+  alert.frequency = gun_by_frequency;
+  alert.amplitude = gun_by_amplitude;
+  alert.transient = gun_by_transient;
+  alert.spectral = gun_by_spectral;
+  alert.score = shotScore;
+  alerts.push_back(alert);
+  clipAt(alert.sample - 1).alerts++;
+}
+
+static bool underGunshotDir(const std::string& path) {
+  size_t start = 0;
+  for (size_t slash; (slash = path.find('/', start)) != std::string::npos; start = slash + 1) {
+    if (path.compare(start, slash - start, "gunshot") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void addClips() {
+  for (size_t i = 0; const char* path = hostRecordingPath(i); i++) {
+    ClipResult clip = {underGunshotDir(path), 0, 0, 0, 0};
+    clips[path] = clip;
+  }
+}
+
+static ClipResult& clipAt(uint64_t sample) {
+  double seconds;
+  return clips[hostRecordingAt(sample, seconds)];
+}
+
+// A candidate closes SHOT_DECAY ms after its peak window; the clip that
+// held the peak gets it
+static void recordCandidate(bool streaming) {
+  // After loop() the ring has moved on by a hop
+  uint64_t windowEnd = streamPosition() - audioRing.available() + WINDOW_SAMPLES - HOP_SAMPLES;
+  uint64_t back = (uint64_t)(shotFeatures.features()[SHOT_DECAY] * hostRecordingRate() / 1000) + WINDOW_SAMPLES / 2;
+  ClipResult& clip = clipAt(windowEnd > back ? windowEnd - back : 0);
+  clip.candidates++;
+  if (shotModel.isShot(shotScore)) {
+    clip.flagged++;
+    clip.flaggedStreaming += streaming;
+  }
+}
+
+static void recordAudio(const uint8_t* payload, size_t length) {
+  if (length < FRAME_HEADER_BYTES || payload[0] != FRAME_MAGIC ||
+      (length - FRAME_HEADER_BYTES) % ADPCM_BLOCK_BYTES != 0) {
+    badMessages++;
+    return;
+  }
+  uint8_t flags = payload[3];
+  uint16_t sequence = le16(payload + 8);
+  uint32_t offset = le32(payload + 10);
+  Upload& upload = uploads[le32(payload + 4)];
+  if (sequence != upload.nextSequence) {
+    upload.sequenceGaps += (uint16_t)(sequence - upload.nextSequence);
+  }
+  if (offset != upload.nextOffset) {
+    upload.offsetGaps++;
+  }
+  uint32_t samples = (length - FRAME_HEADER_BYTES) / ADPCM_BLOCK_BYTES * ADPCM_BLOCK_SAMPLES;
+  if (flags & FRAME_PRESHOT) {
+    upload.preshotFrames++;
+  } else {
+    upload.postFrames++;
+    upload.postSamples += samples;
+    upload.lastFrameSamples = samples;
+  }
+  upload.bytes += length;
+  upload.samples += samples;
+  upload.last = upload.last || (flags & FRAME_LAST);
+  upload.nextSequence = sequence + 1;
+  upload.nextOffset = offset + samples;
+  upload.rate = le16(payload + 14);
+}
+
+static void recordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  const char* leaf = strrchr(topic, '/');
+  if (leaf && strcmp(leaf, "/data") == 0) {
+    recordAlert(payload, length);
+  } else if (leaf && strcmp(leaf, "/audio") == 0) {
+    recordAudio(payload, length);
+  }
+}
+
+// An upload ends with the frame that brings the post-shot audio to
+// STREAM_SECONDS, so it is short by less than that frame without it
+static bool streamedLength(const Upload& upload) {
+  uint64_t expected = (uint64_t)STREAM_SECONDS * upload.rate;
+  return upload.postSamples >= expected && upload.postSamples - upload.lastFrameSamples < expected;
+}
+
+// Returns the number of finished uploads of the wrong length
+static uint32_t printAlerts(uint32_t rate) {
+  uint32_t wrongLength = 0;
+  printf("\nAlerts: %u\n", (unsigned)alerts.size());
+  for (const Alert& alert : alerts) {
+    double seconds;
+    const char* file = hostRecordingAt(alert.sample - 1, seconds);
+    const char* name = strrchr(file, '/');
+    printf("  %9.3f s  %s @ %.3f s  event %u\n", (double)alert.sample / rate, name ? name + 1 : file, seconds,
+           (unsigned)alert.eventId);
+    printf("             F:%c A:%c T:%c S:%c  score %.2f\n", alert.frequency ? 'Y' : 'N',
+           alert.amplitude ? 'Y' : 'N', alert.transient ? 'Y' : 'N', alert.spectral ? 'Y' : 'N',
+           alert.score / 256.0f);
+    std::map<uint32_t, Upload>::const_iterator found = uploads.find(alert.eventId);
+    if (found == uploads.end()) {
+      printf("             no audio uploaded\n");
+      continue;
+    }
+    const Upload& upload = found->second;
+    double preSeconds = upload.rate ? (double)(upload.samples - upload.postSamples) / upload.rate : 0.0;
+    double postSeconds = upload.rate ? (double)upload.postSamples / upload.rate : 0.0;
+    printf("             audio %u pre-shot frames, %.1f s + %u post-shot frames, %.1f s, %llu bytes%s",
+           (unsigned)upload.preshotFrames, preSeconds, (unsigned)upload.postFrames, postSeconds,
+           (unsigned long long)upload.bytes, upload.last ? "" : ", no last frame");
+    if (upload.sequenceGaps || upload.offsetGaps) {
+      printf(", %u frames and %u spans missing", (unsigned)upload.sequenceGaps, (unsigned)upload.offsetGaps);
+    }
+    if (upload.last && !streamedLength(upload)) {
+      printf(", not %u s", (unsigned)STREAM_SECONDS);
+      wrongLength++;
+    }
+    printf("\n");
+  }
+  return wrongLength;
+}
+
+// The counts classifier_eval gives for the same clips are the flagged
+// ones: it scores each clip on its own, with no alert to suppress the next
+static void printClips() {
+  uint32_t count[2] = {0, 0}, scored[2] = {0, 0}, flagged[2] = {0, 0}, streaming[2] = {0, 0}, alerted[2] = {0, 0};
+  for (const std::pair<const std::string, ClipResult>& entry : clips) {
+    const ClipResult& clip = entry.second;
+    count[clip.gunshot]++;
+    scored[clip.gunshot] += clip.candidates > 0;
+    flagged[clip.gunshot] += clip.flagged > 0;
+    streaming[clip.gunshot] += clip.flagged > 0 && clip.flagged == clip.flaggedStreaming && clip.alerts == 0;
+    alerted[clip.gunshot] += clip.alerts > 0;
+  }
+  printf("\nClips, threshold %.2f\n", shotModel.thresholdQ8() / 256.0f);
+  printf("  %-22s %8s %8s\n", "", "gunshot", "other");
+  printf("  %-22s %8u %8u\n", "with a candidate", (unsigned)scored[1], (unsigned)scored[0]);
+  printf("  %-22s %8u %8u\n", "flagged", (unsigned)flagged[1], (unsigned)flagged[0]);
+  printf("  %-22s %8u %8u\n", "  while streaming", (unsigned)streaming[1], (unsigned)streaming[0]);
+  printf("  %-22s %8u %8u\n", "alerted", (unsigned)alerted[1], (unsigned)alerted[0]);
+  printf("  %-22s %8u %8u\n", "clips", (unsigned)count[1], (unsigned)count[0]);
+}
+
+int main(int argc, char** argv) {
+  HostOptions options;
+  if (!hostParseArgs(argc, argv, options)) {
+    return 2;
+  }
+  size_t files = hostLoadRecordings(options.frameDir);
+  if (files == 0) {
+    fprintf(stderr, "no .wav recordings in %s\n", options.frameDir);
+    return 1;
+  }
+  uint32_t rate = hostRecordingRate();
+  printf("gun_audio firmware, %u recordings, %.1f s at %u Hz, uplink %u B/s\n", (unsigned)files,
+         (double)hostRecordingSamples() / rate, (unsigned)rate, (unsigned)options.linkBytesPerSecond);
+
+  addClips();
+  hostSetMqttRecorder(recordMessage);
+  setup();
+  hostHeapResetPeak();
+  hostResetMqttStats();
+  uint64_t fileNanos = hostAudioStats().fileNanos;
+  try {
+    for (;;) {
+      uint32_t spectra = cascadeWindows[cascadeStages - 1];
+      uint32_t candidates = shotCandidates;
+      bool streaming = isStreaming;
+      {
+        HOST_STAGE(stages[STAGE_LOOP]);
+        loop();
+      }
+      if (shotCandidates != candidates) {
+        recordCandidate(streaming);
+      }
+      if (cascadeWindows[cascadeStages - 1] != spectra) {
+        hostStageRecord(stages[STAGE_FFT], fftCycles);
+      }
+      hostStageRecord(stages[STAGE_CLASSIFIER], classifierCycles);
+      hostStageRecord(stages[STAGE_ENCODE], encodeCycles);
+      hostStageRecord(stages[STAGE_FILE], hostAudioStats().fileNanos - fileNanos);
+      fileNanos = hostAudioStats().fileNanos;
+    }
+  } catch (const HostAudioEnd&) {
+    // The recordings have run out, part way through a loop()
+  }
+
+  uint32_t wrongLength = printAlerts(rate);
+
+  if (shotCandidates > 0) {
+    printClips();
+  }
+
+  const HostAudioStats& audio = hostAudioStats();
+  double audioSeconds = (double)streamPosition() / rate;
+  double loopSeconds = stages[STAGE_LOOP].totalNanos / 1e9;
+  double detectorSeconds = loopSeconds - audio.fileNanos / 1e9;
+  printf("\nThroughput\n");
+  printf("  %-22s %12.1f\n", "audio seconds", audioSeconds);
+  printf("  %-22s %12.3f\n", "loop CPU seconds", loopSeconds);
+  printf("  %-22s %12.0f\n", "real-time factor", loopSeconds > 0 ? audioSeconds / loopSeconds : 0.0);
+  printf("  %-22s %12.0f\n", "without file I/O", detectorSeconds > 0 ? audioSeconds / detectorSeconds : 0.0);
+
+  hostPrintStages("Per window stages", stages, STAGE_COUNT);
+
+  printf("\nCascade\n");
+  printf("  %-22s %8s %8s %8s %12s\n", "stage", "windows", "% all", "% CPU", "mean us");
+  for (int stage = 0; stage < cascadeStages; stage++) {
+    uint32_t windows = cascadeWindows[stage];
+    printf("  %-22s %8u %8.2f %8.1f %12.2f\n", cascadeNames[stage], (unsigned)windows,
+           cascadeWindows[0] ? 100.0 * windows / cascadeWindows[0] : 0.0,
+           detectorCycles ? 100.0 * cascadeCycles[stage] / detectorCycles : 0.0,
+           windows ? cascadeCycles[stage] / 1000.0 / windows : 0.0);
+  }
+  printf("  %-22s %8s %8s %8s %12.2f\n", "detector", "", "", "",
+         cascadeWindows[0] ? detectorCycles / 1000.0 / cascadeWindows[0] : 0.0);
+
+  const HostMqttStats& traffic = hostMqttStats();
+  printf("\nUplink and acquisition\n");
+  printf("  %-22s %12u\n", "mqtt messages", (unsigned)traffic.messages);
+  printf("  %-22s %12u\n", "mqtt rejected", (unsigned)traffic.rejected);
+  printf("  %-22s %12llu\n", "mqtt payload bytes", (unsigned long long)traffic.bytes);
+  printf("  %-22s %12u\n", "unparsed messages", (unsigned)badMessages);
+  printf("  %-22s %12u\n", "DMA overflows", (unsigned)audio.overflows);
+  printf("  %-22s %12llu\n", "samples lost", (unsigned long long)audio.samplesLost);
+  printf("  %-22s %12u\n", "heap peak bytes", (unsigned)hostHeapPeak());
+  printf("  %-22s %12.1f\n", "virtual seconds", millis() / 1e3);
+  if (wrongLength) {
+    printf("\n%u uploads did not stream %u s of post-shot audio\n", (unsigned)wrongLength, (unsigned)STREAM_SECONDS);
+  }
+  return 0;
+}
+#endif
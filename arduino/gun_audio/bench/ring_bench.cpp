@@ -0,0 +1,122 @@
+/*
+  Host run of the gunshot detector's sample ring (SampleRing) under threads
+
+  A producer thread stands in for the acquisition task: it writes
+  I2S_READ_SAMPLES blocks at the 16 kHz I2S rate. A consumer thread
+  stands in for loop(): it takes 50%-overlapped windows and stalls for
+  a while every so often, as an alert upload used to stall the sketch.
+  Samples carry their own sequence number, so the consumer can check
+  that every window is exactly the stream, in order. The run is
+  repeated with stalls of increasing length and reports, for each, the
+  ring's high-water mark, what it dropped and what the consumer found
+  missing. test/test_sample_ring checks the same accounting on a virtual
+  clock; build this with -fsanitize=thread to check the handoff itself.
+
+    g++ -O2 -pthread -I../../libraries/SampleRing ring_bench.cpp ../../libraries/SampleRing/SampleRing.cpp -o ring_bench
+    ./ring_bench
+*/
+
+#include <SampleRing.h>
+
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// Mirrors gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define I2S_READ_SAMPLES 256
+#define FFT_SAMPLES 512
+#define ANALYSIS_HOP (FFT_SAMPLES / 2)
+#define AUDIO_RING_SAMPLES 8192
+
+#define BENCH_SECONDS 2
+#define BENCH_STALL_EVERY_MS 500
+
+struct BenchRun {
+  uint32_t stallMs;
+  uint32_t windows;
+  uint32_t missing;         // Samples the consumer saw skipped
+  bool disordered;          // A sample arrived twice or out of order
+};
+
+// Check samples taken off the ring continue the stream
+static void follow(BenchRun& result, int32_t& last, const int32_t* samples, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (samples[i] <= last) {
+      result.disordered = true;
+    } else {
+      result.missing += samples[i] - last - 1;
+    }
+    last = samples[i];
+  }
+}
+
+static int32_t storage[AUDIO_RING_SAMPLES];
+
+static void run(BenchRun& result, SampleRing& ring) {
+  ring.begin(storage, AUDIO_RING_SAMPLES);
+  const uint32_t blocks = BENCH_SECONDS * I2S_SAMPLE_RATE / I2S_READ_SAMPLES;
+  const auto blockTime = std::chrono::microseconds(1000000ull * I2S_READ_SAMPLES / I2S_SAMPLE_RATE);
+  std::atomic<bool> producing(true);
+
+  std::thread producer([&]() {
+    int32_t block[I2S_READ_SAMPLES];
+    auto next = std::chrono::steady_clock::now();
+    for (uint32_t b = 0; b < blocks; b++) {
+      for (int i = 0; i < I2S_READ_SAMPLES; i++) {
+        block[i] = (int32_t)(b * I2S_READ_SAMPLES + i);
+      }
+      ring.write(block, I2S_READ_SAMPLES);
+      next += blockTime;
+      std::this_thread::sleep_until(next);
+    }
+    producing = false;
+  });
+
+  static int32_t window[FFT_SAMPLES];
+  int32_t last = -1;
+  auto lastStall = std::chrono::steady_clock::now();
+  result.windows = result.missing = 0;
+  result.disordered = false;
+  while (producing || ring.available() >= FFT_SAMPLES) {
+    if (!ring.peek(window, FFT_SAMPLES)) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      continue;
+    }
+    result.windows++;
+    for (int i = ANALYSIS_HOP + 1; i < FFT_SAMPLES; i++) {
+      result.disordered = result.disordered || window[i] <= window[i - 1];
+    }
+    follow(result, last, window, ANALYSIS_HOP);
+    ring.consume(ANALYSIS_HOP);
+    auto now = std::chrono::steady_clock::now();
+    if (result.stallMs && now - lastStall > std::chrono::milliseconds(BENCH_STALL_EVERY_MS)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(result.stallMs));
+      lastStall = std::chrono::steady_clock::now();
+    }
+  }
+  producer.join();
+  // What is left over is less than a window, follow it to the end
+  uint32_t left = ring.available();
+  ring.peek(window, left);
+  follow(result, last, window, left);
+}
+
+int main() {
+  const uint32_t ringMs = 1000ull * AUDIO_RING_SAMPLES / I2S_SAMPLE_RATE;
+  const uint32_t stalls[] = {0, 100, 300, 450, 700};
+  printf("SampleRing %u samples (%u ms), %u-sample windows every %u\n", AUDIO_RING_SAMPLES, ringMs, FFT_SAMPLES,
+         ANALYSIS_HOP);
+  printf("  %-10s %9s %10s %9s %9s %12s\n", "stall ms", "windows", "high water", "overruns", "dropped", "seen missing");
+  for (uint32_t s = 0; s < sizeof(stalls) / sizeof(stalls[0]); s++) {
+    SampleRing ring;
+    BenchRun result;
+    result.stallMs = stalls[s];
+    run(result, ring);
+    printf("  %-10u %9u %10u %9u %9u %12u%s\n", (unsigned)stalls[s], (unsigned)result.windows,
+           (unsigned)ring.highWater(), (unsigned)ring.overruns(), (unsigned)ring.droppedSamples(),
+           (unsigned)result.missing, result.disordered ? "   out of order" : "");
+  }
+  return 0;
+}
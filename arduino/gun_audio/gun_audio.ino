@@ -1,12 +1,15 @@
 #include <driver/i2s.h>
-#include <arduinoFFT.h>
+#include <RealFft.h>
+#include <SampleRing.h>
+#include <AudioCodec.h>
+#include <ShotClassifier.h>
 #include <math.h>
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <PubSubClient.h>
 #include <HTTPClient.h>
 #include <ArduinoJson.h>
-#include <CircularBuffer.hpp>
+#include "shot_model.h"
 
 // WiFi Credentials
 const char* ssid = "Mi 11X";
@@ -24,6 +27,7 @@ const char* mqtt_password = "Kaushikyadala53"; // ESP32-specific password
 // MQTT topics
 char mqtt_topic_audio[50]; // For audio data
 char mqtt_topic_alert[50]; // For gunshot alerts
+char mqtt_topic_model[50]; // Gunshot model updates, as ShotModel text
 
 // I2S pin configuration for the INMP441
 #define I2S_WS 25   // Word Select (LRC)
@@ -32,25 +36,90 @@ char mqtt_topic_alert[50]; // For gunshot alerts
 
 // Audio parameters
 #define I2S_SAMPLE_RATE 16000
-#define I2S_BUFFER_SIZE 1024
-#define FFT_SAMPLES 512  // Must be a power of 2 and <= I2S_BUFFER_SIZE
+#define I2S_BUFFER_SIZE 1024     // Samples per DMA buffer
+#define I2S_DMA_BUFFERS 4
+#define I2S_READ_SAMPLES 256     // Samples moved into the ring per i2s_read()
+#define I2S_EVENT_QUEUE_DEPTH 8
+#define FFT_SAMPLES 512  // Must be a power of 2 and <= REAL_FFT_MAX_SIZE
+#define ANALYSIS_HOP (FFT_SAMPLES / 2)  // Windows overlap by half, so every sample is analysed twice
+#define SAMPLE_SCALE (1.0f / 100000.0f)  // I2S word to the units the thresholds below are in
 
 // HTTP request parameters
 #define SEND_INTERVAL 5000  // Minimum time between HTTP requests (5 seconds)
 
 // Audio circular buffer parameters
 #define AUDIO_SAMPLE_RATE 8000  // Reduced sample rate for transmission
-#define SECONDS_TO_BUFFER 3     // Buffer 3 seconds of audio before gunshot
+#define AUDIO_INPUT_SHIFT 5     // I2S word to 16-bit PCM: +-1e6, the old 8-bit full scale, to +-31250
+#define SECONDS_TO_BUFFER 6     // Buffer 6 seconds of audio before gunshot
 #define SECONDS_TO_STREAM 6     // Stream 6 seconds of audio after gunshot
-#define SAMPLES_TO_BUFFER (AUDIO_SAMPLE_RATE * SECONDS_TO_BUFFER)
-#define MQTT_PACKET_SIZE 512    // Size of each MQTT packet in bytes
-
-// Create circular buffer to store audio samples (8-bit for efficiency)
-CircularBuffer<uint8_t, SAMPLES_TO_BUFFER> audioBuffer;
-
-// FFT arrays
-double vReal[FFT_SAMPLES];
-double vImag[FFT_SAMPLES];
+#define PRESHOT_BLOCKS ((AUDIO_SAMPLE_RATE * SECONDS_TO_BUFFER + ADPCM_BLOCK_SAMPLES - 1) / ADPCM_BLOCK_SAMPLES)
+
+// Circular buffer of IMA-ADPCM blocks: 4 bits a sample, twice the
+// seconds of the old 8-bit buffer in the same RAM. Blocks sit back to
+// back, so a packet is copied out in at most two spans.
+uint8_t audioBlocks[PRESHOT_BLOCKS * ADPCM_BLOCK_BYTES];
+int oldestBlock = 0;
+int bufferedBlocks = 0;
+
+// Audio frames on the audio topic: a fixed 16-byte header, little-endian,
+// then whole ADPCM blocks
+//   0     magic            1     version
+//   2     codec            3     flags
+//   4-7   event ID, the alert's eventId
+//   8-9   sequence number, from 0 for each event
+//   10-13 first sample's offset from the oldest pre-shot sample
+//   14-15 sample rate in Hz
+// Offsets skip audio the uplink lost, sequence numbers skip lost frames.
+#define AUDIO_FRAME_MAGIC 0xA7
+#define AUDIO_FRAME_VERSION 1
+#define AUDIO_FRAME_HEADER_BYTES 16
+#define AUDIO_CODEC_IMA_ADPCM 1
+#define AUDIO_FRAME_PRESHOT 0x01      // Audio from before the detection
+#define AUDIO_FRAME_LAST 0x02         // Last frame of the event
+#define AUDIO_FRAME_BLOCKS 8          // 2056 samples, about a quarter second
+#define UPLINK_MESSAGE_BYTES (AUDIO_FRAME_HEADER_BYTES + AUDIO_FRAME_BLOCKS * ADPCM_BLOCK_BYTES)
+
+// Uplink encoder: low-pass and halve the rate, then ADPCM
+HalfBandDecimator decimator(AUDIO_INPUT_SHIFT);
+ImaAdpcmEncoder adpcmEncoder;
+uint32_t encodeCycles = 0;             // CPU cycles to encode the last analysis hop
+
+// FFT in single precision: the ESP32 FPU has no double, so arduinoFFT<double>
+// ran in software emulation
+RealFft fft;
+float binPower[FFT_SAMPLES / 2 + 1];  // |X|^2 per bin, what the sketch used to square magnitudes for
+uint32_t fftCycles = 0;               // CPU cycles of the last FFT stage
+
+// Acquisition/analysis pipeline: one core only moves I2S DMA buffers into
+// the sample ring, the other analyses overlapping windows off it, and
+// MQTT publishing runs in a task of its own so an alert upload holds up
+// neither
+#ifndef AUDIO_PIPELINE
+#define AUDIO_PIPELINE 1              // 0 = read, analyse and publish in turn from loop()
+#endif
+#define AUDIO_RING_SAMPLES 8192       // Power of two, half a second at 16 kHz
+#define ACQUISITION_TASK_CORE 0       // loop() runs on core 1
+#define ACQUISITION_TASK_PRIORITY (configMAX_PRIORITIES - 1)  // Blocked on DMA nearly all the time
+#define UPLINK_TASK_CORE 0            // Same core as the WiFi stack
+#define UPLINK_QUEUE_DEPTH 8          // Messages waiting to be published
+#define STATUS_INTERVAL_MS 1000       // Detector status line on Serial
+int32_t ringStorage[AUDIO_RING_SAMPLES];
+SampleRing audioRing;
+int32_t analysisWindow[FFT_SAMPLES];
+int32_t i2sBlock[I2S_READ_SAMPLES];
+QueueHandle_t i2sEvents;
+volatile uint32_t dmaOverflows = 0;   // DMA buffers the driver overwrote before they were read
+uint32_t uplinkDropped = 0;           // Messages that found the uplink queue full
+unsigned long lastStatusTime = 0;
+#if AUDIO_PIPELINE
+struct UplinkMessage {
+  bool isAlert;
+  uint16_t length;
+  uint8_t payload[UPLINK_MESSAGE_BYTES];
+};
+QueueHandle_t uplinkQueue;
+TaskHandle_t analysisTask;
+#endif
 
 // Frequency range for gunshot detection
 #define FREQUENCY_LOWER_BOUND 250
@@ -64,14 +133,11 @@ double vImag[FFT_SAMPLES];
 #define AMPLITUDE_THRESHOLD 80.0
 
 // Transient detection parameters
-#define HISTORY_SIZE 15           // Number of past amplitude values to store
+#define HISTORY_SIZE 60           // Past window levels, about a second at the analysis hop
 #define TRANSIENT_THRESHOLD 4.0   // Minimum dB rise to consider as a transient
-double amplitudeHistory[HISTORY_SIZE];
+float amplitudeHistory[HISTORY_SIZE];
 int historyIndex = 0;
 
-// Create FFT instance using the updated arduinoFFT syntax
-ArduinoFFT<double> FFT(vReal, vImag, FFT_SAMPLES, I2S_SAMPLE_RATE);
-
 // Detection variables
 bool gun_by_frequency = false;
 bool gun_by_amplitude = false;
@@ -82,26 +148,84 @@ unsigned long lastSendTime = 0;
 
 #define COOLDOWN_MS 500  // Cooldown period after detection
 
+// Classifier: each candidate sound the feature extractor closes is
+// scored by a logistic model, whose weights and threshold can be
+// replaced over MQTT, in place of the four rules above having to agree.
+// Off by default: the built-in model was trained on a synthetic corpus
+// only, so build with it once a model trained on field recordings is
+// published.
+#ifndef SHOT_CLASSIFIER
+#define SHOT_CLASSIFIER 0             // 0 = frequency, amplitude, transient and spectral rules all must agree
+#endif
+ShotFeatureExtractor shotFeatures;
+ShotModel shotModel;
+ShotModel stagedModel;                // Parsed by the MQTT callback, taken up at the next window
+bool modelPending = false;
+int32_t shotScore = 0;                // Log-odds of the last candidate, Q8
+uint32_t shotCandidates = 0;          // Candidates scored since boot
+uint32_t classifierCycles = 0;        // CPU cycles of the last window's classifier stage
+
+// Detector cascade: every window goes through the cheap stages, and only
+// windows they cannot rule out reach the FFT, so a quiet night costs a
+// fraction of the full analysis. A gate only stops a window the full
+// analysis could not have flagged.
+//   level     running RMS and transient: the classifier's onset and peak
+//             test, or the amplitude and transient rules
+//   bands     rules build only: Goertzel bins below the gunshot band
+//             against the total power, for the spectral rule. The
+//             classifier has no band threshold to bound, so its build
+//             has no band stage.
+//   spectrum  FFT, spectral rules and classifier
+#ifndef DETECTOR_CASCADE
+#define DETECTOR_CASCADE 1            // 0 = every window through the spectrum stage
+#endif
+#define BAND_GATE (DETECTOR_CASCADE && !SHOT_CLASSIFIER)
+#define CASCADE_LEVEL 0
+#if BAND_GATE
+#define CASCADE_BANDS 1
+#define CASCADE_SPECTRUM 2
+#define CASCADE_STAGES 3
+const char* cascadeNames[CASCADE_STAGES] = {"level", "bands", "spectrum"};
+#else
+#define CASCADE_SPECTRUM 1
+#define CASCADE_STAGES 2
+const char* cascadeNames[CASCADE_STAGES] = {"level", "spectrum"};
+#endif
+int cascadeStages = CASCADE_STAGES;       // For reports built apart from the sketch
+#define CASCADE_GATE_BINS 3           // Bins 1-3, 31-94 Hz, where wind and engines put most of their power
+#define BAND_GATE_MARGIN 0.01f        // Error allowed for the gate's sums, as a share of the total
+uint32_t cascadeWindows[CASCADE_STAGES];   // Windows that reached each stage
+uint64_t cascadeCycles[CASCADE_STAGES];    // CPU cycles spent in each stage
+uint64_t detectorCycles = 0;               // CPU cycles of the whole detector, encoding included
+float hopSquares = 0;                 // Sum of squares and peak of the last window's second half,
+float hopPeak = 0;                    // the first half of the next
+int32_t previousHop[ANALYSIS_HOP];    // First half of the last window
+int32_t previousWindow[FFT_SAMPLES];  // The last window, put back together for the classifier's flux
+
 // Audio streaming state management
 bool isStreaming = false;
 unsigned long streamingStartTime = 0;
 unsigned long samplesStreamed = 0;
+int preshotRemaining = 0;        // Pre-shot blocks still to be queued for upload
+uint32_t streamDropped = 0;      // Samples lost because the uplink fell behind the stream
+uint32_t audioEventId = 0;       // Ties the audio frames to their alert
+uint16_t frameSequence = 0;      // Sequence number of the next audio frame
+uint32_t streamOffset = 0;       // Event sample offset of the oldest buffered block
 bool gunshotDetected = false;
 
 // WiFi and MQTT clients
 WiFiClientSecure espClient;
-#define MQTT_MAX_PACKET_SIZE 1024  // Increase MQTT packet size limit
-PubSubClient mqttClient(espClient);
+PubSubClient mqttClient(espClient);  // Messages go out with beginPublish(), past the client's buffer size
 
 // Function to add a value to the circular buffer
-void addToHistory(double value) {
+void addToHistory(float value) {
   amplitudeHistory[historyIndex] = value;
   historyIndex = (historyIndex + 1) % HISTORY_SIZE;
 }
 
 // Function to get average background amplitude (excluding most recent)
-double getAverageBackground() {
-  double sum = 0.0;
+float getAverageBackground() {
+  float sum = 0.0f;
   int count = 0;
   for (int i = 0; i < HISTORY_SIZE; i++) {
     // Skip the most recently added value
@@ -131,6 +255,24 @@ void setupWiFi() {
   Serial.println(WiFi.localIP());
 }
 
+// A model published on the model topic replaces the running one. It is
+// parsed here and handed to the analysis at the start of its next window.
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  if (strcmp(topic, mqtt_topic_model) != 0) {
+    return;
+  }
+  if (__atomic_load_n(&modelPending, __ATOMIC_ACQUIRE)) {
+    Serial.println("Gunshot model update still pending, ignored");
+    return;
+  }
+  if (!stagedModel.parse((const char*)payload, length)) {
+    Serial.println("Bad gunshot model, keeping the running one");
+    return;
+  }
+  __atomic_store_n(&modelPending, true, __ATOMIC_RELEASE);
+  Serial.println("Gunshot model received");
+}
+
 // Function to reconnect to MQTT broker
 void reconnectMQTT() {
   while (!mqttClient.connected()) {
@@ -139,6 +281,7 @@ void reconnectMQTT() {
     
     if (mqttClient.connect(clientId.c_str(), mqtt_username, mqtt_password)) {
       Serial.println("connected");
+      mqttClient.subscribe(mqtt_topic_model);
     } else {
       Serial.print("failed, rc=");
       Serial.print(mqttClient.state());
@@ -148,78 +291,110 @@ void reconnectMQTT() {
   }
 }
 
-// Function to send a gunshot alert via MQTT
-void sendGunshotAlert() {
+// Publish on the alert or the audio topic: from the uplink task, or from
+// loop() without the pipeline
+bool publishUplink(bool isAlert, const uint8_t* payload, size_t length) {
   if (!mqttClient.connected()) {
     reconnectMQTT();
   }
+  bool published = mqttClient.beginPublish(isAlert ? mqtt_topic_alert : mqtt_topic_audio, length, false);
+  if (published) {
+    published = mqttClient.write(payload, length) == length;
+    published = mqttClient.endPublish() && published;
+  }
+  if (isAlert) {
+    Serial.println(published ? "Successfully published gunshot alert" : "Failed to publish gunshot alert");
+  } else {
+    Serial.println(published ? "Published audio packet" : "Failed to publish audio packet");
+  }
+  return published;
+}
+
+// Publish a message now, or hand it to the uplink task. Returns false
+// if it could not be sent or queued.
+bool queueUplink(bool isAlert, const uint8_t* payload, size_t length) {
+#if AUDIO_PIPELINE
+  UplinkMessage message;
+  message.isAlert = isAlert;
+  message.length = length;
+  memcpy(message.payload, payload, length);
+  if (xQueueSend(uplinkQueue, &message, 0) != pdTRUE) {
+    uplinkDropped++;
+    return false;
+  }
+  return true;
+#else
+  return publishUplink(isAlert, payload, length);
+#endif
+}
+
+// Messages the uplink can take without waiting
+int uplinkRoom() {
+#if AUDIO_PIPELINE
+  return uxQueueSpacesAvailable(uplinkQueue);
+#else
+  return 1;
+#endif
+}
 
+// Function to send a gunshot alert via MQTT
+void sendGunshotAlert() {
   // Create JSON document for the alert
   StaticJsonDocument<256> doc;
   
   doc["timestamp"] = millis();
+  doc["eventId"] = audioEventId;
   doc["sensorId"] = sensor_id;
   doc["alertType"] = "Poaching alert";
   doc["audioAvailable"] = true;
   doc["is_gunshot"] = true;  // Explicitly include gunshot detection status
+  // Audio lost since boot: 0 means the detector has heard every sample
+  doc["samplesDropped"] = audioRing.droppedSamples() + dmaOverflows * I2S_BUFFER_SIZE;
   
   char jsonBuffer[256];
-  serializeJson(doc, jsonBuffer);
+  size_t jsonLength = serializeJson(doc, jsonBuffer);
   
   // Publish to MQTT
   Serial.print("Publishing gunshot alert: ");
   Serial.println(jsonBuffer);
-  
-  if (mqttClient.publish(mqtt_topic_alert, jsonBuffer)) {
-    Serial.println("Successfully published gunshot alert");
-  } else {
-    Serial.println("Failed to publish gunshot alert");
-  }
+  queueUplink(true, (const uint8_t*)jsonBuffer, jsonLength);
 }
 
-// Function to send audio data via MQTT
-void sendAudioData(const uint8_t* buffer, size_t length, bool isPreshot) {
-  if (!mqttClient.connected()) {
-    reconnectMQTT();
-  }
+// Store a 16 or 32-bit value little-endian
+void putLe16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+void putLe32(uint8_t* out, uint32_t value) {
+  putLe16(out, value & 0xFFFF);
+  putLe16(out + 2, value >> 16);
+}
+
+// Function to send audio data via MQTT: count blocks from the circular
+// buffer behind a frame header
+bool sendAudioData(int count, uint8_t flags) {
+  uint8_t frame[UPLINK_MESSAGE_BYTES];
+  frame[0] = AUDIO_FRAME_MAGIC;
+  frame[1] = AUDIO_FRAME_VERSION;
+  frame[2] = AUDIO_CODEC_IMA_ADPCM;
+  frame[3] = flags;
+  putLe32(frame + 4, audioEventId);
+  putLe16(frame + 8, frameSequence++);
+  putLe32(frame + 10, streamOffset);
+  putLe16(frame + 14, AUDIO_SAMPLE_RATE);
+
+  // The oldest blocks, up to the end of the buffer and then from its start
+  uint8_t* audio = frame + AUDIO_FRAME_HEADER_BYTES;
+  int firstSpan = min(count, PRESHOT_BLOCKS - oldestBlock);
+  memcpy(audio, audioBlocks + oldestBlock * ADPCM_BLOCK_BYTES, firstSpan * ADPCM_BLOCK_BYTES);
+  memcpy(audio + firstSpan * ADPCM_BLOCK_BYTES, audioBlocks, (count - firstSpan) * ADPCM_BLOCK_BYTES);
+  oldestBlock = (oldestBlock + count) % PRESHOT_BLOCKS;
+  bufferedBlocks -= count;
+  streamOffset += count * ADPCM_BLOCK_SAMPLES;
 
-  // Create JSON document with metadata and binary audio
-  StaticJsonDocument<256> doc;
-  
-  doc["timestamp"] = millis();
-  doc["sensorId"] = sensor_id;
-  doc["sampleRate"] = AUDIO_SAMPLE_RATE;
-  doc["bits"] = 8;
-  doc["isPreshot"] = isPreshot;
-  doc["length"] = length;
-  
-  char metadataBuffer[256];
-  size_t metadataLength = serializeJson(doc, metadataBuffer);
-  
-  // Create a buffer with metadata + binary audio data
-  // Format: [metadata length (2 bytes)][metadata json][audio binary]
-  uint8_t packetBuffer[MQTT_PACKET_SIZE];
-  
-  // Store metadata length as first two bytes
-  packetBuffer[0] = metadataLength & 0xFF;
-  packetBuffer[1] = (metadataLength >> 8) & 0xFF;
-  
-  // Copy metadata
-  memcpy(packetBuffer + 2, metadataBuffer, metadataLength);
-  
-  // Copy as much audio data as will fit
-  size_t audioLength = min(length, MQTT_PACKET_SIZE - metadataLength - 2);
-  memcpy(packetBuffer + 2 + metadataLength, buffer, audioLength);
-  
-  // Total packet size
-  size_t packetSize = 2 + metadataLength + audioLength;
-  
   // Publish to MQTT
-  if (mqttClient.publish(mqtt_topic_audio, packetBuffer, packetSize)) {
-    Serial.println("Published audio packet");
-  } else {
-    Serial.println("Failed to publish audio packet");
-  }
+  return queueUplink(false, frame, AUDIO_FRAME_HEADER_BYTES + count * ADPCM_BLOCK_BYTES);
 }
 
 // Send HTTP POST request with detection data (kept for backward compatibility)
@@ -270,49 +445,133 @@ void sendHttpPostRequest(bool is_gunshot) {
   lastSendTime = millis();
 }
 
-// Function to process and transmit all buffered audio
-void transmitBufferedAudio() {
-  uint8_t tempBuffer[MQTT_PACKET_SIZE - 256]; // Allow space for metadata
-  int packetCount = 0;
-  
-  // Get the current size - we'll process this many samples
-  int totalSamples = audioBuffer.size();
-  int remaining = totalSamples;
-  
-  while (remaining > 0) {
-    // Determine how many samples to send in this packet
-    int samplesToSend = min((int)remaining, (int)sizeof(tempBuffer));
-    
-    // Extract samples to a temporary array (not modifying the original buffer yet)
-    for (int i = 0; i < samplesToSend; i++) {
-      // Use shift() instead of first()/drop() combination
-      tempBuffer[i] = audioBuffer.shift();
+// Add an encoded block to the circular buffer. While an upload is
+// running, a full buffer means the uplink has fallen behind and the
+// oldest block, not yet sent, is lost.
+void bufferAudio(const uint8_t* block) {
+  if (bufferedBlocks == PRESHOT_BLOCKS) {
+    if (isStreaming) {
+      if (preshotRemaining > 0) {
+        preshotRemaining--;
+      }
+      streamDropped += ADPCM_BLOCK_SAMPLES;
+      streamOffset += ADPCM_BLOCK_SAMPLES;
     }
+    oldestBlock = (oldestBlock + 1) % PRESHOT_BLOCKS;
+    bufferedBlocks--;
+  }
+  int slot = (oldestBlock + bufferedBlocks) % PRESHOT_BLOCKS;
+  memcpy(audioBlocks + slot * ADPCM_BLOCK_BYTES, block, ADPCM_BLOCK_BYTES);
+  bufferedBlocks++;
+}
+
+// Low-pass, decimate and encode the new samples of an analysis window
+void encodeAudio(const int32_t* samples, size_t count) {
+  uint32_t encodeStart = ESP.getCycleCount();
+  int16_t pcm[ANALYSIS_HOP / 2 + 1];
+  size_t produced = decimator.process(samples, count, pcm);
+  for (size_t i = 0; i < produced; i++) {
+    if (adpcmEncoder.add(pcm[i])) {
+      bufferAudio(adpcmEncoder.block());
+    }
+  }
+  encodeCycles = ESP.getCycleCount() - encodeStart;
+}
+
+// Queue buffered audio while the uplink has room for it: the pre-shot
+// audio first, then post-shot audio as it arrives
+void streamAudio() {
+  while (isStreaming && uplinkRoom() > 0) {
+    bool isPreshot = preshotRemaining > 0;
+    int blocksToSend = isPreshot ? min(preshotRemaining, AUDIO_FRAME_BLOCKS) : AUDIO_FRAME_BLOCKS;
+    if (bufferedBlocks < blocksToSend) {
+      return;  // Wait for a full frame of post-shot audio
+    }
+    int samplesToSend = blocksToSend * ADPCM_BLOCK_SAMPLES;
+    uint8_t flags = 0;
+    if (isPreshot) {
+      flags = AUDIO_FRAME_PRESHOT;
+    } else if (samplesStreamed + samplesToSend >= AUDIO_SAMPLE_RATE * SECONDS_TO_STREAM) {
+      flags = AUDIO_FRAME_LAST;
+    }
+    sendAudioData(blocksToSend, flags);
     
-    // Send the audio packet
-    sendAudioData(tempBuffer, samplesToSend, true);
-    
-    remaining -= samplesToSend;
-    packetCount++;
-    
-    // Small delay to avoid MQTT congestion
-    delay(20);
+    if (isPreshot) {
+      preshotRemaining -= blocksToSend;
+      if (preshotRemaining == 0) {
+        Serial.println("Pre-shot audio queued");
+      }
+    } else {
+      // Blocks hold samples at the uplink rate, already decimated
+      samplesStreamed += samplesToSend;
+      
+      // Check if we've streamed enough samples
+      if (samplesStreamed >= (AUDIO_SAMPLE_RATE * SECONDS_TO_STREAM)) {
+        Serial.println("Post-gunshot audio streaming complete");
+        isStreaming = false;
+      }
+    }
   }
-  
-  Serial.print("Transmitted ");
-  Serial.print(packetCount);
-  Serial.println(" packets of pre-shot audio");
 }
 
+// Move one I2S read into the sample ring, noting any DMA buffer the
+// driver had to overwrite first
+void acquireBlock() {
+  i2s_event_t event;
+  while (xQueueReceive(i2sEvents, &event, 0) == pdTRUE) {
+    if (event.type == I2S_EVENT_RX_Q_OVF) {
+      dmaOverflows++;
+    }
+  }
+  size_t bytes_read = 0;
+  i2s_read(I2S_NUM_0, i2sBlock, sizeof(i2sBlock), &bytes_read, portMAX_DELAY);
+  audioRing.write(i2sBlock, bytes_read / sizeof(int32_t));
+}
+
+#if AUDIO_PIPELINE
+// Core 0, highest priority: keeps the DMA buffers drained whatever the
+// rest of the firmware is doing
+void acquisitionTask(void* parameter) {
+  for (;;) {
+    acquireBlock();
+    xTaskNotifyGive(analysisTask);
+  }
+}
+
+// Core 0: owns the MQTT client and publishes queued alerts and audio
+void uplinkTask(void* parameter) {
+  UplinkMessage message;
+  for (;;) {
+    if (!mqttClient.connected()) {
+      reconnectMQTT();  // Messages queue up meanwhile, and are dropped once it is full
+    }
+    mqttClient.loop();
+    if (xQueueReceive(uplinkQueue, &message, pdMS_TO_TICKS(50)) == pdTRUE) {
+      publishUplink(message.isAlert, message.payload, message.length);
+    }
+  }
+}
+#endif
+
 void setup() {
   Serial.begin(115200);
   Serial.println("ESP32 INMP441 + FFT + MQTT Audio Streaming");
 
+  audioRing.begin(ringStorage, AUDIO_RING_SAMPLES);
+
   // Initialize amplitude history with low values
   for (int i = 0; i < HISTORY_SIZE; i++) {
     amplitudeHistory[i] = -60.0;
   }
 
+  // Window and twiddle tables for the detector's FFT
+  fft.begin(FFT_SAMPLES, SAMPLE_SCALE);
+
+  // Candidate features per analysis window, and the built-in model until
+  // one arrives on the model topic
+  shotFeatures.begin(FFT_SAMPLES / 2 + 1, (float)I2S_SAMPLE_RATE / FFT_SAMPLES, 1000.0f * ANALYSIS_HOP / I2S_SAMPLE_RATE);
+  shotModel.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL));
+
   // Connect to WiFi
   setupWiFi();
   
@@ -321,10 +580,13 @@ void setup() {
   
   // Set up MQTT connection
   mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setBufferSize(SHOT_MODEL_MAX_TEXT + 64);  // Room to receive a model
+  mqttClient.setCallback(mqttCallback);
   
   // Create the MQTT topics
   sprintf(mqtt_topic_audio, "sensors/%s/audio", sensor_id);
   sprintf(mqtt_topic_alert, "sensors/%s/data", sensor_id);
+  sprintf(mqtt_topic_model, "sensors/%s/model", sensor_id);
   
   // Connect to MQTT broker
   reconnectMQTT();
@@ -337,7 +599,7 @@ void setup() {
     .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,
     .communication_format = I2S_COMM_FORMAT_I2S,
     .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-    .dma_buf_count = 4,
+    .dma_buf_count = I2S_DMA_BUFFERS,
     .dma_buf_len = I2S_BUFFER_SIZE,
     .use_apll = false
   };
@@ -350,126 +612,206 @@ void setup() {
     .data_in_num = I2S_SD
   };
 
-  // Install I2S driver and set the pins
-  i2s_driver_install(I2S_NUM_0, &i2s_config, 0, NULL);
+  // Install I2S driver and set the pins. The event queue reports DMA
+  // buffers lost to a late reader.
+  i2s_driver_install(I2S_NUM_0, &i2s_config, I2S_EVENT_QUEUE_DEPTH, &i2sEvents);
   i2s_set_pin(I2S_NUM_0, &pin_config);
+
+#if AUDIO_PIPELINE
+  analysisTask = xTaskGetCurrentTaskHandle();
+  uplinkQueue = xQueueCreate(UPLINK_QUEUE_DEPTH, sizeof(UplinkMessage));
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", 4096, NULL, ACQUISITION_TASK_PRIORITY, NULL,
+                          ACQUISITION_TASK_CORE);
+  xTaskCreatePinnedToCore(uplinkTask, "uplink", 8192, NULL, 1, NULL, UPLINK_TASK_CORE);
+#endif
   
   Serial.println("Setup complete");
 }
 
-void loop() {
-  // Keep MQTT connection alive
-  if (!mqttClient.connected()) {
-    reconnectMQTT();
+// Sum of squares of a half window, and its peak magnitude
+float hopEnergy(const int32_t* samples, float* peak) {
+  float sum_squares = 0;
+  float peak_amplitude = 0;
+  for (int i = 0; i < ANALYSIS_HOP; i++) {
+    float sample = (float)samples[i] * SAMPLE_SCALE;
+    sum_squares += sample * sample;
+    peak_amplitude = fmaxf(peak_amplitude, fabsf(sample));
   }
-  mqttClient.loop();
-
-  // Read audio sample buffer from I2S
-  int32_t audio_samples[I2S_BUFFER_SIZE];
-  size_t bytes_read;
-  i2s_read(I2S_NUM_0, audio_samples, sizeof(audio_samples), &bytes_read, portMAX_DELAY);
-  int samples_read = bytes_read / sizeof(int32_t);
-
-  // Calculate RMS value for amplitude
-  double sum_squares = 0;
+  *peak = peak_amplitude;
+  return sum_squares;
+}
 
-  // Process audio samples and add to circular buffer (downsampled and converted to 8-bit)
-  for (int i = 0; i < samples_read; i++) {
-    int32_t val = audio_samples[i];
-    double sample = (double)val / 100000.0;
-    
-    // Add samples to the FFT buffer (only use what we need)
-    if (i < FFT_SAMPLES) {
-      vReal[i] = sample;
-      vImag[i] = 0;
-    }
-    
-    // Sum of squares for RMS calculation
-    sum_squares += sample * sample;
-    
-    // Add downsampled audio to circular buffer (every 2nd sample at 16kHz becomes 8kHz)
-    // Convert from 32-bit to 8-bit unsigned (0-255)
-    if (i % 2 == 0) {
-      // Map from our sample range to 0-255 range
-      uint8_t sample8bit = constrain(map(val, -1000000, 1000000, 0, 255), 0, 255);
-      
-      // Add to circular buffer
-      audioBuffer.push(sample8bit);
-    }
+// Run the detector on one window of the stream. Windows start
+// ANALYSIS_HOP samples apart, so the first ANALYSIS_HOP samples are new
+// to the transmission buffer.
+void analyseWindow(const int32_t* audio_samples) {
+  uint32_t windowStart = ESP.getCycleCount();
+
+  // Add the new samples to the circular buffer at 8 kHz
+  encodeAudio(audio_samples, ANALYSIS_HOP);
+
+  // ---- STAGE 1: LEVEL ----
+  // RMS amplitude and peak, running: the first half of the window was
+  // the second half of the last one, so only the new half is summed
+  uint32_t stageStart = ESP.getCycleCount();
+  cascadeWindows[CASCADE_LEVEL]++;
+  if (cascadeWindows[CASCADE_LEVEL] == 1) {
+    hopSquares = hopEnergy(audio_samples, &hopPeak);
   }
+  float sum_squares = hopSquares;
+  float peak_amplitude = hopPeak;
+  hopSquares = hopEnergy(audio_samples + ANALYSIS_HOP, &hopPeak);
+  sum_squares += hopSquares;
+  peak_amplitude = fmaxf(peak_amplitude, hopPeak);
 
   // Calculate RMS (Root Mean Square) amplitude
-  double rms_amplitude = sqrt(sum_squares / samples_read);
+  float rms_amplitude = sqrtf(sum_squares / FFT_SAMPLES);
 
   // Convert RMS amplitude to decibels
-  double db_amplitude = 20 * log10((rms_amplitude * 22));
+  float db_amplitude = 20 * log10f((rms_amplitude * 22));
 
   // ---- TRANSIENT DETECTION ----
   addToHistory(db_amplitude);
-  double avgBackground = getAverageBackground();
-  double transient = db_amplitude - avgBackground;
+  float avgBackground = getAverageBackground();
+  float transient = db_amplitude - avgBackground;
   gun_by_transient = (transient >= TRANSIENT_THRESHOLD);
 
-  // ---- FFT Processing ----
-  FFT.windowing(FFT_WIN_TYP_HAMMING, FFT_FORWARD);
-  FFT.compute(FFT_FORWARD);
-  FFT.complexToMagnitude();
+  // ---- AMPLITUDE ANALYSIS ----
+  gun_by_amplitude = (db_amplitude > AMPLITUDE_THRESHOLD);
 
-  // Find the frequency bin with the highest magnitude
-  double bin_width = (double)I2S_SAMPLE_RATE / FFT_SAMPLES;
+  // The classifier only reads the spectrum of a window that opens a
+  // candidate or peaks in one; the rules need all four to agree
+#if SHOT_CLASSIFIER
+  bool passed = shotFeatures.needsSpectrum(rms_amplitude);
+#else
+  bool passed = gun_by_amplitude && gun_by_transient;
+#endif
+  passed = passed || !DETECTOR_CASCADE;
+  cascadeCycles[CASCADE_LEVEL] += ESP.getCycleCount() - stageStart;
+
+  float bin_width = (float)I2S_SAMPLE_RATE / FFT_SAMPLES;
   int lowBin = (int)(FREQUENCY_LOWER_BOUND / bin_width);
   int highBin = (int)(FREQUENCY_UPPER_BOUND / bin_width);
 
-  double peak = 0;
-  int peakIndex = 0;
-  for (int i = 1; i <= FFT_SAMPLES / 2; i++) {
-    if (vReal[i] > peak) {
-      peak = vReal[i];
-      peakIndex = i;
+  // ---- STAGE 2: BANDS ----
+  // The gate bins hold part of the power below the gunshot band, so
+  // bound from above the band's share and power the spectral rule will
+  // find, allowing for the error of the Goertzel and Parseval sums
+#if BAND_GATE
+  if (passed) {
+    stageStart = ESP.getCycleCount();
+    cascadeWindows[CASCADE_BANDS]++;
+    float gateTotal;
+    float gateLow = fft.bandPower(audio_samples, 1, CASCADE_GATE_BINS, gateTotal);
+    float ratioBound = gateTotal > 0 ? 1 + BAND_GATE_MARGIN - gateLow * (1 - BAND_GATE_MARGIN) / gateTotal : 1;
+    float energyBound = gateTotal * (1 + BAND_GATE_MARGIN) / (1 - BAND_GATE_MARGIN) - gateLow;
+    passed = ratioBound > SPECTRAL_RATIO_THRESHOLD && energyBound > MIN_GUNSHOT_BAND_ENERGY;
+    cascadeCycles[CASCADE_BANDS] += ESP.getCycleCount() - stageStart;
+  }
+#endif
+
+  // ---- STAGE 3: SPECTRUM ----
+  float spectralRatio = 0;
+  float dominantFreq = 0;
+  gun_by_frequency = false;
+  gun_by_spectral = false;
+  if (passed) {
+    stageStart = ESP.getCycleCount();
+    cascadeWindows[CASCADE_SPECTRUM]++;
+#if SHOT_CLASSIFIER
+    // Flux is taken against the last window, which the level stage may
+    // have let go without a spectrum
+    if (shotFeatures.spectrumStale()) {
+      memcpy(previousWindow, previousHop, sizeof(previousHop));
+      memcpy(previousWindow + ANALYSIS_HOP, audio_samples, (FFT_SAMPLES - ANALYSIS_HOP) * sizeof(int32_t));
+      fft.transform(previousWindow);
+      fft.powerSpectrum(1, FFT_SAMPLES / 2, binPower + 1);
+      shotFeatures.primeSpectrum(binPower);
+    }
+#endif
+
+    // ---- FFT Processing ----
+    // The peak search reads every bin, so the whole one-sided spectrum is
+    // taken
+    uint32_t fftStart = ESP.getCycleCount();
+    fft.transform(audio_samples);
+    fft.powerSpectrum(1, FFT_SAMPLES / 2, binPower + 1);
+    fftCycles = ESP.getCycleCount() - fftStart;
+
+    // Find the frequency bin with the highest magnitude, and the energy
+    // in the gunshot band and in all, in one pass over the bins
+    float peak = 0;
+    int peakIndex = 0;
+    float energyInGunshotBand = 0;
+    float totalEnergy = 0;
+    for (int i = 1; i <= FFT_SAMPLES / 2; i++) {
+      if (binPower[i] > peak) {
+        peak = binPower[i];
+        peakIndex = i;
+      }
+      if (i >= lowBin && i <= highBin) {
+        energyInGunshotBand += binPower[i];
+      }
+      totalEnergy += binPower[i];
     }
-  } 
-  
-  // Determine if the dominant frequency is in the gunshot range
-  gun_by_frequency = (peakIndex >= lowBin && peakIndex <= highBin);
 
-  // SPECTRAL RATIO ANALYSIS
-  double energyInGunshotBand = 0;
-  for (int i = lowBin; i <= highBin; i++) {
-      energyInGunshotBand += vReal[i] * vReal[i];
-  }
+    // Determine if the dominant frequency is in the gunshot range
+    gun_by_frequency = (peakIndex >= lowBin && peakIndex <= highBin);
 
-  double totalEnergy = 0;
-  for (int i = 1; i <= FFT_SAMPLES / 2; i++) {
-      totalEnergy += vReal[i] * vReal[i];
+    // SPECTRAL RATIO ANALYSIS
+    spectralRatio = (totalEnergy > 0) ? energyInGunshotBand / totalEnergy : 0;
+    gun_by_spectral = (spectralRatio > SPECTRAL_RATIO_THRESHOLD) && (energyInGunshotBand > MIN_GUNSHOT_BAND_ENERGY);
+    dominantFreq = (peakIndex * bin_width);
+    cascadeCycles[CASCADE_SPECTRUM] += ESP.getCycleCount() - stageStart;
   }
 
-  double spectralRatio = (totalEnergy > 0) ? energyInGunshotBand / totalEnergy : 0;
-  gun_by_spectral = (spectralRatio > SPECTRAL_RATIO_THRESHOLD) && (energyInGunshotBand > MIN_GUNSHOT_BAND_ENERGY);
-
-  // ---- AMPLITUDE ANALYSIS ----
-  gun_by_amplitude = (db_amplitude > AMPLITUDE_THRESHOLD);
-  double dominantFreq = (peakIndex * bin_width);
+  // ---- CLASSIFIER ----
+  // A candidate is scored once it has decayed, a few windows after its
+  // onset; the pre-shot buffer still holds the onset. Without a spectrum
+  // it only follows the level, and counts towards the level stage.
+  bool gun_by_classifier = false;
+#if SHOT_CLASSIFIER
+  if (__atomic_load_n(&modelPending, __ATOMIC_ACQUIRE)) {
+    shotModel = stagedModel;
+    __atomic_store_n(&modelPending, false, __ATOMIC_RELEASE);
+  }
+  uint32_t classifierStart = ESP.getCycleCount();
+  if (shotFeatures.add(passed ? binPower : NULL, rms_amplitude, peak_amplitude)) {
+    shotScore = shotModel.score(shotFeatures.features());
+    shotCandidates++;
+    gun_by_classifier = shotModel.isShot(shotScore);
+  }
+  classifierCycles = ESP.getCycleCount() - classifierStart;
+  cascadeCycles[passed ? CASCADE_SPECTRUM : CASCADE_LEVEL] += classifierCycles;
+  memcpy(previousHop, audio_samples, sizeof(previousHop));
+#endif
+  detectorCycles += ESP.getCycleCount() - windowStart;
 
   // Check for gunshot detection
   unsigned long currentTime = millis();
+#if SHOT_CLASSIFIER
+  bool is_gunshot_detected = gun_by_classifier && (currentTime - lastGunTime > COOLDOWN_MS);
+#else
   bool is_gunshot_detected = gun_by_frequency && gun_by_amplitude && 
                              gun_by_transient && gun_by_spectral && 
                              (currentTime - lastGunTime > COOLDOWN_MS);
+#endif
 
   // If this is a new gunshot detection (not previously detected or we're not already streaming)
   if (is_gunshot_detected && !isStreaming) {
     Serial.println("GUNSHOT DETECTED! Starting audio stream...");
     
     // Send gunshot alert
+    audioEventId = currentTime;
     sendGunshotAlert();
     
-    // Send previous buffer (pre-gunshot audio)
-    transmitBufferedAudio();
-    
-    // Start streaming mode
+    // Start streaming mode, the previous buffer (pre-gunshot audio) first
     isStreaming = true;
     streamingStartTime = currentTime;
     samplesStreamed = 0;
+    preshotRemaining = bufferedBlocks;
+    frameSequence = 0;
+    streamOffset = 0;
     
     // Update last gun time for cooldown
     lastGunTime = currentTime;
@@ -480,34 +822,15 @@ void loop() {
     // HTTP POST request removed, now handled via MQTT
   }
 
-  // If we're in streaming mode, send real-time audio
-  if (isStreaming) {
-    // Prepare audio packet for streaming
-    uint8_t streamBuffer[MQTT_PACKET_SIZE - 256]; // Leave room for metadata
-    int samplesToSend = min((int)audioBuffer.size(), (int)sizeof(streamBuffer));
-    
-    // Extract samples to the buffer without modifying the original
-    // (we'll keep collecting new samples in the main buffer)
-    for (int i = 0; i < samplesToSend; i++) {
-      if (!audioBuffer.isEmpty()) {
-        streamBuffer[i] = audioBuffer.shift();
-      }
-    }
-    
-    // Send audio packet (marked as post-shot)
-    sendAudioData(streamBuffer, samplesToSend, false);
-    
-    // Increment the counter for samples we've streamed
-    samplesStreamed += (samplesToSend / 2); // Adjust for downsampling
-    
-    // Check if we've streamed enough samples
-    if (samplesStreamed >= (AUDIO_SAMPLE_RATE * SECONDS_TO_STREAM)) {
-      Serial.println("Post-gunshot audio streaming complete");
-      isStreaming = false;
-    }
-  }
+  // If we're in streaming mode, queue audio as the uplink takes it
+  streamAudio();
 
-  // Print debug information
+  // Print debug information, once a second or on a detection: at the
+  // analysis rate it would fill the UART
+  if (!is_gunshot_detected && currentTime - lastStatusTime < STATUS_INTERVAL_MS) {
+    return;
+  }
+  lastStatusTime = currentTime;
   Serial.print("Amp: ");
   Serial.print(db_amplitude);
   Serial.print(" dB | Trans: ");
@@ -524,11 +847,62 @@ void loop() {
   Serial.print(gun_by_transient ? "Y" : "N");
   Serial.print(" S:");
   Serial.print(gun_by_spectral ? "Y" : "N");
+  Serial.print(" C:");
+  Serial.print(gun_by_classifier ? "Y" : "N");
+  Serial.print(" | Score: ");
+  Serial.print(shotScore / 256.0f);
   Serial.print(" | Gun: ");
   Serial.print(is_gunshot_detected ? "YES" : "NO");
   Serial.print(" | Buffer: ");
-  Serial.println(audioBuffer.size());
+  Serial.print(bufferedBlocks);
+  Serial.print(" | FFT: ");
+  Serial.print(fftCycles);
+  Serial.print(" cycles | Classifier: ");
+  Serial.print(classifierCycles);
+  Serial.print(" cycles | Encode: ");
+  Serial.print(encodeCycles);
+  Serial.print(" cycles | Cascade: ");
+  for (int stage = 0; stage < CASCADE_STAGES; stage++) {
+    Serial.print(stage > 0 ? "/" : "");
+    Serial.print(100.0f * cascadeWindows[stage] / cascadeWindows[CASCADE_LEVEL], 1);
+  }
+  Serial.print(" % of windows, ");
+  for (int stage = 0; stage < CASCADE_STAGES; stage++) {
+    Serial.print(stage > 0 ? "/" : "");
+    Serial.print(detectorCycles > 0 ? 100.0f * cascadeCycles[stage] / detectorCycles : 0.0f, 0);
+  }
+  Serial.print(" % of CPU | Ring: ");
+  Serial.print(audioRing.available());
+  Serial.print("/");
+  Serial.print(audioRing.highWater());
+  Serial.print(" | Lost: ");
+  Serial.print(audioRing.droppedSamples());
+  Serial.print(" ring, ");
+  Serial.print(dmaOverflows);
+  Serial.print(" DMA, ");
+  Serial.print(streamDropped);
+  Serial.print(" stream, ");
+  Serial.print(uplinkDropped);
+  Serial.println(" uplink");
+}
+
+void loop() {
+#if AUDIO_PIPELINE
+  // The acquisition task fills the ring; wait for a window's worth
+  while (!audioRing.peek(analysisWindow, FFT_SAMPLES)) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+#else
+  // Keep MQTT connection alive
+  if (!mqttClient.connected()) {
+    reconnectMQTT();
+  }
+  mqttClient.loop();
 
-  // Slight delay to prevent tight looping
-  delay(10);
-}
\ No newline at end of file
+  while (!audioRing.peek(analysisWindow, FFT_SAMPLES)) {
+    acquireBlock();
+  }
+#endif
+  analyseWindow(analysisWindow);
+  audioRing.consume(ANALYSIS_HOP);
+}
@@ -0,0 +1,26 @@
+/*
+  Built-in gunshot model for ShotClassifier, used until one arrives on
+  the sensor's model topic. Trained with bench/classifier_eval --train
+  on its synthetic corpus; retrain on recordings and publish the output
+  to replace it without reflashing. The sketch only runs the classifier
+  when built with SHOT_CLASSIFIER 1.
+*/
+
+#ifndef SHOT_MODEL_H
+#define SHOT_MODEL_H
+
+const char DEFAULT_SHOT_MODEL[] =
+  "threshold 1.00\n"
+  "bias -1.0964\n"
+  "level 56.4278 0.105311 0.5391\n"
+  "rise 22.1522 0.102108 0.5659\n"
+  "slope 12.0368 0.103271 -0.8567\n"
+  "flux 0.256994 3.43543 -0.1548\n"
+  "centroid 1484.26 0.000845725 -0.2429\n"
+  "crest 10.6079 0.216231 1.4928\n"
+  "low 0.353691 2.91101 -1.2237\n"
+  "mid 0.351072 4.2705 1.6321\n"
+  "high 0.225927 3.50859 0.1425\n"
+  "decay 93.002 0.00965225 -0.9004\n";
+
+#endif
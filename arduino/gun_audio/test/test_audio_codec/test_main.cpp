@@ -0,0 +1,265 @@
+/*
+  AudioCodec: half-band decimation and the IMA-ADPCM round trip
+
+  Tones at the I2S word scale go through HalfBandDecimator and are
+  compared with the exact 8 kHz signal, delayed by the filter: in-band
+  blocks must come through clean, and tones above 4 kHz, which have no
+  in-band content, must be held below MAX_ALIAS_DB as they fold
+  back. The decimator's output is then encoded with ImaAdpcmEncoder and
+  decoded block by block, and the round trip must keep its SNR against
+  the PCM it was given. bench/codec_bench compares both stages with the
+  old 8-bit path and times them.
+
+    pio test -e native -f test_audio_codec
+*/
+
+#include <AudioCodec.h>
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// As in gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define AUDIO_SAMPLE_RATE 8000
+#define AUDIO_INPUT_SHIFT 5
+#define ANALYSIS_HOP 256
+
+#define TEST_SECONDS 2
+#define TEST_INPUT (I2S_SAMPLE_RATE * TEST_SECONDS)
+#define TEST_OUTPUT (TEST_INPUT / 2)
+#define TEST_SKIP 400                // 8 kHz samples left out at the start while the filter fills
+#define MAX_ALIAS_DB -50.0
+#define MIN_FILTER_SNR_DB 40.0
+#define MIN_ADPCM_SNR_DB 14.0
+#define FULL_SCALE 1000000.0         // I2S words the old 8-bit path mapped to its range
+
+struct Tone {
+  double hz;
+  double amplitude;                  // Share of FULL_SCALE
+};
+
+struct TestSignal {
+  const char* name;
+  Tone tones[3];
+};
+
+static const TestSignal inBand[] = {
+  {"440 Hz, -6 dB", {{440, 0.5}}},
+  {"1.5 kHz, -20 dB", {{1500, 0.1}}},
+  {"3 kHz, -6 dB", {{3000, 0.5}}},
+  {"speech band mix", {{300, 0.2}, {1100, 0.15}, {2400, 0.1}}},
+  {"quiet 800 Hz, -40 dB", {{800, 0.01}}},
+};
+
+static const TestSignal aliases[] = {
+  {"5.1 kHz, -6 dB", {{5100, 0.5}}},
+  {"6.7 kHz, -6 dB", {{6700, 0.5}}},
+  {"4.7 kHz, -6 dB", {{4700, 0.5}}},
+};
+
+static int32_t input[TEST_INPUT];
+static int16_t pcm[TEST_OUTPUT];
+static int16_t decoded[TEST_OUTPUT + ADPCM_BLOCK_SAMPLES];
+static double reference[TEST_OUTPUT];
+
+static double toneValue(const TestSignal& signal, double t, bool inBandOnly) {
+  double value = 0;
+  for (int i = 0; i < 3 && signal.tones[i].hz > 0; i++) {
+    if (!inBandOnly || signal.tones[i].hz < AUDIO_SAMPLE_RATE / 2) {
+      value += signal.tones[i].amplitude * FULL_SCALE * sin(6.283185307179586 * signal.tones[i].hz * t);
+    }
+  }
+  return value;
+}
+
+// Input at 16 kHz and the in-band reference at 8 kHz, delayed as the
+// filter delays it. Returns the input's power.
+static double makeSignal(const TestSignal& signal) {
+  double power = 0;
+  for (int n = 0; n < TEST_INPUT; n++) {
+    double value = toneValue(signal, (double)n / I2S_SAMPLE_RATE, false);
+    input[n] = (int32_t)lround(value);
+    power += value * value / TEST_INPUT;
+  }
+  double delay = (double)HalfBandDecimator::delay() / I2S_SAMPLE_RATE;
+  for (int m = 0; m < TEST_OUTPUT; m++) {
+    reference[m] = toneValue(signal, (double)m / AUDIO_SAMPLE_RATE - delay, true);
+  }
+  return power;
+}
+
+// Fed by analysis hops as the sketch feeds it
+static size_t decimate(size_t chunk) {
+  HalfBandDecimator decimator(AUDIO_INPUT_SHIFT);
+  size_t produced = 0;
+  for (size_t start = 0; start < TEST_INPUT; start += chunk) {
+    size_t count = start + chunk <= TEST_INPUT ? chunk : TEST_INPUT - start;
+    produced += decimator.process(input + start, count, pcm + produced);
+  }
+  return produced;
+}
+
+// Encode pcm and decode it back block by block. Returns the samples decoded.
+static size_t roundTrip(size_t count) {
+  ImaAdpcmEncoder encoder;
+  size_t out = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (encoder.add(pcm[i])) {
+      imaAdpcmDecodeBlock(encoder.block(), decoded + out);
+      out += ADPCM_BLOCK_SAMPLES;
+    }
+  }
+  return out;
+}
+
+// Output level against the reference, in dB of signal to error, at the
+// I2S word scale
+static double filterSnr(size_t count) {
+  double signal = 0, error = 0;
+  for (size_t i = TEST_SKIP; i < count; i++) {
+    double out = (double)pcm[i] * (1 << AUDIO_INPUT_SHIFT);
+    signal += reference[i] * reference[i];
+    error += (out - reference[i]) * (out - reference[i]);
+  }
+  return error > 0 ? 10 * log10(signal / error) : 99.9;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_decimator_passes_band() {
+  for (const TestSignal& signal : inBand) {
+    makeSignal(signal);
+    size_t count = decimate(ANALYSIS_HOP);
+    TEST_ASSERT_EQUAL_UINT32(TEST_OUTPUT, count);
+    double snr = filterSnr(count);
+    char message[96];
+    snprintf(message, sizeof(message), "%s: %.1f dB", signal.name, snr);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE_MESSAGE(snr >= MIN_FILTER_SNR_DB, message);
+  }
+}
+
+static void test_decimator_rejects_alias() {
+  // With nothing in band, whatever comes out of the filter or the codec
+  // is a tone folded back, measured against the tone that went in
+  for (const TestSignal& signal : aliases) {
+    double inputPower = makeSignal(signal);
+    size_t count = decimate(ANALYSIS_HOP);
+    size_t decodedCount = roundTrip(count);
+    double filterPower = 0, codecPower = 0;
+    for (size_t i = TEST_SKIP; i < count; i++) {
+      double out = (double)pcm[i] * (1 << AUDIO_INPUT_SHIFT);
+      filterPower += out * out / (count - TEST_SKIP);
+    }
+    for (size_t i = TEST_SKIP; i < decodedCount; i++) {
+      double out = (double)decoded[i] * (1 << AUDIO_INPUT_SHIFT);
+      codecPower += out * out / (decodedCount - TEST_SKIP);
+    }
+    double filterDb = filterPower > 0 ? 10 * log10(filterPower / inputPower) : -99.9;
+    double codecDb = codecPower > 0 ? 10 * log10(codecPower / inputPower) : -99.9;
+    char message[96];
+    snprintf(message, sizeof(message), "%s: %.1f dB through the filter, %.1f dB through ADPCM", signal.name, filterDb,
+             codecDb);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE_MESSAGE(filterDb <= MAX_ALIAS_DB, message);
+    TEST_ASSERT_TRUE_MESSAGE(codecDb <= MAX_ALIAS_DB, message);
+  }
+}
+
+static void test_any_chunking_gives_the_same_output() {
+  // An odd sample is carried over to the next call
+  makeSignal(inBand[3]);
+  size_t count = decimate(ANALYSIS_HOP);
+  static int16_t whole[TEST_OUTPUT];
+  memcpy(whole, pcm, sizeof(whole));
+  const size_t chunks[] = {1, 3, 255, 1000, TEST_INPUT};
+  for (size_t chunk : chunks) {
+    memset(pcm, 0, sizeof(pcm));
+    TEST_ASSERT_EQUAL_UINT32(count, decimate(chunk));
+    TEST_ASSERT_TRUE_MESSAGE(memcmp(whole, pcm, sizeof(whole)) == 0, "chunked output differs");
+  }
+}
+
+static void test_adpcm_round_trip_snr() {
+  for (const TestSignal& signal : inBand) {
+    makeSignal(signal);
+    size_t count = decimate(ANALYSIS_HOP);
+    size_t decodedCount = roundTrip(count);
+    TEST_ASSERT_EQUAL_UINT32(count / ADPCM_BLOCK_SAMPLES * ADPCM_BLOCK_SAMPLES, decodedCount);
+    double power = 0, error = 0;
+    for (size_t i = TEST_SKIP; i < decodedCount; i++) {
+      power += (double)pcm[i] * pcm[i];
+      error += ((double)decoded[i] - pcm[i]) * ((double)decoded[i] - pcm[i]);
+    }
+    double snr = 10 * log10(power / error);
+    char message[96];
+    snprintf(message, sizeof(message), "%s: %.1f dB", signal.name, snr);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE_MESSAGE(snr >= MIN_ADPCM_SNR_DB, message);
+
+    // Each block's header holds its first sample exactly
+    for (size_t b = 0; b < decodedCount; b += ADPCM_BLOCK_SAMPLES) {
+      TEST_ASSERT_EQUAL_INT(pcm[b], decoded[b]);
+    }
+  }
+}
+
+static void test_blocks_decode_on_their_own() {
+  // A lost or corrupt block leaves the next one as it was
+  makeSignal(inBand[3]);
+  size_t count = decimate(ANALYSIS_HOP);
+  ImaAdpcmEncoder encoder;
+  static uint8_t blocks[TEST_OUTPUT / ADPCM_BLOCK_SAMPLES][ADPCM_BLOCK_BYTES];
+  size_t blockCount = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (encoder.add(pcm[i])) {
+      memcpy(blocks[blockCount++], encoder.block(), ADPCM_BLOCK_BYTES);
+    }
+  }
+  TEST_ASSERT_GREATER_THAN(3, blockCount);
+  int16_t expected[ADPCM_BLOCK_SAMPLES], again[ADPCM_BLOCK_SAMPLES];
+  imaAdpcmDecodeBlock(blocks[2], expected);
+  memset(blocks[1], 0xA5, ADPCM_BLOCK_BYTES);
+  imaAdpcmDecodeBlock(blocks[1], again);
+  imaAdpcmDecodeBlock(blocks[2], again);
+  TEST_ASSERT_TRUE(memcmp(expected, again, sizeof(expected)) == 0);
+
+  // A step index out of range in a header is clamped, not read past the table
+  blocks[1][2] = 0xFF;
+  imaAdpcmDecodeBlock(blocks[1], again);
+}
+
+static void test_full_scale_saturates() {
+  // I2S words far past 16 bits after the shift clip instead of wrapping
+  for (int n = 0; n < TEST_INPUT; n++) {
+    input[n] = (n / 64) % 2 ? INT32_MAX : INT32_MIN;
+  }
+  size_t count = decimate(ANALYSIS_HOP);
+  for (size_t i = TEST_SKIP; i < count; i++) {
+    // Outputs whose taps all fall on one level of the square wave
+    size_t reach = HalfBandDecimator::delay() + 1;
+    size_t phase = (2 * i - HalfBandDecimator::delay()) % 128;
+    if (phase >= 64 + reach && phase < 128 - reach) {
+      TEST_ASSERT_GREATER_THAN(32000, pcm[i]);
+    } else if (phase >= reach && phase < 64 - reach) {
+      TEST_ASSERT_LESS_THAN(-32000, pcm[i]);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_decimator_passes_band);
+  RUN_TEST(test_decimator_rejects_alias);
+  RUN_TEST(test_any_chunking_gives_the_same_output);
+  RUN_TEST(test_adpcm_round_trip_snr);
+  RUN_TEST(test_blocks_decode_on_their_own);
+  RUN_TEST(test_full_scale_saturates);
+  return UNITY_END();
+}
@@ -0,0 +1,247 @@
+/*
+  gun_audio.ino end to end: every alert's upload streams the right length
+
+  The sketch runs through setup() and loop() on the ArduinoHost
+  stand-ins over a recording the test writes to /tmp: a noise floor
+  with SHOT_COUNT shots, each an N-wave with its reflection and a
+  decaying noise tail as classifier_eval synthesizes them, far enough
+  apart for each upload to finish before the next. Every alert must
+  upload its pre-shot audio first, then post-shot audio in sequence
+  with no gaps, and end on the frame that brings the post-shot audio to
+  SECONDS_TO_STREAM: the stream must reach it and fall short of it
+  without that frame. A post-shot stream counted twice, or cut short,
+  fails. With the uplink limited, frames may be lost but the upload
+  must still end at the same point of the stream.
+
+    pio test -e native -f test_audio_upload
+*/
+
+#include <Arduino.h>
+#include <AudioCodec.h>
+#include <HostHarness.h>
+#include <unity.h>
+
+#include <map>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// Firmware, from gun_audio.ino
+void setup();
+void loop();
+
+// As in gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define AUDIO_SAMPLE_RATE 8000
+#define SECONDS_TO_STREAM 6
+#define AUDIO_FRAME_MAGIC 0xA7
+#define AUDIO_FRAME_HEADER_BYTES 16
+#define AUDIO_FRAME_PRESHOT 0x01
+#define AUDIO_FRAME_LAST 0x02
+
+#define RECORDING_DIR "/tmp/gun_audio-test-recordings"
+#define SHOT_COUNT 3
+#define SHOT_SPACING 10                // Seconds between shots, past the upload
+#define FIRST_SHOT 2                   // Seconds into the recording
+#define SHOT_LEVEL 16000.0             // Peak of the N-wave, of 32767
+#define NOISE_LEVEL 100.0
+#define SLOW_LINK 3000                 // B/s, below the ADPCM stream's 4 kB/s
+
+struct Upload {
+  uint32_t preshotFrames;
+  uint32_t postFrames;
+  uint64_t postSamples;
+  uint32_t lastFrameSamples;
+  uint32_t sequenceGaps;
+  uint32_t offsetGaps;
+  bool preshotAfterPost;
+  bool last;
+  uint16_t nextSequence;
+  uint32_t nextOffset;
+  uint16_t rate;
+};
+
+static std::map<uint32_t, Upload> uploads;
+static std::vector<uint32_t> alerts;
+static uint32_t badMessages;
+
+static uint16_t le16(const uint8_t* p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const uint8_t* p) {
+  return le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+static void recordAudio(const uint8_t* payload, size_t length) {
+  if (length < AUDIO_FRAME_HEADER_BYTES || payload[0] != AUDIO_FRAME_MAGIC ||
+      (length - AUDIO_FRAME_HEADER_BYTES) % ADPCM_BLOCK_BYTES != 0) {
+    badMessages++;
+    return;
+  }
+  uint8_t flags = payload[3];
+  uint16_t sequence = le16(payload + 8);
+  uint32_t offset = le32(payload + 10);
+  Upload& upload = uploads[le32(payload + 4)];
+  upload.sequenceGaps += (uint16_t)(sequence - upload.nextSequence);
+  upload.offsetGaps += offset != upload.nextOffset;
+  uint32_t samples = (length - AUDIO_FRAME_HEADER_BYTES) / ADPCM_BLOCK_BYTES * ADPCM_BLOCK_SAMPLES;
+  if (flags & AUDIO_FRAME_PRESHOT) {
+    upload.preshotFrames++;
+    upload.preshotAfterPost = upload.preshotAfterPost || upload.postFrames > 0;
+  } else {
+    upload.postFrames++;
+    upload.postSamples += samples;
+    upload.lastFrameSamples = samples;
+  }
+  upload.last = upload.last || (flags & AUDIO_FRAME_LAST);
+  upload.nextSequence = sequence + 1;
+  upload.nextOffset = offset + samples;
+  upload.rate = le16(payload + 14);
+}
+
+static void recordMessage(const char* topic, const uint8_t* payload, size_t length) {
+  const char* leaf = strrchr(topic, '/');
+  if (leaf && strcmp(leaf, "/data") == 0) {
+    std::string json((const char*)payload, length);
+    size_t key = json.find("\"eventId\":");
+    TEST_ASSERT_TRUE_MESSAGE(key != std::string::npos, "alert without eventId");
+    alerts.push_back(strtoul(json.c_str() + key + 10, NULL, 10));
+  } else if (leaf && strcmp(leaf, "/audio") == 0) {
+    recordAudio(payload, length);
+  }
+}
+
+// Linear ramp from amplitude to -amplitude over ms
+static void addNWave(std::vector<double>& s, size_t at, double amplitude, double ms) {
+  size_t length = (size_t)(ms * I2S_SAMPLE_RATE / 1000) + 2;
+  for (size_t i = 0; i < length && at + i < s.size(); i++) {
+    s[at + i] += amplitude * (1 - 2.0 * i / (length - 1));
+  }
+}
+
+static void writeRecording() {
+  std::vector<double> s((FIRST_SHOT + SHOT_COUNT * SHOT_SPACING) * I2S_SAMPLE_RATE, 0.0);
+  uint32_t seed = 24;
+  double low = 0;
+  for (size_t i = 0; i < s.size(); i++) {
+    seed = seed * 1664525 + 1013904223;
+    double white = (double)(int32_t)seed / 2147483648.0;
+    s[i] += NOISE_LEVEL * white;
+    size_t into = (i - FIRST_SHOT * I2S_SAMPLE_RATE) % (SHOT_SPACING * I2S_SAMPLE_RATE);
+    if (i >= FIRST_SHOT * I2S_SAMPLE_RATE && into < I2S_SAMPLE_RATE / 4) {
+      // Decaying tail, low-passed
+      low = 0.5 * low + 0.5 * white;
+      s[i] += 0.4 * SHOT_LEVEL * low * exp(-1000.0 * into / I2S_SAMPLE_RATE / 30);
+    }
+  }
+  for (int shot = 0; shot < SHOT_COUNT; shot++) {
+    size_t at = (FIRST_SHOT + shot * SHOT_SPACING) * I2S_SAMPLE_RATE;
+    addNWave(s, at, SHOT_LEVEL, 2.0);
+    addNWave(s, at + 8 * 16, -0.5 * SHOT_LEVEL, 2.0);
+  }
+
+  FILE* f = fopen(RECORDING_DIR "/shots.wav", "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  uint32_t dataBytes = s.size() * 2;
+  uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0};
+  uint32_t fields[] = {36 + dataBytes, I2S_SAMPLE_RATE, I2S_SAMPLE_RATE * 2};
+  memcpy(header + 4, &fields[0], 4);
+  memcpy(header + 24, &fields[1], 4);
+  memcpy(header + 28, &fields[2], 4);
+  header[32] = 2;
+  header[34] = 16;
+  memcpy(header + 36, "data", 4);
+  memcpy(header + 40, &dataBytes, 4);
+  fwrite(header, 1, sizeof(header), f);
+  for (double v : s) {
+    int16_t sample = (int16_t)fmax(-32768, fmin(32767, lround(v)));
+    fwrite(&sample, 2, 1, f);
+  }
+  fclose(f);
+}
+
+// Another pass of the recording, after what has been played
+static void replay() {
+  uploads.clear();
+  alerts.clear();
+  badMessages = 0;
+  TEST_ASSERT_EQUAL_UINT32(1, hostLoadRecordings(RECORDING_DIR));
+  hostSetMqttRecorder(recordMessage);
+  hostResetMqttStats();
+  try {
+    for (;;) {
+      loop();
+    }
+  } catch (const HostAudioEnd&) {
+    // The recording has run out
+  }
+  hostSetMqttRecorder(NULL);
+}
+
+// Every upload that reached its last frame ended on the frame that
+// brought the post-shot audio to SECONDS_TO_STREAM
+static uint32_t checkUploads(bool lossless) {
+  TEST_ASSERT_EQUAL_UINT32(0, badMessages);
+  TEST_ASSERT_EQUAL_UINT32(0, hostMqttStats().rejected);
+  uint32_t finished = 0;
+  for (uint32_t eventId : alerts) {
+    char message[96];
+    std::map<uint32_t, Upload>::const_iterator found = uploads.find(eventId);
+    snprintf(message, sizeof(message), "event %u", (unsigned)eventId);
+    TEST_ASSERT_TRUE_MESSAGE(found != uploads.end(), message);
+    const Upload& upload = found->second;
+    uint64_t expected = (uint64_t)SECONDS_TO_STREAM * upload.rate;
+    snprintf(message, sizeof(message), "event %u: %u pre-shot, %u post-shot frames, %.2f s", (unsigned)eventId,
+             (unsigned)upload.preshotFrames, (unsigned)upload.postFrames,
+             upload.rate ? (double)upload.postSamples / upload.rate : 0.0);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(AUDIO_SAMPLE_RATE, upload.rate, message);
+    TEST_ASSERT_FALSE_MESSAGE(upload.preshotAfterPost, message);
+    if (lossless) {
+      TEST_ASSERT_GREATER_THAN_MESSAGE(0, upload.preshotFrames, message);
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, upload.sequenceGaps, message);
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, upload.offsetGaps, message);
+    }
+    if (upload.last) {
+      TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(expected, upload.postSamples, message);
+      TEST_ASSERT_LESS_THAN_MESSAGE(expected, upload.postSamples - upload.lastFrameSamples, message);
+      finished++;
+    }
+  }
+  return finished;
+}
+
+void setUp() {
+  hostSetLinkRate(0);
+}
+
+void tearDown() {}
+
+static void test_every_shot_uploads_its_audio() {
+  mkdir(RECORDING_DIR, 0755);
+  writeRecording();
+  setup();
+  replay();
+  TEST_ASSERT_EQUAL_UINT32(SHOT_COUNT, alerts.size());
+  TEST_ASSERT_EQUAL_UINT32(SHOT_COUNT, checkUploads(true));
+}
+
+static void test_slow_link_ends_at_the_same_point() {
+  hostSetLinkRate(SLOW_LINK);
+  replay();
+  TEST_ASSERT_GREATER_THAN(0, alerts.size());
+  TEST_ASSERT_GREATER_THAN(0, checkUploads(false));
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_every_shot_uploads_its_audio);
+  RUN_TEST(test_slow_link_ends_at_the_same_point);
+  return UNITY_END();
+}
@@ -0,0 +1,258 @@
+/*
+  RealFft against a double-precision DFT
+
+  Blocks at the scale the INMP441 delivers them (24-bit samples in 32-bit
+  I2S words) go through RealFft and through a DFT of the same windowed
+  block, summed directly in double. What the detector reads must agree:
+  the power of every bin, the peak bin and the share of power in the
+  gunshot band. bandPower(), the cascade's gate, must give the sums of
+  the same bins by Goertzel and the whole spectrum by Parseval's theorem
+  well inside the margin the sketch allows it.
+
+    pio test -e native -f test_real_fft
+*/
+
+#include <RealFft.h>
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+
+// As in gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define FFT_SAMPLES 512
+#define SAMPLE_SCALE (1.0f / 100000.0f)
+#define FREQUENCY_LOWER_BOUND 250
+#define FREQUENCY_UPPER_BOUND 5000
+#define CASCADE_GATE_BINS 3
+#define BAND_GATE_MARGIN 0.01
+
+#define MAX_BIN_ERROR 1e-4      // Worst bin error as a share of the block's peak power
+#define MAX_RATIO_ERROR 1e-4    // Band power share, absolute
+#define FULL_SCALE 2147483647.0
+
+struct TestSignal {
+  const char* name;
+  void (*fill)(int32_t* samples, uint16_t size, unsigned seed);
+};
+
+static double noise(unsigned& state) {
+  state = state * 1103515245u + 12345u;
+  return ((state >> 8) & 0xFFFF) / 32768.0 - 1.0;
+}
+
+static int32_t clampSample(double value) {
+  value = value > FULL_SCALE ? FULL_SCALE : value < -FULL_SCALE ? -FULL_SCALE : value;
+  return (int32_t)value;
+}
+
+static void fillTone(int32_t* samples, uint16_t size, double hz, double amplitude, double offset) {
+  for (int i = 0; i < size; i++) {
+    samples[i] = clampSample(offset + amplitude * sin(6.283185307179586 * hz * i / I2S_SAMPLE_RATE));
+  }
+}
+
+static void binTone(int32_t* samples, uint16_t size, unsigned) {
+  fillTone(samples, size, 1000.0, 1e7, 0);
+}
+
+static void loudTone(int32_t* samples, uint16_t size, unsigned) {
+  fillTone(samples, size, 3312.5, 1.5e9, 0);
+}
+
+static void biasedTone(int32_t* samples, uint16_t size, unsigned) {
+  fillTone(samples, size, 180.0, 4e6, 2e7);
+}
+
+static void quietNoise(int32_t* samples, uint16_t size, unsigned seed) {
+  for (int i = 0; i < size; i++) {
+    samples[i] = clampSample(2e4 * noise(seed));
+  }
+}
+
+static void tonesInNoise(int32_t* samples, uint16_t size, unsigned seed) {
+  for (int i = 0; i < size; i++) {
+    double t = (double)i / I2S_SAMPLE_RATE;
+    samples[i] = clampSample(3e6 * sin(6.283185307179586 * 440 * t) + 1e6 * sin(6.283185307179586 * 6100 * t) +
+                             5e5 * noise(seed));
+  }
+}
+
+// A muzzle blast: a near full-scale broadband onset decaying over a few
+// milliseconds into background noise
+static void impulse(int32_t* samples, uint16_t size, unsigned seed) {
+  for (int i = 0; i < size; i++) {
+    double envelope = i < size / 5 ? 0 : exp(-(i - size / 5) / 40.0);
+    samples[i] = clampSample(1.9e9 * envelope * noise(seed) + 1e5 * noise(seed));
+  }
+}
+
+static const TestSignal signals[] = {
+  {"1 kHz on a bin", binTone},
+  {"3.3 kHz near full scale", loudTone},
+  {"180 Hz with DC bias", biasedTone},
+  {"two tones in noise", tonesInNoise},
+  {"quiet noise", quietNoise},
+  {"impulse", impulse},
+};
+
+static int32_t samples[REAL_FFT_MAX_SIZE];
+static double reference[REAL_FFT_MAX_SIZE / 2 + 1];
+static float power[REAL_FFT_MAX_SIZE / 2 + 1];
+
+// The DFT of the windowed block, summed directly in double
+static void referencePower(const int32_t* in, uint16_t size, double* out) {
+  static double windowed[REAL_FFT_MAX_SIZE];
+  for (int i = 0; i < size; i++) {
+    windowed[i] = in[i] * (double)SAMPLE_SCALE * (0.54 - 0.46 * cos(6.283185307179586 * i / (size - 1)));
+  }
+  for (int k = 0; k <= size / 2; k++) {
+    double re = 0, im = 0;
+    for (int n = 0; n < size; n++) {
+      double angle = 6.283185307179586 * (double)((long)k * n % size) / size;
+      re += windowed[n] * cos(angle);
+      im -= windowed[n] * sin(angle);
+    }
+    out[k] = re * re + im * im;
+  }
+}
+
+// Worst bin error of the last transform as a share of the peak power
+static double binError(uint16_t size) {
+  double peak = 0, worst = 0;
+  for (int k = 0; k <= size / 2; k++) {
+    peak = fmax(peak, reference[k]);
+    worst = fmax(worst, fabs(power[k] - reference[k]));
+  }
+  return peak > 0 ? worst / peak : 0;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_bins_match_reference_dft() {
+  RealFft fft;
+  TEST_ASSERT_TRUE(fft.begin(FFT_SAMPLES, SAMPLE_SCALE));
+  double binWidth = (double)I2S_SAMPLE_RATE / FFT_SAMPLES;
+  int lowBin = (int)(FREQUENCY_LOWER_BOUND / binWidth);
+  int highBin = (int)(FREQUENCY_UPPER_BOUND / binWidth);
+  for (unsigned s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+    signals[s].fill(samples, FFT_SAMPLES, 1 + s);
+    referencePower(samples, FFT_SAMPLES, reference);
+    fft.transform(samples);
+    fft.powerSpectrum(0, FFT_SAMPLES / 2, power);
+
+    double error = binError(FFT_SAMPLES);
+    int referencePeak = 1, peakBin = 1;
+    double referenceBand = 0, referenceTotal = 0, band = 0, total = 0;
+    for (int k = 1; k <= FFT_SAMPLES / 2; k++) {
+      referencePeak = reference[k] > reference[referencePeak] ? k : referencePeak;
+      peakBin = power[k] > power[peakBin] ? k : peakBin;
+      referenceTotal += reference[k];
+      total += power[k];
+      if (k >= lowBin && k <= highBin) {
+        referenceBand += reference[k];
+        band += power[k];
+      }
+    }
+    double ratioError = fabs(band / total - referenceBand / referenceTotal);
+
+    char message[128];
+    snprintf(message, sizeof(message), "%s: worst bin %.1f dB of the peak, peak bin %d/%d, band share off %.2e",
+             signals[s].name, error > 0 ? 10 * log10(error) : -999.0, peakBin, referencePeak, ratioError);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_TRUE_MESSAGE(error <= MAX_BIN_ERROR, message);
+    TEST_ASSERT_TRUE_MESSAGE(ratioError <= MAX_RATIO_ERROR, message);
+    // A different peak bin only matters if the two were not tied
+    TEST_ASSERT_TRUE_MESSAGE(peakBin == referencePeak ||
+                                 fabs(reference[peakBin] - reference[referencePeak]) <= error * reference[referencePeak],
+                             message);
+  }
+}
+
+static void test_partial_spectrum_matches_full() {
+  RealFft fft;
+  TEST_ASSERT_TRUE(fft.begin(FFT_SAMPLES, SAMPLE_SCALE));
+  tonesInNoise(samples, FFT_SAMPLES, 7);
+  fft.transform(samples);
+  fft.powerSpectrum(0, FFT_SAMPLES / 2, power);
+  float part[40];
+  fft.powerSpectrum(8, 47, part);
+  for (int k = 8; k <= 47; k++) {
+    TEST_ASSERT_TRUE(part[k - 8] == power[k]);
+  }
+  // A last bin past Nyquist stops at it
+  fft.powerSpectrum(FFT_SAMPLES / 2 - 1, FFT_SAMPLES, part);
+  TEST_ASSERT_TRUE(part[0] == power[FFT_SAMPLES / 2 - 1]);
+  TEST_ASSERT_TRUE(part[1] == power[FFT_SAMPLES / 2]);
+}
+
+static void test_every_size_matches_reference_dft() {
+  for (uint16_t size = 8; size <= REAL_FFT_MAX_SIZE; size <<= 1) {
+    RealFft fft;
+    TEST_ASSERT_TRUE(fft.begin(size, SAMPLE_SCALE));
+    TEST_ASSERT_EQUAL_UINT16(size, fft.size());
+    for (unsigned s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+      signals[s].fill(samples, size, 1 + s);
+      referencePower(samples, size, reference);
+      fft.transform(samples);
+      fft.powerSpectrum(0, size / 2, power);
+      char message[64];
+      snprintf(message, sizeof(message), "%u samples, %s", (unsigned)size, signals[s].name);
+      TEST_ASSERT_TRUE_MESSAGE(binError(size) <= MAX_BIN_ERROR, message);
+    }
+  }
+}
+
+static void test_unsupported_sizes_are_refused() {
+  RealFft fft;
+  const uint16_t sizes[] = {0, 1, 2, 4, 12, 100, 511, 513, 2 * REAL_FFT_MAX_SIZE};
+  for (uint16_t size : sizes) {
+    TEST_ASSERT_FALSE(fft.begin(size, SAMPLE_SCALE));
+  }
+}
+
+static void test_band_power_matches_spectrum() {
+  // Goertzel for a few bins and Parseval for the total, off the samples,
+  // against the reference DFT summed over the same bins
+  RealFft fft;
+  TEST_ASSERT_TRUE(fft.begin(FFT_SAMPLES, SAMPLE_SCALE));
+  const uint16_t bands[][2] = {{1, CASCADE_GATE_BINS}, {1, 1}, {5, 12}, {0, 2}, {FFT_SAMPLES / 2 - 3, FFT_SAMPLES / 2}};
+  for (unsigned s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+    signals[s].fill(samples, FFT_SAMPLES, 1 + s);
+    referencePower(samples, FFT_SAMPLES, reference);
+    double referenceTotal = 0;
+    for (int k = 1; k <= FFT_SAMPLES / 2; k++) {
+      referenceTotal += reference[k];
+    }
+    for (const uint16_t* band : bands) {
+      // Bin 0 and Nyquist are left out of the band
+      uint16_t first = band[0] ? band[0] : 1;
+      uint16_t last = band[1] < FFT_SAMPLES / 2 ? band[1] : FFT_SAMPLES / 2 - 1;
+      double referenceBand = 0;
+      for (int k = first; k <= last; k++) {
+        referenceBand += reference[k];
+      }
+      float total;
+      float gateBand = fft.bandPower(samples, band[0], band[1], total);
+      double error = fmax(fabs(gateBand - referenceBand), fabs(total - referenceTotal)) / referenceTotal;
+      char message[128];
+      snprintf(message, sizeof(message), "%s, bins %u-%u: off by %.2e of the total", signals[s].name,
+               (unsigned)band[0], (unsigned)band[1], error);
+      TEST_ASSERT_TRUE_MESSAGE(error <= BAND_GATE_MARGIN / 10, message);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_bins_match_reference_dft);
+  RUN_TEST(test_partial_spectrum_matches_full);
+  RUN_TEST(test_every_size_matches_reference_dft);
+  RUN_TEST(test_unsupported_sizes_are_refused);
+  RUN_TEST(test_band_power_matches_spectrum);
+  return UNITY_END();
+}
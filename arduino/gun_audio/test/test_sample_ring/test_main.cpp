@@ -0,0 +1,217 @@
+/*
+  SampleRing order and drop accounting
+
+  Samples carry their own sequence number, so a reader can check that
+  what comes off the ring is exactly the stream, in order, and that
+  every sample missing from it was counted as dropped. A producer writes
+  I2S_READ_SAMPLES blocks at the 16 kHz I2S rate on a virtual clock and
+  a consumer takes 50%-overlapped windows, stalling every so often as an
+  alert upload used to stall the sketch. A stall the ring can hold must
+  drop nothing; a longer one must drop whole blocks and count every one.
+  bench/ring_bench runs the same under real threads.
+
+    pio test -e native -f test_sample_ring
+*/
+
+#include <SampleRing.h>
+#include <unity.h>
+
+#include <stdio.h>
+
+// As in gun_audio.ino
+#define I2S_SAMPLE_RATE 16000
+#define I2S_READ_SAMPLES 256
+#define FFT_SAMPLES 512
+#define ANALYSIS_HOP (FFT_SAMPLES / 2)
+#define AUDIO_RING_SAMPLES 8192
+
+#define RUN_MS 4000
+#define STALL_EVERY_MS 500
+
+struct StreamCheck {
+  int32_t last;
+  uint32_t missing;         // Samples skipped in the sequence
+  bool disordered;          // A sample arrived twice or out of order
+};
+
+static int32_t storage[AUDIO_RING_SAMPLES];
+
+// Check samples taken off the ring continue the stream
+static void follow(StreamCheck& check, const int32_t* samples, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (samples[i] <= check.last) {
+      check.disordered = true;
+    } else {
+      check.missing += samples[i] - check.last - 1;
+    }
+    check.last = samples[i];
+  }
+}
+
+static void fillBlock(int32_t* block, uint32_t first, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    block[i] = (int32_t)(first + i);
+  }
+}
+
+// Take every window waiting, a hop at a time
+static void takeWindows(SampleRing& ring, StreamCheck& check) {
+  static int32_t window[FFT_SAMPLES];
+  while (ring.peek(window, FFT_SAMPLES)) {
+    for (int i = ANALYSIS_HOP + 1; i < FFT_SAMPLES; i++) {
+      check.disordered = check.disordered || window[i] <= window[i - 1];
+    }
+    follow(check, window, ANALYSIS_HOP);
+    ring.consume(ANALYSIS_HOP);
+  }
+}
+
+// One millisecond at a time: a block is written whenever one is due,
+// and the consumer takes every window waiting unless it is stalled
+static void runStalls(SampleRing& ring, StreamCheck& check, uint32_t stallMs) {
+  TEST_ASSERT_TRUE(ring.begin(storage, AUDIO_RING_SAMPLES));
+  check = {-1, 0, false};
+  int32_t block[I2S_READ_SAMPLES];
+  uint32_t written = 0;
+  uint32_t stalledUntil = 0;
+  uint32_t lastStall = 0;
+  for (uint32_t now = 0; now < RUN_MS; now++) {
+    while ((uint64_t)(written + I2S_READ_SAMPLES) * 1000 <= (uint64_t)now * I2S_SAMPLE_RATE) {
+      fillBlock(block, written, I2S_READ_SAMPLES);
+      ring.write(block, I2S_READ_SAMPLES);
+      written += I2S_READ_SAMPLES;
+    }
+    if (now < stalledUntil) {
+      continue;
+    }
+    takeWindows(ring, check);
+    if (stallMs && now - lastStall >= STALL_EVERY_MS) {
+      stalledUntil = now + stallMs;
+      lastStall = stalledUntil;
+    }
+  }
+  takeWindows(ring, check);
+  // What is left over is less than a window, follow it to the end
+  static int32_t window[FFT_SAMPLES];
+  uint32_t left = ring.available();
+  TEST_ASSERT_TRUE(ring.peek(window, left));
+  follow(check, window, left);
+  check.missing += written - 1 - check.last;
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+static void test_begin_needs_power_of_two() {
+  SampleRing ring;
+  TEST_ASSERT_FALSE(ring.begin(NULL, 256));
+  TEST_ASSERT_FALSE(ring.begin(storage, 0));
+  TEST_ASSERT_FALSE(ring.begin(storage, 100));
+  TEST_ASSERT_FALSE(ring.begin(storage, 257));
+  TEST_ASSERT_TRUE(ring.begin(storage, 256));
+  TEST_ASSERT_EQUAL_UINT32(256, ring.capacity());
+  TEST_ASSERT_EQUAL_UINT32(0, ring.available());
+}
+
+static void test_samples_wrap_in_order() {
+  // Odd block and window sizes, so both copies split across the end
+  SampleRing ring;
+  TEST_ASSERT_TRUE(ring.begin(storage, 256));
+  int32_t block[100];
+  int32_t window[150];
+  uint32_t written = 0;
+  StreamCheck check = {-1, 0, false};
+  for (int round = 0; round < 50; round++) {
+    fillBlock(block, written, 100);
+    TEST_ASSERT_TRUE(ring.write(block, 100));
+    written += 100;
+    while (ring.peek(window, 150)) {
+      for (int i = 1; i < 150; i++) {
+        TEST_ASSERT_EQUAL_INT(window[i - 1] + 1, window[i]);
+      }
+      follow(check, window, 70);
+      ring.consume(70);
+    }
+  }
+  TEST_ASSERT_FALSE(check.disordered);
+  TEST_ASSERT_EQUAL_UINT32(0, check.missing);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.overruns());
+  TEST_ASSERT_LESS_OR_EQUAL(256, ring.highWater());
+  TEST_ASSERT_GREATER_OR_EQUAL(150, ring.highWater());
+
+  // Consuming more than is waiting takes what there is
+  ring.consume(1000);
+  TEST_ASSERT_EQUAL_UINT32(0, ring.available());
+  TEST_ASSERT_FALSE(ring.peek(window, 1));
+}
+
+static void test_full_ring_drops_whole_blocks() {
+  SampleRing ring;
+  TEST_ASSERT_TRUE(ring.begin(storage, 1024));
+  int32_t block[I2S_READ_SAMPLES];
+  for (uint32_t b = 0; b < 4; b++) {
+    fillBlock(block, b * I2S_READ_SAMPLES, I2S_READ_SAMPLES);
+    TEST_ASSERT_TRUE(ring.write(block, I2S_READ_SAMPLES));
+  }
+  TEST_ASSERT_EQUAL_UINT32(1024, ring.highWater());
+
+  // No room at all, then room for all but one sample: both dropped whole
+  fillBlock(block, 5000, I2S_READ_SAMPLES);
+  TEST_ASSERT_FALSE(ring.write(block, I2S_READ_SAMPLES));
+  ring.consume(I2S_READ_SAMPLES - 1);
+  TEST_ASSERT_FALSE(ring.write(block, I2S_READ_SAMPLES));
+  TEST_ASSERT_EQUAL_UINT32(2, ring.overruns());
+  TEST_ASSERT_EQUAL_UINT32(2 * I2S_READ_SAMPLES, ring.droppedSamples());
+  TEST_ASSERT_EQUAL_UINT32(769, ring.available());
+
+  // What was waiting is untouched, and a block that fits goes in after it
+  int32_t first;
+  TEST_ASSERT_TRUE(ring.peek(&first, 1));
+  TEST_ASSERT_EQUAL_INT(255, first);
+  ring.consume(1);
+  TEST_ASSERT_TRUE(ring.write(block, I2S_READ_SAMPLES));
+  static int32_t all[1024];
+  TEST_ASSERT_TRUE(ring.peek(all, 1024));
+  TEST_ASSERT_EQUAL_INT(256, all[0]);
+  TEST_ASSERT_EQUAL_INT(1023, all[767]);
+  TEST_ASSERT_EQUAL_INT(5000, all[768]);
+  TEST_ASSERT_EQUAL_INT(5255, all[1023]);
+  TEST_ASSERT_EQUAL_UINT32(2, ring.overruns());
+}
+
+static void test_stalls_drop_and_count_every_sample() {
+  const uint32_t ringMs = 1000ull * AUDIO_RING_SAMPLES / I2S_SAMPLE_RATE;
+  const uint32_t windowMs = 1000ull * FFT_SAMPLES / I2S_SAMPLE_RATE;
+  const uint32_t stalls[] = {0, 100, 300, 450, 470, 500, 700, 1200};
+  for (uint32_t stallMs : stalls) {
+    SampleRing ring;
+    StreamCheck check;
+    runStalls(ring, check, stallMs);
+    char message[128];
+    snprintf(message, sizeof(message), "stall %u ms: high water %u, %u overruns, %u dropped, %u seen missing",
+             (unsigned)stallMs, (unsigned)ring.highWater(), (unsigned)ring.overruns(),
+             (unsigned)ring.droppedSamples(), (unsigned)check.missing);
+    TEST_MESSAGE(message);
+    TEST_ASSERT_FALSE_MESSAGE(check.disordered, message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(ring.droppedSamples(), check.missing, message);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(ring.overruns() * I2S_READ_SAMPLES, ring.droppedSamples(), message);
+    TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(AUDIO_RING_SAMPLES, ring.highWater(), message);
+    if (stallMs + windowMs < ringMs) {
+      TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, ring.droppedSamples(), message);
+    } else if (stallMs > ringMs) {
+      TEST_ASSERT_GREATER_THAN_MESSAGE(0, ring.droppedSamples(), message);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_begin_needs_power_of_two);
+  RUN_TEST(test_samples_wrap_in_order);
+  RUN_TEST(test_full_ring_drops_whole_blocks);
+  RUN_TEST(test_stalls_drop_and_count_every_sample);
+  return UNITY_END();
+}
@@ -0,0 +1,229 @@
+/*
+  ShotModel::parse against malformed model text
+
+  A model arrives on the sensor's model topic and may be cut short,
+  mistyped or meant for another build. Each payload here must either
+  parse to a whole model or be refused, and a refused one must leave
+  the model that was running in place: empty and truncated payloads,
+  wrong value counts, missing, repeated and unknown lines, values out of
+  their fixed-point range and tokens after the values.
+
+    pio test -e native -f test_shot_model
+*/
+
+#include <ShotClassifier.h>
+#include <unity.h>
+
+#include "../../shot_model.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+static ShotModel model;
+static float probe[SHOT_FEATURE_COUNT];
+
+static bool parseText(const std::string& text) {
+  return model.parse(text.data(), text.size());
+}
+
+static std::vector<std::string> defaultLines() {
+  std::vector<std::string> lines;
+  const char* start = DEFAULT_SHOT_MODEL;
+  while (*start) {
+    const char* end = strchr(start, '\n');
+    lines.push_back(std::string(start, end - start));
+    start = end + 1;
+  }
+  return lines;
+}
+
+static std::string joinLines(const std::vector<std::string>& lines) {
+  std::string text;
+  for (const std::string& line : lines) {
+    text += line + "\n";
+  }
+  return text;
+}
+
+// The default model with the line for name replaced by line
+static std::string withLine(const char* name, const std::string& line) {
+  std::vector<std::string> lines = defaultLines();
+  for (std::string& existing : lines) {
+    if (existing.compare(0, strlen(name) + 1, std::string(name) + " ") == 0) {
+      existing = line;
+    }
+  }
+  return joinLines(lines);
+}
+
+// The running model must be the default one, whatever was refused
+static void checkDefaultKept(const char* message) {
+  ShotModel reference;
+  TEST_ASSERT_TRUE(reference.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL)));
+  TEST_ASSERT_EQUAL_INT32_MESSAGE(reference.thresholdQ8(), model.thresholdQ8(), message);
+  TEST_ASSERT_EQUAL_INT32_MESSAGE(reference.score(probe), model.score(probe), message);
+}
+
+static void checkRefused(const std::string& text) {
+  TEST_ASSERT_FALSE_MESSAGE(parseText(text), text.c_str());
+  checkDefaultKept(text.c_str());
+}
+
+void setUp() {
+  for (uint8_t i = 0; i < SHOT_FEATURE_COUNT; i++) {
+    probe[i] = 1.0f + i;
+  }
+  TEST_ASSERT_TRUE(model.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL)));
+}
+
+void tearDown() {}
+
+static void test_default_model_parses() {
+  ShotModel parsed;
+  TEST_ASSERT_TRUE(parsed.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL)));
+  TEST_ASSERT_EQUAL_INT32(256, parsed.thresholdQ8());
+
+  // Comments, blank lines and CRLF line ends are allowed
+  std::string annotated = "# Trained on recordings\n\n";
+  for (const std::string& line : defaultLines()) {
+    annotated += "  " + line + "   # note\r\n";
+  }
+  TEST_ASSERT_TRUE(parseText(annotated));
+  checkDefaultKept("annotated");
+}
+
+static void test_empty_payload_is_refused() {
+  TEST_ASSERT_FALSE(model.parse(NULL, 0));
+  checkRefused("");
+  checkRefused("\n\n");
+  checkRefused("   \r\n\t\n");
+  checkRefused("# a comment and nothing else\n");
+}
+
+static void test_truncated_model_is_refused() {
+  // Cut at every byte. Only a cut inside the final value can still read
+  // as a whole model, with that value shortened.
+  std::string text = DEFAULT_SHOT_MODEL;
+  size_t lastValue = text.find_last_of(' ') + 1;
+  uint32_t accepted = 0;
+  for (size_t cut = 0; cut < text.size(); cut++) {
+    char message[64];
+    snprintf(message, sizeof(message), "cut after %u of %u bytes", (unsigned)cut, (unsigned)text.size());
+    bool parsed = model.parse(text.data(), cut);
+    if (cut <= lastValue) {
+      TEST_ASSERT_FALSE_MESSAGE(parsed, message);
+      checkDefaultKept(message);
+    } else if (parsed) {
+      accepted++;
+    }
+    TEST_ASSERT_TRUE(model.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL)));
+  }
+  TEST_ASSERT_LESS_OR_EQUAL(text.size() - 1 - lastValue, accepted);
+}
+
+static void test_wrong_value_count_is_refused() {
+  checkRefused(withLine("threshold", "threshold"));
+  checkRefused(withLine("threshold", "threshold 1.00 2.00"));
+  checkRefused(withLine("bias", "bias"));
+  checkRefused(withLine("bias", "bias -1.0 0.5"));
+  checkRefused(withLine("level", "level"));
+  checkRefused(withLine("level", "level 56.4278"));
+  checkRefused(withLine("level", "level 56.4278 0.105311"));
+  checkRefused(withLine("level", "level 56.4278 0.105311 0.5391 0.5"));
+}
+
+static void test_missing_repeated_and_unknown_lines_are_refused() {
+  std::vector<std::string> lines = defaultLines();
+  for (size_t i = 0; i < lines.size(); i++) {
+    std::vector<std::string> missing = lines;
+    missing.erase(missing.begin() + i);
+    checkRefused(joinLines(missing));
+
+    std::vector<std::string> repeated = lines;
+    repeated.push_back(lines[i]);
+    checkRefused(joinLines(repeated));
+  }
+  checkRefused(joinLines(lines) + "loudness 1 2 3\n");
+  checkRefused(withLine("level", "Level 56.4278 0.105311 0.5391"));
+}
+
+static void test_out_of_range_values_are_refused() {
+  // A Q8 weight holds up to 127.996
+  TEST_ASSERT_TRUE(parseText(withLine("decay", "decay 93.002 0.00965225 127.9")));
+  TEST_ASSERT_TRUE(parseText(withLine("decay", "decay 93.002 0.00965225 -127.9")));
+  TEST_ASSERT_TRUE(parseText(DEFAULT_SHOT_MODEL));
+  checkRefused(withLine("decay", "decay 93.002 0.00965225 128"));
+  checkRefused(withLine("decay", "decay 93.002 0.00965225 -200"));
+  checkRefused(withLine("decay", "decay 93.002 0.00965225 1e40"));
+  checkRefused(withLine("bias", "bias 9000"));
+  checkRefused(withLine("bias", "bias -9000"));
+  checkRefused(withLine("threshold", "threshold 5e6"));
+  checkRefused(withLine("threshold", "threshold -5e6"));
+
+  // Not finite anywhere
+  checkRefused(withLine("threshold", "threshold nan"));
+  checkRefused(withLine("bias", "bias inf"));
+  checkRefused(withLine("level", "level nan 0.105311 0.5391"));
+  checkRefused(withLine("level", "level 56.4278 -inf 0.5391"));
+  checkRefused(withLine("level", "level 56.4278 0.105311 infinity"));
+}
+
+static void test_extra_tokens_are_refused() {
+  checkRefused(withLine("threshold", "threshold 1.00 junk"));
+  checkRefused(withLine("threshold", "threshold 1.00junk"));
+  checkRefused(withLine("bias", "bias -1.0964,"));
+  checkRefused(withLine("level", "level 56.4278 0.105311 0.5391 x"));
+  checkRefused(withLine("level", "level 56.4278 0.105311 0.5391x"));
+  checkRefused(withLine("level", "level 56.4278 zero 0.5391"));
+  checkRefused(withLine("level", "level 56.4278 0.105311 0.5391 " + std::string(120, ' ') + "0"));
+}
+
+static void test_oversize_text_is_refused() {
+  std::string text = DEFAULT_SHOT_MODEL;
+  text += "# " + std::string(SHOT_MODEL_MAX_TEXT - text.size(), '-') + "\n";
+  TEST_ASSERT_GREATER_THAN(SHOT_MODEL_MAX_TEXT, text.size());
+  checkRefused(text);
+
+  // A long comment line is fine
+  TEST_ASSERT_TRUE(parseText("# " + std::string(200, '-') + "\n" + DEFAULT_SHOT_MODEL));
+}
+
+static void test_failed_parse_keeps_model() {
+  // Another valid model replaces the default, a bad one after it changes nothing
+  std::string other = withLine("threshold", "threshold -2.5");
+  other = other.replace(other.find("bias"), strlen("bias -1.0964"), "bias 3.25");
+  TEST_ASSERT_TRUE(parseText(other));
+  int32_t score = model.score(probe);
+  TEST_ASSERT_EQUAL_INT32(-640, model.thresholdQ8());
+  ShotModel reference;
+  TEST_ASSERT_TRUE(reference.parse(DEFAULT_SHOT_MODEL, strlen(DEFAULT_SHOT_MODEL)));
+  TEST_ASSERT_NOT_EQUAL(reference.score(probe), score);
+
+  const std::string bad[] = {
+    "", "threshold 1.00\n", withLine("crest", "crest 10.6 0.2"), withLine("high", "high 0.2 3.5 500"),
+    withLine("mid", "mid 0.35 4.27 1.63 extra"), other.substr(0, other.size() / 2),
+  };
+  for (const std::string& text : bad) {
+    TEST_ASSERT_FALSE_MESSAGE(parseText(text), text.c_str());
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(-640, model.thresholdQ8(), text.c_str());
+    TEST_ASSERT_EQUAL_INT32_MESSAGE(score, model.score(probe), text.c_str());
+  }
+}
+
+int main(int argc, char** argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_default_model_parses);
+  RUN_TEST(test_empty_payload_is_refused);
+  RUN_TEST(test_truncated_model_is_refused);
+  RUN_TEST(test_wrong_value_count_is_refused);
+  RUN_TEST(test_missing_repeated_and_unknown_lines_are_refused);
+  RUN_TEST(test_out_of_range_values_are_refused);
+  RUN_TEST(test_extra_tokens_are_refused);
+  RUN_TEST(test_oversize_text_is_refused);
+  RUN_TEST(test_failed_parse_keeps_model);
+  return UNITY_END();
+}
@@ -0,0 +1,157 @@
+#include "AudioCodec.h"
+
+#include <math.h>
+#include <string.h>
+
+#define KAISER_BETA 5.65                // About 60 dB of stopband
+
+static const int16_t stepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+  107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+  876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+  5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+  27086, 29794, 32767};
+
+static const int8_t indexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+// Zeroth-order modified Bessel function, for the Kaiser window
+static double besselI0(double x) {
+  double sum = 1, term = 1;
+  for (int k = 1; k < 30; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+HalfBandDecimator::HalfBandDecimator(uint8_t inputShift) : shift(inputShift) {
+  // Tap at odd offset o from the centre: sin(pi o / 2) / (pi o), windowed
+  const double pi = 3.141592653589793;
+  const int centre = HALF_BAND_TAPS / 2;
+  for (int j = 0; j < HALF_BAND_PAIRS; j++) {
+    int offset = 2 * j + 1;
+    double ideal = sin(pi * offset / 2) / (pi * offset);
+    double r = (double)offset / centre;
+    double window = besselI0(KAISER_BETA * sqrt(1 - r * r)) / besselI0(KAISER_BETA);
+    taps[j] = (int32_t)lround(ideal * window * 32768);
+  }
+  reset();
+}
+
+void HalfBandDecimator::reset() {
+  memset(history, 0, sizeof(history));
+  position = 0;
+}
+
+size_t HalfBandDecimator::process(const int32_t* in, size_t count, int16_t* out) {
+  const uint32_t mask = HALF_BAND_HISTORY - 1;
+  const uint32_t centre = HALF_BAND_TAPS / 2;
+  size_t produced = 0;
+  for (size_t i = 0; i < count; i++) {
+    int32_t sample = in[i] >> shift;
+    history[position & mask] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+    position++;
+    // An output for every even input sample, the newest, history[position - 1].
+    // The centre tap sits centre samples before it.
+    if ((position & 1) == 0) {
+      continue;
+    }
+    uint32_t middle = position - 1 - centre;
+    int32_t acc = history[middle & mask] * (1 << 14);
+    for (int j = 0; j < HALF_BAND_PAIRS; j++) {
+      uint32_t offset = 2 * j + 1;
+      acc += taps[j] * ((int32_t)history[(middle - offset) & mask] + history[(middle + offset) & mask]);
+    }
+    acc = (acc + (1 << 14)) >> 15;
+    out[produced++] = acc > 32767 ? 32767 : acc < -32768 ? -32768 : acc;
+  }
+  return produced;
+}
+
+ImaAdpcmEncoder::ImaAdpcmEncoder() {
+  reset();
+}
+
+void ImaAdpcmEncoder::reset() {
+  predictor = 0;
+  stepIndex = 0;
+  count = 0;
+}
+
+bool ImaAdpcmEncoder::add(int16_t sample) {
+  if (count == 0) {
+    // The header restarts the prediction from the sample itself
+    predictor = sample;
+    out[0] = sample & 0xFF;
+    out[1] = (sample >> 8) & 0xFF;
+    out[2] = stepIndex;
+    out[3] = 0;
+    count = 1;
+    return false;
+  }
+
+  int32_t step = stepTable[stepIndex];
+  int32_t difference = sample - predictor;
+  uint8_t code = 0;
+  if (difference < 0) {
+    code = 8;
+    difference = -difference;
+  }
+  // Quantise as the decoder will reconstruct: step/8 plus the bits set
+  int32_t delta = step >> 3;
+  if (difference >= step) {
+    code |= 4;
+    difference -= step;
+    delta += step;
+  }
+  if (difference >= step >> 1) {
+    code |= 2;
+    difference -= step >> 1;
+    delta += step >> 1;
+  }
+  if (difference >= step >> 2) {
+    code |= 1;
+    delta += step >> 2;
+  }
+  predictor += code & 8 ? -delta : delta;
+  predictor = predictor > 32767 ? 32767 : predictor < -32768 ? -32768 : predictor;
+  stepIndex += indexTable[code];
+  stepIndex = stepIndex < 0 ? 0 : stepIndex > 88 ? 88 : stepIndex;
+
+  uint8_t* byte = out + 4 + (count - 1) / 2;
+  if (count & 1) {
+    *byte = code;
+  } else {
+    *byte |= code << 4;
+  }
+  if (++count == ADPCM_BLOCK_SAMPLES) {
+    count = 0;
+    return true;
+  }
+  return false;
+}
+
+void imaAdpcmDecodeBlock(const uint8_t* block, int16_t* out) {
+  int32_t predictor = (int16_t)(block[0] | (block[1] << 8));
+  int8_t stepIndex = block[2] > 88 ? 88 : block[2];
+  out[0] = predictor;
+  for (int i = 1; i < ADPCM_BLOCK_SAMPLES; i++) {
+    uint8_t code = (block[4 + (i - 1) / 2] >> ((i - 1) & 1 ? 4 : 0)) & 0x0F;
+    int32_t step = stepTable[stepIndex];
+    int32_t delta = step >> 3;
+    if (code & 4) {
+      delta += step;
+    }
+    if (code & 2) {
+      delta += step >> 1;
+    }
+    if (code & 1) {
+      delta += step >> 2;
+    }
+    predictor += code & 8 ? -delta : delta;
+    predictor = predictor > 32767 ? 32767 : predictor < -32768 ? -32768 : predictor;
+    stepIndex += indexTable[code];
+    stepIndex = stepIndex < 0 ? 0 : stepIndex > 88 ? 88 : stepIndex;
+    out[i] = predictor;
+  }
+}
@@ -0,0 +1,73 @@
+/*
+  AudioCodec - 16 kHz I2S words to 8 kHz IMA-ADPCM, and back to PCM
+
+  HalfBandDecimator low-passes and halves the sample rate in one step. A
+  half-band FIR has every other tap zero apart from the centre, so with
+  the symmetric pairs added first, each output costs HALF_BAND_PAIRS
+  multiplies. The taps are a Kaiser-windowed sinc in Q15, built by the
+  constructor: flat to about 3.3 kHz, and at least 60 dB down from
+  4.7 kHz, where keeping every second sample used to fold the top
+  octave back into the band.
+
+  ImaAdpcmEncoder packs the 8 kHz PCM into IMA-ADPCM blocks laid out as
+  in a WAV file (format 0x11): the first sample and the step index in a
+  4-byte header, then two 4-bit codes per byte, low nibble first. Every
+  block decodes on its own, so a lost packet costs only its own audio.
+  Has no Arduino dependencies.
+*/
+
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HALF_BAND_TAPS 47               // 4 * HALF_BAND_PAIRS - 1
+#define HALF_BAND_PAIRS 12              // Non-zero taps either side of the centre
+#define HALF_BAND_HISTORY 64            // Power of two >= HALF_BAND_TAPS
+#define ADPCM_BLOCK_BYTES 132           // 4-byte header and 128 bytes of codes
+#define ADPCM_BLOCK_SAMPLES 257         // The header holds the first sample
+
+class HalfBandDecimator {
+public:
+  // inputShift brings I2S words down to 16-bit PCM, with saturation
+  explicit HalfBandDecimator(uint8_t inputShift);
+
+  void reset();
+
+  // Filter count input samples into out, returning the number of output
+  // samples: half the input, carrying an odd one over to the next call
+  size_t process(const int32_t* in, size_t count, int16_t* out);
+
+  // Output samples lag the input by this many input samples
+  static uint8_t delay() { return HALF_BAND_TAPS / 2; }
+
+private:
+  uint8_t shift;
+  int32_t taps[HALF_BAND_PAIRS];        // Q15, nearest the centre first
+  int16_t history[HALF_BAND_HISTORY];
+  uint32_t position;                    // Input samples seen
+};
+
+class ImaAdpcmEncoder {
+public:
+  ImaAdpcmEncoder();
+
+  void reset();
+
+  // Encode a sample. Returns true when it completed a block, which is
+  // then in block() until the next call.
+  bool add(int16_t sample);
+  const uint8_t* block() const { return out; }
+
+private:
+  int32_t predictor;
+  int8_t stepIndex;
+  uint16_t count;                       // Samples in the block so far
+  uint8_t out[ADPCM_BLOCK_BYTES];
+};
+
+// Decode one block into ADPCM_BLOCK_SAMPLES samples
+void imaAdpcmDecodeBlock(const uint8_t* block, int16_t* out);
+
+#endif
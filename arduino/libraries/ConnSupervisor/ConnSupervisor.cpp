@@ -0,0 +1,180 @@
+#include "ConnSupervisor.h"
+
+#include <WiFi.h>
+
+ConnSupervisor::ConnSupervisor(Client& netClient, PubSubClient& mqttClient)
+  : net(netClient), mqtt(mqttClient), connectedCallback(NULL),
+    ssid(NULL), wifiPassword(NULL), host(NULL), port(0),
+    clientIdPrefix(NULL), username(NULL), password(NULL),
+    state(CONN_WIFI_DOWN), stateSince(0), attemptSince(0), retryAt(0), consecutiveFailures(0) {
+  memset(&counters, 0, sizeof(counters));
+}
+
+void ConnSupervisor::begin(const char* wifiSsid, const char* wifiPass,
+                           const char* brokerHost, uint16_t brokerPort,
+                           const char* idPrefix, const char* user, const char* pass) {
+  ssid = wifiSsid;
+  wifiPassword = wifiPass;
+  host = brokerHost;
+  port = brokerPort;
+  clientIdPrefix = idPrefix;
+  username = user;
+  password = pass;
+  attemptSince = millis();
+  enter(CONN_WIFI_DOWN);
+}
+
+void ConnSupervisor::onConnected(void (*callback)()) {
+  connectedCallback = callback;
+}
+
+void ConnSupervisor::enter(ConnState next) {
+  state = next;
+  stateSince = millis();
+}
+
+void ConnSupervisor::fail(uint32_t& counter) {
+  counter++;
+  if (consecutiveFailures < 16) {
+    consecutiveFailures++;
+  }
+
+  // Exponential backoff with "equal jitter": half fixed, half random, so
+  // a fleet that lost the broker together does not retry in lockstep
+  uint32_t backoff = CONN_BACKOFF_MIN_MS << (consecutiveFailures - 1);
+  if (backoff > CONN_BACKOFF_MAX_MS || backoff < CONN_BACKOFF_MIN_MS) {
+    backoff = CONN_BACKOFF_MAX_MS;
+  }
+  retryAt = millis() + backoff / 2 + random(backoff / 2 + 1);
+  enter(CONN_BACKOFF);
+}
+
+bool ConnSupervisor::poll() {
+  unsigned long now = millis();
+
+  // Losing WiFi drops everything above it
+  if (state >= CONN_TLS && state != CONN_BACKOFF && WiFi.status() != WL_CONNECTED) {
+    Serial.println("WiFi connection lost");
+    if (state == CONN_READY) {
+      counters.drops++;
+      attemptSince = now;
+    }
+    net.stop();
+    enter(CONN_WIFI_DOWN);
+  }
+
+  switch (state) {
+    case CONN_WIFI_DOWN:
+      Serial.printf("Connecting to WiFi: %s\n", ssid);
+      WiFi.disconnect();
+      WiFi.begin(ssid, wifiPassword);
+      enter(CONN_WIFI_JOINING);
+      break;
+
+    case CONN_WIFI_JOINING:
+      if (WiFi.status() == WL_CONNECTED) {
+        Serial.print("WiFi connected, IP address: ");
+        Serial.println(WiFi.localIP());
+        enter(CONN_TLS);
+      } else if (now - stateSince > CONN_WIFI_JOIN_TIMEOUT_MS) {
+        Serial.println("WiFi join timed out");
+        fail(counters.wifiFailures);
+      }
+      break;
+
+    case CONN_TLS:
+      // PubSubClient reuses an already open socket, so the handshake is
+      // its own step and a failure here is told apart from an MQTT refusal
+      if (net.connect(host, port)) {
+        enter(CONN_MQTT);
+      } else {
+        Serial.println("TLS connection to broker failed");
+        fail(counters.tlsFailures);
+      }
+      break;
+
+    case CONN_MQTT: {
+      char clientId[32];
+      snprintf(clientId, sizeof(clientId), "%s%04lx", clientIdPrefix, (unsigned long)random(0xffff));
+      if (mqtt.connect(clientId, username, password)) {
+        enter(CONN_SUBSCRIBE);
+      } else {
+        int code = mqtt.state();
+        Serial.printf("MQTT connect failed, rc=%d\n", code);
+        int index = code + 4;
+        if (index < 0 || index >= CONN_MQTT_STATE_CODES) {
+          index = 0;
+        }
+        net.stop();
+        fail(counters.mqttFailures[index]);
+      }
+      break;
+    }
+
+    case CONN_SUBSCRIBE:
+      if (connectedCallback) {
+        connectedCallback();
+      }
+      counters.sessions++;
+      counters.lastConnectMs = now - attemptSince;
+      if (counters.lastConnectMs > counters.longestConnectMs) {
+        counters.longestConnectMs = counters.lastConnectMs;
+      }
+      consecutiveFailures = 0;
+      Serial.printf("MQTT connected in %lu ms\n", (unsigned long)counters.lastConnectMs);
+      enter(CONN_READY);
+      break;
+
+    case CONN_READY:
+      if (!mqtt.loop()) {
+        Serial.printf("MQTT connection lost, rc=%d\n", mqtt.state());
+        counters.drops++;
+        attemptSince = now;
+        net.stop();
+        enter(CONN_TLS);
+      }
+      break;
+
+    case CONN_BACKOFF:
+      if ((long)(now - retryAt) >= 0) {
+        enter(WiFi.status() == WL_CONNECTED ? CONN_TLS : CONN_WIFI_DOWN);
+      }
+      break;
+  }
+
+  return state == CONN_READY;
+}
+
+int ConnSupervisor::statsJson(char* buffer, size_t size) const {
+  int length = snprintf(buffer, size,
+                        "{\"state\":\"%s\",\"sessions\":%u,\"drops\":%u,\"connect_ms\":%u,\"max_connect_ms\":%u,"
+                        "\"wifi_fail\":%u,\"tls_fail\":%u,\"mqtt_fail\":{",
+                        connStateName(state), (unsigned)counters.sessions, (unsigned)counters.drops,
+                        (unsigned)counters.lastConnectMs, (unsigned)counters.longestConnectMs,
+                        (unsigned)counters.wifiFailures, (unsigned)counters.tlsFailures);
+  // Only the state codes that actually occurred, keyed by their value
+  bool first = true;
+  for (int i = 0; i < CONN_MQTT_STATE_CODES && length < (int)size; i++) {
+    if (counters.mqttFailures[i]) {
+      length += snprintf(buffer + length, size - length, "%s\"%d\":%u",
+                         first ? "" : ",", i - 4, (unsigned)counters.mqttFailures[i]);
+      first = false;
+    }
+  }
+  if (length < (int)size) {
+    length += snprintf(buffer + length, size - length, "}}");
+  }
+  return length < (int)size ? length : (int)size - 1;
+}
+
+const char* connStateName(ConnState state) {
+  switch (state) {
+    case CONN_WIFI_DOWN: return "wifi_down";
+    case CONN_WIFI_JOINING: return "wifi_joining";
+    case CONN_TLS: return "tls";
+    case CONN_MQTT: return "mqtt";
+    case CONN_SUBSCRIBE: return "subscribe";
+    case CONN_READY: return "ready";
+    default: return "backoff";
+  }
+}
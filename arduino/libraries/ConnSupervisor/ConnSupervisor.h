@@ -0,0 +1,94 @@
+/*
+  ConnSupervisor - non-blocking WiFi / TLS / MQTT connection state machine
+
+  Call poll() from loop(). Each call does at most one bounded step
+  (start a WiFi join, open the TLS socket, send the MQTT CONNECT, run
+  the subscribe hook) and returns, so sensing keeps running while the
+  link is down. Failed steps are retried with jittered exponential
+  backoff instead of delay() loops.
+
+  The TLS step blocks for as long as the handshake takes; bound it with
+  WiFiClientSecure::setHandshakeTimeout() and the MQTT step with
+  PubSubClient::setSocketTimeout().
+*/
+
+#ifndef CONN_SUPERVISOR_H
+#define CONN_SUPERVISOR_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <PubSubClient.h>
+
+#define CONN_BACKOFF_MIN_MS 1000       // First retry delay
+#define CONN_BACKOFF_MAX_MS 60000      // Retry delay cap
+#define CONN_WIFI_JOIN_TIMEOUT_MS 15000
+#define CONN_MQTT_STATE_CODES 10       // PubSubClient::state() runs from -4 to 5
+
+enum ConnState {
+  CONN_WIFI_DOWN,
+  CONN_WIFI_JOINING,
+  CONN_TLS,
+  CONN_MQTT,
+  CONN_SUBSCRIBE,
+  CONN_READY,
+  CONN_BACKOFF
+};
+
+struct ConnStats {
+  uint32_t sessions;             // Times the link reached CONN_READY
+  uint32_t drops;                // Ready sessions that were lost
+  uint32_t wifiFailures;         // Joins that timed out
+  uint32_t tlsFailures;          // Socket/handshake failures
+  uint32_t mqttFailures[CONN_MQTT_STATE_CODES];  // CONNECT failures by state() + 4
+  uint32_t lastConnectMs;        // First attempt to subscribed, for the last session
+  uint32_t longestConnectMs;
+};
+
+class ConnSupervisor {
+public:
+  ConnSupervisor(Client& net, PubSubClient& mqtt);
+
+  void begin(const char* ssid, const char* wifiPassword,
+             const char* host, uint16_t port,
+             const char* clientIdPrefix, const char* username, const char* password);
+
+  // Called once the MQTT session is up, to subscribe and announce the device
+  void onConnected(void (*callback)());
+
+  // Advance the state machine and service the MQTT client. Returns true
+  // while the MQTT session is usable.
+  bool poll();
+
+  bool connected() const { return state == CONN_READY; }
+  ConnState currentState() const { return state; }
+  const ConnStats& stats() const { return counters; }
+
+  // Write the counters as a JSON object into buffer, returns its length
+  int statsJson(char* buffer, size_t size) const;
+
+private:
+  void fail(uint32_t& counter);
+  void enter(ConnState next);
+
+  Client& net;
+  PubSubClient& mqtt;
+  void (*connectedCallback)();
+  const char* ssid;
+  const char* wifiPassword;
+  const char* host;
+  uint16_t port;
+  const char* clientIdPrefix;
+  const char* username;
+  const char* password;
+
+  ConnState state;
+  unsigned long stateSince;
+  unsigned long attemptSince;    // Start of the current outage, for time-to-connect
+  unsigned long retryAt;
+  uint8_t consecutiveFailures;
+  ConnStats counters;
+};
+
+const char* connStateName(ConnState state);
+
+#endif
@@ -0,0 +1,58 @@
+#include "FrameSignature.h"
+
+void computeSignature(const uint8_t* lumaMap, uint16_t blocksWide, uint16_t blocksHigh, FrameSignature& signature) {
+  for (int cy = 0; cy < SIGNATURE_HEIGHT; cy++) {
+    int y0 = cy * blocksHigh / SIGNATURE_HEIGHT;
+    int y1 = (cy + 1) * blocksHigh / SIGNATURE_HEIGHT;
+    if (y1 <= y0) {
+      y1 = y0 + 1;  // Maps smaller than the grid repeat blocks
+    }
+    for (int cx = 0; cx < SIGNATURE_WIDTH; cx++) {
+      int x0 = cx * blocksWide / SIGNATURE_WIDTH;
+      int x1 = (cx + 1) * blocksWide / SIGNATURE_WIDTH;
+      if (x1 <= x0) {
+        x1 = x0 + 1;
+      }
+      uint32_t sum = 0;
+      for (int y = y0; y < y1; y++) {
+        const uint8_t* row = lumaMap + y * blocksWide;
+        for (int x = x0; x < x1; x++) {
+          sum += row[x];
+        }
+      }
+      signature.cells[cy * SIGNATURE_WIDTH + cx] = sum / ((x1 - x0) * (y1 - y0));
+    }
+  }
+}
+
+uint16_t signatureDifference(const FrameSignature& previous, const FrameSignature& current, uint8_t cellThreshold) {
+  int32_t shift = 0;
+  for (int i = 0; i < SIGNATURE_CELLS; i++) {
+    shift += current.cells[i] - previous.cells[i];
+  }
+  shift /= SIGNATURE_CELLS;
+
+  uint16_t changed = 0;
+  for (int i = 0; i < SIGNATURE_CELLS; i++) {
+    int delta = current.cells[i] - previous.cells[i] - shift;
+    if (delta > cellThreshold || delta < -cellThreshold) {
+      changed++;
+    }
+  }
+  return changed;
+}
+
+ChangeGate::ChangeGate(uint8_t threshold, uint16_t cells, unsigned long keyframe)
+  : haveReference(false), cellThreshold(threshold), minCells(cells), keyframeMs(keyframe), referenceTime(0) {
+}
+
+bool ChangeGate::pass(const FrameSignature& signature, unsigned long now) {
+  bool keyframe = !haveReference || now - referenceTime >= keyframeMs;
+  if (!keyframe && signatureDifference(reference, signature, cellThreshold) < minCells) {
+    return false;
+  }
+  reference = signature;
+  haveReference = true;
+  referenceTime = now;
+  return true;
+}
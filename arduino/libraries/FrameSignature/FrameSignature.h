@@ -0,0 +1,53 @@
+/*
+  FrameSignature - compact per-frame scene signature
+
+  Reduces a block luminance map (see JpegDc) to a fixed 16x12 grid of
+  average brightness, so frames of any resolution can be compared for
+  scene changes in a couple of hundred byte operations. ChangeGate uses
+  it to pick the frames worth uploading.
+*/
+
+#ifndef FRAME_SIGNATURE_H
+#define FRAME_SIGNATURE_H
+
+#include <stdint.h>
+
+#define SIGNATURE_WIDTH 16
+#define SIGNATURE_HEIGHT 12
+#define SIGNATURE_CELLS (SIGNATURE_WIDTH * SIGNATURE_HEIGHT)
+
+struct FrameSignature {
+  uint8_t cells[SIGNATURE_CELLS];
+};
+
+// Average the blocksWide x blocksHigh luminance map into the signature grid
+void computeSignature(const uint8_t* lumaMap, uint16_t blocksWide, uint16_t blocksHigh, FrameSignature& signature);
+
+// Number of cells whose brightness moved by more than cellThreshold
+// between the two signatures. The overall brightness shift is removed
+// first, so auto-exposure drift alone does not count as a change.
+uint16_t signatureDifference(const FrameSignature& previous, const FrameSignature& current, uint8_t cellThreshold);
+
+// Upload gate: a frame passes when at least minCells cells differ from
+// the last frame that passed, or keyframeMs after it. Time is passed in
+// by the caller.
+class ChangeGate {
+public:
+  ChangeGate(uint8_t cellThreshold, uint16_t minCells, unsigned long keyframeMs);
+
+  // True to upload the frame, which then becomes the one compared with
+  bool pass(const FrameSignature& signature, unsigned long now);
+
+  // Let the next frame through whatever it shows
+  void reset() { haveReference = false; }
+
+private:
+  FrameSignature reference;
+  bool haveReference;
+  uint8_t cellThreshold;
+  uint16_t minCells;
+  unsigned long keyframeMs;
+  unsigned long referenceTime;
+};
+
+#endif
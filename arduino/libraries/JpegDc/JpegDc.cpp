@@ -0,0 +1,449 @@
+#include "JpegDc.h"
+
+#include <string.h>
+
+// JPEG marker codes used by the parser
+#define MARKER_SOF0 0xC0
+#define MARKER_SOF1 0xC1
+#define MARKER_DHT  0xC4
+#define MARKER_SOI  0xD8
+#define MARKER_EOI  0xD9
+#define MARKER_SOS  0xDA
+#define MARKER_DQT  0xDB
+#define MARKER_DRI  0xDD
+
+static inline uint16_t readU16(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+bool JpegDcDecoder::buildTable(HuffmanTable& table, const uint8_t* counts, const uint8_t* values, int total) {
+  memset(table.lookup, 0, sizeof(table.lookup));
+  memcpy(table.values, values, total);
+
+  // Canonical Huffman codes (ITU T.81 Annex C), plus an 8-bit lookahead
+  // table so most symbols resolve with a single array access
+  int32_t code = 0;
+  int k = 0;
+  for (int length = 1; length <= 16; length++) {
+    table.valPtr[length] = k;
+    table.minCode[length] = code;
+    for (int i = 0; i < counts[length - 1]; i++) {
+      if (length <= 8) {
+        int shift = 8 - length;
+        for (int fill = 0; fill < (1 << shift); fill++) {
+          table.lookup[(code << shift) | fill] = (uint16_t)((length << 8) | values[k]);
+        }
+      }
+      code++;
+      k++;
+    }
+    table.maxCode[length] = counts[length - 1] ? code - 1 : -1;
+    if (code > (1 << length)) {
+      return false;  // Over-subscribed code lengths
+    }
+    code <<= 1;
+  }
+  table.maxCode[17] = 0x7FFFFFFF;  // Sentinel for corrupt streams
+  table.defined = true;
+  return true;
+}
+
+void JpegDcDecoder::fillBits() {
+  while (bitCount <= 24) {
+    uint32_t byte = 0;
+    if (hitMarker || pos >= end) {
+      paddingBytes++;
+    } else {
+      byte = *pos++;
+      if (byte == 0xFF) {
+        if (pos < end && *pos == 0x00) {
+          pos++;  // Stuffed zero byte
+        } else {
+          // A marker ends the segment; feed zeros until the caller handles it
+          pos--;
+          hitMarker = true;
+          paddingBytes++;
+          byte = 0;
+        }
+      }
+    }
+    bitBuffer |= byte << (24 - bitCount);
+    bitCount += 8;
+  }
+}
+
+int JpegDcDecoder::decodeHuffman(const HuffmanTable& table) {
+  fillBits();
+  uint16_t entry = table.lookup[bitBuffer >> 24];
+  if (entry) {
+    int length = entry >> 8;
+    bitBuffer <<= length;
+    bitCount -= length;
+    return entry & 0xFF;
+  }
+
+  // Codes longer than 8 bits
+  for (int length = 9; length <= 16; length++) {
+    int32_t code = (int32_t)(bitBuffer >> (32 - length));
+    if (code <= table.maxCode[length]) {
+      bitBuffer <<= length;
+      bitCount -= length;
+      return table.values[table.valPtr[length] + code - table.minCode[length]];
+    }
+  }
+
+  badCode = true;
+  bitBuffer <<= 16;
+  bitCount -= 16;
+  return 0;
+}
+
+int JpegDcDecoder::receiveExtend(int size) {
+  if (size == 0) {
+    return 0;
+  }
+  fillBits();
+  int value = (int)(bitBuffer >> (32 - size));
+  bitBuffer <<= size;
+  bitCount -= size;
+  // Values with a leading 0 bit are negative (ITU T.81 F.2.2.1)
+  if (value < (1 << (size - 1))) {
+    value -= (1 << size) - 1;
+  }
+  return value;
+}
+
+bool JpegDcDecoder::restart() {
+  // Drop any partial byte and expect an RSTn marker next
+  bitBuffer = 0;
+  bitCount = 0;
+  paddingBytes = 0;
+  hitMarker = false;
+  if (end - pos < 2 || pos[0] != 0xFF || (pos[1] & 0xF8) != 0xD0) {
+    return false;
+  }
+  pos += 2;
+  for (int i = 0; i < componentCount; i++) {
+    components[i].predictor = 0;
+  }
+  return true;
+}
+
+void JpegDcDecoder::decodeBlock(Component& comp, bool isLuma, uint8_t* out) {
+  int size = decodeHuffman(dcTables[comp.dcTable]);
+  if (size > 16) {
+    badCode = true;  // No DC difference is that long, the stream is corrupt
+    return;
+  }
+  comp.predictor += receiveExtend(size);
+
+  // AC coefficients only need to be skipped, unless they are measured
+  const HuffmanTable& ac = acTables[comp.acTable];
+  bool measure = measureAc && isLuma;
+  const uint16_t* table = quant[comp.quantTable];
+  for (int k = 1; k < 64; ) {
+    int rs = decodeHuffman(ac);
+    int run = rs >> 4;
+    int bits = rs & 0x0F;
+    if (bits == 0) {
+      if (run != 15) {
+        break;  // End of block
+      }
+      k += 16;
+      continue;
+    }
+    k += run + 1;
+    if (measure && k <= 64) {
+      int value = receiveExtend(bits);
+      acTotal += (uint32_t)(value < 0 ? -value : value) * table[k - 1];
+      continue;
+    }
+    fillBits();
+    bitBuffer <<= bits;
+    bitCount -= bits;
+  }
+  if (measure) {
+    acBlocks++;
+  }
+
+  if (out) {
+    // DC is 8x the mean level-shifted sample value
+    int32_t dc = (int32_t)comp.predictor * quant[comp.quantTable][0];
+    int32_t luma = 128 + ((dc + (dc >= 0 ? 4 : -4)) / 8);
+    *out = (uint8_t)(luma < 0 ? 0 : (luma > 255 ? 255 : luma));
+  }
+}
+
+JpegDcResult JpegDcDecoder::decodeScan(const uint8_t* scanComponents, int scanCount, uint8_t* map) {
+  int hMax = 1;
+  int vMax = 1;
+  for (int i = 0; i < componentCount; i++) {
+    if (components[i].h > hMax) hMax = components[i].h;
+    if (components[i].v > vMax) vMax = components[i].v;
+  }
+
+  Component* scan[4];
+  for (int i = 0; i < scanCount; i++) {
+    scan[i] = &components[scanComponents[i]];
+    if (!dcTables[scan[i]->dcTable].defined || !acTables[scan[i]->acTable].defined) {
+      return JPEG_DC_BAD_HUFFMAN;
+    }
+    scan[i]->predictor = 0;
+  }
+
+  bitBuffer = 0;
+  bitCount = 0;
+  paddingBytes = 0;
+  hitMarker = false;
+  badCode = false;
+
+  // A single-component scan is not interleaved: one block per MCU in raster order
+  int mcusX, mcusY;
+  if (scanCount == 1) {
+    int compWidth = (width * scan[0]->h + hMax - 1) / hMax;
+    int compHeight = (height * scan[0]->v + vMax - 1) / vMax;
+    mcusX = (compWidth + 7) / 8;
+    mcusY = (compHeight + 7) / 8;
+  } else {
+    mcusX = (width + 8 * hMax - 1) / (8 * hMax);
+    mcusY = (height + 8 * vMax - 1) / (8 * vMax);
+  }
+
+  int mcusToRestart = restartInterval;
+  for (int my = 0; my < mcusY; my++) {
+    for (int mx = 0; mx < mcusX; mx++) {
+      if (restartInterval) {
+        if (mcusToRestart == 0) {
+          if (!restart()) {
+            return JPEG_DC_TRUNCATED;
+          }
+          mcusToRestart = restartInterval;
+        }
+        mcusToRestart--;
+      }
+
+      for (int c = 0; c < scanCount; c++) {
+        Component& comp = *scan[c];
+        bool isLuma = (&comp == &components[0]);
+        int blocksH = (scanCount == 1) ? 1 : comp.h;
+        int blocksV = (scanCount == 1) ? 1 : comp.v;
+        for (int v = 0; v < blocksV; v++) {
+          for (int h = 0; h < blocksH; h++) {
+            int bx = mx * blocksH + h;
+            int by = my * blocksV + v;
+            uint8_t* out = NULL;
+            if (isLuma && bx < mapWidth && by < mapHeight) {
+              out = &map[by * mapWidth + bx];
+            }
+            decodeBlock(comp, isLuma, out);
+          }
+        }
+      }
+
+      if (badCode) {
+        return JPEG_DC_BAD_HUFFMAN;
+      }
+      // Consuming the zero padding means the scan ended early
+      if (paddingBytes * 8 > bitCount) {
+        return JPEG_DC_TRUNCATED;
+      }
+    }
+  }
+
+  return JPEG_DC_OK;
+}
+
+JpegDcResult JpegDcDecoder::decode(const uint8_t* data, size_t length, uint8_t* map, size_t mapCapacity) {
+  for (int i = 0; i < 4; i++) {
+    dcTables[i].defined = false;
+    acTables[i].defined = false;
+    memset(quant[i], 0, sizeof(quant[i]));
+  }
+  acTotal = 0;
+  acBlocks = 0;
+  componentCount = 0;
+  width = height = 0;
+  mapWidth = mapHeight = 0;
+  restartInterval = 0;
+
+  if (length < 4 || data[0] != 0xFF || data[1] != MARKER_SOI) {
+    return JPEG_DC_BAD_MARKER;
+  }
+
+  const uint8_t* p = data + 2;
+  const uint8_t* dataEnd = data + length;
+  while (p + 4 <= dataEnd) {
+    if (p[0] != 0xFF) {
+      return JPEG_DC_BAD_MARKER;
+    }
+    uint8_t marker = p[1];
+    if (marker == 0xFF) {
+      p++;  // Fill byte
+      continue;
+    }
+    if (marker == MARKER_EOI) {
+      break;
+    }
+
+    uint16_t segmentLength = readU16(p + 2);
+    const uint8_t* segment = p + 4;
+    const uint8_t* segmentEnd = p + 2 + segmentLength;
+    if (segmentLength < 2 || segmentEnd > dataEnd) {
+      return JPEG_DC_TRUNCATED;
+    }
+
+    switch (marker) {
+      case MARKER_DQT:
+        while (segment < segmentEnd) {
+          int precision = segment[0] >> 4;
+          int id = segment[0] & 0x0F;
+          if (precision > 1 || id > 3) {
+            return JPEG_DC_BAD_MARKER;
+          }
+          if (segment + 1 + (precision ? 128 : 64) > segmentEnd) {
+            return JPEG_DC_TRUNCATED;
+          }
+          for (int k = 0; k < 64; k++) {
+            quant[id][k] = precision ? readU16(segment + 1 + 2 * k) : segment[1 + k];
+          }
+          segment += 1 + (precision ? 128 : 64);
+        }
+        break;
+
+      case MARKER_DHT:
+        while (segment + 17 <= segmentEnd) {
+          int tableClass = segment[0] >> 4;
+          int id = segment[0] & 0x0F;
+          if (tableClass > 1 || id > 3) {
+            return JPEG_DC_BAD_HUFFMAN;
+          }
+          int total = 0;
+          for (int i = 1; i <= 16; i++) {
+            total += segment[i];
+          }
+          if (total > 256 || segment + 17 + total > segmentEnd) {
+            return JPEG_DC_BAD_HUFFMAN;
+          }
+          HuffmanTable& table = tableClass ? acTables[id] : dcTables[id];
+          if (!buildTable(table, segment + 1, segment + 17, total)) {
+            return JPEG_DC_BAD_HUFFMAN;
+          }
+          segment += 17 + total;
+        }
+        break;
+
+      case MARKER_SOF0:
+      case MARKER_SOF1: {
+        // Every field is checked against the segment: a frame cut short
+        // by the camera can end anywhere
+        if (segment + 6 > segmentEnd) {
+          return JPEG_DC_TRUNCATED;
+        }
+        if (segment[0] != 8) {
+          return JPEG_DC_UNSUPPORTED;
+        }
+        height = readU16(segment + 1);
+        width = readU16(segment + 3);
+        componentCount = segment[5];
+        if (componentCount < 1 || componentCount > 4 || width == 0 || height == 0) {
+          return JPEG_DC_UNSUPPORTED;
+        }
+        if (segment + 6 + componentCount * 3 > segmentEnd) {
+          return JPEG_DC_TRUNCATED;
+        }
+        int hMax = 1;
+        for (int i = 0; i < componentCount; i++) {
+          const uint8_t* c = segment + 6 + i * 3;
+          components[i].id = c[0];
+          components[i].h = c[1] >> 4;
+          components[i].v = c[1] & 0x0F;
+          components[i].quantTable = c[2];
+          if (components[i].h < 1 || components[i].h > 4 || components[i].v < 1 || components[i].v > 4 ||
+              components[i].quantTable > 3) {
+            return JPEG_DC_BAD_MARKER;
+          }
+          if (components[i].h > hMax) hMax = components[i].h;
+        }
+        int vMax = 1;
+        for (int i = 0; i < componentCount; i++) {
+          if (components[i].v > vMax) vMax = components[i].v;
+        }
+        int lumaWidth = (width * components[0].h + hMax - 1) / hMax;
+        int lumaHeight = (height * components[0].v + vMax - 1) / vMax;
+        mapWidth = (lumaWidth + 7) / 8;
+        mapHeight = (lumaHeight + 7) / 8;
+        if ((size_t)mapWidth * mapHeight > mapCapacity) {
+          return JPEG_DC_MAP_TOO_SMALL;
+        }
+        break;
+      }
+
+      case MARKER_DRI:
+        if (segment + 2 > segmentEnd) {
+          return JPEG_DC_TRUNCATED;
+        }
+        restartInterval = readU16(segment);
+        break;
+
+      case MARKER_SOS: {
+        if (componentCount == 0) {
+          return JPEG_DC_BAD_MARKER;
+        }
+        if (segment + 1 > segmentEnd) {
+          return JPEG_DC_TRUNCATED;
+        }
+        int scanCount = segment[0];
+        if (scanCount < 1 || scanCount > componentCount) {
+          return JPEG_DC_BAD_MARKER;
+        }
+        // Components, then spectral selection and approximation
+        if (segment + 1 + scanCount * 2 + 3 > segmentEnd) {
+          return JPEG_DC_TRUNCATED;
+        }
+        uint8_t scanComponents[4];
+        bool hasLuma = false;
+        for (int i = 0; i < scanCount; i++) {
+          uint8_t id = segment[1 + i * 2];
+          uint8_t tables = segment[2 + i * 2];
+          int index = -1;
+          for (int c = 0; c < componentCount; c++) {
+            if (components[c].id == id) index = c;
+          }
+          if (index < 0) {
+            return JPEG_DC_BAD_MARKER;
+          }
+          if ((tables >> 4) > 3 || (tables & 0x0F) > 3) {
+            return JPEG_DC_BAD_HUFFMAN;
+          }
+          components[index].dcTable = tables >> 4;
+          components[index].acTable = tables & 0x0F;
+          scanComponents[i] = index;
+          hasLuma |= (index == 0);
+        }
+
+        pos = segmentEnd;
+        end = dataEnd;
+        if (hasLuma) {
+          return decodeScan(scanComponents, scanCount, map);
+        }
+
+        // Skip the entropy-coded data of a chroma-only scan
+        p = segmentEnd;
+        while (p + 1 < dataEnd && !(p[0] == 0xFF && p[1] != 0x00 && (p[1] & 0xF8) != 0xD0)) {
+          p++;
+        }
+        continue;
+      }
+
+      default:
+        if (marker >= 0xC2 && marker <= 0xCF && marker != MARKER_DHT && marker != 0xC8 && marker != 0xCC) {
+          return JPEG_DC_UNSUPPORTED;  // Progressive, lossless or arithmetic coding
+        }
+        break;
+    }
+
+    p = segmentEnd;
+  }
+
+  return JPEG_DC_TRUNCATED;
+}
@@ -0,0 +1,98 @@
+/*
+  JpegDc - partial baseline JPEG decoder
+
+  Decodes only the Huffman stream and the DC coefficient of each 8x8 luma
+  block, which gives a 1/64-scale luminance map of the frame without
+  running the IDCT or allocating an RGB buffer. Intended for cheap scene
+  statistics (brightness, variance, change detection) on camera frames.
+  The AC coefficients are skipped, or summed as a sharpness measure when
+  asked for with setMeasureAc().
+
+  Supports baseline and extended sequential Huffman JPEG (SOF0/SOF1) with
+  any sampling factors and restart intervals. Progressive and arithmetic
+  coded images are rejected.
+*/
+
+#ifndef JPEG_DC_H
+#define JPEG_DC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum JpegDcResult {
+  JPEG_DC_OK = 0,
+  JPEG_DC_TRUNCATED,       // Ran out of data before the scan was complete
+  JPEG_DC_BAD_MARKER,      // Missing SOI or malformed segment
+  JPEG_DC_UNSUPPORTED,     // Progressive, arithmetic or 12-bit image
+  JPEG_DC_BAD_HUFFMAN,     // Invalid code or missing table
+  JPEG_DC_MAP_TOO_SMALL    // Output map cannot hold one value per luma block
+};
+
+class JpegDcDecoder {
+public:
+  // Decode the luma DC values of the JPEG in data into map (row-major,
+  // one byte per 8x8 block, 0-255 brightness). map must hold at least
+  // mapCapacity bytes; the grid size is available from blocksWide() and
+  // blocksHigh() afterwards.
+  JpegDcResult decode(const uint8_t* data, size_t length, uint8_t* map, size_t mapCapacity);
+
+  uint16_t imageWidth() const { return width; }
+  uint16_t imageHeight() const { return height; }
+  uint16_t blocksWide() const { return mapWidth; }
+  uint16_t blocksHigh() const { return mapHeight; }
+
+  // Also sum the magnitudes of the dequantized luma AC coefficients.
+  // Fine detail and sharp edges raise it, blur and flat frames lower it.
+  void setMeasureAc(bool enabled) { measureAc = enabled; }
+  // Mean AC magnitude per luma block of the last decode, 0 unless measured
+  uint32_t acEnergy() const { return acBlocks ? (uint32_t)(acTotal / acBlocks) : 0; }
+
+private:
+  struct HuffmanTable {
+    uint16_t lookup[256];  // First 8 bits -> (length << 8) | value, 0 if longer
+    int32_t maxCode[18];   // Largest code of each length, -1 if none
+    int16_t valPtr[17];    // Index into values of the first code of each length
+    int32_t minCode[17];
+    uint8_t values[256];
+    bool defined;
+  };
+
+  struct Component {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t quantTable;
+    uint8_t dcTable, acTable;
+    int16_t predictor;
+  };
+
+  bool buildTable(HuffmanTable& table, const uint8_t* counts, const uint8_t* values, int total);
+  JpegDcResult decodeScan(const uint8_t* scanComponents, int scanCount, uint8_t* map);
+  void decodeBlock(Component& comp, bool isLuma, uint8_t* out);
+  int decodeHuffman(const HuffmanTable& table);
+  void fillBits();
+  int receiveExtend(int size);
+  bool restart();
+
+  HuffmanTable dcTables[4];
+  HuffmanTable acTables[4];
+  uint16_t quant[4][64];   // Zigzag order, as in the DQT segment
+  Component components[4];
+  int componentCount;
+  uint16_t width, height;
+  uint16_t mapWidth, mapHeight;
+  uint16_t restartInterval;
+  bool measureAc = false;
+  uint64_t acTotal;
+  uint32_t acBlocks;
+
+  // Entropy-coded segment reader
+  const uint8_t* pos;
+  const uint8_t* end;
+  uint32_t bitBuffer;
+  int bitCount;
+  int paddingBytes;        // Zero bytes fed past the end of the segment
+  bool hitMarker;
+  bool badCode;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "RealFft.h"
+
+#include <math.h>
+
+RealFft::RealFft() : length(0), half(0) {}
+
+bool RealFft::begin(uint16_t size, float inputScale) {
+  if (size < 8 || size > REAL_FFT_MAX_SIZE || (size & (size - 1)) != 0) {
+    return false;
+  }
+  length = size;
+  half = size / 2;
+
+  // Tables are worked out in double once, so they carry no more error
+  // than float rounding
+  const double twoPi = 6.283185307179586;
+  for (uint16_t i = 0; i < length; i++) {
+    window[i] = (float)((0.54 - 0.46 * cos(twoPi * i / (length - 1))) * inputScale);
+  }
+  for (uint16_t k = 0; k < half / 2; k++) {
+    twiddle[2 * k] = (float)cos(twoPi * k / half);
+    twiddle[2 * k + 1] = (float)-sin(twoPi * k / half);
+  }
+  for (uint16_t k = 0; k < half; k++) {
+    splitTwiddle[2 * k] = (float)cos(twoPi * k / length);
+    splitTwiddle[2 * k + 1] = (float)-sin(twoPi * k / length);
+  }
+  uint8_t bits = 0;
+  while ((1u << bits) < half) {
+    bits++;
+  }
+  for (uint16_t n = 0; n < half; n++) {
+    uint16_t r = 0;
+    for (uint8_t b = 0; b < bits; b++) {
+      r |= ((n >> b) & 1) << (bits - 1 - b);
+    }
+    reversed[n] = r;
+  }
+  return true;
+}
+
+void RealFft::transform(const int32_t* samples) {
+  // Window, and pack even samples as real and odd as imaginary parts,
+  // straight into bit-reversed order
+  for (uint16_t n = 0; n < half; n++) {
+    float* slot = data + 2 * reversed[n];
+    slot[0] = (float)samples[2 * n] * window[2 * n];
+    slot[1] = (float)samples[2 * n + 1] * window[2 * n + 1];
+  }
+
+  // Radix-2 decimation in time over the half-size complex block
+  for (uint16_t span = 1; span < half; span <<= 1) {
+    uint16_t step = half / (2 * span);
+    for (uint16_t start = 0; start < half; start += 2 * span) {
+      for (uint16_t j = 0; j < span; j++) {
+        float wr = twiddle[2 * j * step];
+        float wi = twiddle[2 * j * step + 1];
+        float* a = data + 2 * (start + j);
+        float* b = a + 2 * span;
+        float tr = wr * b[0] - wi * b[1];
+        float ti = wr * b[1] + wi * b[0];
+        b[0] = a[0] - tr;
+        b[1] = a[1] - ti;
+        a[0] += tr;
+        a[1] += ti;
+      }
+    }
+  }
+}
+
+// Bin of the real block from the half-size result: the transforms of the
+// even and odd samples are separated out of Z[k] and Z[half - k], then
+// combined as E + W^k O
+void RealFft::split(uint16_t bin, float& re, float& im) const {
+  if (bin == 0 || bin == half) {
+    re = bin == 0 ? data[0] + data[1] : data[0] - data[1];
+    im = 0;
+    return;
+  }
+  const float* z = data + 2 * bin;
+  const float* m = data + 2 * (half - bin);
+  float evenRe = 0.5f * (z[0] + m[0]);
+  float evenIm = 0.5f * (z[1] - m[1]);
+  float oddRe = 0.5f * (z[1] + m[1]);
+  float oddIm = -0.5f * (z[0] - m[0]);
+  float wr = splitTwiddle[2 * bin];
+  float wi = splitTwiddle[2 * bin + 1];
+  re = evenRe + wr * oddRe - wi * oddIm;
+  im = evenIm + wr * oddIm + wi * oddRe;
+}
+
+void RealFft::powerSpectrum(uint16_t first, uint16_t last, float* power) const {
+  if (last > half) {
+    last = half;
+  }
+  for (uint16_t bin = first; bin <= last; bin++) {
+    float re, im;
+    split(bin, re, im);
+    power[bin - first] = re * re + im * im;
+  }
+}
+
+float RealFft::bandPower(const int32_t* samples, uint16_t first, uint16_t last, float& total) const {
+  // Sum over all bins of |X|^2 is length times the block's energy. Bins 1
+  // to half - 1 appear twice in it, DC and Nyquist once. Energy is taken
+  // about the mean, which is length * energy - DC^2 without the
+  // cancellation a microphone's DC offset would cause.
+  float sum = 0, nyquist = 0;
+  for (uint16_t n = 0; n < length; n += 2) {
+    float even = (float)samples[n] * window[n];
+    float odd = (float)samples[n + 1] * window[n + 1];
+    sum += even + odd;
+    nyquist += even - odd;
+  }
+  float mean = sum / length;
+
+  // Taking the mean out leaves every bin but DC as it was, and keeps the
+  // Goertzel resonators near DC from growing with the offset. The bins'
+  // recurrences run side by side in the same pass as the energy.
+  if (first == 0) {
+    first = 1;
+  }
+  if (last >= half) {
+    last = half - 1;
+  }
+  uint8_t bins = last >= first ? last - first + 1 : 0;
+  if (bins > REAL_FFT_MAX_BAND_BINS) {
+    bins = REAL_FFT_MAX_BAND_BINS;
+  }
+  float coefficient[REAL_FFT_MAX_BAND_BINS], s1[REAL_FFT_MAX_BAND_BINS], s2[REAL_FFT_MAX_BAND_BINS];
+  for (uint8_t b = 0; b < bins; b++) {
+    coefficient[b] = 2.0f * splitTwiddle[2 * (first + b)];
+    s1[b] = 0;
+    s2[b] = 0;
+  }
+  float energy = 0;
+  for (uint16_t n = 0; n < length; n++) {
+    float centred = (float)samples[n] * window[n] - mean;
+    energy += centred * centred;
+    for (uint8_t b = 0; b < bins; b++) {
+      float s = centred + coefficient[b] * s1[b] - s2[b];
+      s2[b] = s1[b];
+      s1[b] = s;
+    }
+  }
+  total = 0.5f * (length * energy + nyquist * nyquist);
+
+  float band = 0;
+  for (uint8_t b = 0; b < bins; b++) {
+    band += s1[b] * s1[b] + s2[b] * s2[b] - coefficient[b] * s1[b] * s2[b];
+  }
+  return band;
+}
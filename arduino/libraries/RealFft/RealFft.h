@@ -0,0 +1,66 @@
+/*
+  RealFft - single-precision FFT of a real block of samples
+
+  The ESP32 has a single-precision FPU but emulates double in software,
+  so the transform runs in float throughout. A real block of N samples
+  is packed into N/2 complex values, transformed with an N/2-point
+  radix-2 FFT and split back into the N/2 + 1 bins of the one-sided
+  spectrum, about half the work of a complex N-point FFT.
+
+  Bit reversal, twiddles and the window (Hamming, scaled by the input
+  scale so raw I2S words go in unconverted) are tables built once by
+  begin(). transform() does no trigonometry. Only the bins asked of
+  powerSpectrum() are split out of the half-size result, as power
+  (|X|^2), so no square root is taken either. Bins match an unnormalised
+  DFT of the windowed block, as arduinoFFT computes it. bandPower()
+  sums a few bins and the whole spectrum without transforming, for a
+  gate in front of the FFT. Has no Arduino dependencies.
+*/
+
+#ifndef REAL_FFT_H
+#define REAL_FFT_H
+
+#include <stdint.h>
+
+#define REAL_FFT_MAX_SIZE 512    // Largest block; the tables are sized for it
+#define REAL_FFT_MAX_BAND_BINS 8 // Most bins bandPower() sums
+
+class RealFft {
+public:
+  RealFft();
+
+  // size is a power of two from 8 to REAL_FFT_MAX_SIZE. Each input
+  // sample is multiplied by inputScale before the transform. Returns
+  // false for an unsupported size.
+  bool begin(uint16_t size, float inputScale);
+
+  uint16_t size() const { return length; }
+
+  // Window and transform size samples
+  void transform(const int32_t* samples);
+
+  // Power of bins first to last (at most size / 2) of the last
+  // transform, into power[0] onwards
+  void powerSpectrum(uint16_t first, uint16_t last, float* power) const;
+
+  // Without a transform: the summed power of bins first to last (from 1
+  // to size / 2 - 1, at most REAL_FFT_MAX_BAND_BINS of them) of the
+  // windowed samples, by Goertzel, and the power of bins 1 to size / 2
+  // into total, by Parseval's theorem. Both match summing
+  // powerSpectrum() to within float rounding, and for a few bins cost
+  // less than transform().
+  float bandPower(const int32_t* samples, uint16_t first, uint16_t last, float& total) const;
+
+private:
+  void split(uint16_t bin, float& re, float& im) const;
+
+  uint16_t length;
+  uint16_t half;                              // Complex FFT size, length / 2
+  float window[REAL_FFT_MAX_SIZE];
+  float data[REAL_FFT_MAX_SIZE];              // half complex values, re/im interleaved
+  float twiddle[REAL_FFT_MAX_SIZE / 2];       // e^(-2 pi i k / half), k < half / 2, re/im interleaved
+  float splitTwiddle[REAL_FFT_MAX_SIZE];      // e^(-2 pi i k / length), k < half, re/im interleaved
+  uint16_t reversed[REAL_FFT_MAX_SIZE / 2];   // Bit-reversed index of each complex value
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "SampleRing.h"
+
+#include <string.h>
+
+SampleRing::SampleRing() : buffer(NULL), mask(0), head(0), tail(0), overrunCount(0), dropped(0), peak(0) {}
+
+bool SampleRing::begin(int32_t* storage, uint32_t size) {
+  if (!storage || size == 0 || (size & (size - 1)) != 0) {
+    return false;
+  }
+  buffer = storage;
+  mask = size - 1;
+  head = 0;
+  tail = 0;
+  overrunCount = 0;
+  dropped = 0;
+  peak = 0;
+  return true;
+}
+
+bool SampleRing::write(const int32_t* samples, uint32_t count) {
+  uint32_t start = head;
+  uint32_t waiting = start - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  if (count > capacity() - waiting) {
+    __atomic_fetch_add(&overrunCount, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dropped, count, __ATOMIC_RELAXED);
+    return false;
+  }
+  // At most two copies, either side of the wrap
+  uint32_t offset = start & mask;
+  uint32_t first = count < capacity() - offset ? count : capacity() - offset;
+  memcpy(buffer + offset, samples, first * sizeof(int32_t));
+  memcpy(buffer, samples + first, (count - first) * sizeof(int32_t));
+  __atomic_store_n(&head, start + count, __ATOMIC_RELEASE);
+  if (waiting + count > peak) {
+    __atomic_store_n(&peak, waiting + count, __ATOMIC_RELAXED);
+  }
+  return true;
+}
+
+uint32_t SampleRing::available() const {
+  return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - tail;
+}
+
+bool SampleRing::peek(int32_t* out, uint32_t count) const {
+  if (available() < count) {
+    return false;
+  }
+  uint32_t offset = tail & mask;
+  uint32_t first = count < capacity() - offset ? count : capacity() - offset;
+  memcpy(out, buffer + offset, first * sizeof(int32_t));
+  memcpy(out + first, buffer, (count - first) * sizeof(int32_t));
+  return true;
+}
+
+void SampleRing::consume(uint32_t count) {
+  uint32_t waiting = available();
+  __atomic_store_n(&tail, tail + (count < waiting ? count : waiting), __ATOMIC_RELEASE);
+}
+
+uint32_t SampleRing::overruns() const {
+  return __atomic_load_n(&overrunCount, __ATOMIC_RELAXED);
+}
+
+uint32_t SampleRing::droppedSamples() const {
+  return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+uint32_t SampleRing::highWater() const {
+  return __atomic_load_n(&peak, __ATOMIC_RELAXED);
+}
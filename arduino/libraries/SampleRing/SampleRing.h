@@ -0,0 +1,53 @@
+/*
+  SampleRing - lock-free single-producer, single-consumer sample ring
+
+  One task writes blocks of samples as the I2S driver hands them over,
+  another reads overlapping windows off the other end. Head and tail are
+  free-running counters, each written by one side only and published
+  with release/acquire ordering, so neither side ever waits on the
+  other. A block that does not fit whole is dropped and counted rather
+  than overwriting samples the reader has not finished with, so the
+  counters say exactly how much audio was lost. Has no Arduino
+  dependencies.
+*/
+
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdint.h>
+
+class SampleRing {
+public:
+  SampleRing();
+
+  // storage holds capacity samples, a power of two, and must outlive
+  // the ring
+  bool begin(int32_t* storage, uint32_t capacity);
+
+  // Producer: append count samples. Returns false, dropping all of them,
+  // if they do not fit.
+  bool write(const int32_t* samples, uint32_t count);
+
+  // Consumer: samples waiting, copy the oldest count of them without
+  // taking them, and take them
+  uint32_t available() const;
+  bool peek(int32_t* out, uint32_t count) const;
+  void consume(uint32_t count);
+
+  // Counters, readable from any task
+  uint32_t overruns() const;             // Blocks dropped
+  uint32_t droppedSamples() const;
+  uint32_t highWater() const;            // Most samples ever waiting
+  uint32_t capacity() const { return mask + 1; }
+
+private:
+  int32_t* buffer;
+  uint32_t mask;
+  uint32_t head;                         // Written by the producer
+  uint32_t tail;                         // Written by the consumer
+  uint32_t overrunCount;
+  uint32_t dropped;
+  uint32_t peak;
+};
+
+#endif
@@ -0,0 +1,326 @@
+#include "ShotClassifier.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHOT_MIN_RMS 1e-9f               // Floor for the level of a silent window
+#define SHOT_Z_LIMIT 8                   // Standardised features are clamped to +-8, so a score fits 32 bits
+#define SHOT_BIAS_LIMIT (INT32_MAX / 4)  // Q16, with every weight at its limit a score still fits
+#define SHOT_THRESHOLD_LIMIT (INT32_MAX / 2)  // Q8
+
+static const char* const featureNames[SHOT_FEATURE_COUNT] = {
+  "level", "rise", "slope", "flux", "centroid", "crest", "low", "mid", "high", "decay"
+};
+
+const char* shotFeatureName(uint8_t feature) {
+  return feature < SHOT_FEATURE_COUNT ? featureNames[feature] : "";
+}
+
+ShotFeatureExtractor::ShotFeatureExtractor()
+    : binCount(0), binWidth(0), hop(0), lowBin(0), midBin(0), highBin(0), bandWidth(1) {
+  reset();
+}
+
+bool ShotFeatureExtractor::begin(uint16_t bins, float binWidthHz, float hopMs) {
+  if (bins < SHOT_FLUX_BANDS + 1 || bins > SHOT_MAX_BINS) {
+    return false;
+  }
+  binCount = bins;
+  binWidth = binWidthHz;
+  hop = hopMs;
+  lowBin = (uint16_t)(SHOT_LOW_EDGE_HZ / binWidthHz);
+  midBin = (uint16_t)(SHOT_MID_EDGE_HZ / binWidthHz);
+  highBin = (uint16_t)(SHOT_HIGH_EDGE_HZ / binWidthHz);
+  bandWidth = (bins - 1) / SHOT_FLUX_BANDS;
+  reset();
+  return true;
+}
+
+void ShotFeatureExtractor::reset() {
+  memset(bandMagnitude, 0, sizeof(bandMagnitude));
+  stale = false;
+  historySum = 0;
+  historyIndex = 0;
+  historyCount = 0;
+  backgroundLevel = 0;
+  lastLevel = 0;
+  flux = centroid = crest = lowRatio = midRatio = highRatio = 0;
+  inCandidate = false;
+  memset(vector, 0, sizeof(vector));
+}
+
+// One pass over the bins: band shares, centroid and flux, DC left out
+void ShotFeatureExtractor::measureSpectrum(const float* power, float rms, float peak) {
+  float total = 0, weighted = 0, low = 0, mid = 0, high = 0;
+  float rising = 0, magnitudes = 0;
+  uint16_t bin = 1;
+  for (uint8_t band = 0; band < SHOT_FLUX_BANDS; band++) {
+    float bandPower = 0;
+    for (uint16_t end = bin + bandWidth; bin < end; bin++) {
+      float p = power[bin];
+      bandPower += p;
+      weighted += p * bin;
+      if (bin < lowBin) {
+        low += p;
+      } else if (bin < midBin) {
+        mid += p;
+      } else if (bin < highBin) {
+        high += p;
+      }
+    }
+    total += bandPower;
+    float magnitude = sqrtf(bandPower);
+    if (magnitude > bandMagnitude[band]) {
+      rising += magnitude - bandMagnitude[band];
+    }
+    magnitudes += magnitude;
+    bandMagnitude[band] = magnitude;
+  }
+  // Bins past the last whole band count towards the shares only
+  for (; bin < binCount; bin++) {
+    total += power[bin];
+    weighted += power[bin] * bin;
+  }
+
+  if (total > 0) {
+    centroid = weighted / total * binWidth;
+    lowRatio = low / total;
+    midRatio = mid / total;
+    highRatio = high / total;
+  } else {
+    centroid = lowRatio = midRatio = highRatio = 0;
+  }
+  flux = magnitudes > 0 ? rising / magnitudes : 0;
+  crest = rms > SHOT_MIN_RMS && peak > rms ? 20.0f * log10f(peak / rms) : 0;
+}
+
+static float levelOf(float rms) {
+  return 20.0f * log10f(rms > SHOT_MIN_RMS ? rms : SHOT_MIN_RMS);
+}
+
+// The spectrum is read at the onset and at every new peak, see add()
+bool ShotFeatureExtractor::needsSpectrum(float rms) const {
+  float level = levelOf(rms);
+  if (inCandidate) {
+    return level > peakLevel;
+  }
+  return historyCount == SHOT_BACKGROUND_WINDOWS && level - backgroundLevel >= SHOT_ONSET_DB;
+}
+
+// Band magnitudes as measureSpectrum() sums them
+void ShotFeatureExtractor::primeSpectrum(const float* power) {
+  uint16_t bin = 1;
+  for (uint8_t band = 0; band < SHOT_FLUX_BANDS; band++) {
+    float bandPower = 0;
+    for (uint16_t end = bin + bandWidth; bin < end; bin++) {
+      bandPower += power[bin];
+    }
+    bandMagnitude[band] = sqrtf(bandPower);
+  }
+  stale = false;
+}
+
+bool ShotFeatureExtractor::add(const float* power, float rms, float peak) {
+  float level = levelOf(rms);
+  if (power) {
+    measureSpectrum(power, rms, peak);
+  }
+  stale = !power;
+  bool ready = false;
+
+  if (!inCandidate) {
+    if (historyCount == SHOT_BACKGROUND_WINDOWS && level - backgroundLevel >= SHOT_ONSET_DB) {
+      inCandidate = true;
+      candidateBackground = backgroundLevel;
+      peakLevel = level;
+      steepest = level - lastLevel;
+      windowsSincePeak = 0;
+      windows = 1;
+    }
+  } else {
+    windows++;
+    if (level - lastLevel > steepest) {
+      steepest = level - lastLevel;
+    }
+    if (level > peakLevel) {
+      peakLevel = level;
+      windowsSincePeak = 0;
+    } else {
+      windowsSincePeak++;
+      float target = peakLevel - SHOT_DECAY_DB;
+      if (level <= target) {
+        // Between the window before and this one, where the level crossed
+        float fraction = lastLevel > level ? (lastLevel - target) / (lastLevel - level) : 1.0f;
+        vector[SHOT_DECAY] = (windowsSincePeak - 1 + fraction) * hop;
+        ready = true;
+      } else if (windowsSincePeak >= SHOT_DECAY_MAX_WINDOWS || windows >= 2 * SHOT_DECAY_MAX_WINDOWS) {
+        vector[SHOT_DECAY] = SHOT_DECAY_MAX_WINDOWS * hop;
+        ready = true;
+      }
+    }
+  }
+
+  // The spectrum is read at the loudest window of the candidate
+  if (inCandidate && windowsSincePeak == 0) {
+    vector[SHOT_FLUX] = flux;
+    vector[SHOT_CENTROID] = centroid;
+    vector[SHOT_CREST] = crest;
+    vector[SHOT_LOW_RATIO] = lowRatio;
+    vector[SHOT_MID_RATIO] = midRatio;
+    vector[SHOT_HIGH_RATIO] = highRatio;
+  }
+  if (ready) {
+    vector[SHOT_LEVEL] = peakLevel;
+    vector[SHOT_RISE] = peakLevel - candidateBackground;
+    vector[SHOT_SLOPE] = steepest;
+    inCandidate = false;
+  }
+
+  // Every window joins the background, so a sound that stays loud stops
+  // opening candidates once the average has caught up with it
+  if (historyCount == SHOT_BACKGROUND_WINDOWS) {
+    historySum -= history[historyIndex];
+  } else {
+    historyCount++;
+  }
+  history[historyIndex] = level;
+  historySum += level;
+  historyIndex = (historyIndex + 1) % SHOT_BACKGROUND_WINDOWS;
+  backgroundLevel = historySum / historyCount;
+  lastLevel = level;
+  return ready;
+}
+
+ShotModel::ShotModel() : bias(0), threshold(INT32_MAX) {
+  for (uint8_t i = 0; i < SHOT_FEATURE_COUNT; i++) {
+    mean[i] = 0;
+    scale[i] = 0;
+    weight[i] = 0;
+  }
+}
+
+static int32_t toFixed(float value, float one, int32_t limit) {
+  float fixed = value * one;
+  if (fixed > limit) {
+    return limit;
+  }
+  if (fixed < -limit) {
+    return -limit;
+  }
+  return (int32_t)lrintf(fixed);
+}
+
+// Read the numbers that follow a line's name. Returns how many, or -1 if
+// there are more than max or one is not a finite number.
+static int readValues(const char* text, float* values, int max) {
+  int count = 0;
+  for (;;) {
+    while (isspace((unsigned char)*text)) {
+      text++;
+    }
+    if (*text == '\0') {
+      return count;
+    }
+    char* end;
+    float value = strtof(text, &end);
+    if (end == text || (*end != '\0' && !isspace((unsigned char)*end)) || !isfinite(value) || count == max) {
+      return -1;
+    }
+    values[count++] = value;
+    text = end;
+  }
+}
+
+// Whether value fits the fixed-point field it is stored in
+static bool fitsFixed(float value, float one, int32_t limit) {
+  return fabsf(value * one) <= (float)limit;
+}
+
+bool ShotModel::parse(const char* text, size_t length) {
+  if (!text || length > SHOT_MODEL_MAX_TEXT) {
+    return false;
+  }
+  ShotModel parsed;
+  bool given[SHOT_FEATURE_COUNT + 2] = {};   // Each feature, then threshold and bias
+  size_t start = 0;
+  while (start < length) {
+    size_t end = start;
+    while (end < length && text[end] != '\n') {
+      end++;
+    }
+    char line[96];
+    bool cut = end - start > sizeof(line) - 1;
+    size_t lineLength = cut ? sizeof(line) - 1 : end - start;
+    memcpy(line, text + start, lineLength);
+    line[lineLength] = '\0';
+    start = end + 1;
+
+    // Only a comment may run past the line buffer
+    char* comment = strchr(line, '#');
+    if (comment) {
+      *comment = '\0';
+    } else if (cut) {
+      return false;
+    }
+    char name[16];
+    int nameLength = 0;
+    if (sscanf(line, " %15s%n", name, &nameLength) != 1) {
+      continue;  // Blank or comment
+    }
+    float values[3];
+    int count = readValues(line + nameLength, values, 3);
+
+    uint8_t slot = 0;
+    while (slot < SHOT_FEATURE_COUNT && strcmp(name, featureNames[slot]) != 0) {
+      slot++;
+    }
+    if (slot == SHOT_FEATURE_COUNT && strcmp(name, "bias") == 0) {
+      slot++;
+    } else if (slot == SHOT_FEATURE_COUNT && strcmp(name, "threshold") != 0) {
+      return false;
+    }
+    if (given[slot]) {
+      return false;
+    }
+    given[slot] = true;
+    if (slot == SHOT_FEATURE_COUNT) {
+      if (count != 1 || !fitsFixed(values[0], 256.0f, SHOT_THRESHOLD_LIMIT)) {
+        return false;
+      }
+      parsed.threshold = toFixed(values[0], 256.0f, SHOT_THRESHOLD_LIMIT);
+    } else if (slot == SHOT_FEATURE_COUNT + 1) {
+      if (count != 1 || !fitsFixed(values[0], 65536.0f, SHOT_BIAS_LIMIT)) {
+        return false;
+      }
+      parsed.bias = toFixed(values[0], 65536.0f, SHOT_BIAS_LIMIT);
+    } else {
+      if (count != 3 || !fitsFixed(values[2], 256.0f, INT16_MAX)) {
+        return false;
+      }
+      parsed.mean[slot] = values[0];
+      parsed.scale[slot] = values[1];
+      parsed.weight[slot] = (int16_t)toFixed(values[2], 256.0f, INT16_MAX);
+    }
+  }
+  for (bool found : given) {
+    if (!found) {
+      return false;
+    }
+  }
+  *this = parsed;
+  return true;
+}
+
+int32_t ShotModel::score(const float* features) const {
+  int32_t sum = bias;
+  for (uint8_t i = 0; i < SHOT_FEATURE_COUNT; i++) {
+    if (weight[i] != 0) {
+      int32_t z = toFixed((features[i] - mean[i]) * scale[i], 256.0f, SHOT_Z_LIMIT * 256);
+      sum += z * weight[i];
+    }
+  }
+  return sum >> 8;
+}
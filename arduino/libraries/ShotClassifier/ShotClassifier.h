@@ -0,0 +1,153 @@
+/*
+  ShotClassifier - streaming gunshot features and a fixed-point scorer
+
+  ShotFeatureExtractor reads what the detector already has for each
+  analysis window: its one-sided power spectrum, RMS and peak. It keeps
+  a running background level, and a window that rises SHOT_ONSET_DB
+  above it opens a candidate. The candidate is followed until its level
+  has fallen SHOT_DECAY_DB from its peak, or for SHOT_DECAY_MAX_WINDOWS
+  windows, and then handed over as one feature vector: peak level, rise
+  over the background, steepest step, spectral flux, centroid and band
+  shares at the peak, crest factor and decay time. Windows that open no
+  candidate cost one pass over the bins, or none: only a window that
+  opens a candidate or is a new peak in one is read for its spectrum,
+  and needsSpectrum() says which, so a detector can leave the FFT out
+  of the rest.
+
+  ShotModel is a logistic model over that vector. Each feature is
+  standardised as (x - mean) * scale, then weighted in Q8 fixed point,
+  so a score is the log-odds of a gunshot in 1/256 steps. parse() reads
+  the model from text, so weights and the decision threshold can be
+  changed without rebuilding:
+
+    # comment
+    threshold 0.5
+    bias -2.1
+    level -20.5 0.12 1.84      name, mean, scale, weight
+
+  A model gives the threshold, the bias and every feature, each once; a
+  feature that should not count has weight 0, so a model cut short in
+  transit is refused. Has no Arduino dependencies.
+*/
+
+#ifndef SHOT_CLASSIFIER_H
+#define SHOT_CLASSIFIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHOT_MAX_BINS 257                 // One-sided spectrum of a 512-point FFT
+#define SHOT_FLUX_BANDS 16                // Sub-bands spectral flux is taken over
+#define SHOT_BACKGROUND_WINDOWS 32        // Levels the background is averaged over
+#define SHOT_ONSET_DB 6.0f                // Rise over the background that opens a candidate
+#define SHOT_DECAY_DB 10.0f               // Fall from the peak that closes it
+#define SHOT_DECAY_MAX_WINDOWS 24         // Longest a candidate is followed
+#define SHOT_LOW_EDGE_HZ 250.0f           // Band share edges
+#define SHOT_MID_EDGE_HZ 2000.0f
+#define SHOT_HIGH_EDGE_HZ 5000.0f
+#define SHOT_MODEL_MAX_TEXT 1024          // Longest model text parse() is given
+
+enum ShotFeature {
+  SHOT_LEVEL,           // Peak window level, dB of the RMS
+  SHOT_RISE,            // Peak level over the background, dB
+  SHOT_SLOPE,           // Largest window-to-window rise, dB
+  SHOT_FLUX,            // Spectral flux into the peak, 0-1
+  SHOT_CENTROID,        // Spectral centroid at the peak, Hz
+  SHOT_CREST,           // Peak over RMS at the peak, dB
+  SHOT_LOW_RATIO,       // Power share below SHOT_LOW_EDGE_HZ
+  SHOT_MID_RATIO,       // Power share from the low to the mid edge
+  SHOT_HIGH_RATIO,      // Power share from the mid to the high edge
+  SHOT_DECAY,           // Time to fall SHOT_DECAY_DB from the peak, ms
+  SHOT_FEATURE_COUNT
+};
+
+// Name of a feature as model text spells it
+const char* shotFeatureName(uint8_t feature);
+
+class ShotFeatureExtractor {
+public:
+  ShotFeatureExtractor();
+
+  // bins of the one-sided spectrum, including DC, at most SHOT_MAX_BINS;
+  // windows start hopMs apart. Returns false for too many bins.
+  bool begin(uint16_t bins, float binWidthHz, float hopMs);
+
+  // Forget the background and any open candidate
+  void reset();
+
+  // Add one window: power[0..bins-1], and the RMS and peak magnitude of
+  // its samples in one unit. Returns true when a candidate closes, its
+  // features are then in features(). power may be NULL for a window
+  // needsSpectrum() turned down.
+  bool add(const float* power, float rms, float peak);
+
+  // Whether add() will read the spectrum of a window of this RMS
+  bool needsSpectrum(float rms) const;
+
+  // Flux is taken against the window before. When that one was added
+  // without a spectrum, give its spectrum here before adding the next
+  // with one, and the features come out as if every window had one.
+  bool spectrumStale() const { return stale; }
+  void primeSpectrum(const float* power);
+
+  const float* features() const { return vector; }
+  float level() const { return lastLevel; }          // dB of the last window
+  float background() const { return backgroundLevel; }
+  bool tracking() const { return inCandidate; }
+
+private:
+  void measureSpectrum(const float* power, float rms, float peak);
+
+  uint16_t binCount;
+  float binWidth;
+  float hop;
+  uint16_t lowBin, midBin, highBin;
+  uint16_t bandWidth;                               // Bins per flux band
+
+  float bandMagnitude[SHOT_FLUX_BANDS];             // sqrt of band power, last window
+  bool stale;                                       // Last window was added without a spectrum
+  float history[SHOT_BACKGROUND_WINDOWS];
+  float historySum;
+  uint8_t historyIndex;
+  uint8_t historyCount;
+  float backgroundLevel;
+  float lastLevel;
+
+  // Spectral measures of the window just added
+  float flux, centroid, crest, lowRatio, midRatio, highRatio;
+
+  bool inCandidate;
+  float peakLevel;
+  float candidateBackground;
+  float steepest;
+  uint8_t windowsSincePeak;
+  uint8_t windows;
+  float vector[SHOT_FEATURE_COUNT];
+};
+
+class ShotModel {
+public:
+  ShotModel();
+
+  // Replace the model with one read from text. On a malformed line the
+  // model is left as it was and false is returned: an unknown name or one
+  // given twice, the wrong number of values or anything after them, a
+  // value that is not a finite number, or a weight, bias or threshold
+  // outside its fixed-point range. So is a model missing a line.
+  bool parse(const char* text, size_t length);
+
+  // Log-odds of a gunshot, Q8
+  int32_t score(const float* features) const;
+
+  bool isShot(int32_t score) const { return score >= threshold; }
+  int32_t thresholdQ8() const { return threshold; }
+
+private:
+  float mean[SHOT_FEATURE_COUNT];
+  float scale[SHOT_FEATURE_COUNT];
+  int16_t weight[SHOT_FEATURE_COUNT];   // Q8
+  int32_t bias;                         // Q16
+  int32_t threshold;                    // Q8
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "StageStats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+StageHistogram::StageHistogram() : samples(0) {
+  memset(buckets, 0, sizeof(buckets));
+}
+
+// Smallest value that lands in bucket
+static uint32_t bucketLowerBound(uint8_t bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  uint8_t exponent = (bucket >> 2) + 1;
+  return (uint32_t)(4 | (bucket & 3)) << (exponent - 2);
+}
+
+uint32_t StageHistogram::bucketUpperBound(uint8_t bucket) {
+  if (bucket + 1 >= STAGE_HISTOGRAM_BUCKETS) {
+    return UINT32_MAX;
+  }
+  return bucketLowerBound(bucket + 1) - 1;
+}
+
+StageReport::StageReport() {
+  memset(seen, 0, sizeof(seen));
+}
+
+int StageReport::appendJson(char* buffer, size_t size, const char* name, const StageHistogram& histogram) {
+  // Work on a snapshot, the histogram may be recorded into meanwhile
+  uint32_t delta[STAGE_HISTOGRAM_BUCKETS];
+  uint32_t total = 0;
+  for (int i = 0; i < STAGE_HISTOGRAM_BUCKETS; i++) {
+    uint32_t now = histogram.buckets[i];
+    delta[i] = now - seen[i];
+    seen[i] = now;
+    total += delta[i];
+  }
+
+  static const uint8_t percents[] = {50, 90, 99};
+  uint32_t values[3] = {0, 0, 0};
+  if (total) {
+    uint32_t cumulative = 0;
+    int p = 0;
+    for (int i = 0; i < STAGE_HISTOGRAM_BUCKETS && p < 3; i++) {
+      cumulative += delta[i];
+      // Rank of the percentile sample, rounded up
+      while (p < 3 && (uint64_t)cumulative * 100 >= (uint64_t)total * percents[p]) {
+        values[p++] = StageHistogram::bucketUpperBound(i);
+      }
+    }
+  }
+
+  return snprintf(buffer, size, "\"%s\":[%u,%u,%u,%u]", name, (unsigned)total,
+                  (unsigned)values[0], (unsigned)values[1], (unsigned)values[2]);
+}
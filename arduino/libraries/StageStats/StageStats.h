@@ -0,0 +1,66 @@
+/*
+  StageStats - allocation-free latency histograms for firmware stages
+
+  StageHistogram counts samples (microseconds) in fixed log-linear
+  buckets: four per power of two, so each bucket is within 25% of its
+  neighbours, from 1 us up to about two minutes. record() is a count
+  leading zeros, a shift and an increment. Histograms only ever grow,
+  so the task recording into one never has to coordinate with the task
+  reporting it.
+
+  StageReport keeps a copy of the buckets it last reported and
+  summarises only the samples added since, giving per-interval
+  percentiles without resetting anything. Has no Arduino dependencies.
+*/
+
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STAGE_HISTOGRAM_BUCKETS 104   // Four per octave up to 2^27 us
+
+class StageHistogram {
+public:
+  StageHistogram();
+
+  void record(uint32_t micros) {
+    buckets[bucketFor(micros)]++;
+    samples++;
+  }
+
+  uint32_t count() const { return samples; }
+
+  static uint8_t bucketFor(uint32_t value) {
+    if (value < 4) {
+      return value;
+    }
+    uint8_t exponent = 31 - __builtin_clz(value);
+    uint8_t bucket = ((exponent - 1) << 2) | ((value >> (exponent - 2)) & 3);
+    return bucket < STAGE_HISTOGRAM_BUCKETS ? bucket : STAGE_HISTOGRAM_BUCKETS - 1;
+  }
+
+  // Largest value that lands in bucket
+  static uint32_t bucketUpperBound(uint8_t bucket);
+
+private:
+  friend class StageReport;
+  uint32_t buckets[STAGE_HISTOGRAM_BUCKETS];
+  uint32_t samples;
+};
+
+class StageReport {
+public:
+  StageReport();
+
+  // Append "name":[count,p50,p90,p99] covering the samples recorded
+  // since the previous call. Percentiles are bucket upper bounds in us.
+  // Returns the number of characters written, like snprintf.
+  int appendJson(char* buffer, size_t size, const char* name, const StageHistogram& histogram);
+
+private:
+  uint32_t seen[STAGE_HISTOGRAM_BUCKETS];
+};
+
+#endif
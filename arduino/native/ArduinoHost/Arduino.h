@@ -0,0 +1,107 @@
+/*
+  ArduinoHost - host stand-ins for the ESP32 Arduino core
+
+  Lets the firmware in this repo build for PlatformIO's native platform
+  so it can be profiled on a Linux host. Time is virtual: millis() and
+  micros() only move when the firmware calls delay() or the harness
+  charges simulated work to the clock, so a run over the same recorded
+  frames always takes the same path. See HostHarness.h for the hooks
+  the benchmark drivers use.
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "Print.h"
+#include "WString.h"
+#include "freertos/FreeRTOS.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define PROGMEM
+#define RTC_DATA_ATTR                 // Survives deep sleep on the ESP32
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+// Time
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+// GPIO, levels written by the firmware are read back by the harness
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+// Seeded, so every run draws the same sequence
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// The firmware's cycle counts read as nanoseconds of host CPU time
+class EspClass {
+public:
+  uint32_t getCycleCount();
+};
+
+extern EspClass ESP;
+
+bool psramFound();
+// PSRAM is ordinary heap on the host, not counted in the heap peak
+void* ps_malloc(size_t size);
+
+class HardwareSerial : public Print {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void setDebugOutput(bool enable) { (void)enable; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// Sleep and GPIO numbers from ESP-IDF
+typedef enum {
+  GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5, GPIO_NUM_6,
+  GPIO_NUM_7, GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10, GPIO_NUM_11, GPIO_NUM_12, GPIO_NUM_13,
+  GPIO_NUM_14, GPIO_NUM_15, GPIO_NUM_16, GPIO_NUM_17, GPIO_NUM_18, GPIO_NUM_19, GPIO_NUM_20,
+  GPIO_NUM_21, GPIO_NUM_22, GPIO_NUM_23, GPIO_NUM_24, GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_27,
+  GPIO_NUM_28, GPIO_NUM_29, GPIO_NUM_30, GPIO_NUM_31, GPIO_NUM_32, GPIO_NUM_33, GPIO_NUM_34,
+  GPIO_NUM_35, GPIO_NUM_36, GPIO_NUM_37, GPIO_NUM_38, GPIO_NUM_39
+} gpio_num_t;
+
+typedef enum {
+  ESP_SLEEP_WAKEUP_UNDEFINED,
+  ESP_SLEEP_WAKEUP_ALL,
+  ESP_SLEEP_WAKEUP_EXT0,
+  ESP_SLEEP_WAKEUP_EXT1,
+  ESP_SLEEP_WAKEUP_TIMER
+} esp_sleep_wakeup_cause_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio, int level);
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us);
+// Throws HostDeepSleep so the harness regains control
+[[noreturn]] void esp_deep_sleep_start();
+
+#endif
@@ -0,0 +1,386 @@
+#include "Arduino.h"
+#include "HostState.h"
+
+#include <malloc.h>
+#include <new>
+#include <stdarg.h>
+#include <time.h>
+#include <vector>
+
+HostState host;
+HardwareSerial Serial;
+EspClass ESP;
+
+// Time
+
+unsigned long millis() {
+  return (unsigned long)(host.clockMicros / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)host.clockMicros;
+}
+
+void delay(uint32_t ms) {
+  host.clockMicros += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(uint32_t us) {
+  host.clockMicros += us;
+}
+
+void hostAdvanceMicros(uint64_t us) {
+  host.clockMicros += us;
+}
+
+void hostChargeLink(size_t bytes) {
+  if (host.linkBytesPerSecond) {
+    host.clockMicros += (uint64_t)bytes * 1000000 / host.linkBytesPerSecond;
+  }
+}
+
+// GPIO
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin < sizeof(host.pins)) {
+    host.pins[pin] = value ? HIGH : LOW;
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < sizeof(host.pins) ? host.pins[pin] : LOW;
+}
+
+void hostSetPin(uint8_t pin, int level) {
+  digitalWrite(pin, level);
+}
+
+int hostPinLevel(uint8_t pin) {
+  return digitalRead(pin);
+}
+
+// Random numbers, a fixed LCG so runs repeat exactly
+
+static uint32_t randomState = 1;
+
+long random(long max) {
+  if (max <= 0) {
+    return 0;
+  }
+  randomState = randomState * 1103515245u + 12345u;
+  return (long)((randomState >> 8) % (uint32_t)max);
+}
+
+long random(long min, long max) {
+  return max <= min ? min : min + random(max - min);
+}
+
+void randomSeed(unsigned long seed) {
+  randomState = (uint32_t)seed;
+}
+
+uint32_t EspClass::getCycleCount() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec);
+}
+
+// Queues, a ring of fixed-size items
+
+struct HostQueue {
+  std::vector<uint8_t> items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+  UBaseType_t head;
+  UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  if (length == 0 || itemSize == 0) {
+    return NULL;
+  }
+  HostQueue* queue = new HostQueue();
+  queue->items.resize((size_t)length * itemSize);
+  queue->length = length;
+  queue->itemSize = itemSize;
+  queue->head = 0;
+  queue->count = 0;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t wait) {
+  (void)wait;
+  if (!queue || queue->count == queue->length) {
+    return pdFALSE;
+  }
+  size_t slot = (queue->head + queue->count) % queue->length;
+  memcpy(&queue->items[slot * queue->itemSize], item, queue->itemSize);
+  queue->count++;
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+  (void)wait;
+  if (!queue || queue->count == 0) {
+    return pdFALSE;
+  }
+  memcpy(item, &queue->items[(size_t)queue->head * queue->itemSize], queue->itemSize);
+  queue->head = (queue->head + 1) % queue->length;
+  queue->count--;
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  return queue ? queue->count : 0;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  return queue ? queue->length - queue->count : 0;
+}
+
+bool psramFound() {
+  return host.psram;
+}
+
+void* ps_malloc(size_t size) {
+  return malloc(size);
+}
+
+void hostSetPsram(bool present) {
+  host.psram = present;
+}
+
+// Sleep
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() {
+  return (esp_sleep_wakeup_cause_t)host.wakeupCause;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio, int level) {
+  (void)gpio;
+  (void)level;
+  return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t us) {
+  (void)us;
+  return ESP_OK;
+}
+
+void esp_deep_sleep_start() {
+  throw HostDeepSleep();
+}
+
+void hostSetWakeupCause(int cause) {
+  host.wakeupCause = cause;
+}
+
+// Serial, only echoed when the harness runs verbose
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (host.verbose) {
+    fputc(c, stderr);
+  }
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  if (host.verbose) {
+    fwrite(buffer, 1, size, stderr);
+  }
+  return size;
+}
+
+// Print
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::write(const char* str) {
+  return str ? write((const uint8_t*)str, strlen(str)) : 0;
+}
+
+size_t Print::print(const char* str) {
+  return write(str);
+}
+
+size_t Print::print(const String& str) {
+  return write((const uint8_t*)str.c_str(), str.length());
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(int value, int base) {
+  return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(long value, int base) {
+  if (base == DEC && value < 0) {
+    return printNumber((unsigned long)-value, base, true);
+  }
+  return printNumber((unsigned long)value, base, false);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return printNumber(value, base, false);
+}
+
+size_t Print::print(double value, int digits) {
+  char buffer[48];
+  int length = snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write((const uint8_t*)buffer, length);
+}
+
+size_t Print::print(const Printable& value) {
+  return value.printTo(*this);
+}
+
+size_t Print::println() {
+  return write((const uint8_t*)"\r\n", 2);
+}
+
+size_t Print::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) {
+    return 0;
+  }
+  return write((const uint8_t*)buffer, (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+}
+
+size_t Print::printNumber(unsigned long value, int base, bool negative) {
+  char buffer[8 * sizeof(long) + 2];
+  char* p = buffer + sizeof(buffer);
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    int digit = value % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while (value);
+  if (negative) {
+    *--p = '-';
+  }
+  return write((const uint8_t*)p, buffer + sizeof(buffer) - p);
+}
+
+// String
+
+String::String(double number, unsigned int digits) {
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, number);
+  value = buffer;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if (from > to) {
+    std::swap(from, to);
+  }
+  if (from >= value.length()) {
+    return String();
+  }
+  return String(value.substr(from, std::min<size_t>(to, value.length()) - from));
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  size_t found = value.find(c, from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+int String::indexOf(const char* str, unsigned int from) const {
+  size_t found = value.find(str ? str : "", from);
+  return found == std::string::npos ? -1 : (int)found;
+}
+
+long String::toInt() const {
+  return strtol(value.c_str(), NULL, 10);
+}
+
+void String::fromNumber(unsigned long number, unsigned char base, bool negative) {
+  char buffer[8 * sizeof(long) + 2];
+  char* p = buffer + sizeof(buffer);
+  *--p = '\0';
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    int digit = number % base;
+    *--p = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    number /= base;
+  } while (number);
+  if (negative) {
+    *--p = '-';
+  }
+  value = p;
+}
+
+size_t String::strlenSafe(const char* str) {
+  return str ? strlen(str) : 0;
+}
+
+// Heap accounting. Everything allocated with new, including String and
+// the standard containers, is counted; the size of each block comes from
+// malloc_usable_size so no header is needed.
+
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+static size_t heapBaseline = 0;      // In use at the last reset, mostly the recorded frames
+
+static void* countedAlloc(size_t size) {
+  void* p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  heapInUse += malloc_usable_size(p);
+  if (heapInUse > heapPeak) {
+    heapPeak = heapInUse;
+  }
+  return p;
+}
+
+static void countedFree(void* p) {
+  if (p) {
+    heapInUse -= malloc_usable_size(p);
+    free(p);
+  }
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+
+size_t hostHeapInUse() {
+  return heapInUse;
+}
+
+size_t hostHeapPeak() {
+  return heapPeak - heapBaseline;
+}
+
+void hostHeapResetPeak() {
+  heapBaseline = heapInUse;
+  heapPeak = heapInUse;
+}
@@ -0,0 +1,31 @@
+/*
+  Client - host stand-in for the Arduino network client interface
+
+  Connections succeed while WiFi and the broker are up (see
+  hostSetBrokerUp()). Bytes written are counted and charged to the
+  simulated uplink (see hostSetLinkRate()), nothing leaves the host.
+*/
+
+#ifndef HOST_CLIENT_H
+#define HOST_CLIENT_H
+
+#include "Arduino.h"
+
+class Client : public Print {
+public:
+  virtual int connect(const char* host, uint16_t port);
+  virtual size_t write(uint8_t c) override;
+  virtual size_t write(const uint8_t* buffer, size_t size) override;
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+  virtual void flush() {}
+  virtual void stop() { open = false; }
+  virtual uint8_t connected();
+  operator bool() { return connected(); }
+  using Print::write;
+
+protected:
+  bool open = false;
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*
+  ESP32Servo - host stand-in for the ESP32Servo library
+
+  Commanded angles are recorded so the harness can count servo moves.
+*/
+
+#ifndef HOST_ESP32_SERVO_H
+#define HOST_ESP32_SERVO_H
+
+#include "Arduino.h"
+
+class ESP32PWM {
+public:
+  static void allocateTimer(int timer) { (void)timer; }
+};
+
+class Servo {
+public:
+  void setPeriodHertz(int hertz) { (void)hertz; }
+  int attach(int pin, int minUs = 544, int maxUs = 2400);
+  void detach() {}
+  void write(int value);
+  int read() { return angle; }
+
+private:
+  int angle = 90;
+};
+
+#endif
@@ -0,0 +1,24 @@
+/*
+  HTTPClient - host stand-in for the ESP32 HTTPClient
+
+  There is no server on the host: every request fails as a refused
+  connection, after its body is charged to the simulated uplink.
+*/
+
+#ifndef HOST_HTTP_CLIENT_H
+#define HOST_HTTP_CLIENT_H
+
+#include "Arduino.h"
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+class HTTPClient {
+public:
+  bool begin(const String& url) { (void)url; return true; }
+  void addHeader(const String& name, const String& value) { (void)name; (void)value; }
+  int POST(const String& payload);
+  String getString() { return String(); }
+  void end() {}
+};
+
+#endif
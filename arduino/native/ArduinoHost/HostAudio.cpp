@@ -0,0 +1,292 @@
+#include "driver/i2s.h"
+#include "HostHarness.h"
+#include "HostState.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define WAV_SAMPLE_SHIFT 16        // 16-bit sample to the top of a 32-bit I2S word
+
+struct HostRecording {
+  std::string path;
+  long dataOffset;                 // Of the first sample in the file
+  uint64_t samples;
+  uint64_t start;                  // Of the first sample in the stream
+};
+
+static std::vector<HostRecording> recordings;
+static uint64_t streamSamples = 0;
+static uint32_t streamRate = 0;
+
+static struct {
+  bool installed;
+  uint32_t rate;
+  uint8_t bytesPerSample;
+  uint64_t dmaCapacity;            // Samples the DMA buffers hold
+  uint32_t dmaBufferLength;
+  uint64_t clockBase;              // Virtual time of the first captured sample
+  uint64_t position;               // Next sample of the stream to hand out
+  QueueHandle_t events;
+} i2s;
+
+static FILE* currentFile = NULL;
+static size_t currentIndex = 0;
+static HostAudioStats audioStats = {};
+
+static uint64_t cpuNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t le32(const uint8_t* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Finds the samples of a 16-bit mono PCM WAV file
+static bool openWav(const char* path, HostRecording& recording, uint32_t& rate) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    return false;
+  }
+  uint8_t header[12];
+  bool ok = fread(header, 1, 12, f) == 12 && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0;
+  bool pcm16 = false;
+  while (ok) {
+    uint8_t chunk[8];
+    if (fread(chunk, 1, 8, f) != 8) {
+      ok = false;
+      break;
+    }
+    uint32_t size = le32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+      uint8_t fmt[16];
+      if (fread(fmt, 1, 16, f) != 16) {
+        ok = false;
+        break;
+      }
+      pcm16 = (fmt[0] | fmt[1] << 8) == 1 && (fmt[2] | fmt[3] << 8) == 1 && (fmt[14] | fmt[15] << 8) == 16;
+      rate = le32(fmt + 4);
+      fseek(f, size - 16 + (size & 1), SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      recording.path = path;
+      recording.dataOffset = ftell(f);
+      recording.samples = size / 2;
+      break;
+    } else {
+      fseek(f, size + (size & 1), SEEK_CUR);
+    }
+  }
+  fclose(f);
+  return ok && pcm16;
+}
+
+static size_t addRecording(const char* path) {
+  HostRecording recording;
+  uint32_t rate = 0;
+  if (!openWav(path, recording, rate)) {
+    fprintf(stderr, "Skipping %s: not a 16-bit mono PCM WAV file\n", path);
+    return 0;
+  }
+  if (streamRate && rate != streamRate) {
+    fprintf(stderr, "Skipping %s: %u Hz, the recordings before it are %u Hz\n", path, (unsigned)rate,
+            (unsigned)streamRate);
+    return 0;
+  }
+  streamRate = rate;
+  recording.start = streamSamples;
+  streamSamples += recording.samples;
+  recordings.push_back(recording);
+  return 1;
+}
+
+size_t hostLoadRecordings(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return 0;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    return addRecording(path);
+  }
+  DIR* dir = opendir(path);
+  if (!dir) {
+    return 0;
+  }
+  std::vector<std::string> names;
+  while (dirent* entry = readdir(dir)) {
+    size_t length = strlen(entry->d_name);
+    if (length > 4 && strcasecmp(entry->d_name + length - 4, ".wav") == 0) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  size_t added = 0;
+  for (const std::string& name : names) {
+    added += addRecording((std::string(path) + "/" + name).c_str());
+  }
+  return added;
+}
+
+uint64_t hostRecordingSamples() {
+  return streamSamples;
+}
+
+uint32_t hostRecordingRate() {
+  return streamRate;
+}
+
+const char* hostRecordingAt(uint64_t sample, double& seconds) {
+  for (const HostRecording& recording : recordings) {
+    if (sample < recording.start + recording.samples) {
+      seconds = (double)(sample - recording.start) / streamRate;
+      return recording.path.c_str();
+    }
+  }
+  seconds = 0;
+  return "";
+}
+
+const char* hostRecordingPath(size_t index) {
+  return index < recordings.size() ? recordings[index].path.c_str() : NULL;
+}
+
+const HostAudioStats& hostAudioStats() {
+  return audioStats;
+}
+
+// Position the file reads at sample of the stream
+static bool seekStream(uint64_t sample) {
+  while (currentIndex < recordings.size() &&
+         sample >= recordings[currentIndex].start + recordings[currentIndex].samples) {
+    currentIndex++;
+    if (currentFile) {
+      fclose(currentFile);
+      currentFile = NULL;
+    }
+  }
+  if (currentIndex == recordings.size()) {
+    return false;
+  }
+  const HostRecording& recording = recordings[currentIndex];
+  if (!currentFile) {
+    currentFile = fopen(recording.path.c_str(), "rb");
+    if (!currentFile) {
+      return false;
+    }
+  }
+  return fseek(currentFile, recording.dataOffset + (long)(sample - recording.start) * 2, SEEK_SET) == 0;
+}
+
+// Read count samples from the stream, across files
+static bool readStream(int16_t* out, size_t count) {
+  while (count > 0) {
+    if (!seekStream(i2s.position)) {
+      return false;
+    }
+    const HostRecording& recording = recordings[currentIndex];
+    size_t chunk = (size_t)std::min<uint64_t>(count, recording.start + recording.samples - i2s.position);
+    if (fread(out, 2, chunk, currentFile) != chunk) {
+      return false;
+    }
+    out += chunk;
+    count -= chunk;
+    i2s.position += chunk;
+  }
+  return true;
+}
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t* config, int queueSize, void* i2s_queue) {
+  (void)port;
+  if (!config || !(config->mode & I2S_MODE_RX) || config->dma_buf_count <= 0 || config->dma_buf_len <= 0) {
+    return ESP_FAIL;
+  }
+  if (streamRate && config->sample_rate != streamRate) {
+    fprintf(stderr, "i2s_driver_install: recordings are %u Hz, the driver is set to %u Hz\n", (unsigned)streamRate,
+            (unsigned)config->sample_rate);
+    return ESP_FAIL;
+  }
+  i2s.installed = true;
+  i2s.rate = config->sample_rate;
+  i2s.bytesPerSample = config->bits_per_sample == I2S_BITS_PER_SAMPLE_16BIT ? 2 : 4;
+  i2s.dmaBufferLength = config->dma_buf_len;
+  i2s.dmaCapacity = (uint64_t)config->dma_buf_count * config->dma_buf_len;
+  i2s.clockBase = host.clockMicros;
+  i2s.position = 0;
+  i2s.events = NULL;
+  if (i2s_queue && queueSize > 0) {
+    i2s.events = xQueueCreate(queueSize, sizeof(i2s_event_t));
+    *(QueueHandle_t*)i2s_queue = i2s.events;
+  }
+  return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port) {
+  (void)port;
+  i2s.installed = false;
+  return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t* pins) {
+  (void)port;
+  (void)pins;
+  return i2s.installed ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t i2s_read(i2s_port_t port, void* dest, size_t size, size_t* bytesRead, TickType_t ticksToWait) {
+  (void)port;
+  (void)ticksToWait;
+  *bytesRead = 0;
+  if (!i2s.installed) {
+    return ESP_FAIL;
+  }
+  size_t count = size / i2s.bytesPerSample;
+
+  // Whole DMA buffers the microphone filled past what they hold are lost
+  uint64_t captured = (host.clockMicros - i2s.clockBase) * i2s.rate / 1000000;
+  if (captured > i2s.position + i2s.dmaCapacity) {
+    uint64_t buffers = (captured - i2s.position - i2s.dmaCapacity + i2s.dmaBufferLength - 1) / i2s.dmaBufferLength;
+    uint64_t lost = buffers * i2s.dmaBufferLength;
+    i2s.position += lost;
+    audioStats.samplesLost += lost;
+    audioStats.overflows += buffers;
+    for (uint64_t i = 0; i < buffers && i2s.events; i++) {
+      i2s_event_t event = {I2S_EVENT_RX_Q_OVF, 0};
+      xQueueSend(i2s.events, &event, 0);
+    }
+  }
+  if (i2s.position + count > streamSamples) {
+    throw HostAudioEnd();
+  }
+
+  // Wait until the last sample asked for has been captured
+  uint64_t ready = i2s.clockBase + ((i2s.position + count) * 1000000 + i2s.rate - 1) / i2s.rate;
+  if (host.clockMicros < ready) {
+    host.clockMicros = ready;
+  }
+
+  uint64_t start = cpuNanos();
+  static std::vector<int16_t> samples;
+  samples.resize(count);
+  if (!readStream(samples.data(), count)) {
+    throw HostAudioEnd();
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (i2s.bytesPerSample == 4) {
+      ((int32_t*)dest)[i] = (int32_t)samples[i] * (1 << WAV_SAMPLE_SHIFT);
+    } else {
+      ((int16_t*)dest)[i] = samples[i];
+    }
+  }
+  audioStats.fileNanos += cpuNanos() - start;
+  audioStats.samplesRead += count;
+  *bytesRead = count * i2s.bytesPerSample;
+  return ESP_OK;
+}
@@ -0,0 +1,237 @@
+#include "esp_camera.h"
+#include "ESP32Servo.h"
+#include "HostState.h"
+
+#include <dirent.h>
+#include <strings.h>
+#include <algorithm>
+
+static camera_config_t cameraConfig;
+static sensor_t sensor;
+static framesize_t sensorFrameSize = FRAMESIZE_INVALID;
+static int sensorQuality = 0;
+
+// Width and height from the first SOF marker, 0 if there is none
+static void readJpegSize(HostFrame& frame) {
+  frame.width = 0;
+  frame.height = 0;
+  const std::vector<uint8_t>& d = frame.data;
+  size_t i = 2;
+  while (i + 9 < d.size()) {
+    if (d[i] != 0xFF) {
+      return;
+    }
+    uint8_t marker = d[i + 1];
+    size_t length = (d[i + 2] << 8) | d[i + 3];
+    if (marker >= 0xC0 && marker <= 0xC3) {
+      frame.height = (d[i + 5] << 8) | d[i + 6];
+      frame.width = (d[i + 7] << 8) | d[i + 8];
+      return;
+    }
+    i += 2 + length;
+  }
+}
+
+// Subdirectory names of the frame sizes, in framesize_t order
+static const char* const frameSizeNames[FRAMESIZE_INVALID] = {
+  "96x96", "qqvga", "qcif", "hqvga", "240x240", "qvga", "cif", "hvga", "vga", "svga", "xga", "hd", "sxga", "uxga",
+};
+
+static bool isJpegName(const char* name) {
+  const char* dot = strrchr(name, '.');
+  return dot && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+static void loadDirectory(const std::string& directory, std::vector<HostFrame>& frames) {
+  DIR* dir = opendir(directory.c_str());
+  if (!dir) {
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (isJpegName(entry->d_name)) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++) {
+    std::string path = directory + "/" + names[i];
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+      continue;
+    }
+    HostFrame frame;
+    frame.name = names[i];
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+      frame.data.insert(frame.data.end(), chunk, chunk + n);
+    }
+    fclose(file);
+    readJpegSize(frame);
+    host.frameCapacity = std::max(host.frameCapacity, frame.data.size());
+    frames.push_back(frame);
+  }
+}
+
+size_t hostLoadFrames(const char* directory) {
+  host.frames.clear();
+  host.sizedFrames.clear();
+  host.frameCapacity = 0;
+  loadDirectory(directory, host.frames);
+  for (int size = 0; size < FRAMESIZE_INVALID; size++) {
+    std::vector<HostFrame> frames;
+    loadDirectory(std::string(directory) + "/" + frameSizeNames[size], frames);
+    if (!frames.empty()) {
+      host.sizedFrames[size] = frames;
+    }
+  }
+  hostRewindFrames();
+  return host.frames.size();
+}
+
+void hostRewindFrames() {
+  host.nextFrame = 0;
+  host.framesExhausted = false;
+}
+
+size_t hostFrameCount() {
+  return host.frames.size();
+}
+
+const char* hostFrameName(size_t index) {
+  return index < host.frames.size() ? host.frames[index].name.c_str() : NULL;
+}
+
+bool hostFramesExhausted() {
+  return host.framesExhausted;
+}
+
+size_t hostFramesServed() {
+  return host.nextFrame;
+}
+
+size_t hostFramesOutstanding() {
+  return host.outstanding;
+}
+
+size_t hostFramesOutstandingPeak() {
+  return host.outstandingPeak;
+}
+
+// Sensor
+
+int hostSensorFrameSize() {
+  return sensorFrameSize;
+}
+
+int hostSensorQuality() {
+  return sensorQuality;
+}
+
+static int setFrameSize(sensor_t*, framesize_t frameSize) {
+  sensorFrameSize = frameSize;
+  return 0;
+}
+
+static int setQuality(sensor_t*, int quality) {
+  sensorQuality = quality;
+  return 0;
+}
+
+static int ignoreSetting(sensor_t*, int) {
+  return 0;
+}
+
+esp_err_t esp_camera_init(const camera_config_t* config) {
+  cameraConfig = *config;
+  sensorFrameSize = config->frame_size;
+  sensorQuality = config->jpeg_quality;
+  sensor.set_framesize = setFrameSize;
+  sensor.set_quality = setQuality;
+  sensor.set_brightness = ignoreSetting;
+  sensor.set_contrast = ignoreSetting;
+  sensor.set_saturation = ignoreSetting;
+  sensor.set_whitebal = ignoreSetting;
+  sensor.set_awb_gain = ignoreSetting;
+  sensor.set_wb_mode = ignoreSetting;
+  sensor.set_exposure_ctrl = ignoreSetting;
+  sensor.set_aec_value = ignoreSetting;
+  sensor.set_gain_ctrl = ignoreSetting;
+  sensor.set_agc_gain = ignoreSetting;
+  sensor.set_hmirror = ignoreSetting;
+  sensor.set_vflip = ignoreSetting;
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  return ESP_OK;
+}
+
+sensor_t* esp_camera_sensor_get() {
+  return &sensor;
+}
+
+// Each call hands out the next recorded frame in a buffer sized for the
+// largest one, like the driver's fixed-size frame buffers. The recorded
+// frames are served as-is whatever quality was set. While the sensor is
+// set to a frame size that has frames of its own, the frame in the same
+// place in that set is served instead.
+// Like the driver, at most fb_count frames can be held at once; the
+// driver would time out waiting for a free buffer, here it fails at once.
+camera_fb_t* esp_camera_fb_get() {
+  if (host.nextFrame >= host.frames.size()) {
+    host.framesExhausted = true;
+    return NULL;
+  }
+  if (cameraConfig.fb_count > 0 && host.outstanding >= cameraConfig.fb_count) {
+    host.traffic.captureStalls++;
+    return NULL;
+  }
+  const HostFrame* served = &host.frames[host.nextFrame];
+  std::map<int, std::vector<HostFrame> >::const_iterator sized = host.sizedFrames.find(sensorFrameSize);
+  if (sized != host.sizedFrames.end()) {
+    served = &sized->second[host.nextFrame % sized->second.size()];
+  }
+  host.nextFrame++;
+  const HostFrame& frame = *served;
+  camera_fb_t* fb = (camera_fb_t*)malloc(sizeof(camera_fb_t));
+  fb->buf = (uint8_t*)malloc(host.frameCapacity);
+  memcpy(fb->buf, frame.data.data(), frame.data.size());
+  fb->len = frame.data.size();
+  fb->width = frame.width;
+  fb->height = frame.height;
+  fb->format = PIXFORMAT_JPEG;
+  fb->timestamp.tv_sec = host.clockMicros / 1000000;
+  fb->timestamp.tv_usec = host.clockMicros % 1000000;
+
+  host.outstanding++;
+  host.outstandingPeak = std::max(host.outstandingPeak, host.outstanding);
+  return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t* fb) {
+  if (!fb) {
+    return;
+  }
+  free(fb->buf);
+  free(fb);
+  host.outstanding--;
+}
+
+// Servo
+
+int Servo::attach(int pin, int minUs, int maxUs) {
+  (void)minUs;
+  (void)maxUs;
+  return pin;
+}
+
+void Servo::write(int value) {
+  if (value != angle) {
+    host.traffic.servoMoves++;
+  }
+  angle = value;
+}
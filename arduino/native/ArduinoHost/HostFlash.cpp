@@ -0,0 +1,162 @@
+#include "esp_partition.h"
+#include "HostState.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define HOST_FLASH_SECTOR 4096
+
+// Static so flash traffic does not show in the firmware's heap figures
+static uint8_t cells[HOST_FLASH_SECTOR];
+static uint8_t erased[HOST_FLASH_SECTOR];
+
+// As in camera/partitions.csv, each backed by its own file once attached
+struct HostPartition {
+  esp_partition_t partition;
+  int fd;
+};
+static HostPartition partitions[] = {
+  {{ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40, 0x290000, 0, "imagelog", false}, -1},
+  {{ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x40, 0x2F0000, 0, "framestore", false}, -1},
+};
+
+static HostPartition* findPartition(const char* label) {
+  for (HostPartition& entry : partitions) {
+    if (strcmp(entry.partition.label, label) == 0) {
+      return &entry;
+    }
+  }
+  return NULL;
+}
+
+bool hostFlashAttach(const char* label, const char* path, uint32_t size, bool blank) {
+  HostPartition* entry = findPartition(label);
+  if (!entry) {
+    return false;
+  }
+  if (entry->fd >= 0) {
+    close(entry->fd);
+  }
+  entry->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (entry->fd < 0) {
+    return false;
+  }
+  int fd = entry->fd;
+  // A new or resized file starts out erased
+  memset(erased, 0xFF, sizeof(erased));
+  if (blank || lseek(fd, 0, SEEK_END) != (off_t)size) {
+    if (ftruncate(fd, size) != 0) {
+      return false;
+    }
+    for (uint32_t offset = 0; offset < size; offset += HOST_FLASH_SECTOR) {
+      size_t length = std::min((uint32_t)HOST_FLASH_SECTOR, size - offset);
+      if (pwrite(fd, erased, length, offset) != (ssize_t)length) {
+        return false;
+      }
+    }
+  }
+  entry->partition.size = size;
+  host.flashOperations = 0;
+  host.flashCutAt = 0;
+  return true;
+}
+
+void hostFlashCutPower(uint32_t operation) {
+  host.flashCutAt = operation ? host.flashOperations + operation : 0;
+}
+
+uint32_t hostFlashOperations() {
+  return host.flashOperations;
+}
+
+// Count a write or erase, true if the power goes during it
+static bool powerCut() {
+  host.flashOperations++;
+  if (host.flashCutAt && host.flashOperations == host.flashCutAt) {
+    host.flashCutAt = 0;
+    return true;
+  }
+  return false;
+}
+
+// The file behind an attached partition, -1 if the range is outside it
+static int partitionFile(const esp_partition_t* partition, size_t offset, size_t size) {
+  for (HostPartition& entry : partitions) {
+    if (partition == &entry.partition) {
+      return entry.fd >= 0 && offset + size <= partition->size ? entry.fd : -1;
+    }
+  }
+  return -1;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label) {
+  (void)subtype;
+  HostPartition* entry = label ? findPartition(label) : &partitions[0];
+  if (!entry || entry->fd < 0 || type != ESP_PARTITION_TYPE_DATA) {
+    return NULL;
+  }
+  return &entry->partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+  int fd = partitionFile(partition, src_offset, size);
+  if (fd < 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  return pread(fd, dst, size, src_offset) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+  int fd = partitionFile(partition, dst_offset, size);
+  if (fd < 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  bool cut = powerCut();
+  size_t length = cut ? size / 2 : size;
+
+  // Programming only clears bits
+  const uint8_t* bytes = (const uint8_t*)src;
+  for (size_t done = 0; done < length; done += HOST_FLASH_SECTOR) {
+    size_t step = std::min(length - done, (size_t)HOST_FLASH_SECTOR);
+    if (pread(fd, cells, step, dst_offset + done) != (ssize_t)step) {
+      return ESP_FAIL;
+    }
+    for (size_t i = 0; i < step; i++) {
+      cells[i] &= bytes[done + i];
+    }
+    if (pwrite(fd, cells, step, dst_offset + done) != (ssize_t)step) {
+      return ESP_FAIL;
+    }
+  }
+  host.traffic.flashBytesWritten += length;
+  if (cut) {
+    throw HostPowerLoss();
+  }
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+  int fd = partitionFile(partition, offset, size);
+  if (fd < 0) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (offset % HOST_FLASH_SECTOR || size % HOST_FLASH_SECTOR) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  for (size_t sector = offset; sector < offset + size; sector += HOST_FLASH_SECTOR) {
+    // A cut erase leaves half the sector erased, alternating halves so
+    // both a lost header and lost records are seen
+    bool cut = powerCut();
+    size_t start = cut && host.flashOperations % 2 ? HOST_FLASH_SECTOR / 2 : 0;
+    size_t length = cut ? HOST_FLASH_SECTOR / 2 : HOST_FLASH_SECTOR;
+    if (pwrite(fd, erased, length, sector + start) != (ssize_t)length) {
+      return ESP_FAIL;
+    }
+    host.traffic.flashErases++;
+    if (cut) {
+      throw HostPowerLoss();
+    }
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,117 @@
+#include "HostHarness.h"
+#include "HostState.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_LINK_RATE 100000   // Bytes per second, a fair WiFi link in the field
+#define DEFAULT_REPEAT 5
+
+static void printUsage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [--link BYTES_PER_S] [--repeat N] [--bursts DIR] [--verbose] FRAME_DIR\n"
+          "  FRAME_DIR      directory of recorded .jpg frames, served in name order, or\n"
+          "                 for gun_audio a .wav recording or a directory of them\n"
+          "  --bursts       directory of labeled bursts, one subdirectory each, for the\n"
+          "                 projects that select frames\n"
+          "  --link         simulated uplink rate, 0 for unlimited (default %d)\n"
+          "  --repeat       passes over the frames for stage timings (default %d)\n"
+          "  --verbose      echo the firmware's Serial output and status publishes to stderr\n",
+          program, DEFAULT_LINK_RATE, DEFAULT_REPEAT);
+}
+
+bool hostParseArgs(int argc, char** argv, HostOptions& options) {
+  options.frameDir = NULL;
+  options.linkBytesPerSecond = DEFAULT_LINK_RATE;
+  options.repeat = DEFAULT_REPEAT;
+  options.verbose = false;
+  options.burstDir = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--link") == 0 && i + 1 < argc) {
+      options.linkBytesPerSecond = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+      options.repeat = strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--bursts") == 0 && i + 1 < argc) {
+      options.burstDir = argv[++i];
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      options.verbose = true;
+    } else if (argv[i][0] != '-' && !options.frameDir) {
+      options.frameDir = argv[i];
+    } else {
+      printUsage(argv[0]);
+      return false;
+    }
+  }
+  if (!options.frameDir || options.repeat == 0) {
+    printUsage(argv[0]);
+    return false;
+  }
+
+  host.verbose = options.verbose;
+  hostSetLinkRate(options.linkBytesPerSecond);
+  return true;
+}
+
+void hostSetLinkRate(uint32_t bytesPerSecond) {
+  host.linkBytesPerSecond = bytesPerSecond;
+}
+
+// Stage timing
+
+static uint64_t cpuNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+HostStageTimer::HostStageTimer(HostStage& timedStage) : stage(timedStage), start(cpuNanos()) {
+}
+
+HostStageTimer::~HostStageTimer() {
+  hostStageRecord(stage, cpuNanos() - start);
+}
+
+void hostStageRecord(HostStage& stage, uint64_t elapsed) {
+  stage.totalNanos += elapsed;
+  if (stage.calls == 0 || elapsed < stage.minNanos) {
+    stage.minNanos = elapsed;
+  }
+  if (elapsed > stage.maxNanos) {
+    stage.maxNanos = elapsed;
+  }
+  stage.calls++;
+}
+
+void hostPrintStages(const char* title, const HostStage* stages, int count) {
+  printf("\n%s\n", title);
+  printf("  %-22s %8s %12s %12s %12s\n", "stage", "calls", "mean us", "min us", "max us");
+  for (int i = 0; i < count; i++) {
+    const HostStage& s = stages[i];
+    double mean = s.calls ? s.totalNanos / 1000.0 / s.calls : 0;
+    printf("  %-22s %8u %12.1f %12.1f %12.1f\n", s.name, (unsigned)s.calls, mean,
+           s.minNanos / 1000.0, s.maxNanos / 1000.0);
+  }
+}
+
+void hostPrintTraffic(const char* title, size_t frames) {
+  const HostMqttStats& t = host.traffic;
+  printf("\n%s\n", title);
+  printf("  %-22s %12u\n", "frames captured", (unsigned)frames);
+  printf("  %-22s %12u\n", "mqtt messages", (unsigned)t.messages);
+  printf("  %-22s %12u\n", "mqtt rejected", (unsigned)t.rejected);
+  printf("  %-22s %12llu\n", "mqtt payload bytes", (unsigned long long)t.bytes);
+  printf("  %-22s %12.0f\n", "bytes per frame", frames ? (double)t.bytes / frames : 0.0);
+  printf("  %-22s %12u\n", "web responses", (unsigned)t.webResponses);
+  printf("  %-22s %12u\n", "servo moves", (unsigned)t.servoMoves);
+  printf("  %-22s %12u\n", "frame buffers peak", (unsigned)host.outstandingPeak);
+  printf("  %-22s %12u\n", "capture stalls", (unsigned)t.captureStalls);
+  printf("  %-22s %12llu\n", "flash bytes written", (unsigned long long)t.flashBytesWritten);
+  printf("  %-22s %12u\n", "flash erases", (unsigned)t.flashErases);
+  printf("  %-22s %12u\n", "heap peak bytes", (unsigned)hostHeapPeak());
+  printf("  %-22s %12.1f\n", "virtual seconds", host.clockMicros / 1e6);
+  printf("  %-22s %12d\n", "final frame size", hostSensorFrameSize());
+  printf("  %-22s %12d\n", "final quality", hostSensorQuality());
+}
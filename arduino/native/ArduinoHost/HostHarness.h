@@ -0,0 +1,150 @@
+/*
+  HostHarness - benchmark driver hooks for the native build
+
+  The firmware runs unchanged on top of the ArduinoHost stand-ins. A
+  driver program (bench/ in each project) loads recorded JPEG frames or
+  WAV recordings, calls setup() and loop() or individual firmware
+  stages, and wraps them in HostStage timers. Timings are CPU time of the host
+  process. The clock the firmware sees is virtual, and moves on delay()
+  and on bytes sent over the simulated uplink.
+*/
+
+#ifndef HOST_HARNESS_H
+#define HOST_HARNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct HostOptions {
+  const char* frameDir;
+  uint32_t linkBytesPerSecond;  // Simulated uplink rate, 0 = unlimited
+  uint16_t repeat;              // Passes over the frames for the stage timings
+  bool verbose;                 // Echo the firmware's Serial output
+  const char* burstDir;         // Labeled bursts for the frame selection run, or NULL
+};
+
+// Parse the common command line, printing usage and returning false on error
+bool hostParseArgs(int argc, char** argv, HostOptions& options);
+
+// Frames served by esp_camera_fb_get(), in file name order. A
+// subdirectory named after a frame size (qvga, vga, ...) holds frames
+// served instead while the sensor is set to that size.
+size_t hostLoadFrames(const char* directory);
+void hostRewindFrames();
+size_t hostFrameCount();
+const char* hostFrameName(size_t index);
+bool hostFramesExhausted();          // True once fb_get has run out
+size_t hostFramesServed();
+size_t hostFramesOutstanding();      // Frame buffers not yet returned
+size_t hostFramesOutstandingPeak();
+
+// Recordings served by i2s_read(), back to back as one stream: a 16-bit
+// mono PCM WAV file, or every one in a directory in name order. Returns
+// the number of files added; their sample rate must match the driver's.
+size_t hostLoadRecordings(const char* path);
+uint64_t hostRecordingSamples();     // Length of everything loaded
+uint32_t hostRecordingRate();
+// Recording a sample of the stream falls in, and its seconds into it
+const char* hostRecordingAt(uint64_t sample, double& seconds);
+const char* hostRecordingPath(size_t index);  // NULL past the last
+
+struct HostAudioStats {
+  uint64_t samplesRead;              // Handed to the firmware
+  uint64_t samplesLost;              // Overwritten in the DMA buffers before they were read
+  uint32_t overflows;                // DMA buffers lost
+  uint64_t fileNanos;                // CPU time reading the recordings, inside i2s_read()
+};
+const HostAudioStats& hostAudioStats();
+
+// Sensor settings last applied by the firmware
+int hostSensorFrameSize();
+int hostSensorQuality();
+
+// Virtual clock
+void hostAdvanceMicros(uint64_t micros);
+void hostSetLinkRate(uint32_t bytesPerSecond);
+
+// Pins and wake cause seen by the firmware
+void hostSetPin(uint8_t pin, int level);
+int hostPinLevel(uint8_t pin);
+void hostSetWakeupCause(int cause);
+void hostSetWifiUp(bool up);
+// A stopped broker refuses connections and drops the open ones. A
+// nonzero refusal is a PubSubClient state() code, such as
+// MQTT_CONNECT_UNAVAILABLE, that CONNECT is answered with instead.
+void hostSetBrokerUp(bool up);
+void hostSetBrokerRefusal(int state);
+void hostSetPsram(bool present);
+
+// Traffic published by the firmware since the last reset
+struct HostMqttStats {
+  uint32_t messages;
+  uint32_t rejected;                 // publish() calls that did not fit the buffer
+  uint64_t bytes;                    // Payload bytes accepted
+  uint32_t webResponses;
+  uint32_t servoMoves;
+  uint32_t captureStalls;             // esp_camera_fb_get() with all fb_count buffers held
+  uint64_t flashBytesWritten;
+  uint32_t flashErases;              // 4 KB sectors
+};
+const HostMqttStats& hostMqttStats();
+void hostResetMqttStats();
+// Called with every message the firmware publishes, once it is complete
+typedef void (*HostMqttRecorder)(const char* topic, const uint8_t* payload, size_t length);
+void hostSetMqttRecorder(HostMqttRecorder recorder);
+// Deliver a message to the firmware's MQTT callback
+void hostDeliver(const char* topic, const uint8_t* payload, unsigned int length);
+
+// Flash partition "imagelog" or "framestore", kept in a file. blank
+// erases it, otherwise whatever the file holds is kept, as across a
+// reboot. A partition never attached is not found by the firmware.
+bool hostFlashAttach(const char* label, const char* path, uint32_t size, bool blank);
+// Cut the power on the operation-th write or erase from now: it is half
+// done, then HostPowerLoss is thrown
+void hostFlashCutPower(uint32_t operation);
+uint32_t hostFlashOperations();
+
+// Heap use through operator new/delete. The peak is counted from the
+// last reset, so the harness's own frame store is left out.
+size_t hostHeapInUse();
+size_t hostHeapPeak();
+void hostHeapResetPeak();
+
+// Accumulated CPU time of one firmware stage
+struct HostStage {
+  const char* name;
+  uint64_t totalNanos;
+  uint64_t minNanos;
+  uint64_t maxNanos;
+  uint32_t calls;
+};
+
+class HostStageTimer {
+public:
+  explicit HostStageTimer(HostStage& stage);
+  ~HostStageTimer();
+
+private:
+  HostStage& stage;
+  uint64_t start;
+};
+
+#define HOST_STAGE_CONCAT2(a, b) a##b
+#define HOST_STAGE_CONCAT(a, b) HOST_STAGE_CONCAT2(a, b)
+#define HOST_STAGE(stage) HostStageTimer HOST_STAGE_CONCAT(hostStageTimer, __LINE__)(stage)
+// Add a sample measured some other way, such as a virtual time span
+void hostStageRecord(HostStage& stage, uint64_t nanos);
+
+void hostPrintStages(const char* title, const HostStage* stages, int count);
+void hostPrintTraffic(const char* title, size_t frames);
+
+// Thrown by esp_deep_sleep_start()
+struct HostDeepSleep {};
+
+// Thrown by i2s_read() once the recordings have run out
+struct HostAudioEnd {};
+
+// Thrown by a flash operation when hostFlashCutPower() lands on it
+struct HostPowerLoss {};
+
+#endif
@@ -0,0 +1,305 @@
+#include "WiFi.h"
+#include "WiFiClientSecure.h"
+#include "WebServer.h"
+#include "PubSubClient.h"
+#include "HTTPClient.h"
+#include "HostState.h"
+
+WiFiClass WiFi;
+
+// The most recently constructed MQTT client receives hostDeliver() messages
+static PubSubClient* activeMqtt = NULL;
+static HostMqttRecorder mqttRecorder = NULL;
+
+#define MQTT_VERBOSE_PAYLOAD 512   // Longer publishes are image data, not echoed
+
+// IPAddress
+
+String IPAddress::toString() const {
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+  return String(buffer);
+}
+
+IPAddress::IPAddress(uint32_t address) {
+  memcpy(octets, &address, sizeof(octets));
+}
+
+IPAddress::operator uint32_t() const {
+  uint32_t address;
+  memcpy(&address, octets, sizeof(address));
+  return address;
+}
+
+size_t IPAddress::printTo(Print& p) const {
+  return p.print(toString());
+}
+
+// WiFi
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel,
+                             const uint8_t* bssid, bool connect) {
+  (void)ssid;
+  (void)passphrase;
+  (void)channel;
+  (void)bssid;
+  joined = connect;
+  return status();
+}
+
+bool WiFiClass::config(IPAddress localIp, IPAddress gateway, IPAddress subnet, IPAddress dns1) {
+  (void)localIp;
+  (void)gateway;
+  (void)subnet;
+  (void)dns1;
+  return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp) {
+  (void)wifiOff;
+  (void)eraseAp;
+  joined = false;
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  return joined && host.wifiUp ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+void hostSetWifiUp(bool up) {
+  host.wifiUp = up;
+}
+
+void hostSetBrokerUp(bool up) {
+  host.brokerUp = up;
+}
+
+void hostSetBrokerRefusal(int state) {
+  host.brokerRefusal = state;
+}
+
+// Client
+
+int Client::connect(const char* host, uint16_t port) {
+  (void)host;
+  (void)port;
+  open = WiFi.status() == WL_CONNECTED && ::host.brokerUp;
+  return open;
+}
+
+uint8_t Client::connected() {
+  if (open && !host.brokerUp) {
+    open = false;
+  }
+  return open;
+}
+
+size_t Client::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t Client::write(const uint8_t* buffer, size_t size) {
+  (void)buffer;
+  if (!open) {
+    return 0;
+  }
+  hostChargeLink(size);
+  return size;
+}
+
+// WebServer
+
+void WebServer::send(int code, const char* contentType, const String& content) {
+  (void)code;
+  (void)contentType;
+  host.traffic.webResponses++;
+  hostChargeLink(content.length());
+}
+
+void WebServer::send_P(int code, const char* contentType, const char* content) {
+  (void)code;
+  (void)contentType;
+  host.traffic.webResponses++;
+  hostChargeLink(strlen(content));
+}
+
+void WebServer::sendHeader(const String& name, const String& value, bool first) {
+  (void)name;
+  (void)value;
+  (void)first;
+}
+
+// HTTPClient
+
+int HTTPClient::POST(const String& payload) {
+  hostChargeLink(payload.length());
+  return HTTPC_ERROR_CONNECTION_REFUSED;
+}
+
+// PubSubClient
+
+PubSubClient::PubSubClient(Client& netClient) : client(&netClient) {
+  activeMqtt = this;
+}
+
+PubSubClient& PubSubClient::setServer(const char* serverDomain, uint16_t serverPort) {
+  domain = serverDomain;
+  port = serverPort;
+  return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+  this->callback = callback;
+  return *this;
+}
+
+boolean PubSubClient::setBufferSize(uint16_t size) {
+  if (size == 0) {
+    return false;
+  }
+  bufferSize = size;
+  return true;
+}
+
+boolean PubSubClient::connect(const char* id, const char* user, const char* pass) {
+  (void)id;
+  (void)user;
+  (void)pass;
+  if (!client->connected() && !client->connect(domain, port)) {
+    currentState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  if (host.brokerRefusal) {
+    currentState = host.brokerRefusal;
+    client->stop();
+    return false;
+  }
+  currentState = MQTT_CONNECTED;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  currentState = MQTT_DISCONNECTED;
+  client->stop();
+}
+
+boolean PubSubClient::connected() {
+  if (currentState == MQTT_CONNECTED && !client->connected()) {
+    currentState = MQTT_CONNECTION_LOST;
+  }
+  if (currentState == MQTT_CONNECTED && WiFi.status() != WL_CONNECTED) {
+    client->stop();
+    currentState = MQTT_CONNECTION_LOST;
+  }
+  return currentState == MQTT_CONNECTED;
+}
+
+boolean PubSubClient::loop() {
+  return connected();
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload, boolean retained) {
+  return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int length, boolean retained) {
+  (void)payload;
+  (void)retained;
+  if (!connected()) {
+    return false;
+  }
+  // Same limit as the real client: header, topic and payload in one buffer
+  if (bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, bufferSize) + length) {
+    host.traffic.rejected++;
+    return false;
+  }
+  host.traffic.messages++;
+  host.traffic.bytes += length;
+  // Status-sized messages are echoed with the Serial output
+  if (host.verbose && length <= MQTT_VERBOSE_PAYLOAD) {
+    fprintf(stderr, "[mqtt] %s %.*s\n", topic, (int)length, (const char*)payload);
+  }
+  client->write(payload, length);
+  if (mqttRecorder) {
+    mqttRecorder(topic, payload, length);
+  }
+  return true;
+}
+
+boolean PubSubClient::beginPublish(const char* topic, unsigned int length, boolean retained) {
+  (void)retained;
+  if (!connected()) {
+    return false;
+  }
+  streamRemaining = length;
+  if (mqttRecorder) {
+    streamTopic = topic;
+    streamPayload.clear();
+  }
+  return true;
+}
+
+size_t PubSubClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+  if (!connected()) {
+    return 0;
+  }
+  size_t accepted = size < streamRemaining ? size : streamRemaining;
+  streamRemaining -= accepted;
+  host.traffic.bytes += accepted;
+  if (mqttRecorder) {
+    streamPayload.insert(streamPayload.end(), buffer, buffer + accepted);
+  }
+  return client->write(buffer, accepted);
+}
+
+int PubSubClient::endPublish() {
+  if (!connected()) {
+    return 0;
+  }
+  host.traffic.messages++;
+  bool complete = streamRemaining == 0;
+  streamRemaining = 0;
+  if (mqttRecorder && complete) {
+    mqttRecorder(streamTopic.c_str(), streamPayload.data(), streamPayload.size());
+  }
+  return complete ? 1 : 0;
+}
+
+boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
+  (void)topic;
+  (void)qos;
+  return connected();
+}
+
+void PubSubClient::deliver(const char* topic, const uint8_t* payload, unsigned int length) {
+  if (!callback) {
+    return;
+  }
+  // The real client hands out its own buffer, so give the callback a
+  // writable copy of both
+  std::string topicCopy(topic);
+  std::vector<uint8_t> payloadCopy(payload, payload + length);
+  callback(&topicCopy[0], payloadCopy.data(), length);
+}
+
+void hostDeliver(const char* topic, const uint8_t* payload, unsigned int length) {
+  if (activeMqtt) {
+    activeMqtt->deliver(topic, payload, length);
+  }
+}
+
+const HostMqttStats& hostMqttStats() {
+  return host.traffic;
+}
+
+void hostResetMqttStats() {
+  host.traffic = HostMqttStats();
+}
+
+void hostSetMqttRecorder(HostMqttRecorder recorder) {
+  mqttRecorder = recorder;
+}
@@ -0,0 +1,51 @@
+/*
+  HostState - state shared between the ArduinoHost stand-ins and the
+  harness. Not part of the interface used by the firmware or drivers.
+*/
+
+#ifndef HOST_STATE_H
+#define HOST_STATE_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "HostHarness.h"
+
+struct HostFrame {
+  std::string name;
+  std::vector<uint8_t> data;
+  uint16_t width, height;
+};
+
+struct HostState {
+  uint64_t clockMicros = 0;
+  uint32_t linkBytesPerSecond = 0;
+  bool verbose = false;
+  bool psram = true;
+  bool wifiUp = true;
+  bool brokerUp = true;
+  int brokerRefusal = 0;             // CONNACK code answered to CONNECT, 0 accepts
+  int wakeupCause = 0;
+  uint8_t pins[40] = {};
+
+  std::vector<HostFrame> frames;
+  std::map<int, std::vector<HostFrame> > sizedFrames;  // By framesize_t, served while the sensor is set to it
+  size_t nextFrame = 0;
+  bool framesExhausted = false;
+  size_t frameCapacity = 0;          // Buffer size of every frame handed out
+  size_t outstanding = 0;
+  size_t outstandingPeak = 0;
+
+  HostMqttStats traffic = {};
+
+  uint32_t flashOperations = 0;      // Writes and erases since attach
+  uint32_t flashCutAt = 0;           // Operation torn by a power cut, 0 for none
+};
+
+extern HostState host;
+
+// Charge bytes sent over the network to the virtual clock
+void hostChargeLink(size_t bytes);
+
+#endif
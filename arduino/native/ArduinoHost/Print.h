@@ -0,0 +1,57 @@
+/*
+  Print - host stand-in for the Arduino Print base class
+
+  Provides the print/println/printf overloads the firmware uses on
+  Serial, network clients and the MQTT client. Subclasses only
+  implement the two write() calls.
+*/
+
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class String;
+class Print;
+
+class Printable {
+public:
+  virtual ~Printable() {}
+  virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str);
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+
+  size_t print(const char* str);
+  size_t print(const String& str);
+  size_t print(char c);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t print(const Printable& value);
+
+  size_t println();
+  template <typename T> size_t println(const T& value) { return print(value) + println(); }
+  template <typename T> size_t println(const T& value, int format) { return print(value, format) + println(); }
+
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t printNumber(unsigned long value, int base, bool negative);
+};
+
+#endif
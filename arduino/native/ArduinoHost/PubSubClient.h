@@ -0,0 +1,89 @@
+/*
+  PubSubClient - host stand-in for knolleary/PubSubClient 2.8
+
+  Same interface and the same size limits as the real client: a
+  publish() whose packet does not fit the buffer fails, and the
+  streaming beginPublish()/write()/endPublish() path bypasses the
+  buffer. Published bytes are counted per run and charged to the
+  simulated uplink, and handed to the harness's recorder if it set one.
+  hostDeliver() feeds a message to the callback.
+*/
+
+#ifndef HOST_PUB_SUB_CLIENT_H
+#define HOST_PUB_SUB_CLIENT_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Client.h"
+
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256
+#endif
+#define MQTT_MAX_HEADER_SIZE 5
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_BAD_PROTOCOL 1
+#define MQTT_CONNECT_BAD_CLIENT_ID 2
+#define MQTT_CONNECT_UNAVAILABLE 3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED 5
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient : public Print {
+public:
+  explicit PubSubClient(Client& client);
+
+  PubSubClient& setServer(const char* domain, uint16_t port);
+  PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+  PubSubClient& setKeepAlive(uint16_t keepAlive) { (void)keepAlive; return *this; }
+  PubSubClient& setSocketTimeout(uint16_t timeout) { (void)timeout; return *this; }
+  boolean setBufferSize(uint16_t size);
+  uint16_t getBufferSize() { return bufferSize; }
+
+  boolean connect(const char* id) { return connect(id, NULL, NULL); }
+  boolean connect(const char* id, const char* user, const char* pass);
+  void disconnect();
+
+  boolean publish(const char* topic, const char* payload, boolean retained = false);
+  boolean publish(const char* topic, const uint8_t* payload, unsigned int length, boolean retained = false);
+  boolean beginPublish(const char* topic, unsigned int length, boolean retained);
+  int endPublish();
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+
+  boolean subscribe(const char* topic, uint8_t qos = 0);
+  boolean unsubscribe(const char* topic) { (void)topic; return connected(); }
+  boolean loop();
+  boolean connected();
+  int state() { return currentState; }
+
+  // Hand a message to the callback as if the broker had sent it
+  void deliver(const char* topic, const uint8_t* payload, unsigned int length);
+
+private:
+  Client* client;
+  const char* domain = NULL;
+  uint16_t port = 0;
+  uint16_t bufferSize = MQTT_MAX_PACKET_SIZE;
+  int currentState = MQTT_DISCONNECTED;
+  std::function<void(char*, uint8_t*, unsigned int)> callback;
+  unsigned int streamRemaining = 0;   // Bytes still expected by the open beginPublish()
+  std::string streamTopic;
+  std::vector<uint8_t> streamPayload;  // Kept for the recorder
+};
+
+#endif
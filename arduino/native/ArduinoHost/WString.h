@@ -0,0 +1,63 @@
+/*
+  WString - host stand-in for the Arduino String class
+
+  Backed by std::string, so every allocation goes through operator new
+  and shows up in the harness heap figures the same way the firmware's
+  String use costs heap on the device.
+*/
+
+#ifndef HOST_WSTRING_H
+#define HOST_WSTRING_H
+
+#include <string>
+#include "Print.h"
+
+class String {
+public:
+  String() {}
+  String(const char* str) : value(str ? str : "") {}
+  String(const std::string& str) : value(str) {}
+  explicit String(char c) : value(1, c) {}
+  String(int number, unsigned char base = DEC) { fromNumber(number < 0 ? -(long)number : number, base, number < 0); }
+  String(unsigned int number, unsigned char base = DEC) { fromNumber(number, base, false); }
+  String(long number, unsigned char base = DEC) { fromNumber(number < 0 ? -number : number, base, number < 0); }
+  String(unsigned long number, unsigned char base = DEC) { fromNumber(number, base, false); }
+  explicit String(double number, unsigned int digits = 2);
+
+  unsigned int length() const { return value.length(); }
+  const char* c_str() const { return value.c_str(); }
+  bool reserve(unsigned int size) { value.reserve(size); return true; }
+  char charAt(unsigned int index) const { return index < value.length() ? value[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  String substring(unsigned int from) const { return substring(from, length()); }
+  String substring(unsigned int from, unsigned int to) const;
+  int indexOf(char c, unsigned int from = 0) const;
+  int indexOf(const char* str, unsigned int from = 0) const;
+  bool startsWith(const char* prefix) const { return value.compare(0, strlenSafe(prefix), prefix ? prefix : "") == 0; }
+  long toInt() const;
+
+  String& operator+=(const String& other) { value += other.value; return *this; }
+  String& operator+=(const char* str) { value += str ? str : ""; return *this; }
+  String& operator+=(char c) { value += c; return *this; }
+  String& operator+=(int number) { return *this += String(number); }
+  String& operator+=(unsigned long number) { return *this += String(number); }
+  bool concat(const String& other) { value += other.value; return true; }
+
+  bool operator==(const String& other) const { return value == other.value; }
+  bool operator==(const char* str) const { return value == (str ? str : ""); }
+  bool operator!=(const String& other) const { return !(*this == other); }
+  bool operator!=(const char* str) const { return !(*this == str); }
+
+private:
+  void fromNumber(unsigned long number, unsigned char base, bool negative);
+  static size_t strlenSafe(const char* str);
+
+  std::string value;
+};
+
+inline String operator+(const String& a, const String& b) { String s(a); s += b; return s; }
+inline String operator+(const String& a, const char* b) { String s(a); s += b; return s; }
+inline String operator+(const char* a, const String& b) { String s(a); s += b; return s; }
+inline String operator+(const String& a, char b) { String s(a); s += b; return s; }
+
+#endif
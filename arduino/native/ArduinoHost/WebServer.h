@@ -0,0 +1,31 @@
+/*
+  WebServer - host stand-in for the ESP32 WebServer
+
+  Registers handlers but never receives requests; responses sent from
+  handlers the harness calls directly are counted as web traffic.
+*/
+
+#ifndef HOST_WEB_SERVER_H
+#define HOST_WEB_SERVER_H
+
+#include <functional>
+#include "WiFi.h"
+
+class WebServer {
+public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit WebServer(int port = 80) { (void)port; }
+  void begin() {}
+  void close() {}
+  void handleClient() {}
+  void on(const char* uri, THandlerFunction handler) { (void)uri; (void)handler; }
+  void onNotFound(THandlerFunction handler) { (void)handler; }
+  void send(int code, const char* contentType = NULL, const String& content = String());
+  void send_P(int code, const char* contentType, const char* content);
+  void sendHeader(const String& name, const String& value, bool first = false);
+  void setContentLength(size_t length) { (void)length; }
+  WiFiClient client() { return WiFiClient(); }
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+  WiFi - host stand-in for the ESP32 WiFi station interface
+
+  Joins immediately on begin(), with or without a cached channel, BSSID
+  and static lease; the harness can take the link down with
+  hostSetWifiUp(false) to exercise reconnect paths.
+*/
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include "Arduino.h"
+#include "Client.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+class IPAddress : public Printable {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : octets{a, b, c, d} {}
+  IPAddress(uint32_t address);       // First octet in the low byte, as on the ESP32
+  operator uint32_t() const;
+  String toString() const;
+  size_t printTo(Print& p) const override;
+
+private:
+  uint8_t octets[4];
+};
+
+class WiFiClass {
+public:
+  wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0,
+                    const uint8_t* bssid = NULL, bool connect = true);
+  bool config(IPAddress localIp, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress());
+  bool disconnect(bool wifiOff = false, bool eraseAp = false);
+  wl_status_t status();
+  bool mode(wifi_mode_t mode) { (void)mode; return true; }
+  bool setSleep(bool enable) { (void)enable; return true; }
+  IPAddress localIP() { return IPAddress(192, 168, 4, 2); }
+  IPAddress gatewayIP() { return IPAddress(192, 168, 4, 1); }
+  IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+  IPAddress dnsIP(uint8_t dnsNo = 0) { (void)dnsNo; return IPAddress(192, 168, 4, 1); }
+  uint8_t* BSSID() { return bssid; }
+  int32_t channel() { return 6; }
+  int8_t RSSI() { return -60; }
+
+private:
+  bool joined = false;
+  uint8_t bssid[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public Client {
+public:
+  int fd() const { return -1; }
+  int setNoDelay(bool noDelay) { (void)noDelay; return 0; }
+};
+
+#endif
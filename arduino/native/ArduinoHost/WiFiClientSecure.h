@@ -0,0 +1,20 @@
+/*
+  WiFiClientSecure - host stand-in for the ESP32 TLS client
+
+  The handshake is not simulated; certificate and timeout settings are
+  accepted and ignored.
+*/
+
+#ifndef HOST_WIFI_CLIENT_SECURE_H
+#define HOST_WIFI_CLIENT_SECURE_H
+
+#include "WiFi.h"
+
+class WiFiClientSecure : public WiFiClient {
+public:
+  void setInsecure() {}
+  void setCACert(const char* rootCa) { (void)rootCa; }
+  void setHandshakeTimeout(unsigned long seconds) { (void)seconds; }
+};
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  i2s - host stand-in for the ESP-IDF I2S driver, receive side
+
+  Samples come from the recordings the harness loads with
+  hostLoadRecordings(), one 16-bit sample per word, shifted to the top
+  of 32-bit words as a 24-bit microphone delivers them. The microphone
+  runs on the virtual clock: i2s_read() waits (moves the clock) until
+  the samples it asks for have been captured, and when the firmware
+  reads late, the driver's DMA buffers hold only dma_buf_count *
+  dma_buf_len samples. Older whole buffers are lost and reported on the
+  event queue as I2S_EVENT_RX_Q_OVF, as the driver does. Once the
+  recordings run out, i2s_read() throws HostAudioEnd.
+*/
+
+#ifndef HOST_I2S_H
+#define HOST_I2S_H
+
+#include "../Arduino.h"
+
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+typedef enum { I2S_NUM_0 = 0, I2S_NUM_1, I2S_NUM_MAX } i2s_port_t;
+
+typedef enum {
+  I2S_MODE_MASTER = 1 << 0,
+  I2S_MODE_SLAVE = 1 << 1,
+  I2S_MODE_TX = 1 << 2,
+  I2S_MODE_RX = 1 << 3
+} i2s_mode_t;
+
+typedef enum {
+  I2S_BITS_PER_SAMPLE_16BIT = 16,
+  I2S_BITS_PER_SAMPLE_24BIT = 24,
+  I2S_BITS_PER_SAMPLE_32BIT = 32
+} i2s_bits_per_sample_t;
+
+typedef enum {
+  I2S_CHANNEL_FMT_RIGHT_LEFT,
+  I2S_CHANNEL_FMT_ALL_RIGHT,
+  I2S_CHANNEL_FMT_ALL_LEFT,
+  I2S_CHANNEL_FMT_ONLY_RIGHT,
+  I2S_CHANNEL_FMT_ONLY_LEFT
+} i2s_channel_fmt_t;
+
+typedef enum {
+  I2S_COMM_FORMAT_STAND_I2S = 0x01,
+  I2S_COMM_FORMAT_STAND_MSB = 0x02,
+  I2S_COMM_FORMAT_I2S = 0x01
+} i2s_comm_format_t;
+
+typedef struct {
+  i2s_mode_t mode;
+  uint32_t sample_rate;
+  i2s_bits_per_sample_t bits_per_sample;
+  i2s_channel_fmt_t channel_format;
+  i2s_comm_format_t communication_format;
+  int intr_alloc_flags;
+  int dma_buf_count;
+  int dma_buf_len;
+  bool use_apll;
+  bool tx_desc_auto_clear;
+  int fixed_mclk;
+} i2s_config_t;
+
+typedef struct {
+  int mck_io_num;
+  int bck_io_num;
+  int ws_io_num;
+  int data_out_num;
+  int data_in_num;
+} i2s_pin_config_t;
+
+typedef enum {
+  I2S_EVENT_DMA_ERROR,
+  I2S_EVENT_TX_DONE,
+  I2S_EVENT_RX_DONE,
+  I2S_EVENT_TX_Q_OVF,
+  I2S_EVENT_RX_Q_OVF,
+  I2S_EVENT_MAX
+} i2s_event_type_t;
+
+typedef struct {
+  i2s_event_type_t type;
+  size_t size;
+} i2s_event_t;
+
+// i2s_queue, if not NULL, receives a QueueHandle_t of i2s_event_t
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t* config, int queueSize, void* i2s_queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t* pins);
+esp_err_t i2s_read(i2s_port_t port, void* dest, size_t size, size_t* bytesRead, TickType_t ticksToWait);
+
+#endif
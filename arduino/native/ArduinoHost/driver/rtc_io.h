@@ -0,0 +1,17 @@
+/*
+  rtc_io - host stand-in for the RTC GPIO driver, calls are accepted and ignored
+*/
+
+#ifndef HOST_RTC_IO_H
+#define HOST_RTC_IO_H
+
+#include "../Arduino.h"
+
+inline esp_err_t rtc_gpio_pullup_dis(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+inline esp_err_t rtc_gpio_pullup_en(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+inline esp_err_t rtc_gpio_pulldown_dis(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+inline esp_err_t rtc_gpio_pulldown_en(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+inline esp_err_t rtc_gpio_hold_en(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+inline esp_err_t rtc_gpio_hold_dis(gpio_num_t gpio) { (void)gpio; return ESP_OK; }
+
+#endif
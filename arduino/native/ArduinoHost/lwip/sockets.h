@@ -0,0 +1,14 @@
+/*
+  lwip/sockets - host stand-in for the lwIP BSD socket API
+
+  The host's own socket calls have the same names and flags. Host
+  WiFiClients have no socket, so writes to them fail as closed.
+*/
+
+#ifndef HOST_LWIP_SOCKETS_H
+#define HOST_LWIP_SOCKETS_H
+
+#include <errno.h>
+#include <sys/socket.h>
+
+#endif
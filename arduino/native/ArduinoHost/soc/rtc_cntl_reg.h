@@ -0,0 +1,10 @@
+/*
+  rtc_cntl_reg - host stand-in for the RTC control register addresses
+*/
+
+#ifndef HOST_RTC_CNTL_REG_H
+#define HOST_RTC_CNTL_REG_H
+
+#define RTC_CNTL_BROWN_OUT_REG 0
+
+#endif
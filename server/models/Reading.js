@@ -35,6 +35,9 @@ const readingSchema = new mongoose.Schema({
           },
           "imageNumber": {
             "type": "Number"
+          },
+          "eventId": {
+            "type": "Number"
           }
         }],
         "isProcessed": {
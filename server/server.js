@@ -97,6 +97,18 @@ app.get("/audio/:readingId", async (req, res) => {
   }
 });
 
+// Ask a camera for the full frames of an event, body {event_id, frame}.
+// Without frame every frame of the event is sent.
+app.post("/cameras/:deviceId/request", (req, res) => {
+  const eventId = Number(req.body.event_id);
+  const frame = req.body.frame === undefined ? undefined : Number(req.body.frame);
+  if (!Number.isInteger(eventId) || eventId <= 0 || (frame !== undefined && (!Number.isInteger(frame) || frame < 0))) {
+    return res.status(400).json({ status: "error", message: "event_id and frame must be whole numbers" });
+  }
+  require('./services/mqttClient').requestImages(req.params.deviceId, eventId, frame);
+  res.status(202).json({ status: "success", message: "Frames requested" });
+});
+
 // Basic health check route
 app.get("/", (req, res) => {
   res.status(200).json({
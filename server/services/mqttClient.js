@@ -27,9 +27,29 @@ const topics = {
 // Audio buffer storage - stores packets until we have a complete recording
 const audioBuffers = {};
 
+// Binary audio frames (see gun_audio.ino): a 16-byte header, then
+// whole IMA ADPCM blocks
+const AUDIO_FRAME_MAGIC = 0xA7;
+const AUDIO_FRAME_HEADER_BYTES = 16;
+const AUDIO_CODEC_IMA_ADPCM = 1;
+const AUDIO_FRAME_PRESHOT = 0x01;
+const AUDIO_FRAME_LAST = 0x02;
+const ADPCM_BLOCK_BYTES = 132;
+
+// Finalize a recording whose last frame never arrived this long after
+// its most recent frame
+const AUDIO_FRAME_TIMEOUT_MS = 30000;
+
 // Store image chunks in memory before saving to DB
 const imageBuffers = {};
 
+// Reading each camera event's images are attached to, so full frames
+// requested later join the thumbnail that came with the alert
+const eventReadings = {};
+
+// Camera thumbnails use this image number, an event's frames count from 0
+const THUMBNAIL_IMAGE_NUMBER = 255;
+
 // Create MQTT client
 const client = mqtt.connect(brokerUrl, options);
 
@@ -115,8 +135,14 @@ async function processSensorData(topic, data) {
   
   // Initialize audio buffer for this alert if it indicates audio is available
   if (data.audioAvailable) {
-    // Create a unique key for this alert
-    const alertKey = `${sensorId}_${data.timestamp}`;
+    // Create a unique key for this alert; audio frames carry its eventId
+    const alertKey = `${sensorId}_${data.eventId !== undefined ? data.eventId : data.timestamp}`;
+    
+    // Frames that arrived while the reading was saved keep their buffer
+    if (audioBuffers[alertKey]) {
+      audioBuffers[alertKey].readingId = reading._id;
+      return;
+    }
     
     // Initialize the audio buffer for this alert
     audioBuffers[alertKey] = {
@@ -181,6 +207,10 @@ async function processAnimalData(topic, data) {
 
 // Process audio data
 async function processAudioData(sensorId, message) {
+  if (message.length >= AUDIO_FRAME_HEADER_BYTES && message[0] === AUDIO_FRAME_MAGIC) {
+    return processAudioFrame(sensorId, message);
+  }
+  
   try {
     // Extract metadata length from first two bytes (as per ESP32 code)
     const metadataLength = message[0] | (message[1] << 8);
@@ -190,7 +220,13 @@ async function processAudioData(sensorId, message) {
     const metadata = JSON.parse(metadataBuffer.toString());
     
     // Extract the audio data (everything after metadata)
-    const audioData = message.slice(2 + metadataLength);
+    let audioData = message.slice(2 + metadataLength);
+    
+    // ADPCM packets carry whole blocks; store them as 16-bit PCM
+    if (metadata.codec === 'ima-adpcm') {
+      audioData = decodeImaAdpcm(audioData, metadata.blockAlign || 132);
+      metadata.bits = 16;
+    }
     
     console.log(`Received audio packet: ${audioData.length} bytes, sensorId: ${metadata.sensorId}, isPreshot: ${metadata.isPreshot}`);
     
@@ -237,6 +273,125 @@ async function processAudioData(sensorId, message) {
   }
 }
 
+// Process a binary audio frame. Frames are placed by their sample
+// offset, so audio lost on the way becomes silence of the right length,
+// and the recording is finalized on the frame flagged last.
+async function processAudioFrame(sensorId, message) {
+  try {
+    const codec = message[2];
+    const flags = message[3];
+    const eventId = message.readUInt32LE(4);
+    const sequence = message.readUInt16LE(8);
+    const sampleOffset = message.readUInt32LE(10);
+    const sampleRate = message.readUInt16LE(14);
+    
+    if (codec !== AUDIO_CODEC_IMA_ADPCM) {
+      console.error(`Unsupported audio codec ${codec} from sensor ${sensorId}`);
+      return;
+    }
+    const pcm = decodeImaAdpcm(message.slice(AUDIO_FRAME_HEADER_BYTES), ADPCM_BLOCK_BYTES);
+    
+    const alertKey = `${sensorId}_${eventId}`;
+    if (!audioBuffers[alertKey]) {
+      console.log(`Creating audio buffer for alert ${alertKey} (audio arrived before alert)`);
+      audioBuffers[alertKey] = {
+        sensorId: sensorId,
+        timestamp: eventId,  // Device millis at detection, as the alert's timestamp
+        preshot: [],
+        postshot: [],
+        metadata: {
+          sampleRate: sampleRate,
+          bitsPerSample: 16
+        }
+      };
+    }
+    const audioBuffer = audioBuffers[alertKey];
+    audioBuffer.metadata.sampleRate = sampleRate;
+    audioBuffer.metadata.bitsPerSample = 16;
+    
+    // Frames in order: a jump in the sequence is a lost message
+    if (!audioBuffer.frames) {
+      audioBuffer.frames = [];
+      audioBuffer.nextSequence = 0;
+      audioBuffer.missingFrames = 0;
+    }
+    if (sequence !== audioBuffer.nextSequence) {
+      const missing = (sequence - audioBuffer.nextSequence + 0x10000) & 0xFFFF;
+      console.warn(`Audio frame gap for alert ${alertKey}: expected ${audioBuffer.nextSequence}, got ${sequence}`);
+      audioBuffer.missingFrames += missing;
+    }
+    audioBuffer.nextSequence = (sequence + 1) & 0xFFFF;
+    audioBuffer.frames.push({ sampleOffset, pcm, isPreshot: (flags & AUDIO_FRAME_PRESHOT) !== 0 });
+    
+    console.log(`Received audio frame ${sequence}: ${pcm.length / 2} samples at ${sampleOffset}, sensorId: ${sensorId}`);
+    
+    clearTimeout(audioBuffer.timeout);
+    if (flags & AUDIO_FRAME_LAST) {
+      await finalizeAudioRecording(alertKey);
+    } else {
+      audioBuffer.timeout = setTimeout(() => finalizeAudioRecording(alertKey), AUDIO_FRAME_TIMEOUT_MS);
+    }
+  } catch (error) {
+    console.error('Error processing audio frame:', error);
+  }
+}
+
+// Lay decoded frames out by sample offset, filling what never arrived
+// with silence
+function assembleAudioFrames(frames) {
+  const end = frames.reduce((acc, frame) => Math.max(acc, frame.sampleOffset + frame.pcm.length / 2), 0);
+  const pcm = Buffer.alloc(end * 2);
+  for (const frame of frames) {
+    frame.pcm.copy(pcm, frame.sampleOffset * 2);
+  }
+  return pcm;
+}
+
+// IMA ADPCM tables
+const imaIndexTable = [-1, -1, -1, -1, 2, 4, 6, 8];
+const imaStepTable = [
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
+  34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+  157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+  724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+  3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+  15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+];
+
+// Decode IMA ADPCM blocks in the WAV layout (first sample, step index,
+// reserved byte, then two samples a byte, low nibble first) to 16-bit PCM
+function decodeImaAdpcm(data, blockAlign) {
+  const blocks = Math.floor(data.length / blockAlign);
+  const samplesPerBlock = (blockAlign - 4) * 2 + 1;
+  const pcm = Buffer.alloc(blocks * samplesPerBlock * 2);
+  let offset = 0;
+  
+  for (let b = 0; b < blocks; b++) {
+    const block = data.slice(b * blockAlign, (b + 1) * blockAlign);
+    let predictor = block.readInt16LE(0);
+    let index = Math.min(Math.max(block[2], 0), 88);
+    pcm.writeInt16LE(predictor, offset);
+    offset += 2;
+    
+    for (let i = 4; i < blockAlign; i++) {
+      for (const nibble of [block[i] & 0x0f, block[i] >> 4]) {
+        const step = imaStepTable[index];
+        let diff = step >> 3;
+        if (nibble & 4) diff += step;
+        if (nibble & 2) diff += step >> 1;
+        if (nibble & 1) diff += step >> 2;
+        predictor += (nibble & 8) ? -diff : diff;
+        predictor = Math.min(Math.max(predictor, -32768), 32767);
+        index = Math.min(Math.max(index + imaIndexTable[nibble & 7], 0), 88);
+        pcm.writeInt16LE(predictor, offset);
+        offset += 2;
+      }
+    }
+  }
+  
+  return pcm;
+}
+
 // Finalize audio recording by creating WAV file and storing in MongoDB
 async function finalizeAudioRecording(alertKey) {
   try {
@@ -249,22 +404,30 @@ async function finalizeAudioRecording(alertKey) {
       return;
     }
     
+    clearTimeout(audioBuffer.timeout);
+    
     // Combine all audio buffers (preshot and postshot)
-    const allAudioBuffers = [...audioBuffer.preshot, ...audioBuffer.postshot];
-    const totalLength = allAudioBuffers.reduce((acc, buf) => acc + buf.length, 0);
+    let consolidatedAudio;
+    if (audioBuffer.frames) {
+      consolidatedAudio = assembleAudioFrames(audioBuffer.frames);
+      const received = audioBuffer.frames.reduce((acc, frame) => acc + frame.pcm.length, 0);
+      console.log(`Audio frames: ${audioBuffer.frames.length}, missing frames: ${audioBuffer.missingFrames}, silence filled: ${consolidatedAudio.length - received} bytes`);
+    } else {
+      const allAudioBuffers = [...audioBuffer.preshot, ...audioBuffer.postshot];
+      consolidatedAudio = Buffer.concat(allAudioBuffers);
+      console.log(`Preshot buffers: ${audioBuffer.preshot.length}, Postshot buffers: ${audioBuffer.postshot.length}`);
+    }
+    const totalLength = consolidatedAudio.length;
     
     console.log(`Audio data size: ${totalLength} bytes`);
-    console.log(`Preshot buffers: ${audioBuffer.preshot.length}, Postshot buffers: ${audioBuffer.postshot.length}`);
     
     // Skip if no audio data
     if (totalLength === 0) {
       console.error(`No audio data to process for alert ${alertKey}`);
+      delete audioBuffers[alertKey];
       return;
     }
     
-    // Create a consolidated buffer with all audio data
-    const consolidatedAudio = Buffer.concat(allAudioBuffers, totalLength);
-    
     // Create a WAV file from the raw audio data
     const sampleRate = audioBuffer.metadata.sampleRate;
     const bitsPerSample = audioBuffer.metadata.bitsPerSample;
@@ -425,8 +588,10 @@ async function processImageMetadata(topic, data) {
     const imageNumber = data.image_number;
     const timestamp = data.timestamp;
     const expectedChunks = data.chunks;
+    const eventId = data.event_id;
+    const eventKey = `${deviceId}_${eventId}`;
     
-    console.log(`Received image metadata for ${deviceId}, image ${imageNumber}, expecting ${expectedChunks} chunks`);
+    console.log(`Received image metadata for ${deviceId}, image ${imageNumber}${imageNumber === THUMBNAIL_IMAGE_NUMBER ? ' (thumbnail)' : ''}, expecting ${expectedChunks} chunks`);
     
     // Create a key for this specific image
     const imageKey = `${deviceId}_${timestamp}_${imageNumber}`;
@@ -437,12 +602,19 @@ async function processImageMetadata(topic, data) {
       imageNumber: imageNumber,
       timestamp: timestamp,
       totalChunks: expectedChunks,
+      eventId: eventId,
       receivedChunks: 0,
       chunks: new Array(expectedChunks),
       size: data.size,
       isComplete: false
     };
     
+    // Frames requested after the alert go with the rest of their event
+    if (eventReadings[eventKey]) {
+      imageBuffers[imageKey].readingId = eventReadings[eventKey];
+      return;
+    }
+    
     // Look for a sensor reading to attach this image to
     // Find a reading from the last 10 seconds (assuming image comes shortly after the alert)
     const tenSecondsAgo = new Date(Date.now() - 10000);
@@ -454,6 +626,12 @@ async function processImageMetadata(topic, data) {
     
     if (reading) {
       imageBuffers[imageKey].readingId = reading._id;
+      if (eventId !== undefined) {
+        eventReadings[eventKey] = reading._id;
+        setTimeout(() => {
+          delete eventReadings[eventKey];
+        }, 24 * 60 * 60 * 1000); // Frames can be requested for a day
+      }
       
       // Update reading to indicate video is available
       if (!reading.sensorData.videoData.available) {
@@ -520,7 +698,7 @@ async function processImageChunk(topic, message) {
         
         // Save to database if we have a reading ID
         if (matchingBuffer.readingId) {
-          await saveImageToReading(matchingBuffer.readingId, base64Image, imageNumber, matchingBuffer.timestamp);
+          await saveImageToReading(matchingBuffer.readingId, base64Image, imageNumber, matchingBuffer.timestamp, matchingBuffer.eventId);
         } else {
           console.log(`No reading ID found for ${deviceId}, image ${imageNumber}`);
         }
@@ -542,7 +720,7 @@ async function processImageChunk(topic, message) {
 }
 
 // Save image to reading
-async function saveImageToReading(readingId, base64Image, imageNumber, timestamp) {
+async function saveImageToReading(readingId, base64Image, imageNumber, timestamp, eventId) {
   try {
     const reading = await Reading.findById(readingId);
     
@@ -556,7 +734,8 @@ async function saveImageToReading(readingId, base64Image, imageNumber, timestamp
       reading.sensorData.videoData.images.push({
         timestamp: timestamp,
         data: base64Image,
-        imageNumber: imageNumber
+        imageNumber: imageNumber,
+        eventId: eventId
       });
       
       // Update imageCount
@@ -572,9 +751,21 @@ async function saveImageToReading(readingId, base64Image, imageNumber, timestamp
   }
 }
 
+// Ask a camera for full frames of an event it sent a thumbnail for, one
+// frame or, without a frame number, all of them
+function requestImages(deviceId, eventId, frame) {
+  const request = { event_id: eventId };
+  if (frame !== undefined) {
+    request.frame = frame;
+  }
+  client.publish(`cameras/${deviceId}/request`, JSON.stringify(request));
+  console.log(`Requested frames of event ${eventId} from ${deviceId}`);
+}
+
 // Handle errors
 client.on('error', (err) => {
   console.error('MQTT client error:', err);
 });
 
 module.exports = client;
+module.exports.requestImages = requestImages;